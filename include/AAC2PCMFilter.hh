@@ -0,0 +1,99 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// Decoder of the AAC access units to L16, PCMU or PCMA payloads.
+// C++ header
+
+#ifndef _AAC2PCM_FILTER_HH
+#define _AAC2PCM_FILTER_HH
+
+#ifndef _FRAMED_FILTER_HH
+#include "FramedFilter.hh"
+#endif
+
+#include "rAudioStreamerReceiver.h"
+#include "fdk-aac/aacdecoder_lib.h"
+
+#define PCM_AU_SIZE_MAX 1536                // 6144 bits per channel, 2 channels
+#define PCM_DECODED_MAX 4096                // samples of a decoded frame, 2048 x 2 channels
+#define PCM_PENDING_MAX 4096                // mono samples waiting for the next payload
+#define PCM_HALFBAND_HISTORY 18             // input samples kept between frames by the 2:1 decimator
+
+// Decodes the raw AUs of the input source (AudioFramedMemorySource) with
+// fdk-aac, mixes the channels down to mono and delivers payloads of 20 ms
+// (10 ms for L16 above 32 kHz, to fit in a packet) of L16 (network byte
+// order), PCMU or PCMA. G.711 is 8 kHz: a 16 kHz stream
+// is decimated 2:1 with a halfband FIR, the other rates are refused by
+// createNew(). The cpu time of each step is measured, for the stats.
+// Send the payloads with a SimpleRTPSink, one payload per packet.
+class AAC2PCMFilter: public FramedFilter {
+public:
+    static AAC2PCMFilter* createNew(UsageEnvironment& env, FramedSource* inputSource,
+                                    unsigned samplingFrequency, unsigned numChannels,
+                                    int encoding);
+
+    unsigned outputFrequency() const { return fOutputFrequency; }
+    unsigned payloadMs() const { return fPayloadSamples * 1000 / fOutputFrequency; }
+    // Statistics
+    unsigned frames() const { return fFrames; }
+    unsigned decodeErrors() const { return fDecodeErrors; }
+    long long decodeTime() const { return fDecodeTime; }        // ns
+    long long resampleTime() const { return fResampleTime; }
+    long long compandTime() const { return fCompandTime; }
+
+protected:
+    AAC2PCMFilter(UsageEnvironment& env, FramedSource* inputSource,
+                  HANDLE_AACDECODER decoder, unsigned samplingFrequency,
+                  int encoding, unsigned outputFrequency);
+        // called only by createNew()
+
+    virtual ~AAC2PCMFilter();
+
+private:
+    static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                  unsigned numTruncatedBytes,
+                                  struct timeval presentationTime,
+                                  unsigned durationInMicroseconds);
+    void afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                            struct timeval presentationTime);
+    unsigned decimate(unsigned numSamples);
+    void deliver();
+
+    // redefined virtual functions:
+    virtual void doGetNextFrame();
+
+private:
+    HANDLE_AACDECODER fDecoder;
+    unsigned fSamplingFrequency;
+    int fEncoding;                          // PCM_ENCODING_*
+    unsigned fOutputFrequency;
+    unsigned fPayloadSamples;
+    unsigned char fAU[PCM_AU_SIZE_MAX];
+    INT_PCM fDecoded[PCM_DECODED_MAX];
+    // Mono samples, after the history of the decimator
+    short fWork[PCM_HALFBAND_HISTORY + PCM_DECODED_MAX];
+    short fPending[PCM_PENDING_MAX];
+    unsigned fPendingCount;
+    struct timeval fNextPresentationTime;   // of the first sample pending
+    unsigned fFrames;
+    unsigned fDecodeErrors;
+    long long fDecodeTime;
+    long long fResampleTime;
+    long long fCompandTime;
+};
+
+#endif
@@ -0,0 +1,131 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// RFC 3640 aggregation: several AAC access units in each RTP packet.
+// C++ header
+
+#ifndef _AAC_AGGREGATOR_HH
+#define _AAC_AGGREGATOR_HH
+
+#ifndef _FRAMED_FILTER_HH
+#include "FramedFilter.hh"
+#endif
+#ifndef _MPEG4_GENERIC_RTP_SINK_HH
+#include "MPEG4GenericRTPSink.hh"
+#endif
+
+#ifndef RTP_PAYLOAD_MAX_SIZE
+#define RTP_PAYLOAD_MAX_SIZE 1352
+#endif
+
+#define AGGREGATE_AUS_MAX 32
+#define AGGREGATE_AU_SIZE_MAX 8191          // sizeLength=13
+
+// Packs the raw AUs of the input source in RTP payloads: the AU header
+// section (AU-headers-length + one 16 bits AU header per AU, sizeLength=13,
+// indexLength=3) followed by the AUs.
+// Up to maxAUs AUs, bounded by RTP_PAYLOAD_MAX_SIZE. A packet is sent
+// anyway maxLatencyMs after its first AU, when the input stalls.
+class AACAggregator: public FramedFilter {
+public:
+    static AACAggregator* createNew(UsageEnvironment& env, FramedSource* inputSource,
+                                    unsigned samplingFrequency, unsigned maxLatencyMs);
+
+    unsigned maxAUs() const { return fMaxAUs; }
+    // Statistics
+    unsigned packets() const { return fPackets; }
+    unsigned aus() const { return fAUs; }
+    unsigned auBytes() const { return fAUBytes; }
+    unsigned headerBytes() const { return fHeaderBytes; }
+    unsigned flushes() const { return fFlushes; }
+
+protected:
+    AACAggregator(UsageEnvironment& env, FramedSource* inputSource, unsigned maxAUs, unsigned maxLatencyMs);
+        // called only by createNew()
+
+    virtual ~AACAggregator();
+
+private:
+    static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                  unsigned numTruncatedBytes,
+                                  struct timeval presentationTime,
+                                  unsigned durationInMicroseconds);
+    void afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                            struct timeval presentationTime,
+                            unsigned durationInMicroseconds);
+    void deliver(unsigned carrySize, struct timeval carryPresentationTime, unsigned carryDuration);
+    void getNextAU();
+    void scheduleFlush();
+    static void flushTimeout(void* clientData);
+    void flushTimeout1();
+    static unsigned headerSectionSize(unsigned numAUs) { return 2 + 2 * numAUs; }
+
+    // redefined virtual functions:
+    virtual void doGetNextFrame();
+
+private:
+    unsigned fMaxAUs;
+    unsigned fMaxLatencyUs;
+    unsigned char fAU[RTP_PAYLOAD_MAX_SIZE + AGGREGATE_AU_SIZE_MAX];    // AUs of the next payload
+    unsigned fAUSize[AGGREGATE_AUS_MAX];
+    unsigned fNumAUs;
+    unsigned fDataSize;
+    unsigned fPendingOffset;                // where the pending read of the input writes its AU
+    TaskToken fFlushTask;
+    Boolean fFlushDue;                      // the latency ran out while the sink was busy
+    struct timeval fFirstPresentationTime;
+    unsigned fDuration;
+    unsigned fPackets;
+    unsigned fAUs;
+    unsigned fAUBytes;
+    unsigned fHeaderBytes;
+    unsigned fFlushes;
+};
+
+// MPEG4GenericRTPSink for the payloads built by AACAggregator: the AU
+// header section is already in the frame
+class AACAggregateRTPSink: public MPEG4GenericRTPSink {
+public:
+    static AACAggregateRTPSink* createNew(UsageEnvironment& env, Groupsock* RTPgs,
+                                          u_int8_t rtpPayloadFormat,
+                                          u_int32_t rtpTimestampFrequency,
+                                          char const* sdpMediaTypeString,
+                                          char const* mpeg4Mode, char const* configString,
+                                          unsigned numChannels = 1);
+
+protected:
+    AACAggregateRTPSink(UsageEnvironment& env, Groupsock* RTPgs,
+                        u_int8_t rtpPayloadFormat,
+                        u_int32_t rtpTimestampFrequency,
+                        char const* sdpMediaTypeString,
+                        char const* mpeg4Mode, char const* configString,
+                        unsigned numChannels);
+        // called only by createNew()
+
+    virtual ~AACAggregateRTPSink();
+
+private:
+    // redefined virtual functions:
+    virtual void doSpecialFrameHandling(unsigned fragmentationOffset,
+                                        unsigned char* frameStart,
+                                        unsigned numBytesInFrame,
+                                        struct timeval framePresentationTime,
+                                        unsigned numRemainingBytes);
+    virtual unsigned specialHeaderSize() const;
+};
+
+#endif
@@ -0,0 +1,74 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// A fixed AAC clip, to feed the filters in the benches and the calibration of --adapt.
+// C++ header
+
+#ifndef _AAC_CLIP_SOURCE_HH
+#define _AAC_CLIP_SOURCE_HH
+
+#ifndef _FRAMED_SOURCE_HH
+#include "FramedSource.hh"
+#endif
+
+#include "rAudioStreamerReceiver.h"
+
+#define CLIP_AU_SIZE_MAX 1536               // 6144 bits per channel, 2 channels
+
+// Delivers the raw AUs of a clip, at once and as fast as they are asked
+// for, with the presentation times of a live stream, then closes. The clip
+// is read from an ADTS file or, the same on every run, encoded at startup
+// with fdk-aac from a synthetic voice: a gliding pitch with its harmonics,
+// syllables at 4 Hz and some noise.
+class AACClipSource: public FramedSource {
+public:
+    static AACClipSource* createNew(UsageEnvironment& env, unsigned samplingFrequency,
+                                    unsigned numChannels, unsigned bitrate, unsigned seconds);
+    static AACClipSource* createNew(UsageEnvironment& env, char const* fileName);
+
+    unsigned samplingFrequency() const { return fSamplingFrequency; }
+    unsigned numChannels() const { return fNumChannels; }
+    unsigned numFrames() const { return fNumFrames; }
+    unsigned bytes() const { return fBytes; }
+    // Play it again from the first AU
+    void rewind() { fNext = 0; }
+
+protected:
+    AACClipSource(UsageEnvironment& env, unsigned samplingFrequency, unsigned numChannels);
+        // called only by createNew()
+
+    virtual ~AACClipSource();
+
+private:
+    Boolean addAU(unsigned char const* data, unsigned size);
+
+    // redefined virtual functions:
+    virtual void doGetNextFrame();
+
+private:
+    unsigned fSamplingFrequency;
+    unsigned fNumChannels;
+    unsigned char* fData;
+    unsigned* fOffset;
+    unsigned fNumFrames;
+    unsigned fMaxFrames;
+    unsigned fBytes;
+    unsigned fNext;
+    struct timeval fStart;
+};
+
+#endif
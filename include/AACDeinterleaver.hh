@@ -0,0 +1,112 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// RFC 3640 de-interleaving: the AAC access units put back in order, with a latency bound.
+// C++ header
+
+#ifndef _AAC_DEINTERLEAVER_HH
+#define _AAC_DEINTERLEAVER_HH
+
+#ifndef _FRAMED_FILTER_HH
+#include "FramedFilter.hh"
+#endif
+#ifndef _RTP_SOURCE_HH
+#include "RTPSource.hh"
+#endif
+
+#include "rAudioStreamerReceiver.h"
+
+#define DEINTERLEAVE_PAYLOAD_SIZE_MAX 1500  // RTP payload read from the source
+#define DEINTERLEAVE_AUS_MAX 64             // AUs waiting for the ones before them
+#define DEINTERLEAVE_AU_SIZE_MAX 1536       // 6144 bits per channel, 2 channels
+#define DEINTERLEAVE_SAMPLES_PER_AU 1024    // RTP timestamp ticks of an AAC AU
+
+// Reads the MPEG4-GENERIC payloads of an RTP source (without the M bit rule,
+// one payload per packet, sizeLength=13, indexLength=3, indexDeltaLength=3)
+// and delivers the AUs in the order of their AU-Index. Up to maxLatencyMs
+// of AUs wait for the missing ones before them: when an AU arrives beyond
+// that, the missing AU is given up and delivered as an empty frame, the
+// sink conceals it. Works also with the streams that are not interleaved.
+class AACDeinterleaver: public FramedFilter {
+public:
+    static AACDeinterleaver* createNew(UsageEnvironment& env, RTPSource* inputSource,
+                                       unsigned samplingFrequency, unsigned maxLatencyMs);
+
+    unsigned windowAUs() const { return fWindow; }
+    // Statistics
+    unsigned aus() const { return fAUs; }
+    unsigned concealedAUs() const { return fConcealedAUs; }
+    unsigned lateAUs() const { return fLateAUs; }
+    unsigned singleGaps() const { return fSingleGaps; }
+    unsigned longGaps() const { return fLongGaps; }
+
+protected:
+    AACDeinterleaver(UsageEnvironment& env, RTPSource* inputSource,
+                     unsigned samplingFrequency, unsigned window);
+        // called only by createNew()
+
+    virtual ~AACDeinterleaver();
+
+private:
+    static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                  unsigned numTruncatedBytes,
+                                  struct timeval presentationTime,
+                                  unsigned durationInMicroseconds);
+    void afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                            struct timeval presentationTime);
+    Boolean place();
+    void deliver(Boolean present);
+
+    // redefined virtual functions:
+    virtual void doGetNextFrame();
+
+private:
+    RTPSource* fRTPSource;
+    unsigned fSamplingFrequency;
+    unsigned fWindow;                       // AUs, the latency bound
+    unsigned char fPayload[DEINTERLEAVE_PAYLOAD_SIZE_MAX];
+    // The AUs of the last payload not placed yet, they point to fPayload
+    struct {
+        unsigned char* data;
+        unsigned size;
+        u_int32_t timestamp;
+        struct timeval presentationTime;
+    } fPending[DEINTERLEAVE_AUS_MAX];
+    unsigned fPendingHead;
+    unsigned fPendingCount;
+    // The AUs placed, the slot fHead holds the next AU to deliver
+    struct {
+        unsigned char data[DEINTERLEAVE_AU_SIZE_MAX];
+        unsigned size;
+        Boolean present;
+        struct timeval presentationTime;
+    } fSlot[DEINTERLEAVE_AUS_MAX];
+    unsigned fHead;
+    unsigned fPlaced;                       // AUs in the slots
+    Boolean fHaveTimestamp;
+    Boolean fDraining;                      // the stream restarted, the AUs placed go without concealment
+    u_int32_t fNextTimestamp;               // RTP timestamp of the AU in fHead
+    struct timeval fNextPresentationTime;
+    unsigned fAUs;
+    unsigned fConcealedAUs;
+    unsigned fLateAUs;
+    unsigned fGap;                          // AUs concealed in a row
+    unsigned fSingleGaps;
+    unsigned fLongGaps;
+};
+
+#endif
@@ -0,0 +1,109 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// RFC 3640 interleaving: the AAC access units of a group spread over its packets.
+// C++ header
+
+#ifndef _AAC_INTERLEAVER_HH
+#define _AAC_INTERLEAVER_HH
+
+#ifndef _FRAMED_FILTER_HH
+#include "FramedFilter.hh"
+#endif
+
+#include "rAudioStreamerReceiver.h"
+
+#ifndef RTP_PAYLOAD_MAX_SIZE
+#define RTP_PAYLOAD_MAX_SIZE 1352
+#endif
+
+#define INTERLEAVE_AUS_MAX (INTERLEAVE_PACKETS_MAX * INTERLEAVE_FRAMES_MAX)
+#define INTERLEAVE_AU_SIZE_MAX 8191         // sizeLength=13
+
+// Collects groups of packets * framesPerPacket consecutive AUs from the input
+// source. Packet p of a group carries the AUs p, p + packets, p + 2 * packets...
+// The packets with neighbour AUs (p and p + 1, the last one and the first of
+// the next group) are sent apart: in the order 0, s, 2s... modulo packets, so
+// a burst of up to burstPackets() lost packets becomes isolated missing AUs.
+// The payload is the usual AU header section (sizeLength=13, indexLength=3,
+// indexDeltaLength=3): AU-Index 0 in the first AU header, AU-Index-delta
+// packets - 1 in the others, and the RTP timestamp is the one of the first AU.
+// A group is sent, one packet every framesPerPacket AUs, while the next one is
+// collected.
+// Send the payloads with AACAggregateRTPSink, it doesn't add any header.
+class AACInterleaver: public FramedFilter {
+public:
+    static AACInterleaver* createNew(UsageEnvironment& env, FramedSource* inputSource,
+                                     unsigned samplingFrequency, unsigned packets,
+                                     unsigned framesPerPacket);
+
+    unsigned latencyMs() const;
+    unsigned burstPackets() const { return fBurstPackets; }
+    // Statistics
+    unsigned packets() const { return fPackets; }
+    unsigned aus() const { return fAUs; }
+    unsigned headerBytes() const { return fHeaderBytes; }
+    unsigned droppedAUs() const { return fDroppedAUs; }
+
+protected:
+    AACInterleaver(UsageEnvironment& env, FramedSource* inputSource,
+                   unsigned samplingFrequency, unsigned packets, unsigned framesPerPacket);
+        // called only by createNew()
+
+    virtual ~AACInterleaver();
+
+private:
+    static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                  unsigned numTruncatedBytes,
+                                  struct timeval presentationTime,
+                                  unsigned durationInMicroseconds);
+    void afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                            struct timeval presentationTime);
+    long long auTime(unsigned index) const;
+    void deliver();
+
+    // redefined virtual functions:
+    virtual void doGetNextFrame();
+
+private:
+    unsigned fSamplingFrequency;
+    unsigned fGroupPackets;
+    unsigned fPacketAUs;
+    unsigned fGroupAUs;
+    unsigned fStride;                       // between the packets sent one after the other
+    unsigned fBurstPackets;
+    // The group being collected and the one being sent
+    struct {
+        unsigned char data[INTERLEAVE_PACKETS_MAX * RTP_PAYLOAD_MAX_SIZE];
+        unsigned dataSize;
+        unsigned offset[INTERLEAVE_AUS_MAX];
+        unsigned size[INTERLEAVE_AUS_MAX];  // 0 if the AU was dropped
+        long long time;                     // presentation time of the first AU (us)
+    } fGroup[2];
+    unsigned fFill;                         // group being collected
+    unsigned fFillAUs;
+    unsigned fNextPacket;                   // sent of the group, fGroupPackets when done
+    unsigned fReadSincePacket;
+    Boolean fHaveTime;
+    long long fNextGroupTime;
+    unsigned fPackets;
+    unsigned fAUs;
+    unsigned fHeaderBytes;
+    unsigned fDroppedAUs;
+};
+
+#endif
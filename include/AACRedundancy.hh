@@ -0,0 +1,88 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// RFC 2198 redundancy: the previous AAC access units sent again in each RTP packet.
+// C++ header
+
+#ifndef _AAC_REDUNDANCY_HH
+#define _AAC_REDUNDANCY_HH
+
+#ifndef _FRAMED_FILTER_HH
+#include "FramedFilter.hh"
+#endif
+
+#include "rAudioStreamerReceiver.h"
+
+#ifndef RTP_PAYLOAD_MAX_SIZE
+#define RTP_PAYLOAD_MAX_SIZE 1352
+#endif
+
+// Builds RFC 2198 payloads from the raw AUs of the input source: the last
+// depth AUs as redundant blocks, oldest first, then the new AU as primary
+// block. Each block is a whole MPEG4-GENERIC payload of blockPayloadFormat
+// (AU header section with one 16 bits AU header + the AU). The oldest
+// blocks are left out when the payload would exceed RTP_PAYLOAD_MAX_SIZE.
+// Send the payloads with AACAggregateRTPSink, it doesn't add any header.
+class AACRedundancy: public FramedFilter {
+public:
+    static AACRedundancy* createNew(UsageEnvironment& env, FramedSource* inputSource,
+                                    unsigned samplingFrequency, unsigned depth,
+                                    u_int8_t blockPayloadFormat);
+
+    // Statistics
+    unsigned packets() const { return fPackets; }
+    unsigned primaryBytes() const { return fPrimaryBytes; }
+    unsigned redundantBytes() const { return fRedundantBytes; }
+    unsigned redundantBlocks() const { return fRedundantBlocks; }
+
+protected:
+    AACRedundancy(UsageEnvironment& env, FramedSource* inputSource,
+                  unsigned samplingFrequency, unsigned depth, u_int8_t blockPayloadFormat);
+        // called only by createNew()
+
+    virtual ~AACRedundancy();
+
+private:
+    static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                  unsigned numTruncatedBytes,
+                                  struct timeval presentationTime,
+                                  unsigned durationInMicroseconds);
+    void afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                            struct timeval presentationTime,
+                            unsigned durationInMicroseconds);
+    u_int32_t rtpTimestamp(struct timeval const& presentationTime) const;
+
+    // redefined virtual functions:
+    virtual void doGetNextFrame();
+
+private:
+    unsigned fSamplingFrequency;
+    unsigned fDepth;
+    u_int8_t fBlockPayloadFormat;
+    // The new AU and the previous ones, fDepth + 1 slots used as a ring
+    unsigned char fAU[RED_DEPTH_MAX + 1][RTP_PAYLOAD_MAX_SIZE];
+    unsigned fAUSize[RED_DEPTH_MAX + 1];
+    struct timeval fAUTime[RED_DEPTH_MAX + 1];
+    unsigned fHead;                         // slot of the new AU
+    unsigned fCount;                        // previous AUs in the ring
+    unsigned fPackets;
+    unsigned fPrimaryBytes;
+    unsigned fRedundantBytes;
+    unsigned fRedundantBlocks;
+};
+
+#endif
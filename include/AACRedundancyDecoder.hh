@@ -0,0 +1,97 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// RFC 2198 redundancy: rebuild the lost AAC access units from the redundant blocks.
+// C++ header
+
+#ifndef _AAC_REDUNDANCY_DECODER_HH
+#define _AAC_REDUNDANCY_DECODER_HH
+
+#ifndef _FRAMED_FILTER_HH
+#include "FramedFilter.hh"
+#endif
+#ifndef _RTP_SOURCE_HH
+#include "RTPSource.hh"
+#endif
+
+#include "rAudioStreamerReceiver.h"
+
+#define RED_PAYLOAD_SIZE_MAX 1500           // RTP payload read from the source
+#define RED_QUEUE_MAX 32                    // AUs of one payload waiting for the sink
+#define RED_SAMPLES_PER_AU 1024             // RTP timestamp ticks of an AAC AU
+
+// Reads the RFC 2198 payloads of an RTP source (without the M bit rule, one
+// payload per packet) and delivers raw AUs, as MPEG4GenericRTPSource does.
+// The RTP timestamp of the last AU delivered tells which redundant blocks
+// cover AUs that were lost: they are delivered, in order, before the primary
+// block. The other redundant blocks are skipped.
+class AACRedundancyDecoder: public FramedFilter {
+public:
+    static AACRedundancyDecoder* createNew(UsageEnvironment& env, RTPSource* inputSource,
+                                           unsigned samplingFrequency, u_int8_t blockPayloadFormat);
+
+    // Statistics
+    unsigned payloads() const { return fPayloads; }
+    unsigned primaryAUs() const { return fPrimaryAUs; }
+    unsigned recoveredAUs() const { return fRecoveredAUs; }
+    unsigned lostAUs() const { return fLostAUs; }
+    unsigned bytes() const { return fBytes; }
+    unsigned redundantBytes() const { return fRedundantBytes; }
+
+protected:
+    AACRedundancyDecoder(UsageEnvironment& env, RTPSource* inputSource,
+                         unsigned samplingFrequency, u_int8_t blockPayloadFormat);
+        // called only by createNew()
+
+    virtual ~AACRedundancyDecoder();
+
+private:
+    static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                  unsigned numTruncatedBytes,
+                                  struct timeval presentationTime,
+                                  unsigned durationInMicroseconds);
+    void afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                            struct timeval presentationTime);
+    unsigned queueBlock(unsigned char* block, unsigned blockSize, struct timeval presentationTime);
+    void deliver();
+
+    // redefined virtual functions:
+    virtual void doGetNextFrame();
+
+private:
+    RTPSource* fRTPSource;
+    unsigned fSamplingFrequency;
+    u_int8_t fBlockPayloadFormat;
+    unsigned char fPayload[RED_PAYLOAD_SIZE_MAX];
+    struct {
+        unsigned char* data;                // in fPayload
+        unsigned size;
+        struct timeval presentationTime;
+    } fQueue[RED_QUEUE_MAX];
+    unsigned fQueueHead;
+    unsigned fQueueCount;
+    Boolean fHaveTimestamp;
+    u_int32_t fLastTimestamp;               // RTP timestamp of the last primary block
+    unsigned fPayloads;
+    unsigned fPrimaryAUs;
+    unsigned fRecoveredAUs;
+    unsigned fLostAUs;
+    unsigned fBytes;
+    unsigned fRedundantBytes;
+};
+
+#endif
@@ -0,0 +1,124 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// Re-encoder of the AAC access units at a bitrate that can be changed while streaming.
+// C++ header
+
+#ifndef _AAC_TRANSCODER_HH
+#define _AAC_TRANSCODER_HH
+
+#ifndef _FRAMED_FILTER_HH
+#include "FramedFilter.hh"
+#endif
+
+#include "rAudioStreamerReceiver.h"
+#include "fdk-aac/aacdecoder_lib.h"
+#include "fdk-aac/aacenc_lib.h"
+
+#define TRANSCODE_AU_SIZE_MAX 1536          // 6144 bits per channel, 2 channels
+#define TRANSCODE_DECODED_MAX 4096          // samples of a decoded frame, 2048 x 2 channels
+#define TRANSCODE_QUEUE_MAX 5               // AUs flushed from the encoder (its delay) + 1 of the source
+
+// Decodes the raw AUs of the input source (AudioFramedMemorySource) with
+// fdk-aac and encodes them again, AAC-LC CBR, same sampling frequency and
+// channels: the AudioSpecificConfig of the SDP doesn't change. The bitrate
+// and the afterburner (better quality for more cpu) can be changed at any
+// frame. The AUs come out with the delay of the encoder, their presentation
+// time is moved back by the same amount. With setPassthrough() the AUs of
+// the source are forwarded as they are and no cpu is spent any more: the
+// encoder is flushed first, and the AUs of the source that overlap with
+// the audio it still held are skipped, so the timestamps don't jump.
+// resume() encodes again with a new encoder: its look-ahead delays the
+// output and its AUs continue the timestamps of the forwarded ones.
+// The cpu time of the decoder and of the encoder is measured, for the stats.
+class AACTranscoder: public FramedFilter {
+public:
+    static AACTranscoder* createNew(UsageEnvironment& env, FramedSource* inputSource,
+                                    unsigned samplingFrequency, unsigned numChannels,
+                                    unsigned bitrate);
+
+    void setBitrate(unsigned bitrate);
+    void setAfterburner(Boolean afterburner);
+    void setPassthrough();
+    Boolean resume(unsigned bitrate);
+    unsigned bitrate() const { return fBitrate; }
+    Boolean afterburner() const { return fAfterburner; }
+    Boolean passthrough() const { return fPassthrough; }
+    unsigned delayMs() const { return fDelayUs / 1000; }
+    // Statistics
+    unsigned frames() const { return fFrames; }
+    unsigned decodeErrors() const { return fDecodeErrors; }
+    unsigned skipped() const { return fSkipped; }               // AUs of the source, after the flush
+    unsigned inBytes() const { return fInBytes; }
+    unsigned outBytes() const { return fOutBytes; }
+    long long decodeTime() const { return fDecodeTime; }        // ns
+    long long encodeTime() const { return fEncodeTime; }
+
+protected:
+    AACTranscoder(UsageEnvironment& env, FramedSource* inputSource,
+                  HANDLE_AACDECODER decoder, HANDLE_AACENCODER encoder,
+                  unsigned samplingFrequency, unsigned numChannels,
+                  unsigned bitrate, unsigned delayUs);
+        // called only by createNew()
+
+    virtual ~AACTranscoder();
+
+private:
+    static HANDLE_AACENCODER openEncoder(unsigned samplingFrequency, unsigned numChannels,
+                                         unsigned bitrate, Boolean afterburner, unsigned* delayUs);
+    static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                  unsigned numTruncatedBytes,
+                                  struct timeval presentationTime,
+                                  unsigned durationInMicroseconds);
+    void afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                            struct timeval presentationTime);
+    void deliver(unsigned char* data, unsigned size, struct timeval presentationTime);
+    void queue(unsigned char* data, unsigned size, long long presentationTime);
+    static void deliverQueued(void* clientData);
+    void deliverQueued1();
+
+    // redefined virtual functions:
+    virtual void doGetNextFrame();
+
+private:
+    HANDLE_AACDECODER fDecoder;
+    HANDLE_AACENCODER fEncoder;
+    unsigned fSamplingFrequency;
+    unsigned fNumChannels;
+    unsigned fBitrate;
+    Boolean fAfterburner;
+    Boolean fPassthrough;
+    unsigned fDelayUs;                      // of the encoder
+    unsigned char fAU[TRANSCODE_AU_SIZE_MAX];
+    INT_PCM fDecoded[TRANSCODE_DECODED_MAX];
+    unsigned char fEncoded[TRANSCODE_AU_SIZE_MAX];
+    long long fNextPts;                     // us, the end of the last AU delivered
+    unsigned char fQueue[TRANSCODE_QUEUE_MAX][TRANSCODE_AU_SIZE_MAX];
+    unsigned fQueueSize[TRANSCODE_QUEUE_MAX];
+    long long fQueuePts[TRANSCODE_QUEUE_MAX];
+    unsigned fQueueHead;
+    unsigned fQueueTail;
+    unsigned fFrames;
+    unsigned fDecodeErrors;
+    unsigned fSkipped;
+    unsigned fInBytes;
+    unsigned fOutBytes;
+    long long fDecodeTime;
+    long long fEncodeTime;
+};
+
+#endif
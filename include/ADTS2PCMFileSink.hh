@@ -55,6 +55,7 @@ protected:
     virtual void afterGettingFrame(unsigned frameSize,
                                    unsigned numTruncatedBytes,
                                    struct timeval presentationTime);
+    void writePCM();
 
     FILE* fOutFid;
     unsigned char* fBuffer;
@@ -0,0 +1,70 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// A 'ServerMediaSubsession' object that creates new, unicast, "RTPSink"s
+// on demand, from the AAC frames of a circular buffer.
+// C++ header
+
+#ifndef _AUDIO_FRAMED_MEMORY_SERVER_MEDIA_SUBSESSION_HH
+#define _AUDIO_FRAMED_MEMORY_SERVER_MEDIA_SUBSESSION_HH
+
+#ifndef _ON_DEMAND_SERVER_MEDIA_SUBSESSION_HH
+#include "OnDemandServerMediaSubsession.hh"
+#endif
+
+#include "rAudioStreamerReceiver.h"
+
+class AudioFramedMemoryServerMediaSubsession: public OnDemandServerMediaSubsession {
+public:
+    static AudioFramedMemoryServerMediaSubsession* createNew(UsageEnvironment& env,
+                                                             cb_output_buffer *cbBuffer,
+                                                             unsigned samplingFrequency,
+                                                             unsigned numChannels,
+                                                             unsigned prerollMs,
+                                                             unsigned aggregateMs,
+                                                             Boolean reuseFirstSource);
+
+protected:
+    AudioFramedMemoryServerMediaSubsession(UsageEnvironment& env,
+                                           cb_output_buffer *cbBuffer,
+                                           unsigned samplingFrequency,
+                                           unsigned numChannels,
+                                           unsigned prerollMs,
+                                           unsigned aggregateMs,
+                                           Boolean reuseFirstSource);
+        // called only by createNew()
+
+    virtual ~AudioFramedMemoryServerMediaSubsession();
+
+protected:
+    // redefined virtual functions
+    virtual FramedSource* createNewStreamSource(unsigned clientSessionId,
+                                                unsigned& estBitrate);
+    virtual RTPSink* createNewRTPSink(Groupsock* rtpGroupsock,
+                                      unsigned char rtpPayloadTypeIfDynamic,
+                                      FramedSource* inputSource);
+
+private:
+    cb_output_buffer *fBuffer;
+    unsigned fSamplingFrequency;
+    unsigned fNumChannels;
+    unsigned fPrerollMs;
+    unsigned fAggregateMs;
+    char fConfigStr[5];
+};
+
+#endif
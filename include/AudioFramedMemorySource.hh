@@ -32,19 +32,25 @@ public:
     static AudioFramedMemorySource* createNew(UsageEnvironment& env,
                                                 cb_output_buffer *cbBuffer,
                                                 unsigned samplingFrequency,
-                                                unsigned numChannels);
+                                                unsigned numChannels,
+                                                unsigned prerollMs = 0);
 
     unsigned samplingFrequency() const { return fSamplingFrequency; }
     unsigned numChannels() const { return fNumChannels; }
     char const* configStr() const { return fConfigStr; }
     static void doGetNextFrameTask(void *clientData);
     void doGetNextFrameEx();
+    static void incomingFrameHandler(AudioFramedMemorySource *source, int mask);
+    void incomingFrameHandler1();
+    static void afterGettingFirst(AudioFramedMemorySource *source);
 
 protected:
     AudioFramedMemorySource(UsageEnvironment& env,
                                 cb_output_buffer *cbBuffer,
+                                int reader,
                                 unsigned samplingFrequency,
-                                unsigned numChannels);
+                                unsigned numChannels,
+                                unsigned prerollMs);
         // called only by createNew()
 
     virtual ~AudioFramedMemorySource();
@@ -57,13 +63,17 @@ private:
 
 private:
     cb_output_buffer *fBuffer;
+    int fReader;                            // reader id in fBuffer->ring
     u_int64_t fCurIndex;
     int fProfile;
     int fSamplingFrequency;
     int fNumChannels;
     unsigned fuSecsPerFrame;
+    unsigned fPrerollMs;                    // start from the frames of the last fPrerollMs ms already in the ring
+    unsigned fPrerollFrames;                // frames of the pre-roll not yet sent
     char fConfigStr[5];
     Boolean fHaveStartedReading;
+    Boolean fFirstFrameSent;
     int fPacketCounter;
 };
 
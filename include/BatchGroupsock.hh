@@ -0,0 +1,75 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// A Groupsock that sends each packet to all its destinations with one system call.
+// C++ header
+
+#ifndef _BATCH_GROUPSOCK_HH
+#define _BATCH_GROUPSOCK_HH
+
+#ifndef _GROUPSOCK_HH
+#include "Groupsock.hh"
+#endif
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define BATCH_DATAGRAMS_MAX 32              // datagrams sent by one sendmmsg()
+#define BATCH_PACKET_SIZE_MAX 1500          // larger packets are sent at once
+
+// Groupsock::output() is not virtual: it calls write() once per destination
+// with the same packet. The unicast datagrams are collected by write(), the
+// packet is copied once, and they are sent together with sendmmsg() by a
+// task scheduled with no delay, that runs before the sink sends its next
+// packet, or as soon as a different packet is written.
+// Multicast destinations, and a groupsock with a single destination, are
+// written as usual (write() sets their TTL). Batching is off by default.
+class BatchGroupsock: public Groupsock {
+public:
+    BatchGroupsock(UsageEnvironment& env, struct sockaddr_storage const& groupAddr, Port port, u_int8_t ttl);
+    virtual ~BatchGroupsock();
+
+    // True: one sendmmsg() for all the destinations; default False, as the plain Groupsock
+    static void setBatching(Boolean batching) { fBatching = batching; }
+    // Statistics of all the instances
+    static unsigned datagrams() { return fDatagrams; }
+    static unsigned sendCalls() { return fSendCalls; }
+
+    // redefined virtual functions:
+    virtual Boolean write(struct sockaddr_storage const& addressAndPort, u_int8_t ttl,
+                          unsigned char* buffer, unsigned bufferSize);
+
+private:
+    Boolean flush();
+    static void flushTask(void* clientData);
+
+private:
+    unsigned fCount;
+    unsigned char fPacket[BATCH_PACKET_SIZE_MAX];   // the packet of the datagrams collected
+    unsigned fPacketSize;
+    TaskToken fFlushTask;
+    struct sockaddr_storage fAddress[BATCH_DATAGRAMS_MAX];
+    struct iovec fIov[BATCH_DATAGRAMS_MAX];
+    struct mmsghdr fMsg[BATCH_DATAGRAMS_MAX];
+
+    static Boolean fBatching;
+    static Boolean fSendmmsgMissing;        // ENOSYS, kernel older than 3.0
+    static unsigned fDatagrams;
+    static unsigned fSendCalls;
+};
+
+#endif
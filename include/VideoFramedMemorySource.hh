@@ -0,0 +1,61 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// A class for streaming video NAL units from a circular buffer.
+// C++ header
+
+#ifndef _VIDEO_FRAMED_MEMORY_SOURCE_HH
+#define _VIDEO_FRAMED_MEMORY_SOURCE_HH
+
+#ifndef _FRAMED_SOURCE_HH
+#include "FramedSource.hh"
+#endif
+
+#include "rAudioStreamerReceiver.h"
+
+class VideoFramedMemorySource: public FramedSource {
+public:
+    static VideoFramedMemorySource* createNew(UsageEnvironment& env,
+                                                cb_output_buffer *cbBuffer);
+
+    static void doGetNextFrameTask(void *clientData);
+    static void incomingFrameHandler(VideoFramedMemorySource *source, int mask);
+    void incomingFrameHandler1();
+
+protected:
+    VideoFramedMemorySource(UsageEnvironment& env,
+                                cb_output_buffer *cbBuffer,
+                                int reader);
+        // called only by createNew()
+
+    virtual ~VideoFramedMemorySource();
+
+private:
+    int readFrame();
+    // redefined virtual functions:
+    virtual void doGetNextFrame();
+
+private:
+    cb_output_buffer *fBuffer;
+    int fReader;                            // reader id in fBuffer->ring
+    unsigned char *fFrame;                  // copy of the current frame
+    unsigned int fFrameLen;
+    unsigned int fNalStart;                 // next NAL unit in fFrame
+    uint32_t fFrameTime;
+};
+
+#endif
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Control socket: a Unix stream socket served by the live555 event loop.
+ * Each line received is a command, the answer is written back on the
+ * same connection, so it works with e.g. "echo list | nc -U PATH".
+ */
+
+#ifndef _CONTROL_SOCKET_H
+#define _CONTROL_SOCKET_H
+
+#define CONTROL_CLIENTS_MAX 4               // connections open at the same time
+#define CONTROL_LINE_MAX 256                // longest command
+#define CONTROL_REPLY_MAX 8192              // longest answer
+
+class UsageEnvironment;
+
+// Run the command in line (without the newline), write the answer to reply
+typedef void (*control_handler)(char *line, char *reply, int reply_size);
+
+int control_socket_open(UsageEnvironment *env, const char *path, control_handler handler);
+void control_socket_close();
+
+#endif
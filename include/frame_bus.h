@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Frame bus: the frames parsed by rAudioStreamer, published in a POSIX
+ * shared memory (/dev/shm/NAME) for other local processes.
+ *
+ * Layout of the shared memory:
+ *   frame_bus_header                       at 0
+ *   data[data_size]                        at header_size
+ *
+ * One publisher, any number of readers, the publisher never waits for
+ * them. Each frame is stored contiguous in data, so a reader gets it with
+ * one memcpy. The frame n is described by slot[n % slots]; seq is the
+ * number of frames published so far and write_pos the number of bytes
+ * claimed in data (both wrap around 2^32, data_size is a power of 2).
+ * A reader that is more than slots - 1 frames behind, or whose frame was
+ * overwritten during the copy, loses the frame and counts it in lost.
+ * Readers sleeping on a futex on seq are woken up at each publish.
+ * The reader table shows who reads and how far behind it is.
+ *
+ * Readers include this file only: no library and no parsing needed.
+ */
+
+#ifndef _FRAME_BUS_H
+#define _FRAME_BUS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define FRAME_BUS_MAGIC 0x53554246          // "FBUS"
+#define FRAME_BUS_VERSION 1
+#define FRAME_BUS_READERS 8
+#define FRAME_BUS_SLOTS 64
+#define FRAME_BUS_DATA_SIZE 65536           // must be a power of 2
+
+typedef struct
+{
+    uint32_t seq;                           // frame stored in this slot
+    uint32_t pos;                           // position of the frame, offset in data is pos % data_size
+    uint32_t size;                          // size of the frame
+    uint32_t time;                          // time in the firmware header (msec)
+} frame_bus_slot;
+
+typedef struct
+{
+    int32_t pid __attribute__((aligned(64)));   // process of the reader, 0 if the entry is free
+    uint32_t seq;                           // next frame to read
+    uint32_t lost;                          // frames lost by the reader
+} frame_bus_reader;
+
+typedef struct
+{
+    uint32_t magic;                         // FRAME_BUS_MAGIC
+    uint32_t version;                       // FRAME_BUS_VERSION
+    uint32_t header_size;                   // offset of data
+    uint32_t data_size;                     // size of data
+    uint32_t slots;                         // number of slots
+    uint32_t type;                          // TYPE_AAC: ADTS frames
+    uint32_t freq;                          // sampling frequency, 0 until detected
+    uint32_t chan;                          // number of channels, 0 until detected
+    int32_t publisher_pid;                  // process of the publisher
+    uint32_t closed;                        // set when the publisher exits
+    uint32_t seq __attribute__((aligned(64)));  // frames published, futex word
+    uint32_t waiters;                       // readers sleeping on seq
+    uint32_t write_pos;                     // bytes claimed by the publisher
+    frame_bus_reader reader[FRAME_BUS_READERS];
+    frame_bus_slot slot[FRAME_BUS_SLOTS];
+} frame_bus_header;
+
+static inline unsigned char *frame_bus_data(frame_bus_header *bus)
+{
+    return (unsigned char *) bus + bus->header_size;
+}
+
+// Publisher (src/frame_bus.cpp)
+frame_bus_header *frame_bus_create(const char *name, uint32_t type);
+void frame_bus_format(frame_bus_header *bus, uint32_t freq, uint32_t chan);
+void frame_bus_publish(frame_bus_header *bus, const unsigned char *src1, uint32_t n1,
+        const unsigned char *src2, uint32_t n2, uint32_t time);
+int frame_bus_reap(frame_bus_header *bus);
+int frame_bus_readers(frame_bus_header *bus);
+void frame_bus_destroy(frame_bus_header *bus, const char *name);
+
+// Reader: map the bus called name, return NULL if it doesn't exist or is not compatible
+static inline frame_bus_header *frame_bus_open(const char *name)
+{
+    frame_bus_header *bus;
+    struct stat st;
+    int fd;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1) return NULL;
+    if ((fstat(fd, &st) == -1) || (st.st_size < (off_t) sizeof(frame_bus_header))) {
+        close(fd);
+        return NULL;
+    }
+    bus = (frame_bus_header *) mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (bus == MAP_FAILED) return NULL;
+
+    if ((bus->magic != FRAME_BUS_MAGIC) || (bus->version != FRAME_BUS_VERSION) ||
+            (bus->slots != FRAME_BUS_SLOTS) ||
+            ((off_t) bus->header_size + bus->data_size != st.st_size)) {
+        munmap(bus, st.st_size);
+        return NULL;
+    }
+    return bus;
+}
+
+static inline void frame_bus_close(frame_bus_header *bus)
+{
+    munmap(bus, bus->header_size + bus->data_size);
+}
+
+// Reader: 0 if the publisher exited, open the bus again to read from the new one
+static inline int frame_bus_alive(frame_bus_header *bus)
+{
+    if (__atomic_load_n(&bus->closed, __ATOMIC_ACQUIRE)) return 0;
+    return (kill(bus->publisher_pid, 0) == 0) || (errno != ESRCH);
+}
+
+// Reader: get an entry of the reader table, it will read the frames published from now on
+// Return the reader id or -1 if the table is full; the entries of dead readers are reused
+static inline int frame_bus_attach(frame_bus_header *bus)
+{
+    int32_t pid = getpid();
+    int32_t old;
+    int i;
+
+    for (i = 0; i < FRAME_BUS_READERS; i++) {
+        old = __atomic_load_n(&bus->reader[i].pid, __ATOMIC_ACQUIRE);
+        if ((old != 0) && ((kill(old, 0) == 0) || (errno != ESRCH))) continue;
+        if (__atomic_compare_exchange_n(&bus->reader[i].pid, &old, pid, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            bus->reader[i].lost = 0;
+            __atomic_store_n(&bus->reader[i].seq, __atomic_load_n(&bus->seq, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+            return i;
+        }
+    }
+    return -1;
+}
+
+static inline void frame_bus_detach(frame_bus_header *bus, int id)
+{
+    __atomic_store_n(&bus->reader[id].pid, 0, __ATOMIC_RELEASE);
+}
+
+// Reader: copy the next frame to dest
+// Return its size, 0 if there are no new frames, -1 if the frame is larger than dest_size (it's skipped)
+static inline int frame_bus_read(frame_bus_header *bus, int id, unsigned char *dest, uint32_t dest_size, uint32_t *time)
+{
+    frame_bus_reader *r = &bus->reader[id];
+    frame_bus_slot *s;
+    uint32_t seq, head, pos, size, off;
+
+    for (;;) {
+        seq = r->seq;
+        head = __atomic_load_n(&bus->seq, __ATOMIC_ACQUIRE);
+        if (seq == head) return 0;
+
+        // The slot of head - slots is being written
+        if (head - seq > bus->slots - 1) {
+            r->lost += head - seq - (bus->slots - 1);
+            seq = head - (bus->slots - 1);
+        }
+
+        s = &bus->slot[seq % bus->slots];
+        if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != seq) {
+            r->lost++;
+            __atomic_store_n(&r->seq, seq + 1, __ATOMIC_RELEASE);
+            continue;
+        }
+        pos = s->pos;
+        size = s->size;
+        if (time != NULL) *time = s->time;
+        off = pos % bus->data_size;
+
+        if ((size > dest_size) || (off + size > bus->data_size)) {
+            __atomic_store_n(&r->seq, seq + 1, __ATOMIC_RELEASE);
+            if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != seq) {
+                r->lost++;
+                continue;
+            }
+            return -1;
+        }
+        memcpy(dest, frame_bus_data(bus) + off, size);
+
+        // Check that the publisher didn't reuse the slot or the data during the copy
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        __atomic_store_n(&r->seq, seq + 1, __ATOMIC_RELEASE);
+        if ((__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq) ||
+                (__atomic_load_n(&bus->write_pos, __ATOMIC_RELAXED) - pos > bus->data_size)) {
+            r->lost++;
+            continue;
+        }
+        return size;
+    }
+}
+
+// Reader: sleep until a new frame is published or timeout_ms expires (-1 to wait forever)
+// Return 1 if there is a new frame, 0 otherwise
+static inline int frame_bus_wait(frame_bus_header *bus, int id, int timeout_ms)
+{
+    uint32_t seq = bus->reader[id].seq;
+    struct timespec ts;
+
+    if (__atomic_load_n(&bus->seq, __ATOMIC_SEQ_CST) != seq) return 1;
+
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+    __atomic_add_fetch(&bus->waiters, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &bus->seq, FUTEX_WAIT, seq, (timeout_ms < 0) ? NULL : &ts, NULL, 0);
+    __atomic_sub_fetch(&bus->waiters, 1, __ATOMIC_SEQ_CST);
+
+    return __atomic_load_n(&bus->seq, __ATOMIC_ACQUIRE) != seq;
+}
+
+#endif
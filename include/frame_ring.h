@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Lock-free indices of the frame table of a cb_output_buffer.
+ * One producer (the capture) and up to FRAME_RING_READERS consumers
+ * (the sources in the live555 event loop), each one with its own tail.
+ * head is written only by the producer and each tail only by its
+ * reader, each one in its own cache line.
+ * A slot is always left empty to tell a full ring from an empty one:
+ * the ring is full when the slowest reader is size - 1 frames behind.
+ * waiting is set by a reader that found the ring empty: the producer
+ * clears it and wakes the reader up after publishing a frame.
+ * On overrun the producer can move the tail of a slow reader forward
+ * (frame_ring_advance) before reusing its frames: the reader finds it
+ * out when it releases the slot and drops the frame it was reading.
+ * head and the tails are positions that run over wrap, a multiple of
+ * size, and not slot numbers: a reader stopped during a copy while the
+ * producer goes round the ring would otherwise find its tail back on the
+ * same slot and release a frame overwritten in the meantime.
+ */
+
+#ifndef _FRAME_RING_H
+#define _FRAME_RING_H
+
+#define CACHE_LINE_SIZE 64
+#define FRAME_RING_READERS 8                // as many RTSP clients, each one has its own reader
+
+typedef struct
+{
+    unsigned int tail __attribute__((aligned(CACHE_LINE_SIZE)));   // position of the next slot to read
+    unsigned int reading;                   // position of the slot being read, written only by the reader
+    int waiting;                            // the reader waits for a new frame
+    int active;                             // the slot is used by a reader
+} frame_ring_reader;
+
+typedef struct
+{
+    unsigned int size;                      // number of slots
+    unsigned int wrap;                      // the positions go from 0 to wrap - 1
+    unsigned int head __attribute__((aligned(CACHE_LINE_SIZE)));   // position of the next slot to write
+    frame_ring_reader reader[FRAME_RING_READERS];
+} frame_ring;
+
+static inline void frame_ring_init(frame_ring *r, unsigned int size)
+{
+    int i;
+
+    r->size = size;
+    r->wrap = size * (0xFFFFFFFFU / size);
+    r->head = 0;
+    for (i = 0; i < FRAME_RING_READERS; i++) {
+        r->reader[i].tail = 0;
+        r->reader[i].reading = 0;
+        r->reader[i].waiting = 0;
+        r->reader[i].active = 0;
+    }
+}
+
+// Return the position after pos
+static inline unsigned int frame_ring_next(frame_ring *r, unsigned int pos)
+{
+    return (pos + 1 == r->wrap) ? 0 : pos + 1;
+}
+
+// Return the slot of the position pos
+static inline unsigned int frame_ring_slot(frame_ring *r, unsigned int pos)
+{
+    return pos % r->size;
+}
+
+// Return the number of positions from from to to
+static inline unsigned int frame_ring_distance(frame_ring *r, unsigned int from, unsigned int to)
+{
+    return (to >= from) ? to - from : to + (r->wrap - from);
+}
+
+// Consumer: get a reader id, it will read the frames published from now on
+// Return -1 if all the readers are in use
+static inline int frame_ring_attach(frame_ring *r)
+{
+    int i;
+
+    for (i = 0; i < FRAME_RING_READERS; i++) {
+        if (__atomic_load_n(&r->reader[i].active, __ATOMIC_ACQUIRE) == 0) {
+            r->reader[i].tail = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+            r->reader[i].waiting = 0;
+            __atomic_store_n(&r->reader[i].active, 1, __ATOMIC_SEQ_CST);
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Consumer: give the reader id back
+static inline void frame_ring_detach(frame_ring *r, int id)
+{
+    __atomic_store_n(&r->reader[id].active, 0, __ATOMIC_RELEASE);
+}
+
+// Producer: return 1 if the reader id is attached
+static inline int frame_ring_active(frame_ring *r, int id)
+{
+    return __atomic_load_n(&r->reader[id].active, __ATOMIC_ACQUIRE);
+}
+
+// Producer: return the number of attached readers
+static inline int frame_ring_readers(frame_ring *r)
+{
+    int i, n = 0;
+
+    for (i = 0; i < FRAME_RING_READERS; i++) {
+        n += frame_ring_active(r, i);
+    }
+    return n;
+}
+
+// Producer: return the position of the next slot to read of the reader id
+static inline unsigned int frame_ring_tail(frame_ring *r, int id)
+{
+    return __atomic_load_n(&r->reader[id].tail, __ATOMIC_ACQUIRE);
+}
+
+// Producer: return the number of frames published and not yet read by the reader id
+static inline unsigned int frame_ring_lag(frame_ring *r, int id)
+{
+    return frame_ring_distance(r, frame_ring_tail(r, id), __atomic_load_n(&r->head, __ATOMIC_ACQUIRE));
+}
+
+// Producer: return 1 if the ring is full for the reader id
+static inline int frame_ring_full(frame_ring *r, int id)
+{
+    return frame_ring_lag(r, id) == r->size - 1;
+}
+
+// Producer: return the slot to fill or -1 if the ring is full for a reader
+static inline int frame_ring_write_slot(frame_ring *r)
+{
+    int i;
+
+    for (i = 0; i < FRAME_RING_READERS; i++) {
+        if (frame_ring_active(r, i) && frame_ring_full(r, i)) return -1;
+    }
+    return frame_ring_slot(r, __atomic_load_n(&r->head, __ATOMIC_RELAXED));
+}
+
+// Producer: move the tail of the reader id from the position tail to pos, on overrun
+// Return 0 if the reader moved it in the meantime
+static inline int frame_ring_advance(frame_ring *r, int id, unsigned int tail, unsigned int pos)
+{
+    return __atomic_compare_exchange_n(&r->reader[id].tail, &tail, pos, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+// Producer: make the filled slot visible to the readers
+static inline void frame_ring_publish(frame_ring *r)
+{
+    unsigned int head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&r->head, frame_ring_next(r, head), __ATOMIC_RELEASE);
+}
+
+// Consumer: return the slot to read or -1 if the ring is empty
+static inline int frame_ring_read_slot(frame_ring *r, int id)
+{
+    unsigned int tail = __atomic_load_n(&r->reader[id].tail, __ATOMIC_RELAXED);
+
+    if (tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) return -1;
+    r->reader[id].reading = tail;
+    return frame_ring_slot(r, tail);
+}
+
+// Consumer: give the slot returned by frame_ring_read_slot back to the producer
+// Return 0 if the producer took it back during the read (overrun): the frame read is not valid
+static inline int frame_ring_release(frame_ring *r, int id)
+{
+    unsigned int tail = r->reader[id].reading;
+
+    return __atomic_compare_exchange_n(&r->reader[id].tail, &tail, frame_ring_next(r, tail), 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+// Consumer: ask to be woken up, return 0 if the ring is still empty
+static inline int frame_ring_wait(frame_ring *r, int id)
+{
+    __atomic_store_n(&r->reader[id].waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (frame_ring_read_slot(r, id) == -1) return 0;
+
+    // A frame was published in the meantime
+    __atomic_store_n(&r->reader[id].waiting, 0, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// Producer: return 1 if the reader id must be woken up after a publish
+static inline int frame_ring_wake(frame_ring *r, int id)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->reader[id].waiting, __ATOMIC_RELAXED) == 0) return 0;
+    return __atomic_exchange_n(&r->reader[id].waiting, 0, __ATOMIC_RELAXED);
+}
+
+// Consumer: move the tail from the position tail back by frames, to read again the last frames published
+// frames must leave the ring far from full, or the producer could reuse them
+// Return 0 if the producer moved the tail in the meantime
+static inline int frame_ring_rewind(frame_ring *r, int id, unsigned int tail, unsigned int frames)
+{
+    return __atomic_compare_exchange_n(&r->reader[id].tail, &tail, (tail >= frames) ? tail - frames : tail + (r->wrap - frames),
+            0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+// Consumer: skip all the frames already in the ring
+static inline void frame_ring_skip_all(frame_ring *r, int id)
+{
+    unsigned int tail = __atomic_load_n(&r->reader[id].tail, __ATOMIC_RELAXED);
+
+    // The producer can only move the tail forward, towards head
+    while (!__atomic_compare_exchange_n(&r->reader[id].tail, &tail, __atomic_load_n(&r->head, __ATOMIC_ACQUIRE),
+            0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+}
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Parser of fshare_frame_buf, without globals and without live555.
+ * The stream area of the buffer is [buffer + offset, buffer + size):
+ * frames and headers can wrap around its end.
+ * Header only, so that other processes can include it and use the same
+ * header layouts as rAudioStreamer.
+ */
+
+#ifndef _FSHARE_PARSER_H
+#define _FSHARE_PARSER_H
+
+#include <string.h>
+
+#include "rAudioStreamerReceiver.h"
+
+// Layout of the frame header for each header size
+template <int N> struct frame_header_layout;
+template <> struct frame_header_layout<19> { typedef struct frame_header_19 type; };
+template <> struct frame_header_layout<22> { typedef struct frame_header_22 type; };
+template <> struct frame_header_layout<24> { typedef struct frame_header_24 type; };
+template <> struct frame_header_layout<26> { typedef struct frame_header_26 type; };
+template <> struct frame_header_layout<28> { typedef struct frame_header_28 type; };
+
+// Move buf by offset bytes inside the stream area
+static inline unsigned char *fshare_move(const cb_input_buffer *ib, unsigned char *buf, int offset)
+{
+    buf += offset;
+    if ((offset > 0) && (buf > ib->buffer + ib->size))
+        buf -= (ib->size - ib->offset);
+    if ((offset < 0) && (buf < ib->buffer + ib->offset))
+        buf += (ib->size - ib->offset);
+
+    return buf;
+}
+
+// Distance from buf to end, moving forward in the stream area
+static inline int fshare_distance(const cb_input_buffer *ib, unsigned char *buf, unsigned char *end)
+{
+    if (end >= buf) return end - buf;
+    return end - buf + (ib->size - ib->offset);
+}
+
+// Copy n bytes starting at src in the stream area to dest
+static inline void fshare_memcpy(const cb_input_buffer *ib, unsigned char *dest, unsigned char *src, size_t n)
+{
+    if (src + n > ib->buffer + ib->size) {
+        memcpy(dest, src, ib->buffer + ib->size - src);
+        memcpy(dest + (ib->buffer + ib->size - src), ib->buffer + ib->offset, n - (ib->buffer + ib->size - src));
+    } else {
+        memcpy(dest, src, n);
+    }
+}
+
+// Decode the header of layout T at src
+// Read the fields in place, the header is copied only if it wraps around the end of the buffer
+template <typename T> inline void fshare_header_decode(const cb_input_buffer *ib, struct frame_header *fh, unsigned char *src)
+{
+    T h;
+    const T *hp = (const T *) src;
+
+    if (src + sizeof(T) > ib->buffer + ib->size) {
+        fshare_memcpy(ib, (unsigned char *) &h, src, sizeof(T));
+        hp = &h;
+    }
+    fh->len = hp->len;
+    fh->counter = hp->counter;
+    fh->time = hp->time;
+    fh->type = hp->type;
+    fh->stream_counter = hp->stream_counter;
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Encoders of the PCM payloads: G.711 mu-law and A-law, L16.
+ * The G.711 encoders are table lookups, the tables are built by g711_init()
+ * from the reference encoders of ITU-T G.711 (Sun Microsystems g711.c).
+ */
+
+#ifndef _G711_H
+#define _G711_H
+
+#define G711_ULAW_TABLE_SIZE 16384          // 14 bits samples
+#define G711_ALAW_TABLE_SIZE 8192           // 13 bits samples
+
+// Build the tables, call it once before the encoders
+void g711_init();
+
+// Reference encoders of one sample, used to build the tables
+unsigned char g711_linear2ulaw(short pcm);
+unsigned char g711_linear2alaw(short pcm);
+
+// Encode n samples, out is n bytes
+void g711_ulaw_encode(const short *pcm, unsigned char *out, unsigned int n);
+void g711_alaw_encode(const short *pcm, unsigned char *out, unsigned int n);
+// n samples in network byte order, out is 2 * n bytes
+void l16_encode(const short *pcm, unsigned char *out, unsigned int n);
+
+// Time to encode n samples with the tables and with the reference encoder (ns),
+// alaw selects the A-law encoders
+void g711_benchmark(int alaw, unsigned int n, long long *table_ns, long long *reference_ns);
+
+#endif
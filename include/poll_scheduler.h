@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Wakeup scheduler for the capture loop.
+ * Learns when the firmware writes frames to fshare_frame_buf and tells
+ * capture() how long it can sleep before the next write.
+ */
+
+#ifndef _POLL_SCHEDULER_H
+#define _POLL_SCHEDULER_H
+
+#include <stdint.h>
+
+#define POLL_PERIOD_DEFAULT 32000           // initial guess of the write period (usec)
+#define POLL_GUARD 2000                     // wake up this long after the expected write (usec)
+#define POLL_MIN 1000                       // shortest sleep (usec)
+#define POLL_MAX 200000                     // longest sleep when the stream stalls (usec)
+#define POLL_OFFSET_WINDOW 256              // frames used to refresh the clock offset
+#define POLL_STATS_INTERVAL 10000000        // debug statistics interval (usec)
+#define POLL_HISTOGRAM_BUCKETS 9            // wakeup delay: < 50 us, < 100 us, ... < 10 ms, >= 10 ms
+
+typedef struct
+{
+    int period;                             // interval between two writes from frame_header.time (usec)
+    int cadence;                            // interval between two writes measured locally (usec)
+    int misses;                             // consecutive wakeups without new frames
+    long long last_write;                   // local time of the last write (usec)
+    uint32_t last_fw_time;                  // frame_header.time of the last frame (msec)
+    int fw_time_valid;                      // last_fw_time contains a value
+    long long offset;                       // local time - firmware time (usec), min of the current window
+    long long offset_next;                  // min of the window being collected
+    int offset_count;                       // frames collected in the current window
+    long long last_data;                    // local time of the last wakeup with new frames (usec)
+    unsigned int wakeups;                   // statistics
+    unsigned int empty_wakeups;
+    unsigned int late_count;
+    long long late_sum;
+    long long late_max;
+    long long stats_start;
+    long long wake_expected;                // requested wakeup time (usec), 0 if unknown
+    unsigned int wake_histogram[POLL_HISTOGRAM_BUCKETS];    // actual - requested wakeup time, since start
+    long long wake_delay_max;
+} poll_scheduler;
+
+long long poll_scheduler_now();
+void poll_scheduler_init(poll_scheduler *ps);
+void poll_scheduler_resume(poll_scheduler *ps);
+void poll_scheduler_frame(poll_scheduler *ps, uint32_t fw_time, long long now);
+void poll_scheduler_wakeup(poll_scheduler *ps, int frames, long long now);
+int poll_scheduler_next(poll_scheduler *ps, long long now);
+void poll_scheduler_woken(poll_scheduler *ps, long long now);
+void poll_scheduler_stats(poll_scheduler *ps, long long now);
+
+#endif
@@ -30,10 +30,13 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <time.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <getopt.h>
 
+#include "frame_ring.h"
+
 #define SAMPLING_FREQ 16000
 #define NUM_CHANNELS 1
 
@@ -43,6 +46,8 @@
 #define READ_LOCK_FILE "fshare_read_lock"
 #define WRITE_LOCK_FILE "fshare_write_lock"
 
+#define MODEL_AUTO 0
+
 #define Y203C 200
 #define Y23 201
 #define Y25 202
@@ -74,7 +79,11 @@
 #define QG311R 415
 #define B091QP 416
 
-#define BUF_OFFSET_MSTAR 230 //228
+#define PLATFORM_MSTAR 2
+#define PLATFORM_ALLWINNER 3
+
+#define BUF_OFFSET_MSTAR 230
+#define BUF_OFFSET_MSTAR_OLD 228
 #define FRAME_HEADER_SIZE_MSTAR 19
 
 #define BUF_OFFSET_Y20GA 300
@@ -143,10 +152,75 @@
 #define MILLIS_10 10000
 #define MILLIS_25 25000
 
+#define PROCESS_STATS_INTERVAL 10000000
+#define SNAPSHOT_RETRIES 8
+
+#define PROBE_WRITES 3                      // writes of the firmware used to detect the model
+#define PROBE_TIMEOUT 1000000               // max time to wait for them (usec)
+#define PROBE_POLL 5000                     // (usec)
+#define PROBE_MAX_FRAMES 256
+
+// Steps of the startup trace
+#define STARTUP_EXEC 0
+#define STARTUP_MMAP 1
+#define STARTUP_FIRST_FRAME 2
+#define STARTUP_READY 3
+#define STARTUP_FIRST_RTP 4
+#define STARTUP_ADAPT 5
+#define STARTUP_STEPS 6
+
 #define TYPE_NONE 0
+#define TYPE_LOW 360
+#define TYPE_HIGH 1080
 #define TYPE_AAC 65521
 
+#define CODEC_NONE 0
+#define CODEC_H264 264
+#define CODEC_H265 265
+
 #define OUTPUT_BUFFER_SIZE_AUDIO 32768
+#define OUTPUT_BUFFER_SIZE_LOW 262144
+#define OUTPUT_BUFFER_SIZE_HIGH 786432
+#define OUTPUT_BUFFER_SLOTS_AUDIO 64        // ~ 4 s of 64 ms frames
+#define OUTPUT_BUFFER_SLOTS_VIDEO 42        // SPS + PPS + I frame + the rest of a GOP
+#define OUTPUT_BUFFER_SLOTS_MIN 4
+#define OUTPUT_BUFFER_SLOTS_MAX 4096
+
+// What the capture does when a reader is so late that a new frame doesn't fit
+#define OVERRUN_DROP_NEWEST 0               // drop the new frame
+#define OVERRUN_DROP_OLDEST 1               // drop the oldest frames of the late reader
+#define OVERRUN_RESET 2                     // drop all the frames of the late reader, it restarts from the new one
+#define VIDEO_FRAME_SIZE_MAX 524288
+#define AUDIO_PORT_DEFAULT 6666
+#define VIDEO_PORT_DEFAULT 6668
+#define DESTINATIONS_MAX 32                 // unicast destinations served by one process
+#define RTSP_STREAM_NAME "audio"
+#define PREROLL_DEFAULT 320                 // audio sent at once to a new RTSP client (msec)
+#define RED_PAYLOAD_FORMAT 98               // RFC 2198 payloads, the blocks use 97 (MPEG4-GENERIC)
+#define RED_DEPTH_MAX 2                     // previous AUs sent again in each packet
+#define RED_BLOCK_SIZE_MAX 1023             // length of a redundant block, 10 bits
+#define RED_OFFSET_MAX 16383                // timestamp offset of a redundant block, 14 bits
+#define INTERLEAVE_PACKETS_MAX 8            // packets of an interleaved group, AU-Index-delta is 3 bits
+#define INTERLEAVE_FRAMES_MAX 8             // AUs in each packet of an interleaved group
+#define PCM_ENCODING_L16 0                  // 16 bits linear, network byte order (RFC 3551)
+#define PCM_ENCODING_PCMU 1                 // G.711 mu-law, static payload type 0
+#define PCM_ENCODING_PCMA 2                 // G.711 A-law, static payload type 8
+#define PCM_PAYLOAD_MS 20                   // audio in each PCM packet
+#define ADAPT_INTERVAL 2000000             // check of the receiver reports of --adapt (usec)
+#define ADAPT_HOLD 5000                     // after a bitrate change, the reports of the old one are ignored (msec)
+#define ADAPT_LOSS_DOWN 13                  // fraction lost (/256) that lowers the bitrate, 5%
+#define ADAPT_LOSS_DOWN_FAST 51             // that lowers it by 2 steps, 20%
+#define ADAPT_LOSS_UP 3                     // below it for ADAPT_UP_CHECKS checks the bitrate goes up, 1%
+#define ADAPT_JITTER_DOWN 80                // jitter that lowers the bitrate (msec)
+#define ADAPT_JITTER_UP 40                  // below it for ADAPT_UP_CHECKS checks the bitrate goes up (msec)
+#define ADAPT_UP_CHECKS 5                   // checks in a row with a clean link before a step up
+#define ADAPT_OVER_CHECKS 3                 // checks in a row over the budget without afterburner before the AUs are forwarded
+#define ADAPT_PASSTHROUGH_HOLD 60000        // forwarded AUs before encoding again at MIN (msec)
+#define ADAPT_BUDGET_DEFAULT 25             // cpu of the re-encoding, % of a core
+#define ADAPT_CALIBRATE_SECONDS 1           // of audio decoded and encoded again at MAX and at MIN at the first start
+#define ADAPT_CALIBRATION_FILE "/tmp/rAudioStreamer.adapt" // the costs measured, kept across restarts
+#define IDLE_TIMEOUT_MIN 10                 // shortest --idle timeout, a few RTCP intervals (sec)
+#define IDLE_CHECK_INTERVAL 1000000         // listener check and liveness poll of the parked capture (usec)
 
 typedef struct
 {
@@ -158,26 +232,47 @@ typedef struct
 } cb_input_buffer;
 
 // Frame position inside the output buffer, needed to use DiscreteFramer instead Framer.
+// 16 bytes with no padding, also on 32 bit ARM: 4 per cache line
 typedef struct
 {
-    unsigned char *ptr;                     // pointer to the frame start
-    unsigned int counter;                   // frame counter
-    unsigned int size;                      // frame size
+    uint32_t offset;                        // offset of the frame start from buffer
+    uint32_t size;                          // frame size, 0 if the slot was never filled
+    uint32_t time;                          // time in the firmware header (msec)
+    uint16_t generation;                    // low 16 bits of the counter in the firmware header (single copy mode)
+    uint16_t counter;                       // frame counter
 } cb_output_frame;
+typedef char cb_output_frame_size_check[(sizeof(cb_output_frame) == 16) ? 1 : -1];
 
 typedef struct
 {
     unsigned char *buffer;                  // pointer to the base of the output buffer
     unsigned int size;                      // size of the output buffer
+    cb_input_buffer *source;                // input buffer when the frames are read in place (single copy mode)
     int type;                               // type of the stream in this buffer
+    int codec;                              // video codec, detected from the first key frame
     unsigned char *write_index;             // write absolute index
-    cb_output_frame output_frame[42];       // array of frames that buffer contains 42 = SPS + PPS + iframe + GOP
-    int output_frame_size;                  // number of frames that buffer contains
-    unsigned int frame_read_index;          // index of the next frame to read
-    unsigned int frame_write_index;         // index of the next frame to write
-    pthread_mutex_t mutex;                  // mutex of the structure
+    cb_output_frame *output_frame;          // frames in the buffer, ring.size slots
+    frame_ring ring;                        // lock-free indices of output_frame
+    int event_fd[FRAME_RING_READERS];       // eventfd of each reader, signalled when a frame is published
+    int overrun;                            // OVERRUN_* policy
+    int retain;                             // keep filling the ring without readers, for the pre-roll
+    uint32_t published;                     // local time of the last frame published (msec, wraps around)
+    unsigned int dropped_newest;            // new frames dropped on overrun
+    unsigned int dropped_oldest;            // frames taken back from late readers on overrun
+    unsigned int resets;                    // readers moved to the new frame on overrun
+    unsigned int lag_max[FRAME_RING_READERS];   // max frames not yet read by each reader, since the last stats
 } cb_output_buffer;
 
+// Parameters of a camera model
+typedef struct
+{
+    const char *name;                       // name used by --model
+    int model;                              // model id
+    int platform;                           // PLATFORM_MSTAR or PLATFORM_ALLWINNER
+    int buf_offset;                         // offset where stream starts
+    int frame_header_size;                  // size of the frame header, selects its layout
+} model_desc;
+
 struct __attribute__((__packed__)) frame_header {
     uint32_t len;
     uint32_t counter;
@@ -239,5 +334,14 @@ struct __attribute__((__packed__)) frame_header_28 {
 };
 
 long long current_timestamp();
+void startup_trace(int step);
+void frame_presentation_time(uint32_t time, struct timeval *pt);
+int cb_frame_unchanged(cb_output_buffer *cb, cb_output_frame *frame);
+void s2cb_memcpy(cb_output_buffer *dest, unsigned char *src, size_t n);
+unsigned int cb_reader_bytes(cb_output_buffer *cb, int id);
+int cb_output_buffer_reserve(cb_output_buffer *cb, unsigned int len);
+unsigned int cb_output_buffer_rewind(cb_output_buffer *cb, int id, unsigned int ms);
+void getAACConfigStr(char *configStr, unsigned samplingFrequency, unsigned numChannels);
+void idle_listener_seen(const char *who);
 
 #endif
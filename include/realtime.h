@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Realtime mode: SCHED_FIFO, CPU affinity, locked and prefaulted memory.
+ * Keeps the capture on time when the encoder of the cam saturates the CPU.
+ */
+
+#ifndef _REALTIME_H
+#define _REALTIME_H
+
+#include <stddef.h>
+
+#define REALTIME_STACK_SIZE 262144          // stack of the capture thread, it's locked in memory
+
+int realtime_thread(const char *name, int priority, int cpu);
+int realtime_lock();
+void realtime_prefault(const unsigned char *buf, size_t size);
+void realtime_prefault_write(unsigned char *buf, size_t size);
+
+#endif
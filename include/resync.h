@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Scanner for the ADTS sync word (0xFFF), used to find the frames again
+ * when the chain of headers in fshare_frame_buf is broken.
+ * Uses NEON on ARM and SSE2 on x86 when the compiler enables them.
+ */
+
+#ifndef _RESYNC_H
+#define _RESYNC_H
+
+// Return the first p in [buf, end) with p[0] == 0xFF and p[1] & 0xF0 == 0xF0, or NULL
+// p[1] must be readable, the last byte of the range is not checked
+unsigned char *resync_find_sync(unsigned char *buf, unsigned char *end);
+
+#endif
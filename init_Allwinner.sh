@@ -65,3 +65,4 @@ cd live || exit 1
 cp -f ../Makefile.template Makefile
 cp -rf ../src .
 cp -rf ../include .
+cp -rf ../test .
@@ -0,0 +1,253 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// Decoder of the AAC access units to L16, PCMU or PCMA payloads.
+// Implementation
+
+#include "AAC2PCMFilter.hh"
+#include "g711.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef RTP_PAYLOAD_MAX_SIZE
+#define RTP_PAYLOAD_MAX_SIZE 1352
+#endif
+
+extern int debug;
+
+static long long pcm_thread_time() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+AAC2PCMFilter*
+AAC2PCMFilter::createNew(UsageEnvironment& env, FramedSource* inputSource,
+                         unsigned samplingFrequency, unsigned numChannels, int encoding) {
+    HANDLE_AACDECODER decoder;
+    AAC_DECODER_ERROR err;
+    unsigned outputFrequency = samplingFrequency;
+    unsigned config[2];
+    char configStr[5];
+    UCHAR audioSpecificConfig[2];
+    UCHAR* conf = audioSpecificConfig;
+    UINT confSize = 2;
+
+    if (encoding != PCM_ENCODING_L16) {
+        if (samplingFrequency == 16000) {
+            outputFrequency = 8000;
+        } else if (samplingFrequency != 8000) {
+            fprintf(stderr, "%lld: AAC2PCMFilter - error - G.711 needs 8 or 16 kHz audio, the stream is %u Hz\n",
+                    current_timestamp(), samplingFrequency);
+            return NULL;
+        }
+    }
+
+    // Raw AUs: the decoder is configured with the AudioSpecificConfig of the SDP
+    decoder = aacDecoder_Open(TT_MP4_RAW, 1);
+    if (decoder == NULL) {
+        fprintf(stderr, "%lld: AAC2PCMFilter - error - couldn't open the AAC decoder\n", current_timestamp());
+        return NULL;
+    }
+    getAACConfigStr(configStr, samplingFrequency, numChannels);
+    sscanf(configStr, "%2x%2x", &config[0], &config[1]);
+    audioSpecificConfig[0] = config[0];
+    audioSpecificConfig[1] = config[1];
+    err = aacDecoder_ConfigRaw(decoder, &conf, &confSize);
+    if (err != AAC_DEC_OK) {
+        fprintf(stderr, "%lld: AAC2PCMFilter - error - couldn't configure the AAC decoder: %x\n", current_timestamp(), err);
+        aacDecoder_Close(decoder);
+        return NULL;
+    }
+    g711_init();
+
+    return new AAC2PCMFilter(env, inputSource, decoder, samplingFrequency, encoding, outputFrequency);
+}
+
+AAC2PCMFilter::AAC2PCMFilter(UsageEnvironment& env, FramedSource* inputSource,
+                             HANDLE_AACDECODER decoder, unsigned samplingFrequency,
+                             int encoding, unsigned outputFrequency)
+    : FramedFilter(env, inputSource), fDecoder(decoder), fSamplingFrequency(samplingFrequency),
+      fEncoding(encoding), fOutputFrequency(outputFrequency), fPendingCount(0),
+      fFrames(0), fDecodeErrors(0), fDecodeTime(0), fResampleTime(0), fCompandTime(0) {
+    unsigned bytesPerSample = (encoding == PCM_ENCODING_L16) ? 2 : 1;
+
+    // 20 ms, 10 ms when L16 above 32 kHz doesn't fit in a packet
+    fPayloadSamples = outputFrequency * PCM_PAYLOAD_MS / 1000;
+    while (fPayloadSamples * bytesPerSample > RTP_PAYLOAD_MAX_SIZE) fPayloadSamples /= 2;
+
+    memset(fWork, 0, sizeof(fWork));
+    fNextPresentationTime.tv_sec = 0;
+    fNextPresentationTime.tv_usec = 0;
+}
+
+AAC2PCMFilter::~AAC2PCMFilter() {
+    aacDecoder_Close(fDecoder);
+}
+
+void AAC2PCMFilter::doGetNextFrame() {
+    if (fPendingCount >= fPayloadSamples) {
+        deliver();
+        return;
+    }
+
+    fInputSource->getNextFrame(fAU, sizeof(fAU),
+                               afterGettingFrame, this,
+                               FramedSource::handleClosure, this);
+}
+
+void AAC2PCMFilter::afterGettingFrame(void* clientData, unsigned frameSize,
+                                      unsigned numTruncatedBytes,
+                                      struct timeval presentationTime,
+                                      unsigned /*durationInMicroseconds*/) {
+    AAC2PCMFilter* filter = (AAC2PCMFilter*) clientData;
+    filter->afterGettingFrame1(frameSize, numTruncatedBytes, presentationTime);
+}
+
+void AAC2PCMFilter::afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                                       struct timeval presentationTime) {
+    UCHAR* data = fAU;
+    UINT size = frameSize;
+    UINT valid = frameSize;
+    AAC_DECODER_ERROR err;
+    CStreamInfo* info;
+    short* to;
+    long long start, t, pendingUs, nextUs;
+    long long uSecsPerFrame = 1024/*samples-per-frame*/ * 1000000LL / fSamplingFrequency;
+    unsigned numSamples, numChannels, i, k;
+    int sum;
+
+    // Empty frame (the source is starting)
+    if ((frameSize == 0) && (numTruncatedBytes == 0)) {
+        doGetNextFrame();
+        return;
+    }
+    if (numTruncatedBytes > 0) {
+        fprintf(stderr, "%lld: AAC2PCMFilter - error - AU too large, dropped\n", current_timestamp());
+        doGetNextFrame();
+        return;
+    }
+
+    start = pcm_thread_time();
+    err = aacDecoder_Fill(fDecoder, &data, &size, &valid);
+    if (err == AAC_DEC_OK) err = aacDecoder_DecodeFrame(fDecoder, fDecoded, PCM_DECODED_MAX, 0);
+    info = aacDecoder_GetStreamInfo(fDecoder);
+    if ((err != AAC_DEC_OK) || (info == NULL) || (info->numChannels < 1) ||
+            (info->frameSize * info->numChannels > PCM_DECODED_MAX) ||
+            (fPendingCount + info->frameSize > PCM_PENDING_MAX)) {
+        if (debug) fprintf(stderr, "%lld: AAC2PCMFilter - decode failed: %x\n", current_timestamp(), err);
+        fDecodeErrors++;
+        doGetNextFrame();
+        return;
+    }
+    numSamples = info->frameSize;
+    numChannels = info->numChannels;
+
+    // Mono: straight to the samples pending, or to the decimator
+    to = (fOutputFrequency != fSamplingFrequency) ? fWork + PCM_HALFBAND_HISTORY : fPending + fPendingCount;
+    if (numChannels == 1) {
+        memcpy(to, fDecoded, numSamples * sizeof(short));
+    } else {
+        for (i = 0; i < numSamples; i++) {
+            sum = 0;
+            for (k = 0; k < numChannels; k++) sum += fDecoded[i * numChannels + k];
+            to[i] = sum / (int) numChannels;
+        }
+    }
+    t = pcm_thread_time();
+    fDecodeTime += t - start;
+
+    if (fOutputFrequency != fSamplingFrequency) {
+        numSamples = decimate(numSamples);
+        fResampleTime += pcm_thread_time() - t;
+    }
+
+    // The payloads follow their own clock, set again by the source when
+    // they differ by more than half AU (minute resync, gap in the stream)
+    pendingUs = fPendingCount * 1000000LL / fOutputFrequency;
+    nextUs = fNextPresentationTime.tv_sec * 1000000LL + fNextPresentationTime.tv_usec;
+    t = presentationTime.tv_sec * 1000000LL + presentationTime.tv_usec;
+    if ((fFrames == 0) || (llabs(t - nextUs - pendingUs) > uSecsPerFrame / 2)) {
+        nextUs = t - pendingUs;
+        fNextPresentationTime.tv_sec = nextUs / 1000000;
+        fNextPresentationTime.tv_usec = nextUs % 1000000;
+    }
+    fPendingCount += numSamples;
+    fFrames++;
+
+    doGetNextFrame();
+}
+
+// 2:1 with a 23 taps halfband FIR (Blackman window, Q15): flat to 3 kHz,
+// -6 dB at 4 kHz, -23 dB at 5 kHz, below -70 dB from 6 kHz. Every other
+// tap is 0, the center one is 9 samples back (0.56 ms at 16 kHz).
+// The output goes to the samples pending, return their number
+unsigned AAC2PCMFilter::decimate(unsigned numSamples) {
+    short* y = fPending + fPendingCount;
+    const short* c;
+    unsigned m;
+    int acc;
+
+    for (m = 0; m < numSamples / 2; m++) {
+        c = fWork + 2 * m + 9;
+        acc = 16384 * c[0] + 10087 * (c[-1] + c[1]) - 2559 * (c[-3] + c[3]) +
+                864 * (c[-5] + c[5]) - 238 * (c[-7] + c[7]) + 38 * (c[-9] + c[9]);
+        acc = (acc + 16384) >> 15;
+        if (acc > 32767) acc = 32767;
+        if (acc < -32768) acc = -32768;
+        y[m] = acc;
+    }
+    memmove(fWork, fWork + numSamples, PCM_HALFBAND_HISTORY * sizeof(short));
+
+    return numSamples / 2;
+}
+
+void AAC2PCMFilter::deliver() {
+    unsigned bytesPerSample = (fEncoding == PCM_ENCODING_L16) ? 2 : 1;
+    unsigned samples = fPayloadSamples;
+    long long start = pcm_thread_time();
+    unsigned uSeconds;
+
+    if (samples * bytesPerSample > fMaxSize) {
+        samples = fMaxSize / bytesPerSample;
+        fNumTruncatedBytes = (fPayloadSamples - samples) * bytesPerSample;
+    } else {
+        fNumTruncatedBytes = 0;
+    }
+    if (fEncoding == PCM_ENCODING_PCMU) {
+        g711_ulaw_encode(fPending, fTo, samples);
+    } else if (fEncoding == PCM_ENCODING_PCMA) {
+        g711_alaw_encode(fPending, fTo, samples);
+    } else {
+        l16_encode(fPending, fTo, samples);
+    }
+    fCompandTime += pcm_thread_time() - start;
+
+    fFrameSize = samples * bytesPerSample;
+    fPresentationTime = fNextPresentationTime;
+    fDurationInMicroseconds = fPayloadSamples * 1000000LL / fOutputFrequency;
+
+    uSeconds = fNextPresentationTime.tv_usec + fDurationInMicroseconds;
+    fNextPresentationTime.tv_sec += uSeconds / 1000000;
+    fNextPresentationTime.tv_usec = uSeconds % 1000000;
+    fPendingCount -= fPayloadSamples;
+    memmove(fPending, fPending + fPayloadSamples, fPendingCount * sizeof(short));
+
+    FramedSource::afterGetting(this);
+}
@@ -0,0 +1,242 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// RFC 3640 aggregation: several AAC access units in each RTP packet.
+// Implementation
+
+#include "rAudioStreamerReceiver.h"
+#include "AACAggregator.hh"
+
+extern int debug;
+
+////////// AACAggregator //////////
+
+AACAggregator*
+AACAggregator::createNew(UsageEnvironment& env, FramedSource* inputSource,
+                         unsigned samplingFrequency, unsigned maxLatencyMs) {
+    unsigned uSecsPerAU = (1024/*samples-per-frame*/*1000000) / samplingFrequency;
+    // The first AU of a packet waits for the following ones
+    unsigned maxAUs = 1 + (maxLatencyMs * 1000) / uSecsPerAU;
+
+    if (maxAUs > AGGREGATE_AUS_MAX) maxAUs = AGGREGATE_AUS_MAX;
+
+    return new AACAggregator(env, inputSource, maxAUs, maxLatencyMs);
+}
+
+AACAggregator::AACAggregator(UsageEnvironment& env, FramedSource* inputSource, unsigned maxAUs, unsigned maxLatencyMs)
+    : FramedFilter(env, inputSource), fMaxAUs(maxAUs), fMaxLatencyUs(maxLatencyMs * 1000),
+      fNumAUs(0), fDataSize(0), fPendingOffset(0), fFlushTask(NULL), fFlushDue(False), fDuration(0),
+      fPackets(0), fAUs(0), fAUBytes(0), fHeaderBytes(0), fFlushes(0) {
+}
+
+AACAggregator::~AACAggregator() {
+    envir().taskScheduler().unscheduleDelayedTask(fFlushTask);
+}
+
+void AACAggregator::doGetNextFrame() {
+    struct timeval noTime = { 0, 0 };
+
+    // The packet filled up or ran out of time while the sink was sending the previous one
+    if ((fNumAUs >= fMaxAUs) || ((fNumAUs > 0) && fFlushDue)) {
+        deliver(0, noTime, 0);
+        return;
+    }
+    getNextAU();
+}
+
+void AACAggregator::getNextAU() {
+    // Still pending from before a timeout: its AU is moved in place when it arrives
+    if (fInputSource->isCurrentlyAwaitingData()) return;
+
+    fPendingOffset = fDataSize;
+    fInputSource->getNextFrame(fAU + fDataSize, sizeof(fAU) - fDataSize,
+                               afterGettingFrame, this,
+                               FramedSource::handleClosure, this);
+}
+
+void AACAggregator::scheduleFlush() {
+    envir().taskScheduler().unscheduleDelayedTask(fFlushTask);
+    fFlushTask = envir().taskScheduler().scheduleDelayedTask(fMaxLatencyUs, flushTimeout, this);
+}
+
+void AACAggregator::flushTimeout(void* clientData) {
+    AACAggregator* aggregator = (AACAggregator*) clientData;
+    aggregator->flushTimeout1();
+}
+
+// The input stalled: send the AUs collected so far, the next AU will start a new payload
+void AACAggregator::flushTimeout1() {
+    struct timeval noTime = { 0, 0 };
+
+    fFlushTask = NULL;
+    if (fNumAUs == 0) return;
+
+    fFlushes++;
+    if (isCurrentlyAwaitingData()) {
+        deliver(0, noTime, 0);
+    } else {
+        fFlushDue = True;
+    }
+}
+
+void AACAggregator::afterGettingFrame(void* clientData, unsigned frameSize,
+                                      unsigned numTruncatedBytes,
+                                      struct timeval presentationTime,
+                                      unsigned durationInMicroseconds) {
+    AACAggregator* aggregator = (AACAggregator*) clientData;
+    aggregator->afterGettingFrame1(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
+}
+
+void AACAggregator::afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                                       struct timeval presentationTime,
+                                       unsigned durationInMicroseconds) {
+    struct timeval noTime = { 0, 0 };
+
+    // A timeout sent the AUs before it: move it after the ones collected since
+    if ((fPendingOffset != fDataSize) && (frameSize > 0)) {
+        memmove(fAU + fDataSize, fAU + fPendingOffset, frameSize);
+    }
+    fPendingOffset = fDataSize;
+
+    // Empty frame (the source is starting) or an AU that can't be described with 13 bits
+    if ((frameSize == 0) || (numTruncatedBytes > 0) || (frameSize > AGGREGATE_AU_SIZE_MAX)) {
+        if (frameSize > 0) fprintf(stderr, "%lld: AACAggregator - error - AU too large, dropped\n", current_timestamp());
+        if (isCurrentlyAwaitingData()) getNextAU();
+        return;
+    }
+
+    // It doesn't fit: send the AUs before it, it will start the next payload
+    if ((fNumAUs > 0) && (headerSectionSize(fNumAUs + 1) + fDataSize + frameSize > RTP_PAYLOAD_MAX_SIZE)) {
+        deliver(frameSize, presentationTime, durationInMicroseconds);
+        return;
+    }
+
+    if (fNumAUs == 0) {
+        fFirstPresentationTime = presentationTime;
+        fDuration = 0;
+        scheduleFlush();
+    }
+    fAUSize[fNumAUs++] = frameSize;
+    fDataSize += frameSize;
+    fDuration += durationInMicroseconds;
+
+    // The AU read before a timeout: the sink asks for the next packet when it has sent that one
+    if (!isCurrentlyAwaitingData()) return;
+
+    if (fNumAUs >= fMaxAUs) {
+        deliver(0, noTime, 0);
+    } else {
+        getNextAU();
+    }
+}
+
+// Send the AUs collected so far, carrySize bytes after them are the first AU of the next payload
+void AACAggregator::deliver(unsigned carrySize, struct timeval carryPresentationTime, unsigned carryDuration) {
+    unsigned headerSize = headerSectionSize(fNumAUs);
+    unsigned i;
+
+    if (headerSize + fDataSize > fMaxSize) {
+        // Can't happen with the sinks, their buffer holds a whole packet
+        fprintf(stderr, "%lld: AACAggregator - error - payload larger than the buffer of the sink\n", current_timestamp());
+        fNumTruncatedBytes = headerSize + fDataSize - fMaxSize;
+        fFrameSize = 0;
+    } else {
+        // AU-headers-length in bits, then size (13 bits) and index (3 bits, 0) of each AU
+        fTo[0] = (fNumAUs * 16) >> 8;
+        fTo[1] = (fNumAUs * 16) & 0xFF;
+        for (i = 0; i < fNumAUs; i++) {
+            fTo[2 + 2 * i] = fAUSize[i] >> 5;
+            fTo[3 + 2 * i] = (fAUSize[i] & 0x1F) << 3;
+        }
+        memcpy(fTo + headerSize, fAU, fDataSize);
+        fNumTruncatedBytes = 0;
+        fFrameSize = headerSize + fDataSize;
+    }
+    fPresentationTime = fFirstPresentationTime;
+    fDurationInMicroseconds = fDuration;
+
+    fPackets++;
+    fAUs += fNumAUs;
+    fAUBytes += fDataSize;
+    fHeaderBytes += headerSize;
+    if (debug) fprintf(stderr, "%lld: AACAggregator - %u AUs - %u bytes\n", current_timestamp(), fNumAUs, fFrameSize);
+
+    envir().taskScheduler().unscheduleDelayedTask(fFlushTask);
+    fFlushDue = False;
+    if (carrySize > 0) {
+        memmove(fAU, fAU + fDataSize, carrySize);
+        fAUSize[0] = carrySize;
+        fNumAUs = 1;
+        fDataSize = carrySize;
+        fPendingOffset = carrySize;
+        fFirstPresentationTime = carryPresentationTime;
+        fDuration = carryDuration;
+        scheduleFlush();
+    } else {
+        fNumAUs = 0;
+        fDataSize = 0;
+    }
+
+    FramedSource::afterGetting(this);
+}
+
+////////// AACAggregateRTPSink //////////
+
+AACAggregateRTPSink*
+AACAggregateRTPSink::createNew(UsageEnvironment& env, Groupsock* RTPgs,
+                               u_int8_t rtpPayloadFormat,
+                               u_int32_t rtpTimestampFrequency,
+                               char const* sdpMediaTypeString,
+                               char const* mpeg4Mode, char const* configString,
+                               unsigned numChannels) {
+    return new AACAggregateRTPSink(env, RTPgs, rtpPayloadFormat, rtpTimestampFrequency,
+                                   sdpMediaTypeString, mpeg4Mode, configString, numChannels);
+}
+
+AACAggregateRTPSink::AACAggregateRTPSink(UsageEnvironment& env, Groupsock* RTPgs,
+                                         u_int8_t rtpPayloadFormat,
+                                         u_int32_t rtpTimestampFrequency,
+                                         char const* sdpMediaTypeString,
+                                         char const* mpeg4Mode, char const* configString,
+                                         unsigned numChannels)
+    : MPEG4GenericRTPSink(env, RTPgs, rtpPayloadFormat, rtpTimestampFrequency,
+                          sdpMediaTypeString, mpeg4Mode, configString, numChannels) {
+}
+
+AACAggregateRTPSink::~AACAggregateRTPSink() {
+}
+
+void AACAggregateRTPSink::doSpecialFrameHandling(unsigned fragmentationOffset,
+                                                 unsigned char* frameStart,
+                                                 unsigned numBytesInFrame,
+                                                 struct timeval framePresentationTime,
+                                                 unsigned numRemainingBytes) {
+    // Set the marker bit on the last packet of the frame, as MPEG4GenericRTPSink
+    if (numRemainingBytes == 0) setMarkerBit();
+
+    // Important: Also call our base class's doSpecialFrameHandling(),
+    // to set the packet's timestamp:
+    MultiFramedRTPSink::doSpecialFrameHandling(fragmentationOffset,
+                                               frameStart, numBytesInFrame,
+                                               framePresentationTime,
+                                               numRemainingBytes);
+}
+
+unsigned AACAggregateRTPSink::specialHeaderSize() const {
+    // The AU header section is written by AACAggregator
+    return 0;
+}
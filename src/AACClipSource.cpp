@@ -0,0 +1,215 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// A fixed AAC clip, to feed the filters in the benches and the calibration of --adapt.
+// Implementation
+
+#include "AACClipSource.hh"
+#include "fdk-aac/aacenc_lib.h"
+
+#include <math.h>
+
+#define CLIP_FRAME_SAMPLES 1024
+
+static unsigned const clipSamplingFrequencyTable[16] = {
+    96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
+    16000, 12000, 11025, 8000, 7350, 0, 0, 0
+};
+
+AACClipSource*
+AACClipSource::createNew(UsageEnvironment& env, unsigned samplingFrequency,
+                         unsigned numChannels, unsigned bitrate, unsigned seconds) {
+    HANDLE_AACENCODER encoder;
+    AACENC_BufDesc inBuf, outBuf;
+    AACENC_InArgs inArgs;
+    AACENC_OutArgs outArgs;
+    AACENC_ERROR err;
+    INT_PCM pcm[CLIP_FRAME_SAMPLES * 2];
+    unsigned char au[CLIP_AU_SIZE_MAX];
+    void* inPtr = pcm;
+    void* outPtr = au;
+    INT inId = IN_AUDIO_DATA, inSize, inElSize = sizeof(INT_PCM);
+    INT outId = OUT_BITSTREAM_DATA, outSize = sizeof(au), outElSize = 1;
+    unsigned total = seconds * samplingFrequency;
+    unsigned n = 0, i, k;
+    unsigned noise = 12345;
+    double phase = 0.0, f0, env0, x;
+    AACClipSource* clip;
+
+    if ((numChannels < 1) || (numChannels > 2)) return NULL;
+    if (aacEncOpen(&encoder, 0, numChannels) != AACENC_OK) return NULL;
+    if ((aacEncoder_SetParam(encoder, AACENC_AOT, 2) != AACENC_OK) ||
+            (aacEncoder_SetParam(encoder, AACENC_SAMPLERATE, samplingFrequency) != AACENC_OK) ||
+            (aacEncoder_SetParam(encoder, AACENC_CHANNELMODE, (numChannels == 1) ? MODE_1 : MODE_2) != AACENC_OK) ||
+            (aacEncoder_SetParam(encoder, AACENC_CHANNELORDER, 1) != AACENC_OK) ||
+            (aacEncoder_SetParam(encoder, AACENC_TRANSMUX, TT_MP4_RAW) != AACENC_OK) ||
+            (aacEncoder_SetParam(encoder, AACENC_BITRATEMODE, 0) != AACENC_OK) ||
+            (aacEncoder_SetParam(encoder, AACENC_BITRATE, bitrate) != AACENC_OK) ||
+            (aacEncoder_SetParam(encoder, AACENC_AFTERBURNER, 1) != AACENC_OK) ||
+            (aacEncEncode(encoder, NULL, NULL, NULL, NULL) != AACENC_OK)) {
+        fprintf(stderr, "%lld: AACClipSource - error - couldn't configure the AAC encoder\n", current_timestamp());
+        aacEncClose(&encoder);
+        return NULL;
+    }
+
+    clip = new AACClipSource(env, samplingFrequency, numChannels);
+    inBuf.numBufs = 1;
+    inBuf.bufs = &inPtr;
+    inBuf.bufferIdentifiers = &inId;
+    inBuf.bufSizes = &inSize;
+    inBuf.bufElSizes = &inElSize;
+    outBuf.numBufs = 1;
+    outBuf.bufs = &outPtr;
+    outBuf.bufferIdentifiers = &outId;
+    outBuf.bufSizes = &outSize;
+    outBuf.bufElSizes = &outElSize;
+
+    for (;;) {
+        // A frame of the voice, then -1 to flush the look-ahead of the encoder
+        if (n < total) {
+            for (i = 0; i < CLIP_FRAME_SAMPLES; i++, n++) {
+                f0 = 120.0 + 100.0 * (0.5 + 0.5 * sin(2 * M_PI * 0.3 * n / samplingFrequency));
+                env0 = 0.5 + 0.5 * sin(2 * M_PI * 4.0 * n / samplingFrequency);
+                phase += 2 * M_PI * f0 / samplingFrequency;
+                x = 0.0;
+                for (k = 1; k <= 10; k++) x += sin(k * phase) / k;
+                noise = noise * 1103515245 + 12345;
+                x = 6000.0 * env0 * x + (double) ((int) (noise >> 16) % 600 - 300);
+                for (k = 0; k < numChannels; k++) pcm[i * numChannels + k] = (INT_PCM) x;
+            }
+            inArgs.numInSamples = CLIP_FRAME_SAMPLES * numChannels;
+        } else {
+            inArgs.numInSamples = -1;
+        }
+        inArgs.numAncBytes = 0;
+        inSize = CLIP_FRAME_SAMPLES * numChannels * sizeof(INT_PCM);
+        err = aacEncEncode(encoder, &inBuf, &outBuf, &inArgs, &outArgs);
+        if (err == AACENC_ENCODE_EOF) break;
+        if (err != AACENC_OK) {
+            fprintf(stderr, "%lld: AACClipSource - error - encoding failed: %x\n", current_timestamp(), err);
+            break;
+        }
+        if ((outArgs.numOutBytes > 0) && !clip->addAU(au, outArgs.numOutBytes)) break;
+    }
+    aacEncClose(&encoder);
+
+    if (clip->fNumFrames == 0) {
+        Medium::close(clip);
+        return NULL;
+    }
+    return clip;
+}
+
+AACClipSource*
+AACClipSource::createNew(UsageEnvironment& env, char const* fileName) {
+    unsigned char header[7], au[CLIP_AU_SIZE_MAX];
+    unsigned frameLength, headerSize;
+    AACClipSource* clip = NULL;
+    FILE* f = fopen(fileName, "rb");
+
+    if (f == NULL) {
+        fprintf(stderr, "%lld: AACClipSource - error - couldn't open %s\n", current_timestamp(), fileName);
+        return NULL;
+    }
+
+    // ADTS: the header of each frame gives its rate, channels and length
+    while (fread(header, 1, sizeof(header), f) == sizeof(header)) {
+        if ((header[0] != 0xFF) || ((header[1] & 0xF0) != 0xF0)) {
+            fprintf(stderr, "%lld: AACClipSource - error - %s is not an ADTS stream\n", current_timestamp(), fileName);
+            break;
+        }
+        headerSize = (header[1] & 0x01) ? 7 : 9;
+        frameLength = ((header[3] & 0x03) << 11) | (header[4] << 3) | (header[5] >> 5);
+        if ((frameLength <= headerSize) || (frameLength - headerSize > CLIP_AU_SIZE_MAX)) break;
+        if (clip == NULL) {
+            clip = new AACClipSource(env, clipSamplingFrequencyTable[(header[2] & 0x3C) >> 2],
+                                     ((header[2] & 0x01) << 2) | (header[3] >> 6));
+        }
+        // The CRC, if any, isn't part of the AU
+        if ((headerSize == 9) && (fread(au, 1, 2, f) != 2)) break;
+        if (fread(au, 1, frameLength - headerSize, f) != frameLength - headerSize) break;
+        if (!clip->addAU(au, frameLength - headerSize)) break;
+    }
+    fclose(f);
+
+    if ((clip != NULL) && ((clip->fNumFrames == 0) || (clip->fSamplingFrequency == 0))) {
+        Medium::close(clip);
+        return NULL;
+    }
+    return clip;
+}
+
+AACClipSource::AACClipSource(UsageEnvironment& env, unsigned samplingFrequency, unsigned numChannels)
+    : FramedSource(env), fSamplingFrequency(samplingFrequency), fNumChannels(numChannels),
+      fData(NULL), fOffset(NULL), fNumFrames(0), fMaxFrames(0), fBytes(0), fNext(0) {
+    gettimeofday(&fStart, NULL);
+}
+
+AACClipSource::~AACClipSource() {
+    free(fData);
+    free(fOffset);
+}
+
+Boolean AACClipSource::addAU(unsigned char const* data, unsigned size) {
+    unsigned char* newData;
+    unsigned* newOffset;
+
+    if (fNumFrames + 1 >= fMaxFrames) {
+        fMaxFrames = (fMaxFrames == 0) ? 256 : fMaxFrames * 2;
+        newData = (unsigned char*) realloc(fData, fMaxFrames * CLIP_AU_SIZE_MAX);
+        if (newData == NULL) return False;
+        fData = newData;
+        newOffset = (unsigned*) realloc(fOffset, (fMaxFrames + 1) * sizeof(unsigned));
+        if (newOffset == NULL) return False;
+        fOffset = newOffset;
+        if (fNumFrames == 0) fOffset[0] = 0;
+    }
+    memcpy(fData + fOffset[fNumFrames], data, size);
+    fOffset[fNumFrames + 1] = fOffset[fNumFrames] + size;
+    fNumFrames++;
+    fBytes += size;
+
+    return True;
+}
+
+void AACClipSource::doGetNextFrame() {
+    unsigned uSecsPerFrame = CLIP_FRAME_SAMPLES * 1000000LL / fSamplingFrequency;
+    long long uSeconds;
+    unsigned size;
+
+    if (fNext >= fNumFrames) {
+        handleClosure();
+        return;
+    }
+
+    size = fOffset[fNext + 1] - fOffset[fNext];
+    if (size > fMaxSize) {
+        fNumTruncatedBytes = size - fMaxSize;
+        size = fMaxSize;
+    } else {
+        fNumTruncatedBytes = 0;
+    }
+    memcpy(fTo, fData + fOffset[fNext], size);
+    fFrameSize = size;
+    uSeconds = fStart.tv_usec + (long long) fNext * uSecsPerFrame;
+    fPresentationTime.tv_sec = fStart.tv_sec + uSeconds / 1000000;
+    fPresentationTime.tv_usec = uSeconds % 1000000;
+    fDurationInMicroseconds = uSecsPerFrame;
+    fNext++;
+
+    FramedSource::afterGetting(this);
+}
@@ -0,0 +1,244 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// RFC 3640 de-interleaving: the AAC access units put back in order, with a latency bound.
+// Implementation
+
+#include "AACDeinterleaver.hh"
+
+extern int debug;
+
+AACDeinterleaver*
+AACDeinterleaver::createNew(UsageEnvironment& env, RTPSource* inputSource,
+                            unsigned samplingFrequency, unsigned maxLatencyMs) {
+    unsigned uSecsPerAU = (DEINTERLEAVE_SAMPLES_PER_AU * 1000000) / samplingFrequency;
+    unsigned window = (maxLatencyMs * 1000) / uSecsPerAU;
+
+    if (window < 1) window = 1;
+    if (window > DEINTERLEAVE_AUS_MAX) window = DEINTERLEAVE_AUS_MAX;
+
+    return new AACDeinterleaver(env, inputSource, samplingFrequency, window);
+}
+
+AACDeinterleaver::AACDeinterleaver(UsageEnvironment& env, RTPSource* inputSource,
+                                   unsigned samplingFrequency, unsigned window)
+    : FramedFilter(env, inputSource), fRTPSource(inputSource), fSamplingFrequency(samplingFrequency),
+      fWindow(window), fPendingHead(0), fPendingCount(0), fHead(0), fPlaced(0),
+      fHaveTimestamp(False), fDraining(False), fNextTimestamp(0),
+      fAUs(0), fConcealedAUs(0), fLateAUs(0), fGap(0), fSingleGaps(0), fLongGaps(0) {
+    unsigned i;
+
+    for (i = 0; i < DEINTERLEAVE_AUS_MAX; i++) fSlot[i].present = False;
+    fNextPresentationTime.tv_sec = 0;
+    fNextPresentationTime.tv_usec = 0;
+}
+
+AACDeinterleaver::~AACDeinterleaver() {
+}
+
+void AACDeinterleaver::doGetNextFrame() {
+    while (True) {
+        // The next AU is here
+        if (fHaveTimestamp && fSlot[fHead].present) {
+            deliver(True);
+            return;
+        }
+
+        // After a restart of the streamer the AUs placed are delivered, the missing ones skipped
+        if (fDraining) {
+            if (fPlaced > 0) {
+                fHead = (fHead + 1) % DEINTERLEAVE_AUS_MAX;
+                fNextTimestamp += DEINTERLEAVE_SAMPLES_PER_AU;
+            } else {
+                fDraining = False;
+                fHaveTimestamp = False;
+            }
+            continue;
+        }
+
+        // The AUs of the last payload, the ones beyond the window give up the missing AU
+        if (fPendingCount > 0) {
+            if (place()) continue;
+            deliver(False);
+            return;
+        }
+
+        fInputSource->getNextFrame(fPayload, sizeof(fPayload),
+                                   afterGettingFrame, this,
+                                   FramedSource::handleClosure, this);
+        return;
+    }
+}
+
+void AACDeinterleaver::afterGettingFrame(void* clientData, unsigned frameSize,
+                                         unsigned numTruncatedBytes,
+                                         struct timeval presentationTime,
+                                         unsigned /*durationInMicroseconds*/) {
+    AACDeinterleaver* deinterleaver = (AACDeinterleaver*) clientData;
+    deinterleaver->afterGettingFrame1(frameSize, numTruncatedBytes, presentationTime);
+}
+
+// AU header section: AU-headers-length in bits, then 16 bits for each AU,
+// size (13 bits) and AU-Index of the first AU or AU-Index-delta (3 bits)
+void AACDeinterleaver::afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                                          struct timeval presentationTime) {
+    u_int32_t timestamp = fRTPSource->curPacketRTPTimestamp();
+    u_int32_t auTimestamp = timestamp;
+    unsigned headersBits, numAUs, pos, size, index, i, slot;
+    long long uSeconds;
+
+    if ((numTruncatedBytes > 0) || (frameSize < 2)) {
+        fprintf(stderr, "AACDeinterleaver - bad payload size, dropped\n");
+        doGetNextFrame();
+        return;
+    }
+    headersBits = (fPayload[0] << 8) | fPayload[1];
+    numAUs = headersBits / 16;
+    pos = 2 + headersBits / 8;
+    if ((headersBits % 16 != 0) || (numAUs > DEINTERLEAVE_AUS_MAX) || (pos > frameSize)) {
+        fprintf(stderr, "AACDeinterleaver - bad AU header section, payload dropped\n");
+        doGetNextFrame();
+        return;
+    }
+
+    for (i = 0; i < numAUs; i++) {
+        size = (fPayload[2 + 2 * i] << 5) | (fPayload[3 + 2 * i] >> 3);
+        index = fPayload[3 + 2 * i] & 0x07;
+        if (pos + size > frameSize) break;
+        auTimestamp += ((i == 0) ? index : index + 1) * DEINTERLEAVE_SAMPLES_PER_AU;
+
+        slot = (fPendingHead + fPendingCount) % DEINTERLEAVE_AUS_MAX;
+        fPending[slot].data = fPayload + pos;
+        fPending[slot].size = size;
+        fPending[slot].timestamp = auTimestamp;
+        uSeconds = presentationTime.tv_sec * 1000000LL + presentationTime.tv_usec +
+                (long long) (u_int32_t) (auTimestamp - timestamp) * 1000000 / fSamplingFrequency;
+        fPending[slot].presentationTime.tv_sec = uSeconds / 1000000;
+        fPending[slot].presentationTime.tv_usec = uSeconds % 1000000;
+        fPendingCount++;
+        pos += size;
+    }
+
+    doGetNextFrame();
+}
+
+// Place the next pending AU in its slot
+// Return False if it is beyond the window: the missing AU in fHead must be given up first
+Boolean AACDeinterleaver::place() {
+    unsigned restartAUs = (10 * fSamplingFrequency) / DEINTERLEAVE_SAMPLES_PER_AU;
+    unsigned i;
+    int offset, slot;
+
+    if (!fHaveTimestamp) {
+        for (i = 0; i < DEINTERLEAVE_AUS_MAX; i++) fSlot[i].present = False;
+        fHead = 0;
+        fPlaced = 0;
+        fNextTimestamp = fPending[fPendingHead].timestamp;
+        fNextPresentationTime = fPending[fPendingHead].presentationTime;
+        fHaveTimestamp = True;
+    }
+
+    // AUs from the start of the window, rounded: the timestamps of the streamer may jitter a bit
+    offset = (int) (fPending[fPendingHead].timestamp - fNextTimestamp);
+    if (offset >= 0) {
+        slot = (offset + DEINTERLEAVE_SAMPLES_PER_AU / 2) / DEINTERLEAVE_SAMPLES_PER_AU;
+    } else {
+        slot = -((-offset + DEINTERLEAVE_SAMPLES_PER_AU / 2) / DEINTERLEAVE_SAMPLES_PER_AU);
+    }
+
+    // More than 10 s away: the streamer restarted, start again from this AU
+    if ((slot > (int) restartAUs) || (slot < -((int) restartAUs))) {
+        if (fPlaced > 0) {
+            fDraining = True;
+        } else {
+            fHaveTimestamp = False;
+        }
+        return True;
+    }
+
+    if (slot < 0) {
+        // Too late, it was concealed
+        fLateAUs++;
+    } else if ((unsigned) slot >= fWindow) {
+        if (fPlaced > 0) return False;
+        // Nothing to wait for: the gap is longer than the window, start again from this AU
+        if (debug) fprintf(stderr, "AACDeinterleaver - %d AUs missing, not concealed\n", slot);
+        fLongGaps++;
+        fHaveTimestamp = False;
+        return True;
+    } else {
+        i = (fHead + slot) % DEINTERLEAVE_AUS_MAX;
+        // Duplicated packets, and the AUs dropped by the streamer (size 0) are left out
+        if (!fSlot[i].present && (fPending[fPendingHead].size > 0) &&
+                (fPending[fPendingHead].size <= DEINTERLEAVE_AU_SIZE_MAX)) {
+            memcpy(fSlot[i].data, fPending[fPendingHead].data, fPending[fPendingHead].size);
+            fSlot[i].size = fPending[fPendingHead].size;
+            fSlot[i].presentationTime = fPending[fPendingHead].presentationTime;
+            fSlot[i].present = True;
+            fPlaced++;
+            fAUs++;
+        }
+    }
+
+    fPendingHead = (fPendingHead + 1) % DEINTERLEAVE_AUS_MAX;
+    fPendingCount--;
+    return True;
+}
+
+// Deliver the AU in fHead, or an empty frame if it is missing
+void AACDeinterleaver::deliver(Boolean present) {
+    unsigned uSecsPerAU = (DEINTERLEAVE_SAMPLES_PER_AU * 1000000) / fSamplingFrequency;
+    unsigned size, uSeconds;
+
+    if (present) {
+        size = fSlot[fHead].size;
+        if (size > fMaxSize) {
+            fNumTruncatedBytes = size - fMaxSize;
+            size = fMaxSize;
+        } else {
+            fNumTruncatedBytes = 0;
+        }
+        memcpy(fTo, fSlot[fHead].data, size);
+        fFrameSize = size;
+        fPresentationTime = fSlot[fHead].presentationTime;
+        fSlot[fHead].present = False;
+        fPlaced--;
+
+        if (fGap == 1) {
+            fSingleGaps++;
+        } else if (fGap > 1) {
+            fLongGaps++;
+        }
+        fGap = 0;
+    } else {
+        fFrameSize = 0;
+        fNumTruncatedBytes = 0;
+        fPresentationTime = fNextPresentationTime;
+        fConcealedAUs++;
+        fGap++;
+        if (debug) fprintf(stderr, "AACDeinterleaver - AU missing, concealed\n");
+    }
+    fDurationInMicroseconds = uSecsPerAU;
+
+    uSeconds = fPresentationTime.tv_usec + uSecsPerAU;
+    fNextPresentationTime.tv_sec = fPresentationTime.tv_sec + uSeconds / 1000000;
+    fNextPresentationTime.tv_usec = uSeconds % 1000000;
+    fHead = (fHead + 1) % DEINTERLEAVE_AUS_MAX;
+    fNextTimestamp += DEINTERLEAVE_SAMPLES_PER_AU;
+
+    FramedSource::afterGetting(this);
+}
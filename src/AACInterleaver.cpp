@@ -0,0 +1,203 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// RFC 3640 interleaving: the AAC access units of a group spread over its packets.
+// Implementation
+
+#include "rAudioStreamerReceiver.h"
+#include "AACInterleaver.hh"
+
+#include <stdlib.h>
+
+extern int debug;
+
+AACInterleaver*
+AACInterleaver::createNew(UsageEnvironment& env, FramedSource* inputSource,
+                          unsigned samplingFrequency, unsigned packets,
+                          unsigned framesPerPacket) {
+    if (packets < 1) packets = 1;
+    if (packets > INTERLEAVE_PACKETS_MAX) packets = INTERLEAVE_PACKETS_MAX;
+    if (framesPerPacket < 1) framesPerPacket = 1;
+    if (framesPerPacket > INTERLEAVE_FRAMES_MAX) framesPerPacket = INTERLEAVE_FRAMES_MAX;
+
+    return new AACInterleaver(env, inputSource, samplingFrequency, packets, framesPerPacket);
+}
+
+AACInterleaver::AACInterleaver(UsageEnvironment& env, FramedSource* inputSource,
+                               unsigned samplingFrequency, unsigned packets, unsigned framesPerPacket)
+    : FramedFilter(env, inputSource), fSamplingFrequency(samplingFrequency),
+      fGroupPackets(packets), fPacketAUs(framesPerPacket), fGroupAUs(packets * framesPerPacket),
+      fFill(0), fFillAUs(0), fNextPacket(packets), fReadSincePacket(0), fHaveTime(False), fNextGroupTime(0),
+      fPackets(0), fAUs(0), fHeaderBytes(0), fDroppedAUs(0) {
+    unsigned s, inverse, distance;
+
+    fGroup[0].dataSize = 0;
+    fGroup[1].dataSize = 0;
+
+    // Packets p and p + 1 are sent inverse positions apart, s * inverse = 1
+    // modulo packets: choose the stride that keeps them farthest apart
+    fStride = 1;
+    fBurstPackets = 1;
+    for (s = 2; s < packets; s++) {
+        for (inverse = 1; inverse < packets; inverse++) {
+            if ((s * inverse) % packets == 1) break;
+        }
+        if (inverse == packets) continue;
+        distance = (inverse < packets - inverse) ? inverse : packets - inverse;
+        if (distance > fBurstPackets) {
+            fStride = s;
+            fBurstPackets = distance;
+        }
+    }
+}
+
+AACInterleaver::~AACInterleaver() {
+}
+
+// A group is collected before its first packet is sent
+unsigned AACInterleaver::latencyMs() const {
+    return (unsigned) (auTime(fGroupAUs) / 1000);
+}
+
+// Offset of the AU index of a group from its first AU (us)
+long long AACInterleaver::auTime(unsigned index) const {
+    return (long long) index * 1024/*samples-per-frame*/ * 1000000 / fSamplingFrequency;
+}
+
+void AACInterleaver::doGetNextFrame() {
+    // The group collected is complete: send it while the next one is collected
+    if ((fFillAUs == fGroupAUs) && (fNextPacket == fGroupPackets)) {
+        fFill ^= 1;
+        fFillAUs = 0;
+        fGroup[fFill].dataSize = 0;
+        fNextPacket = 0;
+        fReadSincePacket = fPacketAUs;
+    }
+
+    // One packet every fPacketAUs AUs read, the same rate as the source
+    if ((fNextPacket < fGroupPackets) && ((fReadSincePacket >= fPacketAUs) || (fFillAUs == fGroupAUs))) {
+        deliver();
+        return;
+    }
+
+    fInputSource->getNextFrame(fGroup[fFill].data + fGroup[fFill].dataSize,
+                               sizeof(fGroup[fFill].data) - fGroup[fFill].dataSize,
+                               afterGettingFrame, this,
+                               FramedSource::handleClosure, this);
+}
+
+void AACInterleaver::afterGettingFrame(void* clientData, unsigned frameSize,
+                                       unsigned numTruncatedBytes,
+                                       struct timeval presentationTime,
+                                       unsigned /*durationInMicroseconds*/) {
+    AACInterleaver* interleaver = (AACInterleaver*) clientData;
+    interleaver->afterGettingFrame1(frameSize, numTruncatedBytes, presentationTime);
+}
+
+void AACInterleaver::afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                                        struct timeval presentationTime) {
+    long long t = presentationTime.tv_sec * 1000000LL + presentationTime.tv_usec;
+    long long uSecsPerAU = auTime(1);
+    unsigned size = frameSize;
+
+    // Empty frame (the source is starting)
+    if ((frameSize == 0) && (numTruncatedBytes == 0)) {
+        doGetNextFrame();
+        return;
+    }
+
+    // The receiver derives the time of each AU from the first one of the
+    // packet: the group follows its own clock, set again by the source only
+    // when they differ by more than a quarter of AU (minute resync, drift)
+    if (fFillAUs == 0) {
+        if (!fHaveTime || (llabs(t - fNextGroupTime) > uSecsPerAU / 4)) {
+            fGroup[fFill].time = t;
+        } else {
+            fGroup[fFill].time = fNextGroupTime;
+        }
+        fHaveTime = True;
+    } else if (llabs(t - fGroup[fFill].time - auTime(fFillAUs)) > uSecsPerAU / 2) {
+        // A gap in the stream (pause of the capture, frames dropped): the
+        // AUs collected can't be described any more, start a new group
+        if (debug) fprintf(stderr, "%lld: AACInterleaver - gap in the stream, %u AUs dropped\n", current_timestamp(), fFillAUs);
+        fDroppedAUs += fFillAUs;
+        if (numTruncatedBytes == 0) memmove(fGroup[fFill].data, fGroup[fFill].data + fGroup[fFill].dataSize, frameSize);
+        fGroup[fFill].dataSize = 0;
+        fGroup[fFill].time = t;
+        fFillAUs = 0;
+    }
+
+    // An AU that doesn't fit keeps its place with size 0, the receiver conceals it
+    if ((numTruncatedBytes > 0) || (frameSize > INTERLEAVE_AU_SIZE_MAX)) {
+        fprintf(stderr, "%lld: AACInterleaver - error - AU too large, dropped\n", current_timestamp());
+        fDroppedAUs++;
+        size = 0;
+    }
+    fGroup[fFill].offset[fFillAUs] = fGroup[fFill].dataSize;
+    fGroup[fFill].size[fFillAUs] = size;
+    fGroup[fFill].dataSize += size;
+    fFillAUs++;
+    fReadSincePacket++;
+    if (fFillAUs == fGroupAUs) fNextGroupTime = fGroup[fFill].time + auTime(fGroupAUs);
+
+    doGetNextFrame();
+}
+
+// Send the next packet of the complete group
+void AACInterleaver::deliver() {
+    unsigned sent = fFill ^ 1;
+    unsigned maxSize = (fMaxSize < RTP_PAYLOAD_MAX_SIZE) ? fMaxSize : RTP_PAYLOAD_MAX_SIZE;
+    unsigned headerSize = 2 + 2 * fPacketAUs;
+    unsigned packet = (fNextPacket * fStride) % fGroupPackets;
+    unsigned dataSize = 0, size, i, k;
+    unsigned char* to = fTo + headerSize;
+    long long t = fGroup[sent].time + auTime(packet);
+
+    // AU-headers-length in bits, then size (13 bits) and AU-Index / AU-Index-delta (3 bits)
+    fTo[0] = (fPacketAUs * 16) >> 8;
+    fTo[1] = (fPacketAUs * 16) & 0xFF;
+    for (k = 0; k < fPacketAUs; k++) {
+        i = packet + k * fGroupPackets;
+        size = fGroup[sent].size[i];
+        if (headerSize + dataSize + size > maxSize) {
+            fprintf(stderr, "%lld: AACInterleaver - error - payload too large, AU dropped\n", current_timestamp());
+            fDroppedAUs++;
+            size = 0;
+        }
+        fTo[2 + 2 * k] = size >> 5;
+        fTo[3 + 2 * k] = ((size & 0x1F) << 3) | ((k > 0) ? fGroupPackets - 1 : 0);
+        memcpy(to, fGroup[sent].data + fGroup[sent].offset[i], size);
+        to += size;
+        dataSize += size;
+    }
+
+    fFrameSize = headerSize + dataSize;
+    fNumTruncatedBytes = 0;
+    fPresentationTime.tv_sec = t / 1000000;
+    fPresentationTime.tv_usec = t % 1000000;
+    fDurationInMicroseconds = (unsigned) auTime(fPacketAUs);
+
+    fPackets++;
+    fAUs += fPacketAUs;
+    fHeaderBytes += headerSize;
+    if (debug) fprintf(stderr, "%lld: AACInterleaver - packet %u/%u - %u bytes\n", current_timestamp(), packet + 1, fGroupPackets, fFrameSize);
+
+    fNextPacket++;
+    fReadSincePacket = 0;
+
+    FramedSource::afterGetting(this);
+}
@@ -0,0 +1,142 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// RFC 2198 redundancy: the previous AAC access units sent again in each RTP packet.
+// Implementation
+
+#include "rAudioStreamerReceiver.h"
+#include "AACRedundancy.hh"
+
+extern int debug;
+
+// AU header section of a block with one AU, then the AU
+static unsigned char* writeBlock(unsigned char* to, unsigned char const* au, unsigned auSize) {
+    to[0] = 0;
+    to[1] = 16;
+    to[2] = auSize >> 5;
+    to[3] = (auSize & 0x1F) << 3;
+    memcpy(to + 4, au, auSize);
+
+    return to + 4 + auSize;
+}
+
+AACRedundancy*
+AACRedundancy::createNew(UsageEnvironment& env, FramedSource* inputSource,
+                         unsigned samplingFrequency, unsigned depth,
+                         u_int8_t blockPayloadFormat) {
+    if (depth > RED_DEPTH_MAX) depth = RED_DEPTH_MAX;
+
+    return new AACRedundancy(env, inputSource, samplingFrequency, depth, blockPayloadFormat);
+}
+
+AACRedundancy::AACRedundancy(UsageEnvironment& env, FramedSource* inputSource,
+                             unsigned samplingFrequency, unsigned depth, u_int8_t blockPayloadFormat)
+    : FramedFilter(env, inputSource), fSamplingFrequency(samplingFrequency), fDepth(depth),
+      fBlockPayloadFormat(blockPayloadFormat), fHead(0), fCount(0),
+      fPackets(0), fPrimaryBytes(0), fRedundantBytes(0), fRedundantBlocks(0) {
+}
+
+AACRedundancy::~AACRedundancy() {
+}
+
+void AACRedundancy::doGetNextFrame() {
+    fInputSource->getNextFrame(fAU[fHead], sizeof(fAU[fHead]),
+                               afterGettingFrame, this,
+                               FramedSource::handleClosure, this);
+}
+
+void AACRedundancy::afterGettingFrame(void* clientData, unsigned frameSize,
+                                      unsigned numTruncatedBytes,
+                                      struct timeval presentationTime,
+                                      unsigned durationInMicroseconds) {
+    AACRedundancy* redundancy = (AACRedundancy*) clientData;
+    redundancy->afterGettingFrame1(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
+}
+
+// Same conversion as RTPSink::convertToRTPTimestamp(), without the random base:
+// the difference of two of them is the offset of the RTP timestamps
+u_int32_t AACRedundancy::rtpTimestamp(struct timeval const& presentationTime) const {
+    u_int32_t timestamp = fSamplingFrequency * presentationTime.tv_sec;
+
+    timestamp += (u_int32_t) (fSamplingFrequency * (presentationTime.tv_usec / 1000000.0) + 0.5);
+    return timestamp;
+}
+
+void AACRedundancy::afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                                       struct timeval presentationTime,
+                                       unsigned durationInMicroseconds) {
+    unsigned slots = fDepth + 1;
+    unsigned maxSize = (fMaxSize < RTP_PAYLOAD_MAX_SIZE) ? fMaxSize : RTP_PAYLOAD_MAX_SIZE;
+    unsigned block[RED_DEPTH_MAX], offset[RED_DEPTH_MAX];
+    unsigned numBlocks = 0, payloadSize, blockSize, slot, k;
+    u_int32_t timestamp = rtpTimestamp(presentationTime);
+    unsigned char* to = fTo;
+
+    // Empty frame (the source is starting) or an AU that doesn't fit in a packet
+    if ((frameSize == 0) || (numTruncatedBytes > 0) || (1 + 4 + frameSize > maxSize)) {
+        if (frameSize > 0) fprintf(stderr, "%lld: AACRedundancy - error - AU too large, dropped\n", current_timestamp());
+        doGetNextFrame();
+        return;
+    }
+    fAUSize[fHead] = frameSize;
+    fAUTime[fHead] = presentationTime;
+
+    // Choose the redundant blocks from the newest: the oldest are left out first
+    payloadSize = 1 + 4 + frameSize;
+    for (k = 1; k <= fCount; k++) {
+        slot = (fHead + slots - k) % slots;
+        blockSize = 4 + fAUSize[slot];
+        offset[numBlocks] = timestamp - rtpTimestamp(fAUTime[slot]);
+        // After a pause of the capture the previous AUs are too old to be useful
+        if ((offset[numBlocks] == 0) || (offset[numBlocks] > RED_OFFSET_MAX)) break;
+        if ((blockSize > RED_BLOCK_SIZE_MAX) || (payloadSize + 4 + blockSize > maxSize)) break;
+        block[numBlocks++] = slot;
+        payloadSize += 4 + blockSize;
+    }
+
+    // Block headers: F, block PT, timestamp offset (14 bits), block length (10 bits)
+    for (k = numBlocks; k-- > 0;) {
+        blockSize = 4 + fAUSize[block[k]];
+        to[0] = 0x80 | fBlockPayloadFormat;
+        to[1] = offset[k] >> 6;
+        to[2] = ((offset[k] & 0x3F) << 2) | (blockSize >> 8);
+        to[3] = blockSize & 0xFF;
+        to += 4;
+    }
+    // Header of the primary block: F = 0 and PT only
+    *to++ = fBlockPayloadFormat;
+    for (k = numBlocks; k-- > 0;) {
+        to = writeBlock(to, fAU[block[k]], fAUSize[block[k]]);
+        fRedundantBytes += 4 + 4 + fAUSize[block[k]];
+    }
+    to = writeBlock(to, fAU[fHead], frameSize);
+
+    fFrameSize = to - fTo;
+    fNumTruncatedBytes = 0;
+    fPresentationTime = presentationTime;
+    fDurationInMicroseconds = durationInMicroseconds;
+
+    fPackets++;
+    fPrimaryBytes += 1 + 4 + frameSize;
+    fRedundantBlocks += numBlocks;
+    if (debug) fprintf(stderr, "%lld: AACRedundancy - %u redundant blocks - %u bytes\n", current_timestamp(), numBlocks, fFrameSize);
+
+    fHead = (fHead + 1) % slots;
+    if (fCount < fDepth) fCount++;
+
+    FramedSource::afterGetting(this);
+}
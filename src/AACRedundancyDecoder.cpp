@@ -0,0 +1,204 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// RFC 2198 redundancy: rebuild the lost AAC access units from the redundant blocks.
+// Implementation
+
+#include "AACRedundancyDecoder.hh"
+
+extern int debug;
+
+AACRedundancyDecoder*
+AACRedundancyDecoder::createNew(UsageEnvironment& env, RTPSource* inputSource,
+                                unsigned samplingFrequency, u_int8_t blockPayloadFormat) {
+    return new AACRedundancyDecoder(env, inputSource, samplingFrequency, blockPayloadFormat);
+}
+
+AACRedundancyDecoder::AACRedundancyDecoder(UsageEnvironment& env, RTPSource* inputSource,
+                                           unsigned samplingFrequency, u_int8_t blockPayloadFormat)
+    : FramedFilter(env, inputSource), fRTPSource(inputSource), fSamplingFrequency(samplingFrequency),
+      fBlockPayloadFormat(blockPayloadFormat), fQueueHead(0), fQueueCount(0), fHaveTimestamp(False),
+      fLastTimestamp(0), fPayloads(0), fPrimaryAUs(0), fRecoveredAUs(0), fLostAUs(0),
+      fBytes(0), fRedundantBytes(0) {
+}
+
+AACRedundancyDecoder::~AACRedundancyDecoder() {
+}
+
+void AACRedundancyDecoder::doGetNextFrame() {
+    // The AUs of the last payload first, they point to fPayload
+    if (fQueueCount > 0) {
+        deliver();
+        return;
+    }
+
+    fInputSource->getNextFrame(fPayload, sizeof(fPayload),
+                               afterGettingFrame, this,
+                               FramedSource::handleClosure, this);
+}
+
+void AACRedundancyDecoder::afterGettingFrame(void* clientData, unsigned frameSize,
+                                             unsigned numTruncatedBytes,
+                                             struct timeval presentationTime,
+                                             unsigned /*durationInMicroseconds*/) {
+    AACRedundancyDecoder* decoder = (AACRedundancyDecoder*) clientData;
+    decoder->afterGettingFrame1(frameSize, numTruncatedBytes, presentationTime);
+}
+
+// Queue the AUs of a MPEG4-GENERIC payload (AU-headers-length, 16 bits AU headers, AUs)
+// Return the number of AUs queued
+unsigned AACRedundancyDecoder::queueBlock(unsigned char* block, unsigned blockSize, struct timeval presentationTime) {
+    unsigned headersSize, numAUs, auSize, pos, i, slot, queued = 0;
+    unsigned uSecsPerAU = (RED_SAMPLES_PER_AU * 1000000) / fSamplingFrequency;
+
+    if (blockSize < 2) return 0;
+    headersSize = ((block[0] << 8) | block[1]) / 8;
+    numAUs = headersSize / 2;
+    pos = 2 + headersSize;
+    if (pos > blockSize) return 0;
+
+    for (i = 0; i < numAUs; i++) {
+        auSize = (block[2 + 2 * i] << 5) | (block[3 + 2 * i] >> 3);
+        if ((pos + auSize > blockSize) || (fQueueCount == RED_QUEUE_MAX)) break;
+
+        slot = (fQueueHead + fQueueCount) % RED_QUEUE_MAX;
+        fQueue[slot].data = block + pos;
+        fQueue[slot].size = auSize;
+        fQueue[slot].presentationTime = presentationTime;
+        fQueueCount++;
+        queued++;
+
+        pos += auSize;
+        presentationTime.tv_usec += uSecsPerAU;
+        presentationTime.tv_sec += presentationTime.tv_usec / 1000000;
+        presentationTime.tv_usec %= 1000000;
+    }
+
+    return queued;
+}
+
+void AACRedundancyDecoder::afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                                              struct timeval presentationTime) {
+    unsigned char* block[RED_QUEUE_MAX];
+    unsigned blockSize[RED_QUEUE_MAX], offset[RED_QUEUE_MAX];
+    u_int8_t blockPT[RED_QUEUE_MAX];
+    unsigned numBlocks = 0, recovered = 0, redundantSize = 0, primary, missing, k;
+    unsigned char* p = fPayload;
+    unsigned char* end = fPayload + frameSize;
+    u_int32_t timestamp = fRTPSource->curPacketRTPTimestamp();
+    int delta = (int) (timestamp - fLastTimestamp);
+    long long uSeconds;
+    struct timeval blockTime;
+
+    if (numTruncatedBytes > 0) {
+        fprintf(stderr, "AACRedundancyDecoder - payload too large, dropped\n");
+        doGetNextFrame();
+        return;
+    }
+
+    // Block headers, then the blocks in the same order
+    while ((p < end) && (*p & 0x80)) {
+        if ((p + 4 > end) || (numBlocks == RED_QUEUE_MAX)) {
+            fprintf(stderr, "AACRedundancyDecoder - bad RFC 2198 header, payload dropped\n");
+            doGetNextFrame();
+            return;
+        }
+        blockPT[numBlocks] = p[0] & 0x7F;
+        offset[numBlocks] = (p[1] << 6) | (p[2] >> 2);
+        blockSize[numBlocks] = ((p[2] & 0x03) << 8) | p[3];
+        numBlocks++;
+        p += 4;
+    }
+    if (p >= end) {
+        fprintf(stderr, "AACRedundancyDecoder - payload without primary block, dropped\n");
+        doGetNextFrame();
+        return;
+    }
+    p++;
+    for (k = 0; k < numBlocks; k++) {
+        block[k] = p;
+        p += blockSize[k];
+        redundantSize += blockSize[k];
+    }
+    if (p > end) {
+        fprintf(stderr, "AACRedundancyDecoder - truncated redundant blocks, payload dropped\n");
+        doGetNextFrame();
+        return;
+    }
+    // A late or duplicated packet: its AUs were delivered or replaced by silence
+    if (fHaveTimestamp && (delta <= 0) && (delta > -10 * (int) fSamplingFrequency)) {
+        if (debug) fprintf(stderr, "AACRedundancyDecoder - late packet, dropped\n");
+        doGetNextFrame();
+        return;
+    }
+    // A timestamp far from the last one: the streamer restarted
+    if (fHaveTimestamp && ((delta <= 0) || ((unsigned) delta > 10 * fSamplingFrequency))) fHaveTimestamp = False;
+
+    fPayloads++;
+    fBytes += frameSize;
+    // Everything but the primary block is the cost of the redundancy
+    fRedundantBytes += 4 * numBlocks + 1 + redundantSize;
+
+    // The redundant blocks newer than the last AU delivered replace the lost packets
+    if (fHaveTimestamp) {
+        for (k = 0; k < numBlocks; k++) {
+            if ((blockPT[k] != fBlockPayloadFormat) || ((int) (timestamp - offset[k] - fLastTimestamp) <= 0)) continue;
+            uSeconds = presentationTime.tv_sec * 1000000LL + presentationTime.tv_usec -
+                    (long long) offset[k] * 1000000 / fSamplingFrequency;
+            blockTime.tv_sec = uSeconds / 1000000;
+            blockTime.tv_usec = uSeconds % 1000000;
+            recovered += queueBlock(block[k], blockSize[k], blockTime);
+        }
+    }
+    primary = queueBlock(p, end - p, presentationTime);
+
+    if (fHaveTimestamp) {
+        missing = (delta + RED_SAMPLES_PER_AU / 2) / RED_SAMPLES_PER_AU;
+        missing = (missing > 1) ? missing - 1 : 0;
+        if (missing > recovered) fLostAUs += missing - recovered;
+        if (debug && (missing > 0)) fprintf(stderr, "AACRedundancyDecoder - %u AUs missing - %u recovered\n", missing, recovered);
+    }
+    fPrimaryAUs += primary;
+    fRecoveredAUs += recovered;
+    fLastTimestamp = timestamp;
+    fHaveTimestamp = True;
+
+    if (fQueueCount == 0) {
+        doGetNextFrame();
+        return;
+    }
+    deliver();
+}
+
+void AACRedundancyDecoder::deliver() {
+    unsigned size = fQueue[fQueueHead].size;
+
+    if (size > fMaxSize) {
+        fNumTruncatedBytes = size - fMaxSize;
+        size = fMaxSize;
+    } else {
+        fNumTruncatedBytes = 0;
+    }
+    memcpy(fTo, fQueue[fQueueHead].data, size);
+    fFrameSize = size;
+    fPresentationTime = fQueue[fQueueHead].presentationTime;
+    fDurationInMicroseconds = (RED_SAMPLES_PER_AU * 1000000) / fSamplingFrequency;
+    fQueueHead = (fQueueHead + 1) % RED_QUEUE_MAX;
+    fQueueCount--;
+
+    FramedSource::afterGetting(this);
+}
@@ -0,0 +1,378 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// Re-encoder of the AAC access units at a bitrate that can be changed while streaming.
+// Implementation
+
+#include "AACTranscoder.hh"
+
+#include <time.h>
+
+extern int debug;
+
+static long long transcode_thread_time() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+AACTranscoder*
+AACTranscoder::createNew(UsageEnvironment& env, FramedSource* inputSource,
+                         unsigned samplingFrequency, unsigned numChannels, unsigned bitrate) {
+    HANDLE_AACDECODER decoder;
+    HANDLE_AACENCODER encoder;
+    unsigned config[2];
+    char configStr[5];
+    UCHAR audioSpecificConfig[2];
+    UCHAR* conf = audioSpecificConfig;
+    UINT confSize = 2;
+    unsigned delayUs;
+
+    if ((numChannels < 1) || (numChannels > 2)) {
+        fprintf(stderr, "%lld: AACTranscoder - error - %u channels, only mono and stereo are supported\n",
+                current_timestamp(), numChannels);
+        return NULL;
+    }
+
+    // Raw AUs: the decoder is configured with the AudioSpecificConfig of the SDP
+    decoder = aacDecoder_Open(TT_MP4_RAW, 1);
+    if (decoder == NULL) {
+        fprintf(stderr, "%lld: AACTranscoder - error - couldn't open the AAC decoder\n", current_timestamp());
+        return NULL;
+    }
+    getAACConfigStr(configStr, samplingFrequency, numChannels);
+    sscanf(configStr, "%2x%2x", &config[0], &config[1]);
+    audioSpecificConfig[0] = config[0];
+    audioSpecificConfig[1] = config[1];
+    if (aacDecoder_ConfigRaw(decoder, &conf, &confSize) != AAC_DEC_OK) {
+        fprintf(stderr, "%lld: AACTranscoder - error - couldn't configure the AAC decoder\n", current_timestamp());
+        aacDecoder_Close(decoder);
+        return NULL;
+    }
+
+    encoder = openEncoder(samplingFrequency, numChannels, bitrate, True, &delayUs);
+    if (encoder == NULL) {
+        aacDecoder_Close(decoder);
+        return NULL;
+    }
+
+    return new AACTranscoder(env, inputSource, decoder, encoder, samplingFrequency, numChannels, bitrate, delayUs);
+}
+
+// AAC-LC, CBR, raw AUs, with the AudioSpecificConfig of the SDP
+// Return NULL on failure
+HANDLE_AACENCODER AACTranscoder::openEncoder(unsigned samplingFrequency, unsigned numChannels,
+                                             unsigned bitrate, Boolean afterburner, unsigned* delayUs) {
+    HANDLE_AACENCODER encoder;
+    AACENC_InfoStruct info;
+    unsigned config[2];
+    char configStr[5];
+
+    if (aacEncOpen(&encoder, 0, numChannels) != AACENC_OK) {
+        fprintf(stderr, "%lld: AACTranscoder - error - couldn't open the AAC encoder\n", current_timestamp());
+        return NULL;
+    }
+    if ((aacEncoder_SetParam(encoder, AACENC_AOT, 2) != AACENC_OK) ||
+            (aacEncoder_SetParam(encoder, AACENC_SAMPLERATE, samplingFrequency) != AACENC_OK) ||
+            (aacEncoder_SetParam(encoder, AACENC_CHANNELMODE, (numChannels == 1) ? MODE_1 : MODE_2) != AACENC_OK) ||
+            (aacEncoder_SetParam(encoder, AACENC_CHANNELORDER, 1) != AACENC_OK) ||
+            (aacEncoder_SetParam(encoder, AACENC_TRANSMUX, TT_MP4_RAW) != AACENC_OK) ||
+            (aacEncoder_SetParam(encoder, AACENC_BITRATEMODE, 0) != AACENC_OK) ||
+            (aacEncoder_SetParam(encoder, AACENC_BITRATE, bitrate) != AACENC_OK) ||
+            (aacEncoder_SetParam(encoder, AACENC_AFTERBURNER, afterburner ? 1 : 0) != AACENC_OK) ||
+            (aacEncEncode(encoder, NULL, NULL, NULL, NULL) != AACENC_OK) ||
+            (aacEncInfo(encoder, &info) != AACENC_OK)) {
+        fprintf(stderr, "%lld: AACTranscoder - error - couldn't configure the AAC encoder\n", current_timestamp());
+        aacEncClose(&encoder);
+        return NULL;
+    }
+    // The receivers keep decoding with the configuration of the SDP
+    getAACConfigStr(configStr, samplingFrequency, numChannels);
+    sscanf(configStr, "%2x%2x", &config[0], &config[1]);
+    if ((info.confSize != 2) || (info.confBuf[0] != config[0]) || (info.confBuf[1] != config[1])) {
+        fprintf(stderr, "%lld: AACTranscoder - error - the encoder doesn't produce the AudioSpecificConfig %s\n",
+                current_timestamp(), configStr);
+        aacEncClose(&encoder);
+        return NULL;
+    }
+    *delayUs = (unsigned) (info.nDelay * 1000000LL / samplingFrequency);
+
+    return encoder;
+}
+
+AACTranscoder::AACTranscoder(UsageEnvironment& env, FramedSource* inputSource,
+                             HANDLE_AACDECODER decoder, HANDLE_AACENCODER encoder,
+                             unsigned samplingFrequency, unsigned numChannels,
+                             unsigned bitrate, unsigned delayUs)
+    : FramedFilter(env, inputSource), fDecoder(decoder), fEncoder(encoder),
+      fSamplingFrequency(samplingFrequency), fNumChannels(numChannels), fBitrate(bitrate), fAfterburner(True),
+      fPassthrough(False), fDelayUs(delayUs), fNextPts(0), fQueueHead(0), fQueueTail(0),
+      fFrames(0), fDecodeErrors(0), fSkipped(0), fInBytes(0), fOutBytes(0), fDecodeTime(0), fEncodeTime(0) {
+}
+
+AACTranscoder::~AACTranscoder() {
+    aacEncClose(&fEncoder);
+    aacDecoder_Close(fDecoder);
+}
+
+// Both are applied by the encoder from the next frame, without a gap
+void AACTranscoder::setBitrate(unsigned bitrate) {
+    if (aacEncoder_SetParam(fEncoder, AACENC_BITRATE, bitrate) != AACENC_OK) {
+        fprintf(stderr, "%lld: AACTranscoder - error - couldn't set the bitrate to %u\n", current_timestamp(), bitrate);
+        return;
+    }
+    fBitrate = bitrate;
+}
+
+void AACTranscoder::setAfterburner(Boolean afterburner) {
+    if (aacEncoder_SetParam(fEncoder, AACENC_AFTERBURNER, afterburner ? 1 : 0) != AACENC_OK) {
+        fprintf(stderr, "%lld: AACTranscoder - error - couldn't set the afterburner\n", current_timestamp());
+        return;
+    }
+    fAfterburner = afterburner;
+}
+
+// The encoder still holds fDelayUs of audio, the look-ahead: it's flushed
+// and sent before the AUs of the source, continuing the timestamps of the
+// encoded AUs. The AUs of the source that start before the end of the
+// flushed audio are then skipped, they would repeat it.
+void AACTranscoder::setPassthrough() {
+    AACENC_BufDesc inBuf, outBuf;
+    AACENC_InArgs inArgs;
+    AACENC_OutArgs outArgs;
+    AACENC_ERROR err;
+    void* outPtr = fEncoded;
+    INT outId = OUT_BITSTREAM_DATA, outSize = sizeof(fEncoded), outElSize = 1;
+    long long duration = 1024/*samples-per-frame*/ * 1000000LL / fSamplingFrequency;
+    unsigned i, lost = 0;
+
+    if (fPassthrough) return;
+    fPassthrough = True;
+
+    memset(&inBuf, 0, sizeof(inBuf));
+    outBuf.numBufs = 1;
+    outBuf.bufs = &outPtr;
+    outBuf.bufferIdentifiers = &outId;
+    outBuf.bufSizes = &outSize;
+    outBuf.bufElSizes = &outElSize;
+    inArgs.numInSamples = -1;
+    inArgs.numAncBytes = 0;
+    // An AU for each call, until EOF: bounded in case the encoder misbehaves
+    for (i = 0; i < 2 * TRANSCODE_QUEUE_MAX; i++) {
+        err = aacEncEncode(fEncoder, &inBuf, &outBuf, &inArgs, &outArgs);
+        if (err == AACENC_ENCODE_EOF) break;
+        if (err != AACENC_OK) {
+            fprintf(stderr, "%lld: AACTranscoder - error - flush failed\n", current_timestamp());
+            break;
+        }
+        // Nothing was encoded yet: no timestamp to continue and nothing to flush
+        if ((outArgs.numOutBytes == 0) || (fNextPts == 0)) continue;
+        if (fQueueTail < TRANSCODE_QUEUE_MAX - 1) {
+            queue(fEncoded, outArgs.numOutBytes, fNextPts);
+        } else {
+            lost++;
+        }
+        fNextPts += duration;
+    }
+    if (lost > 0) fprintf(stderr, "%lld: AACTranscoder - error - %u AUs flushed from the encoder dropped\n", current_timestamp(), lost);
+    if (debug) fprintf(stderr, "%lld: AACTranscoder - passthrough, %u AUs flushed from the encoder\n", current_timestamp(), fQueueTail);
+}
+
+// The flushed encoder can't take frames any more: a new one, with the
+// afterburner as it was. Its first AUs come after its look-ahead, those
+// that start before the end of the last AU forwarded are dropped
+// Return False if the flushed AUs are still queued or if the encoder can't
+// be opened, the AUs are still forwarded
+Boolean AACTranscoder::resume(unsigned bitrate) {
+    HANDLE_AACENCODER encoder;
+    unsigned delayUs;
+
+    if (!fPassthrough) return True;
+    if (fQueueHead < fQueueTail) return False;
+    encoder = openEncoder(fSamplingFrequency, fNumChannels, bitrate, fAfterburner, &delayUs);
+    if (encoder == NULL) return False;
+    aacEncClose(&fEncoder);
+    fEncoder = encoder;
+    fBitrate = bitrate;
+    fDelayUs = delayUs;
+    fPassthrough = False;
+    if (debug) fprintf(stderr, "%lld: AACTranscoder - encoding again at %u\n", current_timestamp(), bitrate);
+
+    return True;
+}
+
+void AACTranscoder::doGetNextFrame() {
+    if (fQueueHead < fQueueTail) {
+        nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
+                (TaskFunc*) AACTranscoder::deliverQueued, this);
+        return;
+    }
+    fInputSource->getNextFrame(fAU, sizeof(fAU),
+                               afterGettingFrame, this,
+                               FramedSource::handleClosure, this);
+}
+
+void AACTranscoder::afterGettingFrame(void* clientData, unsigned frameSize,
+                                      unsigned numTruncatedBytes,
+                                      struct timeval presentationTime,
+                                      unsigned /*durationInMicroseconds*/) {
+    AACTranscoder* transcoder = (AACTranscoder*) clientData;
+    transcoder->afterGettingFrame1(frameSize, numTruncatedBytes, presentationTime);
+}
+
+void AACTranscoder::afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                                       struct timeval presentationTime) {
+    UCHAR* data = fAU;
+    UINT size = frameSize;
+    UINT valid = frameSize;
+    AAC_DECODER_ERROR err;
+    CStreamInfo* info;
+    AACENC_BufDesc inBuf, outBuf;
+    AACENC_InArgs inArgs;
+    AACENC_OutArgs outArgs;
+    void* inPtr = fDecoded;
+    void* outPtr = fEncoded;
+    INT inId = IN_AUDIO_DATA, inSize, inElSize = sizeof(INT_PCM);
+    INT outId = OUT_BITSTREAM_DATA, outSize = sizeof(fEncoded), outElSize = 1;
+    long long start, t;
+
+    // Empty frame (the source is starting)
+    if ((frameSize == 0) && (numTruncatedBytes == 0)) {
+        doGetNextFrame();
+        return;
+    }
+    if (numTruncatedBytes > 0) {
+        fprintf(stderr, "%lld: AACTranscoder - error - AU too large, dropped\n", current_timestamp());
+        doGetNextFrame();
+        return;
+    }
+    fInBytes += frameSize;
+
+    if (fPassthrough) {
+        t = presentationTime.tv_sec * 1000000LL + presentationTime.tv_usec;
+        if (t < fNextPts) {
+            fSkipped++;
+            doGetNextFrame();
+            return;
+        }
+        fNextPts = t + 1024/*samples-per-frame*/ * 1000000LL / fSamplingFrequency;
+        // The input was already requested when the encoder was flushed: its AUs go first
+        if (fQueueHead < fQueueTail) {
+            queue(fAU, frameSize, t);
+            deliverQueued1();
+            return;
+        }
+        deliver(fAU, frameSize, presentationTime);
+        return;
+    }
+
+    // A frame that can't be decoded is concealed: the encoder gets a frame
+    // for each AU and its output keeps the timing of the source
+    start = transcode_thread_time();
+    err = aacDecoder_Fill(fDecoder, &data, &size, &valid);
+    if (err == AAC_DEC_OK) err = aacDecoder_DecodeFrame(fDecoder, fDecoded, TRANSCODE_DECODED_MAX, 0);
+    if (err != AAC_DEC_OK) {
+        if (debug) fprintf(stderr, "%lld: AACTranscoder - decode failed: %x\n", current_timestamp(), err);
+        fDecodeErrors++;
+        err = aacDecoder_DecodeFrame(fDecoder, fDecoded, TRANSCODE_DECODED_MAX, AACDEC_CONCEAL);
+    }
+    info = aacDecoder_GetStreamInfo(fDecoder);
+    if ((err != AAC_DEC_OK) || (info == NULL) || (info->frameSize * info->numChannels > TRANSCODE_DECODED_MAX)) {
+        doGetNextFrame();
+        return;
+    }
+    t = transcode_thread_time();
+    fDecodeTime += t - start;
+
+    inSize = info->frameSize * info->numChannels * sizeof(INT_PCM);
+    inBuf.numBufs = 1;
+    inBuf.bufs = &inPtr;
+    inBuf.bufferIdentifiers = &inId;
+    inBuf.bufSizes = &inSize;
+    inBuf.bufElSizes = &inElSize;
+    outBuf.numBufs = 1;
+    outBuf.bufs = &outPtr;
+    outBuf.bufferIdentifiers = &outId;
+    outBuf.bufSizes = &outSize;
+    outBuf.bufElSizes = &outElSize;
+    inArgs.numInSamples = info->frameSize * info->numChannels;
+    inArgs.numAncBytes = 0;
+    if (aacEncEncode(fEncoder, &inBuf, &outBuf, &inArgs, &outArgs) != AACENC_OK) {
+        fprintf(stderr, "%lld: AACTranscoder - error - encode failed\n", current_timestamp());
+        doGetNextFrame();
+        return;
+    }
+    fEncodeTime += transcode_thread_time() - t;
+    fFrames++;
+
+    // The encoder is filling its look-ahead
+    if (outArgs.numOutBytes == 0) {
+        doGetNextFrame();
+        return;
+    }
+
+    t = presentationTime.tv_sec * 1000000LL + presentationTime.tv_usec - fDelayUs;
+    // After resume(): the audio of this AU was already forwarded
+    if (t < fNextPts) {
+        fSkipped++;
+        doGetNextFrame();
+        return;
+    }
+    fNextPts = t + 1024/*samples-per-frame*/ * 1000000LL / fSamplingFrequency;
+    presentationTime.tv_sec = t / 1000000;
+    presentationTime.tv_usec = t % 1000000;
+    deliver(fEncoded, outArgs.numOutBytes, presentationTime);
+}
+
+void AACTranscoder::queue(unsigned char* data, unsigned size, long long presentationTime) {
+    memcpy(fQueue[fQueueTail], data, size);
+    fQueueSize[fQueueTail] = size;
+    fQueuePts[fQueueTail] = presentationTime;
+    fQueueTail++;
+}
+
+void AACTranscoder::deliverQueued(void* clientData) {
+    AACTranscoder* transcoder = (AACTranscoder*) clientData;
+    transcoder->deliverQueued1();
+}
+
+void AACTranscoder::deliverQueued1() {
+    struct timeval presentationTime;
+    unsigned i = fQueueHead++;
+
+    presentationTime.tv_sec = fQueuePts[i] / 1000000;
+    presentationTime.tv_usec = fQueuePts[i] % 1000000;
+    if (fQueueHead == fQueueTail) fQueueHead = fQueueTail = 0;
+    deliver(fQueue[i], fQueueSize[i], presentationTime);
+}
+
+void AACTranscoder::deliver(unsigned char* data, unsigned size, struct timeval presentationTime) {
+    if (size > fMaxSize) {
+        fNumTruncatedBytes = size - fMaxSize;
+        size = fMaxSize;
+    } else {
+        fNumTruncatedBytes = 0;
+    }
+    memcpy(fTo, data, size);
+    fFrameSize = size;
+    fPresentationTime = presentationTime;
+    fDurationInMicroseconds = 1024/*samples-per-frame*/ * 1000000LL / fSamplingFrequency;
+    fOutBytes += size;
+
+    FramedSource::afterGetting(this);
+}
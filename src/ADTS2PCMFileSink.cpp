@@ -121,7 +121,17 @@ void ADTS2PCMFileSink::addData(unsigned char* data, unsigned dataSize,
         unsigned int aacHeaderSize = 7;
         AAC_DECODER_ERROR err;
         unsigned int valid;
-        int i;
+
+        // An empty frame is a lost AU: the decoder conceals it from the previous ones
+        if (dataSize == 0) {
+            err = aacDecoder_DecodeFrame(fAACHandle, fPCMBuffer, 1024, AACDEC_CONCEAL);
+            if (err != AAC_DEC_OK) {
+                if (debug) fprintf(stderr, "Conceal failed: %x\n", err);
+                return;
+            }
+            writePCM();
+            return;
+        }
 
         dataSize = dataSize + aacHeaderSize;
         aacHeader[0] = 0xFF;
@@ -153,28 +163,35 @@ void ADTS2PCMFileSink::addData(unsigned char* data, unsigned dataSize,
             fprintf(stderr, "Decode failed: %x\n", err);
             return;
         }
-        CStreamInfo *info = aacDecoder_GetStreamInfo(fAACHandle);
-        if (debug) {
-            fprintf(stderr, "Sample Rate: %d\n", info->sampleRate);
-            fprintf(stderr, "Frame Size: %d\n", info->frameSize);
-            fprintf(stderr, "Num Channels: %d\n", info->numChannels);
-        }
-        if (packet_counter) {
-            fprintf(stderr, "Packet Counter: %d\n", fPacketCounter++);
-        }
+        writePCM();
+    }
+}
 
-        if (gpio == 1) {
-            speaker(1);
-            speaker_counter = 1000; // 1 sec
-        }
-        if (fSampleRate == info->sampleRate / 2) {
-            for (i = 0; i < info->frameSize / 2; i++) {
-                fPCMBuffer[i] = fPCMBuffer[2 * i];
-            }
-            fwrite(fPCMBuffer, sizeof(INT_PCM), info->frameSize / 2, fOutFid);
-        } else {
-            fwrite(fPCMBuffer, sizeof(INT_PCM), info->frameSize, fOutFid);
+// Write the PCM samples of the last frame decoded
+void ADTS2PCMFileSink::writePCM() {
+    int i;
+
+    CStreamInfo *info = aacDecoder_GetStreamInfo(fAACHandle);
+    if (debug) {
+        fprintf(stderr, "Sample Rate: %d\n", info->sampleRate);
+        fprintf(stderr, "Frame Size: %d\n", info->frameSize);
+        fprintf(stderr, "Num Channels: %d\n", info->numChannels);
+    }
+    if (packet_counter) {
+        fprintf(stderr, "Packet Counter: %d\n", fPacketCounter++);
+    }
+
+    if (gpio == 1) {
+        speaker(1);
+        speaker_counter = 1000; // 1 sec
+    }
+    if (fSampleRate == info->sampleRate / 2) {
+        for (i = 0; i < info->frameSize / 2; i++) {
+            fPCMBuffer[i] = fPCMBuffer[2 * i];
         }
+        fwrite(fPCMBuffer, sizeof(INT_PCM), info->frameSize / 2, fOutFid);
+    } else {
+        fwrite(fPCMBuffer, sizeof(INT_PCM), info->frameSize, fOutFid);
     }
 }
 
@@ -0,0 +1,98 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// A 'ServerMediaSubsession' object that creates new, unicast, "RTPSink"s
+// on demand, from the AAC frames of a circular buffer.
+// Implementation
+
+#include "liveMedia.hh"
+
+#include "AudioFramedMemoryServerMediaSubsession.hh"
+#include "AudioFramedMemorySource.hh"
+#include "AACAggregator.hh"
+
+extern int debug;
+
+AudioFramedMemoryServerMediaSubsession*
+AudioFramedMemoryServerMediaSubsession::createNew(UsageEnvironment& env,
+                                                  cb_output_buffer *cbBuffer,
+                                                  unsigned samplingFrequency,
+                                                  unsigned numChannels,
+                                                  unsigned prerollMs,
+                                                  unsigned aggregateMs,
+                                                  Boolean reuseFirstSource) {
+    return new AudioFramedMemoryServerMediaSubsession(env, cbBuffer, samplingFrequency, numChannels,
+                                                      prerollMs, aggregateMs, reuseFirstSource);
+}
+
+AudioFramedMemoryServerMediaSubsession::AudioFramedMemoryServerMediaSubsession(UsageEnvironment& env,
+                                                                               cb_output_buffer *cbBuffer,
+                                                                               unsigned samplingFrequency,
+                                                                               unsigned numChannels,
+                                                                               unsigned prerollMs,
+                                                                               unsigned aggregateMs,
+                                                                               Boolean reuseFirstSource)
+    : OnDemandServerMediaSubsession(env, reuseFirstSource),
+      fBuffer(cbBuffer), fSamplingFrequency(samplingFrequency), fNumChannels(numChannels),
+      fPrerollMs(prerollMs), fAggregateMs(aggregateMs) {
+    getAACConfigStr(fConfigStr, samplingFrequency, numChannels);
+}
+
+AudioFramedMemoryServerMediaSubsession::~AudioFramedMemoryServerMediaSubsession() {
+}
+
+FramedSource* AudioFramedMemoryServerMediaSubsession::createNewStreamSource(unsigned clientSessionId, unsigned& estBitrate) {
+    FramedSource* source;
+
+    estBitrate = 32; // kbps
+
+    // Idle mode: wake up the capture now, not at the next check
+    idle_listener_seen("rtsp client");
+
+    // Each client has its own source and ring reader, so each one starts with
+    // the pre-roll: FRAME_RING_READERS clients at most
+    source = AudioFramedMemorySource::createNew(envir(), fBuffer, fSamplingFrequency, fNumChannels, fPrerollMs);
+    if (source == NULL) {
+        fprintf(stderr, "%lld: rtsp - error - no reader left for client session %08X\n", current_timestamp(), clientSessionId);
+        return NULL;
+    }
+    if (debug) fprintf(stderr, "%lld: rtsp - new audio source for client session %08X\n", current_timestamp(), clientSessionId);
+
+    if (fAggregateMs > 0) {
+        source = AACAggregator::createNew(envir(), source, fSamplingFrequency, fAggregateMs);
+    }
+
+    return source;
+}
+
+RTPSink* AudioFramedMemoryServerMediaSubsession::createNewRTPSink(Groupsock* rtpGroupsock,
+                                                                  unsigned char rtpPayloadTypeIfDynamic,
+                                                                  FramedSource* /*inputSource*/) {
+    if (fAggregateMs > 0) {
+        // Same SDP, the AU header section is built by AACAggregator
+        return AACAggregateRTPSink::createNew(envir(), rtpGroupsock,
+                                              rtpPayloadTypeIfDynamic,
+                                              fSamplingFrequency,
+                                              "audio", "aac-hbr", fConfigStr,
+                                              fNumChannels);
+    }
+    return MPEG4GenericRTPSink::createNew(envir(), rtpGroupsock,
+                                          rtpPayloadTypeIfDynamic,
+                                          fSamplingFrequency,
+                                          "audio", "aac-hbr", fConfigStr,
+                                          fNumChannels);
+}
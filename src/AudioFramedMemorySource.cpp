@@ -22,8 +22,6 @@ along with this library; if not, write to the Free Software Foundation, Inc.,
 #include "AudioFramedMemorySource.hh"
 #include "GroupsockHelper.hh"
 
-#include <pthread.h>
-
 #define MILLIS_25 25000
 #define MILLIS_10 10000
 
@@ -31,6 +29,8 @@ along with this library; if not, write to the Free Software Foundation, Inc.,
 
 extern int packet_counter;
 extern int debug;
+extern int video_high;
+extern int video_low;
 
 ////////// FramedMemorySource //////////
 
@@ -45,19 +45,29 @@ AudioFramedMemorySource*
 AudioFramedMemorySource::createNew(UsageEnvironment& env,
                                         cb_output_buffer *cbBuffer,
                                         unsigned samplingFrequency,
-                                        unsigned numChannels) {
+                                        unsigned numChannels,
+                                        unsigned prerollMs) {
     if (cbBuffer == NULL) return NULL;
 
-    return new AudioFramedMemorySource(env, cbBuffer, samplingFrequency, numChannels);
+    int reader = frame_ring_attach(&(cbBuffer->ring));
+    if (reader == -1) {
+        fprintf(stderr, "%lld: AudioFramedMemorySource - createNew() error - too many readers\n", current_timestamp());
+        return NULL;
+    }
+
+    return new AudioFramedMemorySource(env, cbBuffer, reader, samplingFrequency, numChannels, prerollMs);
 }
 
 AudioFramedMemorySource::AudioFramedMemorySource(UsageEnvironment& env,
                                                  cb_output_buffer *cbBuffer,
+                                                 int reader,
                                                  unsigned samplingFrequency,
-                                                 unsigned numChannels)
-    : FramedSource(env), fBuffer(cbBuffer), fProfile(1),
+                                                 unsigned numChannels,
+                                                 unsigned prerollMs)
+    : FramedSource(env), fBuffer(cbBuffer), fReader(reader), fProfile(1),
       fSamplingFrequency(samplingFrequency), fNumChannels(numChannels),
-      fHaveStartedReading(False), fPacketCounter(0) {
+      fPrerollMs(prerollMs), fPrerollFrames(0),
+      fHaveStartedReading(False), fFirstFrameSent(False), fPacketCounter(0) {
 
     u_int8_t samplingFrequencyIndex;
     int i;
@@ -81,9 +91,16 @@ AudioFramedMemorySource::AudioFramedMemorySource(UsageEnvironment& env,
     audioSpecificConfig[1] = (samplingFrequencyIndex<<7) | (channelConfiguration<<3);
     sprintf(fConfigStr, "%02X%02X", audioSpecificConfig[0], audioSpecificConfig[1]);
     if (debug) fprintf(stderr, "%lld: AudioFramedMemorySource - fConfigStr %s\n", current_timestamp(), fConfigStr);
+
+    // The capture signals the new frames through the eventfd of the buffer
+    envir().taskScheduler().setBackgroundHandling(fBuffer->event_fd[fReader], SOCKET_READABLE,
+            (TaskScheduler::BackgroundHandlerProc*) &AudioFramedMemorySource::incomingFrameHandler, this);
 }
 
-AudioFramedMemorySource::~AudioFramedMemorySource() {}
+AudioFramedMemorySource::~AudioFramedMemorySource() {
+    envir().taskScheduler().disableBackgroundHandling(fBuffer->event_fd[fReader]);
+    frame_ring_detach(&(fBuffer->ring), fReader);
+}
 
 int AudioFramedMemorySource::cb_check_sync_word(unsigned char *str)
 {
@@ -114,13 +131,27 @@ void AudioFramedMemorySource::doGetNextFrameEx() {
     doGetNextFrame();
 }
 
+void AudioFramedMemorySource::incomingFrameHandler(AudioFramedMemorySource *source, int /*mask*/) {
+    source->incomingFrameHandler1();
+}
+
+void AudioFramedMemorySource::incomingFrameHandler1() {
+    uint64_t count;
+
+    // Reset the eventfd
+    if (read(fBuffer->event_fd[fReader], &count, sizeof(count)) != sizeof(count)) return;
+
+    if (isCurrentlyAwaitingData()) doGetNextFrame();
+}
+
 void AudioFramedMemorySource::doGetNextFrame() {
     Boolean isFirstReading = !fHaveStartedReading;
     if (!fHaveStartedReading) {
         if (debug) fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() 1st start\n", current_timestamp());
-        pthread_mutex_lock(&(fBuffer->mutex));
-        fBuffer->frame_read_index = fBuffer->frame_write_index;
-        pthread_mutex_unlock(&(fBuffer->mutex));
+        frame_ring_skip_all(&(fBuffer->ring), fReader);
+        // Pre-roll: send at once the last frames already in the ring, the client can start decoding without waiting
+        fPrerollFrames = cb_output_buffer_rewind(fBuffer, fReader, fPrerollMs);
+        if (debug && (fPrerollFrames > 0)) fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() pre-roll of %u frames\n", current_timestamp(), fPrerollFrames);
         fHaveStartedReading = True;
     }
 
@@ -128,9 +159,8 @@ void AudioFramedMemorySource::doGetNextFrame() {
 
     if (debug) fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() start - fMaxSize %d\n", current_timestamp(), fMaxSize);
 
-    pthread_mutex_lock(&(fBuffer->mutex));
-    if (fBuffer->frame_read_index == fBuffer->frame_write_index) {
-        pthread_mutex_unlock(&(fBuffer->mutex));
+    int slot = frame_ring_read_slot(&(fBuffer->ring), fReader);
+    if (slot == -1) {
         if (debug) fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() read_index = write_index\n", current_timestamp());
         fFrameSize = 0;
         fNumTruncatedBytes = 0;
@@ -138,13 +168,15 @@ void AudioFramedMemorySource::doGetNextFrame() {
         if (isFirstReading) {
             nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
                     (TaskFunc*)FramedSource::afterGetting, this);
-        } else {
-            nextTask() = envir().taskScheduler().scheduleDelayedTask(fuSecsPerFrame/4,
+        } else if (frame_ring_wait(&(fBuffer->ring), fReader)) {
+            // A frame arrived in the meantime
+            nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
                     (TaskFunc*) AudioFramedMemorySource::doGetNextFrameTask, this);
         }
+        // Otherwise incomingFrameHandler() will be called by the capture
         return;
-    } else if (fBuffer->output_frame[fBuffer->frame_read_index].ptr == NULL) {
-        pthread_mutex_unlock(&(fBuffer->mutex));
+    } else if (fBuffer->output_frame[slot].size == 0) {
+        frame_ring_release(&(fBuffer->ring), fReader);
         fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() error - NULL ptr\n", current_timestamp());
         fFrameSize = 0;
         fNumTruncatedBytes = 0;
@@ -153,13 +185,12 @@ void AudioFramedMemorySource::doGetNextFrame() {
             nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
                     (TaskFunc*)FramedSource::afterGetting, this);
         } else {
-            nextTask() = envir().taskScheduler().scheduleDelayedTask(fuSecsPerFrame/4,
+            nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
                     (TaskFunc*) AudioFramedMemorySource::doGetNextFrameTask, this);
         }
         return;
-    } else if (cb_check_sync_word(fBuffer->output_frame[fBuffer->frame_read_index].ptr) != 1) {
-        fBuffer->frame_read_index = (fBuffer->frame_read_index + 1) % fBuffer->output_frame_size;
-        pthread_mutex_unlock(&(fBuffer->mutex));
+    } else if (cb_check_sync_word(fBuffer->buffer + fBuffer->output_frame[slot].offset) != 1) {
+        frame_ring_release(&(fBuffer->ring), fReader);
         fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() error - wrong frame header\n", current_timestamp());
         fFrameSize = 0;
         fNumTruncatedBytes = 0;
@@ -168,17 +199,19 @@ void AudioFramedMemorySource::doGetNextFrame() {
             nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
                     (TaskFunc*)FramedSource::afterGetting, this);
         } else {
-            nextTask() = envir().taskScheduler().scheduleDelayedTask(fuSecsPerFrame/4,
+            nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
                     (TaskFunc*) AudioFramedMemorySource::doGetNextFrameTask, this);
         }
         return;
     }
 
     // Frame found, send it
+    cb_output_frame frame = fBuffer->output_frame[slot];
     unsigned char *ptr;
     unsigned int size;
-    ptr = fBuffer->output_frame[fBuffer->frame_read_index].ptr;
-    size = fBuffer->output_frame[fBuffer->frame_read_index].size;
+    int valid;
+    ptr = fBuffer->buffer + frame.offset;
+    size = frame.size;
     ptr += HEADER_SIZE;
     if (ptr >= fBuffer->buffer + fBuffer->size) ptr -= fBuffer->size;
     size -= HEADER_SIZE;
@@ -187,16 +220,14 @@ void AudioFramedMemorySource::doGetNextFrame() {
         // The size of the frame is smaller than the available buffer
         fNumTruncatedBytes = 0;
         fFrameSize = size;
-        if (debug) fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() whole frame - fFrameSize %d - counter %d - fMaxSize %d\n", current_timestamp(), fFrameSize, fBuffer->output_frame[fBuffer->frame_read_index].counter, fMaxSize);
+        if (debug) fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() whole frame - fFrameSize %d - counter %d - fMaxSize %d\n", current_timestamp(), fFrameSize, frame.counter, fMaxSize);
         if (ptr + fFrameSize > fBuffer->buffer + fBuffer->size) {
             memmove(fTo, ptr, fBuffer->buffer + fBuffer->size - ptr);
             memmove(fTo + (fBuffer->buffer + fBuffer->size - ptr), fBuffer->buffer, fFrameSize - (fBuffer->buffer + fBuffer->size - ptr));
         } else {
             memmove(fTo, ptr, fFrameSize);
         }
-        fBuffer->frame_read_index = (fBuffer->frame_read_index + 1) % fBuffer->output_frame_size;
-
-        pthread_mutex_unlock(&(fBuffer->mutex));
+        valid = frame_ring_release(&(fBuffer->ring), fReader);
     } else {
         // The size of the frame is greater than the available buffer
         fNumTruncatedBytes = size - fMaxSize;
@@ -208,17 +239,55 @@ void AudioFramedMemorySource::doGetNextFrame() {
         } else {
             memmove(fTo, ptr, fFrameSize);
         }
-        fBuffer->frame_read_index = (fBuffer->frame_read_index + 1) % fBuffer->output_frame_size;
+        valid = frame_ring_release(&(fBuffer->ring), fReader);
+    }
 
-        pthread_mutex_unlock(&(fBuffer->mutex));
+    // The capture took the frame back to make room for a new one (overrun)
+    if (!valid) {
+        if (debug) fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() warning - frame dropped by the capture\n", current_timestamp());
+        fFrameSize = 0;
+        fNumTruncatedBytes = 0;
+        nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
+                (TaskFunc*) AudioFramedMemorySource::doGetNextFrameTask, this);
+        return;
+    }
+
+    // Single copy mode: the firmware could have overwritten the frame during the copy
+    if ((fBuffer->source != NULL) && (cb_frame_unchanged(fBuffer, &frame) == 0)) {
+        fprintf(stderr, "%lld: AudioFramedMemorySource - doGetNextFrame() error - frame overwritten by the firmware\n", current_timestamp());
+        fFrameSize = 0;
+        fNumTruncatedBytes = 0;
+        nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
+                (TaskFunc*) AudioFramedMemorySource::doGetNextFrameTask, this);
+        return;
     }
 
     // Set the 'presentation time':
     struct timeval newPT;
     gettimeofday(&newPT, NULL);
-    if ((fPresentationTime.tv_sec == 0 && fPresentationTime.tv_usec == 0) || (newPT.tv_sec % 60 == 0)) {
-        // At the first frame and every minute use the current time:
+    if (video_high || video_low) {
+        // Use the clock of the video, from the firmware time of the frame
+        struct timeval fwPT;
+        frame_presentation_time(frame.time, &fwPT);
+        // Increment by the play time of the previous data, unless it drifts from the video
+        long long drift = (fwPT.tv_sec - fPresentationTime.tv_sec) * 1000000LL + fwPT.tv_usec - fPresentationTime.tv_usec - fuSecsPerFrame;
+        if ((drift > (long long) fuSecsPerFrame) || (drift < -((long long) fuSecsPerFrame))) {
+            fPresentationTime = fwPT;
+        } else {
+            unsigned uSeconds = fPresentationTime.tv_usec + fuSecsPerFrame;
+            fPresentationTime.tv_sec += uSeconds/1000000;
+            fPresentationTime.tv_usec = uSeconds%1000000;
+        }
+    } else if ((fPresentationTime.tv_sec == 0 && fPresentationTime.tv_usec == 0) || (newPT.tv_sec % 60 == 0) ||
+            (newPT.tv_sec - fPresentationTime.tv_sec > 2)) {
+        // At the first frame, every minute and after a pause of the capture (idle mode) use the current time:
         gettimeofday(&fPresentationTime, NULL);
+        if (fPrerollFrames > 1) {
+            // The last frame of the pre-roll is the current one
+            long long uSeconds = fPresentationTime.tv_sec * 1000000LL + fPresentationTime.tv_usec - (long long) (fPrerollFrames - 1) * fuSecsPerFrame;
+            fPresentationTime.tv_sec = uSeconds / 1000000;
+            fPresentationTime.tv_usec = uSeconds % 1000000;
+        }
     } else {
         // Increment by the play time of the previous data:
         unsigned uSeconds = fPresentationTime.tv_usec + fuSecsPerFrame;
@@ -226,13 +295,31 @@ void AudioFramedMemorySource::doGetNextFrame() {
         fPresentationTime.tv_usec = uSeconds%1000000;
     }
 
-    fDurationInMicroseconds = fuSecsPerFrame;
+    // The frames of the pre-roll are sent without waiting
+    if (fPrerollFrames > 0) {
+        fPrerollFrames--;
+        fDurationInMicroseconds = 0;
+    } else {
+        fDurationInMicroseconds = fuSecsPerFrame;
+    }
 
     if (packet_counter) {
         fprintf(stderr, "Packet Counter: %d\n", fPacketCounter++);
     }
 
     // Switch to another task, and inform the reader that he has data:
-    nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
-            (TaskFunc*)FramedSource::afterGetting, this);
+    if (fFirstFrameSent) {
+        nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
+                (TaskFunc*)FramedSource::afterGetting, this);
+    } else {
+        fFirstFrameSent = True;
+        nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
+                (TaskFunc*)AudioFramedMemorySource::afterGettingFirst, this);
+    }
+}
+
+void AudioFramedMemorySource::afterGettingFirst(AudioFramedMemorySource *source) {
+    // The sink sends the RTP packet before returning
+    FramedSource::afterGetting(source);
+    startup_trace(STARTUP_FIRST_RTP);
 }
@@ -0,0 +1,129 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// A Groupsock that sends each packet to all its destinations with one system call.
+// Implementation
+
+#include "BatchGroupsock.hh"
+#include "GroupsockHelper.hh"
+
+#include <errno.h>
+#include <string.h>
+#include <netinet/in.h>
+
+extern int debug;
+
+long long current_timestamp();
+
+Boolean BatchGroupsock::fBatching = False;
+Boolean BatchGroupsock::fSendmmsgMissing = False;
+unsigned BatchGroupsock::fDatagrams = 0;
+unsigned BatchGroupsock::fSendCalls = 0;
+
+BatchGroupsock::BatchGroupsock(UsageEnvironment& env, struct sockaddr_storage const& groupAddr, Port port, u_int8_t ttl)
+    : Groupsock(env, groupAddr, port, ttl), fCount(0), fPacketSize(0), fFlushTask(NULL) {
+    unsigned i;
+
+    memset(fMsg, 0, sizeof(fMsg));
+    for (i = 0; i < BATCH_DATAGRAMS_MAX; i++) {
+        fMsg[i].msg_hdr.msg_name = &fAddress[i];
+        fMsg[i].msg_hdr.msg_iov = &fIov[i];
+        fMsg[i].msg_hdr.msg_iovlen = 1;
+        fIov[i].iov_base = fPacket;
+    }
+}
+
+BatchGroupsock::~BatchGroupsock() {
+    env().taskScheduler().unscheduleDelayedTask(fFlushTask);
+    flush();
+}
+
+Boolean BatchGroupsock::write(struct sockaddr_storage const& addressAndPort, u_int8_t ttl,
+                              unsigned char* buffer, unsigned bufferSize) {
+    // Another packet: the datagrams of the previous one go first
+    if ((fCount > 0) && ((bufferSize != fPacketSize) || (memcmp(buffer, fPacket, bufferSize) != 0))) {
+        flush();
+    }
+
+    // A single destination has nothing to batch: no copy and no task, the packet goes at once
+    if (!fBatching || !hasMultipleDestinations() || (bufferSize > BATCH_PACKET_SIZE_MAX) ||
+            IsMulticastAddress(addressAndPort)) {
+        flush();
+        fSendCalls++;
+        if (!OutputSocket::write(addressAndPort, ttl, buffer, bufferSize)) return False;
+        fDatagrams++;
+        return True;
+    }
+
+    if (fCount == BATCH_DATAGRAMS_MAX) flush();
+
+    // The sink can reuse its buffer as soon as output() returns
+    if (fCount == 0) {
+        memcpy(fPacket, buffer, bufferSize);
+        fPacketSize = bufferSize;
+        if (fFlushTask == NULL) fFlushTask = env().taskScheduler().scheduleDelayedTask(0, flushTask, this);
+    }
+    fAddress[fCount] = addressAndPort;
+    fMsg[fCount].msg_hdr.msg_namelen = (addressAndPort.ss_family == AF_INET6) ?
+            sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    fIov[fCount].iov_len = bufferSize;
+    fCount++;
+
+    // A failed send is printed by flush(), False would skip the following destinations
+    return True;
+}
+
+void BatchGroupsock::flushTask(void* clientData) {
+    BatchGroupsock* gs = (BatchGroupsock*) clientData;
+
+    gs->fFlushTask = NULL;
+    gs->flush();
+}
+
+// Send the datagrams collected, a destination that fails doesn't stop the others
+// Return False if any of them failed
+Boolean BatchGroupsock::flush() {
+    unsigned sent = 0;
+    int n;
+    Boolean result = True;
+
+    while (sent < fCount) {
+        fSendCalls++;
+        if (!fSendmmsgMissing) {
+            n = sendmmsg(socketNum(), &fMsg[sent], fCount - sent, 0);
+            if ((n == -1) && (errno == ENOSYS)) {
+                fSendmmsgMissing = True;
+                continue;
+            }
+        } else {
+            n = (sendmsg(socketNum(), &fMsg[sent].msg_hdr, 0) == -1) ? -1 : 1;
+        }
+
+        if (n <= 0) {
+            if (debug) fprintf(stderr, "%lld: BatchGroupsock - error - datagram %u/%u not sent: %s\n",
+                                current_timestamp(), sent + 1, fCount, strerror(errno));
+            result = False;
+            n = 1;
+        } else {
+            fDatagrams += n;
+        }
+        sent += n;
+    }
+    fCount = 0;
+
+    return result;
+}
@@ -0,0 +1,184 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2020 Live Networks, Inc.  All rights reserved.
+// A class for streaming video NAL units from a circular buffer.
+// Implementation
+
+#include "rAudioStreamerReceiver.h"
+#include "VideoFramedMemorySource.hh"
+#include "GroupsockHelper.hh"
+
+extern int debug;
+
+////////// VideoFramedMemorySource //////////
+
+VideoFramedMemorySource*
+VideoFramedMemorySource::createNew(UsageEnvironment& env,
+                                        cb_output_buffer *cbBuffer) {
+    if (cbBuffer == NULL) return NULL;
+
+    int reader = frame_ring_attach(&(cbBuffer->ring));
+    if (reader == -1) {
+        fprintf(stderr, "%lld: VideoFramedMemorySource - createNew() error - too many readers\n", current_timestamp());
+        return NULL;
+    }
+
+    return new VideoFramedMemorySource(env, cbBuffer, reader);
+}
+
+VideoFramedMemorySource::VideoFramedMemorySource(UsageEnvironment& env,
+                                                 cb_output_buffer *cbBuffer,
+                                                 int reader)
+    : FramedSource(env), fBuffer(cbBuffer), fReader(reader),
+      fFrameLen(0), fNalStart(0), fFrameTime(0) {
+
+    fFrame = (unsigned char *) malloc(VIDEO_FRAME_SIZE_MAX * sizeof(unsigned char));
+    if (fFrame == NULL) {
+        fprintf(stderr, "could not alloc memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The capture signals the new frames through the eventfd of the buffer
+    envir().taskScheduler().setBackgroundHandling(fBuffer->event_fd[fReader], SOCKET_READABLE,
+            (TaskScheduler::BackgroundHandlerProc*) &VideoFramedMemorySource::incomingFrameHandler, this);
+}
+
+VideoFramedMemorySource::~VideoFramedMemorySource() {
+    envir().taskScheduler().disableBackgroundHandling(fBuffer->event_fd[fReader]);
+    frame_ring_detach(&(fBuffer->ring), fReader);
+    free(fFrame);
+}
+
+void VideoFramedMemorySource::incomingFrameHandler(VideoFramedMemorySource *source, int /*mask*/) {
+    source->incomingFrameHandler1();
+}
+
+void VideoFramedMemorySource::incomingFrameHandler1() {
+    uint64_t count;
+
+    // Reset the eventfd
+    if (read(fBuffer->event_fd[fReader], &count, sizeof(count)) != sizeof(count)) return;
+
+    if (isCurrentlyAwaitingData()) doGetNextFrame();
+}
+
+void VideoFramedMemorySource::doGetNextFrameTask(void* clientData) {
+    VideoFramedMemorySource *source = (VideoFramedMemorySource *) clientData;
+    source->doGetNextFrame();
+}
+
+// Copy the next frame of the buffer to fFrame
+// Return 1 if a frame was read, 0 if the buffer is empty, -1 if the frame was dropped
+int VideoFramedMemorySource::readFrame() {
+    int slot = frame_ring_read_slot(&(fBuffer->ring), fReader);
+    if (slot == -1) return 0;
+
+    cb_output_frame frame = fBuffer->output_frame[slot];
+    unsigned char *ptr = fBuffer->buffer + frame.offset;
+    unsigned char *buf_end = fBuffer->buffer + fBuffer->size;
+
+    if ((frame.size == 0) || (frame.size > VIDEO_FRAME_SIZE_MAX)) {
+        frame_ring_release(&(fBuffer->ring), fReader);
+        fprintf(stderr, "%lld: VideoFramedMemorySource - readFrame() error - frame not valid, size %d\n", current_timestamp(), frame.size);
+        return -1;
+    }
+
+    if (ptr + frame.size > buf_end) {
+        memcpy(fFrame, ptr, buf_end - ptr);
+        memcpy(fFrame + (buf_end - ptr), fBuffer->buffer, frame.size - (buf_end - ptr));
+    } else {
+        memcpy(fFrame, ptr, frame.size);
+    }
+
+    // The capture took the frame back to make room for a new one (overrun)
+    if (!frame_ring_release(&(fBuffer->ring), fReader)) {
+        if (debug) fprintf(stderr, "%lld: VideoFramedMemorySource - readFrame() warning - frame dropped by the capture\n", current_timestamp());
+        return -1;
+    }
+
+    // Single copy mode: the firmware could have overwritten the frame during the copy
+    if ((fBuffer->source != NULL) && (cb_frame_unchanged(fBuffer, &frame) == 0)) {
+        fprintf(stderr, "%lld: VideoFramedMemorySource - readFrame() error - frame overwritten by the firmware\n", current_timestamp());
+        return -1;
+    }
+
+    // Skip the first start code
+    unsigned char *nal = (unsigned char *) memmem(fFrame, frame.size, "\0\0\1", 3);
+    if (nal == NULL) {
+        fprintf(stderr, "%lld: VideoFramedMemorySource - readFrame() error - start code not found\n", current_timestamp());
+        return -1;
+    }
+    fFrameLen = frame.size;
+    fNalStart = nal + 3 - fFrame;
+    fFrameTime = frame.time;
+    if (debug) fprintf(stderr, "%lld: VideoFramedMemorySource - readFrame() - size %d - counter %d\n", current_timestamp(), frame.size, frame.counter);
+
+    return 1;
+}
+
+void VideoFramedMemorySource::doGetNextFrame() {
+    int ret;
+
+    // All the NAL units of the current frame have been sent
+    if (fNalStart >= fFrameLen) {
+        ret = readFrame();
+        if (ret == -1) {
+            nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
+                    (TaskFunc*) VideoFramedMemorySource::doGetNextFrameTask, this);
+            return;
+        } else if (ret == 0) {
+            if (frame_ring_wait(&(fBuffer->ring), fReader)) {
+                // A frame arrived in the meantime
+                nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
+                        (TaskFunc*) VideoFramedMemorySource::doGetNextFrameTask, this);
+            }
+            // Otherwise incomingFrameHandler() will be called by the capture
+            return;
+        }
+    }
+
+    // The NAL unit ends at the next start code (00 00 01 or 00 00 00 01)
+    unsigned char *nal = fFrame + fNalStart;
+    unsigned char *next = (unsigned char *) memmem(nal, fFrameLen - fNalStart, "\0\0\1", 3);
+    unsigned int nalSize;
+    if (next == NULL) {
+        nalSize = fFrameLen - fNalStart;
+        fNalStart = fFrameLen;
+    } else {
+        fNalStart = next + 3 - fFrame;
+        if ((next > nal) && (*(next - 1) == 0)) next--;
+        nalSize = next - nal;
+    }
+
+    if (nalSize > fMaxSize) {
+        fprintf(stderr, "%lld: VideoFramedMemorySource - doGetNextFrame() error - the size of the NAL unit is greater than the available buffer %d/%d\n", current_timestamp(), nalSize, fMaxSize);
+        fNumTruncatedBytes = nalSize - fMaxSize;
+        fFrameSize = fMaxSize;
+    } else {
+        fNumTruncatedBytes = 0;
+        fFrameSize = nalSize;
+    }
+    memcpy(fTo, nal, fFrameSize);
+
+    // All the NAL units of a frame have the same presentation time
+    frame_presentation_time(fFrameTime, &fPresentationTime);
+    fDurationInMicroseconds = 0;
+
+    // Switch to another task, and inform the reader that he has data:
+    nextTask() = envir().taskScheduler().scheduleDelayedTask(0,
+            (TaskFunc*)FramedSource::afterGetting, this);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * AudioSpecificConfig of the SDP, also used to configure the decoders.
+ * Kept apart from the streamer so that the benches in test/ run the same
+ * filters.
+ */
+
+#include "rAudioStreamerReceiver.h"
+
+extern int debug;
+
+void getAACConfigStr(char *configStr, unsigned samplingFrequency, unsigned numChannels)
+{
+    unsigned samplingFrequencyTable[16] = {
+        96000, 88200, 64000, 48000,
+        44100, 32000, 24000, 22050,
+        16000, 12000, 11025, 8000,
+        7350, 0, 0, 0
+    };
+
+    u_int8_t samplingFrequencyIndex;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        if (samplingFrequency == samplingFrequencyTable[i]) {
+            samplingFrequencyIndex = i;
+            break;
+        }
+    }
+    if (i == 16) samplingFrequencyIndex = 8;
+
+    u_int8_t channelConfiguration = numChannels;
+    if (channelConfiguration == 8) channelConfiguration--;
+
+    // Construct the 'AudioSpecificConfig', and from it, the corresponding ASCII string:
+    unsigned char audioSpecificConfig[2];
+    u_int8_t const audioObjectType = 2;
+    audioSpecificConfig[0] = (audioObjectType<<3) | (samplingFrequencyIndex>>1);
+    audioSpecificConfig[1] = (samplingFrequencyIndex<<7) | (channelConfiguration<<3);
+    sprintf(configStr, "%02X%02X", audioSpecificConfig[0], audioSpecificConfig[1]);
+    if (debug) fprintf(stderr, "%lld: configStr %s\n", current_timestamp(), configStr);
+}
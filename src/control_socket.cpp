@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Control socket.
+ *
+ * The sockets are non blocking and read by the event loop, so a slow or
+ * stuck client never delays the RTP packets. Commands are short and the
+ * answers fit in the socket buffer: they are written without waiting.
+ */
+
+#include "control_socket.h"
+
+#include "UsageEnvironment.hh"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+extern int debug;
+
+long long current_timestamp();
+
+struct control_client {
+    int fd;                                 // -1 if the entry is free
+    int len;                                // bytes in line
+    char line[CONTROL_LINE_MAX];
+};
+
+static UsageEnvironment *control_env = NULL;
+static control_handler control_command = NULL;
+static int control_fd = -1;
+static char control_path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+static struct control_client control_clients[CONTROL_CLIENTS_MAX];
+
+static void control_client_close(struct control_client *cl)
+{
+    control_env->taskScheduler().disableBackgroundHandling(cl->fd);
+    close(cl->fd);
+    cl->fd = -1;
+}
+
+// Run the complete lines received, keep the last partial one
+static void control_client_read(void *clientData, int mask)
+{
+    struct control_client *cl = (struct control_client *) clientData;
+    char reply[CONTROL_REPLY_MAX];
+    char *nl;
+    int n;
+
+    n = read(cl->fd, cl->line + cl->len, sizeof(cl->line) - 1 - cl->len);
+    if ((n == -1) && ((errno == EAGAIN) || (errno == EINTR))) return;
+    if (n <= 0) {
+        // The last command may have no newline
+        if ((n == 0) && (cl->len > 0)) {
+            cl->line[cl->len] = '\0';
+            reply[0] = '\0';
+            control_command(cl->line, reply, sizeof(reply));
+            if (write(cl->fd, reply, strlen(reply)) == -1) {}
+        }
+        control_client_close(cl);
+        return;
+    }
+    cl->len += n;
+    cl->line[cl->len] = '\0';
+
+    while ((nl = strchr(cl->line, '\n')) != NULL) {
+        *nl = '\0';
+        if ((nl > cl->line) && (*(nl - 1) == '\r')) *(nl - 1) = '\0';
+        if (cl->line[0] != '\0') {
+            if (debug) fprintf(stderr, "%lld: control - command: %s\n", current_timestamp(), cl->line);
+            reply[0] = '\0';
+            control_command(cl->line, reply, sizeof(reply));
+            if (write(cl->fd, reply, strlen(reply)) == -1) {
+                control_client_close(cl);
+                return;
+            }
+        }
+        cl->len -= nl + 1 - cl->line;
+        memmove(cl->line, nl + 1, cl->len + 1);
+    }
+
+    if (cl->len == (int) sizeof(cl->line) - 1) {
+        fprintf(stderr, "%lld: control - error - command too long\n", current_timestamp());
+        control_client_close(cl);
+    }
+}
+
+static void control_accept(void *clientData, int mask)
+{
+    const char *busy = "error - too many connections\n";
+    int fd, i;
+
+    fd = accept(control_fd, NULL, NULL);
+    if (fd == -1) return;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    for (i = 0; i < CONTROL_CLIENTS_MAX; i++) {
+        if (control_clients[i].fd == -1) break;
+    }
+    if (i == CONTROL_CLIENTS_MAX) {
+        if (write(fd, busy, strlen(busy)) == -1) {}
+        close(fd);
+        return;
+    }
+
+    control_clients[i].fd = fd;
+    control_clients[i].len = 0;
+    control_env->taskScheduler().setBackgroundHandling(fd, SOCKET_READABLE, control_client_read, &control_clients[i]);
+}
+
+// Listen on the Unix socket path, an old socket file is removed
+// Return 0 on success
+int control_socket_open(UsageEnvironment *env, const char *path, control_handler handler)
+{
+    struct sockaddr_un sa;
+    int i;
+
+    if (strlen(path) >= sizeof(sa.sun_path)) {
+        fprintf(stderr, "%lld: control - error - path too long: %s\n", current_timestamp(), path);
+        return -1;
+    }
+
+    control_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (control_fd == -1) {
+        fprintf(stderr, "%lld: control - error - could not create the socket: %s\n", current_timestamp(), strerror(errno));
+        return -1;
+    }
+    fcntl(control_fd, F_SETFL, fcntl(control_fd, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(control_fd, F_SETFD, FD_CLOEXEC);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+    unlink(path);
+    // Only the owner (root on the cam) can change the destinations
+    if ((bind(control_fd, (struct sockaddr *) &sa, sizeof(sa)) == -1) ||
+            (chmod(path, 0600) == -1) ||
+            (listen(control_fd, CONTROL_CLIENTS_MAX) == -1)) {
+        fprintf(stderr, "%lld: control - error - could not listen on %s: %s\n", current_timestamp(), path, strerror(errno));
+        close(control_fd);
+        control_fd = -1;
+        return -1;
+    }
+
+    for (i = 0; i < CONTROL_CLIENTS_MAX; i++) control_clients[i].fd = -1;
+    strcpy(control_path, path);
+    control_env = env;
+    control_command = handler;
+    env->taskScheduler().setBackgroundHandling(control_fd, SOCKET_READABLE, control_accept, NULL);
+
+    return 0;
+}
+
+void control_socket_close()
+{
+    int i;
+
+    if (control_fd == -1) return;
+    for (i = 0; i < CONTROL_CLIENTS_MAX; i++) {
+        if (control_clients[i].fd != -1) control_client_close(&control_clients[i]);
+    }
+    control_env->taskScheduler().disableBackgroundHandling(control_fd);
+    close(control_fd);
+    control_fd = -1;
+    unlink(control_path);
+}
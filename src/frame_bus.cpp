@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Publisher side of the frame bus, see frame_bus.h for the layout.
+ *
+ * A frame is published in this order: claim its bytes in write_pos,
+ * invalidate its slot, copy the data, fill the slot, advance seq and
+ * wake up the sleeping readers. A reader checks slot and write_pos
+ * again after the copy, so it never returns a frame overwritten under it.
+ */
+
+#include "frame_bus.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+extern int debug;
+
+long long current_timestamp();
+
+// Create the shared memory /dev/shm/name, an old bus with the same name is removed
+// Return NULL on error
+frame_bus_header *frame_bus_create(const char *name, uint32_t type)
+{
+    frame_bus_header *bus;
+    uint32_t header_size = (sizeof(frame_bus_header) + 63) & ~63;
+    int fd;
+
+    // The readers of the old bus keep their mapping and see that it's closed
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (fd == -1) {
+        fprintf(stderr, "%lld: frame bus - error - could not create %s\n", current_timestamp(), name);
+        return NULL;
+    }
+    fchmod(fd, 0666);
+    if (ftruncate(fd, header_size + FRAME_BUS_DATA_SIZE) == -1) {
+        fprintf(stderr, "%lld: frame bus - error - could not resize %s\n", current_timestamp(), name);
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    bus = (frame_bus_header *) mmap(NULL, header_size + FRAME_BUS_DATA_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (bus == MAP_FAILED) {
+        fprintf(stderr, "%lld: frame bus - error - could not map %s\n", current_timestamp(), name);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    // ftruncate filled it with zeros: free reader table, no frames
+    bus->header_size = header_size;
+    bus->data_size = FRAME_BUS_DATA_SIZE;
+    bus->slots = FRAME_BUS_SLOTS;
+    bus->type = type;
+    bus->publisher_pid = getpid();
+    bus->version = FRAME_BUS_VERSION;
+    // The magic is the last field written: a reader checks it before the others
+    __atomic_store_n(&bus->magic, FRAME_BUS_MAGIC, __ATOMIC_RELEASE);
+
+    return bus;
+}
+
+// Set the format of the stream, when it's detected
+void frame_bus_format(frame_bus_header *bus, uint32_t freq, uint32_t chan)
+{
+    __atomic_store_n(&bus->freq, freq, __ATOMIC_RELAXED);
+    __atomic_store_n(&bus->chan, chan, __ATOMIC_RELEASE);
+}
+
+// Publish a frame made by n1 bytes at src1 followed by n2 bytes at src2 (the part wrapped around the end of the source)
+void frame_bus_publish(frame_bus_header *bus, const unsigned char *src1, uint32_t n1,
+        const unsigned char *src2, uint32_t n2, uint32_t time)
+{
+    uint32_t seq = bus->seq;
+    frame_bus_slot *s = &bus->slot[seq % bus->slots];
+    uint32_t size = n1 + n2;
+    uint32_t pos = bus->write_pos;
+    uint32_t off = pos % bus->data_size;
+    unsigned char *dest;
+
+    if (size > bus->data_size / 2) return;
+
+    // The frame must be contiguous: skip the end of data if it doesn't fit
+    if (off + size > bus->data_size) {
+        pos += bus->data_size - off;
+        off = 0;
+    }
+    dest = frame_bus_data(bus) + off;
+
+    // Claim the bytes and invalidate the slot before writing them
+    __atomic_store_n(&bus->write_pos, pos + size, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(dest, src1, n1);
+    if (n2 > 0) memcpy(dest + n1, src2, n2);
+
+    s->pos = pos;
+    s->size = size;
+    s->time = time;
+    __atomic_store_n(&s->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&bus->seq, seq + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&bus->waiters, __ATOMIC_SEQ_CST) > 0) {
+        syscall(SYS_futex, &bus->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+// Print the reader table, free the entries of the readers that died
+// Return the number of readers
+int frame_bus_reap(frame_bus_header *bus)
+{
+    uint32_t head = __atomic_load_n(&bus->seq, __ATOMIC_ACQUIRE);
+    int32_t pid;
+    int i, n = 0;
+
+    for (i = 0; i < FRAME_BUS_READERS; i++) {
+        pid = __atomic_load_n(&bus->reader[i].pid, __ATOMIC_ACQUIRE);
+        if (pid == 0) continue;
+        if ((kill(pid, 0) == -1) && (errno == ESRCH)) {
+            __atomic_compare_exchange_n(&bus->reader[i].pid, &pid, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+            continue;
+        }
+        n++;
+        if (debug) fprintf(stderr, "%lld: frame bus - reader %d - pid %d - lag %u frames - lost %u\n", current_timestamp(),
+                    i, pid, head - __atomic_load_n(&bus->reader[i].seq, __ATOMIC_ACQUIRE), bus->reader[i].lost);
+    }
+
+    return n;
+}
+
+// Return the number of readers alive, without printing or freeing anything
+int frame_bus_readers(frame_bus_header *bus)
+{
+    int32_t pid;
+    int i, n = 0;
+
+    for (i = 0; i < FRAME_BUS_READERS; i++) {
+        pid = __atomic_load_n(&bus->reader[i].pid, __ATOMIC_ACQUIRE);
+        if ((pid != 0) && ((kill(pid, 0) == 0) || (errno != ESRCH))) n++;
+    }
+
+    return n;
+}
+
+// Close the bus, the readers see it with frame_bus_alive()
+void frame_bus_destroy(frame_bus_header *bus, const char *name)
+{
+    __atomic_store_n(&bus->closed, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &bus->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    munmap(bus, bus->header_size + bus->data_size);
+    shm_unlink(name);
+}
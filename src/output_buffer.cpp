@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Producer side of the output buffers: the copy of a frame and the room
+ * made for it. Kept apart from the capture so that test/frame_ring_stress
+ * runs the same code.
+ */
+
+#include "rAudioStreamerReceiver.h"
+
+void s2cb_memcpy(cb_output_buffer *dest, unsigned char *src, size_t n)
+{
+    unsigned char *uc_dest = dest->write_index;
+
+    if (uc_dest + n > dest->buffer + dest->size) {
+        memcpy(uc_dest, src, dest->buffer + dest->size - uc_dest);
+        memcpy(dest->buffer, src + (dest->buffer + dest->size - uc_dest), n - (dest->buffer + dest->size - uc_dest));
+        dest->write_index = n + uc_dest - dest->size;
+    } else {
+        memcpy(uc_dest, src, n);
+        dest->write_index += n;
+    }
+    if (dest->write_index == dest->buffer + dest->size) {
+        dest->write_index = dest->buffer;
+    }
+}
+
+// Bytes of the buffer used by the frames from the position tail to head
+static unsigned int cb_tail_bytes(cb_output_buffer *cb, unsigned int tail)
+{
+    unsigned int write_offset = cb->write_index - cb->buffer;
+
+    if (tail == cb->ring.head) return 0;
+    // The buffer is full if the oldest frame starts at the write index
+    return (write_offset + cb->size - cb->output_frame[frame_ring_slot(&(cb->ring), tail)].offset - 1) % cb->size + 1;
+}
+
+// Bytes of the buffer used by the frames that the reader id has not read yet
+unsigned int cb_reader_bytes(cb_output_buffer *cb, int id)
+{
+    return cb_tail_bytes(cb, frame_ring_tail(&(cb->ring), id));
+}
+
+// Make room for a frame of len bytes, applying the overrun policy to the readers that are too late
+// Return the slot to fill or -1 if the frame must be dropped
+int cb_output_buffer_reserve(cb_output_buffer *cb, unsigned int len)
+{
+    frame_ring *r = &(cb->ring);
+    unsigned int tail, lag;
+    int i;
+
+    for (i = 0; i < FRAME_RING_READERS; i++) {
+        if (!frame_ring_active(r, i)) continue;
+        lag = frame_ring_lag(r, i);
+        if (lag > cb->lag_max[i]) cb->lag_max[i] = lag;
+
+        // The check and the move use the same tail: a reader that catches up in
+        // between makes the move fail, instead of being pushed past head
+        // Single copy mode: the bytes belong to the firmware, only the slots can run out
+        for (;;) {
+            tail = frame_ring_tail(r, i);
+            lag = frame_ring_distance(r, tail, r->head);
+            if ((lag < r->size - 1) && ((cb->source != NULL) || (cb_tail_bytes(cb, tail) + len <= cb->size))) break;
+
+            if (cb->overrun == OVERRUN_DROP_NEWEST) {
+                cb->dropped_newest++;
+                return -1;
+            } else if (cb->overrun == OVERRUN_DROP_OLDEST) {
+                if (frame_ring_advance(r, i, tail, frame_ring_next(r, tail))) cb->dropped_oldest++;
+            } else {
+                if (frame_ring_advance(r, i, tail, r->head)) {
+                    cb->dropped_oldest += lag;
+                    cb->resets++;
+                }
+            }
+        }
+    }
+
+    return frame_ring_write_slot(r);
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Wakeup scheduler for the capture loop.
+ *
+ * The firmware stamps every frame with frame_header.time (msec).
+ * The minimum of (local time - firmware time) seen over a window of
+ * frames is the delay of a wakeup that happens right after the write:
+ * it maps firmware times to local times, so that we can predict the
+ * next write and measure how late we woke up.
+ * The interval between writes is learnt from the times of consecutive
+ * frames. The measured write index cadence is used instead when the
+ * firmware times don't agree with it (different unit, frozen clock).
+ */
+
+#include "poll_scheduler.h"
+
+#include <stdio.h>
+#include <limits.h>
+#include <time.h>
+
+extern int debug;
+
+// Upper bounds of the buckets of the wakeup delay histogram (usec), the last bucket has none
+static const int poll_histogram_bound[POLL_HISTOGRAM_BUCKETS - 1] = {
+    50, 100, 200, 500, 1000, 2000, 5000, 10000
+};
+
+long long current_timestamp();
+
+long long poll_scheduler_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void poll_scheduler_init(poll_scheduler *ps)
+{
+    int i;
+
+    ps->period = POLL_PERIOD_DEFAULT;
+    ps->cadence = POLL_PERIOD_DEFAULT;
+    ps->misses = 0;
+    ps->last_write = 0;
+    ps->last_fw_time = 0;
+    ps->fw_time_valid = 0;
+    ps->offset = LLONG_MAX;
+    ps->offset_next = LLONG_MAX;
+    ps->offset_count = 0;
+    ps->last_data = 0;
+    ps->wakeups = 0;
+    ps->empty_wakeups = 0;
+    ps->late_count = 0;
+    ps->late_sum = 0;
+    ps->late_max = 0;
+    ps->stats_start = poll_scheduler_now();
+    ps->wake_expected = 0;
+    for (i = 0; i < POLL_HISTOGRAM_BUCKETS; i++) {
+        ps->wake_histogram[i] = 0;
+    }
+    ps->wake_delay_max = 0;
+}
+
+// Call it when the capture restarts after a pause: the timing learnt before
+// is stale, the statistics and the wakeup delay histogram are kept
+void poll_scheduler_resume(poll_scheduler *ps)
+{
+    ps->misses = 0;
+    ps->last_write = 0;
+    ps->fw_time_valid = 0;
+    ps->offset = LLONG_MAX;
+    ps->offset_next = LLONG_MAX;
+    ps->offset_count = 0;
+    ps->last_data = 0;
+    ps->wake_expected = 0;
+}
+
+// Call it for every new frame, in the order they are found in the buffer
+void poll_scheduler_frame(poll_scheduler *ps, uint32_t fw_time, long long now)
+{
+    long long sample = now - fw_time * 1000LL;
+    long long write_time, late;
+    int delta;
+
+    if (ps->fw_time_valid) {
+        delta = (int) (fw_time - ps->last_fw_time);
+        // Ignore restarts of the firmware clock and long gaps
+        if ((delta >= 0) && (delta < 1000)) {
+            ps->period += (delta * 1000 - ps->period) / 8;
+        } else {
+            ps->offset = LLONG_MAX;
+            ps->offset_next = LLONG_MAX;
+            ps->offset_count = 0;
+        }
+    }
+    ps->last_fw_time = fw_time;
+    ps->fw_time_valid = 1;
+
+    // Sliding minimum: a new window replaces the old one to follow clock drift
+    if (sample < ps->offset) ps->offset = sample;
+    if (sample < ps->offset_next) ps->offset_next = sample;
+    if (++ps->offset_count >= POLL_OFFSET_WINDOW) {
+        ps->offset = ps->offset_next;
+        ps->offset_next = LLONG_MAX;
+        ps->offset_count = 0;
+    }
+
+    write_time = fw_time * 1000LL + ps->offset;
+    if (write_time > ps->last_write) ps->last_write = write_time;
+
+    late = now - write_time;
+    ps->late_sum += late;
+    ps->late_count++;
+    if (late > ps->late_max) ps->late_max = late;
+}
+
+// Call it once per wakeup with the number of new frames found
+void poll_scheduler_wakeup(poll_scheduler *ps, int frames, long long now)
+{
+    ps->wakeups++;
+    if (frames == 0) {
+        ps->empty_wakeups++;
+        ps->misses++;
+        return;
+    }
+
+    if (ps->last_data != 0) {
+        ps->cadence += ((int) ((now - ps->last_data) / frames) - ps->cadence) / 8;
+    }
+    ps->last_data = now;
+    ps->misses = 0;
+}
+
+// The firmware times are usable if their period agrees with the measured one
+static int poll_scheduler_fw_time_ok(poll_scheduler *ps)
+{
+    return ps->fw_time_valid && (ps->period * 4 >= ps->cadence) && (ps->period <= ps->cadence * 4);
+}
+
+// Return the time to sleep before the next poll (usec)
+int poll_scheduler_next(poll_scheduler *ps, long long now)
+{
+    long long wait;
+
+    if (ps->misses == 0) {
+        // Wake up just after the next expected write
+        if (poll_scheduler_fw_time_ok(ps)) {
+            wait = ps->last_write + ps->period + POLL_GUARD - now;
+        } else {
+            wait = ps->last_data + ps->cadence + POLL_GUARD - now;
+        }
+    } else {
+        // The write is late or the stream stalled: back off
+        wait = (ps->misses < 8) ? (long long) POLL_GUARD << ps->misses : POLL_MAX;
+    }
+
+    if (wait < POLL_MIN) wait = POLL_MIN;
+    if (wait > POLL_MAX) wait = POLL_MAX;
+
+    ps->wake_expected = now + wait;
+    return (int) wait;
+}
+
+// Call it when the capture wakes up, to measure how late it is on the time asked to poll_scheduler_next()
+void poll_scheduler_woken(poll_scheduler *ps, long long now)
+{
+    long long delay;
+    int i;
+
+    if (ps->wake_expected == 0) return;
+    delay = now - ps->wake_expected;
+    ps->wake_expected = 0;
+
+    for (i = 0; i < POLL_HISTOGRAM_BUCKETS - 1; i++) {
+        if (delay < poll_histogram_bound[i]) break;
+    }
+    ps->wake_histogram[i]++;
+    if (delay > ps->wake_delay_max) ps->wake_delay_max = delay;
+}
+
+void poll_scheduler_stats(poll_scheduler *ps, long long now)
+{
+    long long elapsed = now - ps->stats_start;
+
+    if (elapsed < POLL_STATS_INTERVAL) return;
+
+    if (debug) {
+        if (poll_scheduler_fw_time_ok(ps)) {
+            fprintf(stderr, "%lld: capture - poll stats - wakeups/s: %.1f - empty: %u/%u - period: %d us - late avg: %lld us - late max: %lld us\n",
+                    current_timestamp(), ps->wakeups * 1000000.0 / elapsed,
+                    ps->empty_wakeups, ps->wakeups, ps->period,
+                    (ps->late_count > 0) ? ps->late_sum / ps->late_count : 0, ps->late_max);
+        } else {
+            fprintf(stderr, "%lld: capture - poll stats - wakeups/s: %.1f - empty: %u/%u - cadence: %d us - frame time not usable, lateness unknown\n",
+                    current_timestamp(), ps->wakeups * 1000000.0 / elapsed,
+                    ps->empty_wakeups, ps->wakeups, ps->cadence);
+        }
+        fprintf(stderr, "%lld: capture - wakeup delay since start - <50us: %u - <100us: %u - <200us: %u - <500us: %u - <1ms: %u - <2ms: %u - <5ms: %u - <10ms: %u - >=10ms: %u - max: %lld us\n",
+                current_timestamp(), ps->wake_histogram[0], ps->wake_histogram[1], ps->wake_histogram[2],
+                ps->wake_histogram[3], ps->wake_histogram[4], ps->wake_histogram[5], ps->wake_histogram[6],
+                ps->wake_histogram[7], ps->wake_histogram[8], ps->wake_delay_max);
+    }
+
+    ps->wakeups = 0;
+    ps->empty_wakeups = 0;
+    ps->late_count = 0;
+    ps->late_sum = 0;
+    ps->late_max = 0;
+    ps->stats_start = now;
+}
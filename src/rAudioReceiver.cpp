@@ -26,6 +26,8 @@
 
 #include "rAudioStreamerReceiver.h"
 #include "ADTS2PCMFileSink.hh"
+#include "AACRedundancyDecoder.hh"
+#include "AACDeinterleaver.hh"
 #include "speaker.h"
 
 #include "errno.h"
@@ -33,6 +35,8 @@
 #include "pthread.h"
 
 void afterPlaying(void* clientData); // forward
+void redStats(void* clientData); // forward
+void deinterleaveStats(void* clientData); // forward
 
 // A structure to hold the state of the current session.
 // It is used in the "afterPlaying()" function to clean up the session.
@@ -42,8 +46,13 @@ struct sessionState_t {
     RTCPInstance* rtcpInstance;
     Groupsock* rtpGroupsock;
     Groupsock* rtcpGroupsock;
+    AACRedundancyDecoder* redundancy;       // NULL without --red
+    AACDeinterleaver* deinterleaver;        // NULL without --deinterleave
 } sessionState;
 
+#define RED_STATS_INTERVAL 30000000         // us
+#define DEINTERLEAVE_STATS_INTERVAL 30000000    // us
+
 UsageEnvironment* env;
 
 int packet_counter;
@@ -77,9 +86,14 @@ void print_usage(char *progname)
     fprintf(stderr, "\t-x TYPE, --xcast TYPE\n");
     fprintf(stderr, "\t\tset unicast, multicast or ssm (source-specific multicast)\n");
     fprintf(stderr, "\t-u ADDRESS, --source ADDRESS\n");
-    fprintf(stderr, "\t\tsource address when ssm is selected\n");
+    fprintf(stderr, "\t\tsource address when ssm is selected, with unicast the RTCP reports are sent to it\n");
     fprintf(stderr, "\t-i,   --ipv6\n");
     fprintf(stderr, "\t\tuse ipv6 instead of ipv4\n");
+    fprintf(stderr, "\t-e,   --red\n");
+    fprintf(stderr, "\t\tthe stream carries RFC 2198 redundant frames (streamer --red), rebuild the lost ones\n");
+    fprintf(stderr, "\t-L MS, --deinterleave MS\n");
+    fprintf(stderr, "\t\tput back in order the frames of the streamer --interleave, waiting at most MS ms for the missing ones\n");
+    fprintf(stderr, "\t\t(at least PACKETS x FRAMES x 64 ms at 16 kHz), the lost frames are concealed\n");
     fprintf(stderr, "\t-g,   --gpio\n");
     fprintf(stderr, "\t\tenable and disable gpio to activate the speaker (only Allwinner-v2)\n");
     fprintf(stderr, "\t-d,   --debug\n");
@@ -96,6 +110,8 @@ int main(int argc, char** argv) {
     char cast[16];
     char source_address[16];
     int ipv6 = 0;
+    int red = 0;
+    int deinterleave = 0;
     char *endptr;
 
     int pth_ret;
@@ -118,6 +134,8 @@ int main(int argc, char** argv) {
             {"source",  required_argument, 0, 'u'},
             {"ipv6",  no_argument, 0, 'i'},
             {"pc",  no_argument, 0, 'p'},
+            {"red",  no_argument, 0, 'e'},
+            {"deinterleave",  required_argument, 0, 'L'},
             {"gpio",  no_argument, 0, 'g'},
             {"debug",  no_argument, 0, 'd'},
             {"help",  no_argument, 0, 'h'},
@@ -126,7 +144,7 @@ int main(int argc, char** argv) {
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long (argc, argv, "s:c:x:u:ipgdh",
+        c = getopt_long (argc, argv, "s:c:x:u:ipeL:gdh",
                          long_options, &option_index);
 
         /* Detect the end of the options. */
@@ -197,6 +215,19 @@ int main(int argc, char** argv) {
             packet_counter = 1;
             break;
 
+        case 'e':
+            red = 1;
+            break;
+
+        case 'L':
+            errno = 0;
+            deinterleave = strtol(optarg, &endptr, 10);
+            if ((errno != 0) || (endptr == optarg) || (deinterleave < 1) || (deinterleave > 10000)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
         case 'g':
             gpio = 1;
             break;
@@ -220,6 +251,11 @@ int main(int argc, char** argv) {
         }
     }
 
+    if (red && deinterleave) {
+        fprintf(stderr, "--red and --deinterleave can't be used together\n");
+        exit(EXIT_FAILURE);
+    }
+
     if ((strcasecmp("ssm", cast) == 0) && (source_address[0] == '\0')) {
         print_usage(argv[0]);
         exit(EXIT_FAILURE);
@@ -288,20 +324,49 @@ int main(int argc, char** argv) {
     } else {
         sessionState.rtpGroupsock = new Groupsock(*env, sessionAddress, rtpPort, ttl);
         sessionState.rtcpGroupsock = new Groupsock(*env, sessionAddress, rtcpPort, ttl);
+        if ((strcasecmp("unicast", cast) == 0) && (source_address[0] != '\0')) {
+            // Unicast: send the RRs to the streamer, they keep it out of the idle mode
+            NetAddressList sourceAddresses(source_address);
+            struct sockaddr_storage sourceAddress;
+            copyAddress(sourceAddress, sourceAddresses.firstAddress());
+            sessionState.rtcpGroupsock->changeDestinationParameters(sourceAddress, 0, ~0);
+        }
     }
 
     RTPSource* rtpSource;
 
     // Create the data source: a "MPEG4 Generic RTP source"
     unsigned char rtpPayloadFormat = 97; // a dynamic payload type
-    rtpSource
-        = MPEG4GenericRTPSource::createNew(*env, sessionState.rtpGroupsock,
-            rtpPayloadFormat,
-            0, //SAMPLING_FREQ,
-            "audio", "aac-hbr",
-            13,   // unsigned sizeLength
-            3,    // unsigned indexLength,
-            3);   // unsigned indexDeltaLength
+    sessionState.redundancy = NULL;
+    sessionState.deinterleaver = NULL;
+    if (red) {
+        // RFC 2198: one payload per packet, the decoder extracts the AUs
+        rtpSource
+            = SimpleRTPSource::createNew(*env, sessionState.rtpGroupsock,
+                RED_PAYLOAD_FORMAT,
+                sample_rate,
+                "audio/RED",
+                0,
+                False);
+    } else if (deinterleave) {
+        // The AU headers are needed to put the AUs back in order: one payload per packet
+        rtpSource
+            = SimpleRTPSource::createNew(*env, sessionState.rtpGroupsock,
+                rtpPayloadFormat,
+                sample_rate,
+                "audio/MPEG4-GENERIC",
+                0,
+                False);
+    } else {
+        rtpSource
+            = MPEG4GenericRTPSource::createNew(*env, sessionState.rtpGroupsock,
+                rtpPayloadFormat,
+                0, //SAMPLING_FREQ,
+                "audio", "aac-hbr",
+                13,   // unsigned sizeLength
+                3,    // unsigned indexLength,
+                3);   // unsigned indexDeltaLength
+    }
 
     // Create (and start) a 'RTCP instance' for the RTP source:
     const unsigned estimatedSessionBandwidth = 50; // in kbps; for RTCP b/w share
@@ -316,6 +381,16 @@ int main(int argc, char** argv) {
     // Note: This starts RTCP running automatically
 
     sessionState.source = rtpSource;
+    if (red) {
+        sessionState.redundancy = AACRedundancyDecoder::createNew(*env, rtpSource, sample_rate, rtpPayloadFormat);
+        sessionState.source = sessionState.redundancy;
+        env->taskScheduler().scheduleDelayedTask(RED_STATS_INTERVAL, redStats, NULL);
+    } else if (deinterleave) {
+        sessionState.deinterleaver = AACDeinterleaver::createNew(*env, rtpSource, sample_rate, deinterleave);
+        sessionState.source = sessionState.deinterleaver;
+        fprintf(stderr, "De-interleaving with up to %u frames of latency\n", sessionState.deinterleaver->windowAUs());
+        env->taskScheduler().scheduleDelayedTask(DEINTERLEAVE_STATS_INTERVAL, deinterleaveStats, NULL);
+    }
 
     // Finally, start receiving the stream:
     fprintf(stderr, "Beginning receiving stream...\n");
@@ -329,6 +404,54 @@ int main(int argc, char** argv) {
     return 0; // only to prevent compiler warning
 }
 
+// Print the frames rebuilt from the redundancy and what they cost,
+// to choose the depth of the streamer for this link
+void redStats(void* /*clientData*/) {
+    static unsigned primary_prev = 0, recovered_prev = 0, lost_prev = 0, bytes_prev = 0, redundant_prev = 0;
+    AACRedundancyDecoder* r = sessionState.redundancy;
+    unsigned primary = r->primaryAUs();
+    unsigned recovered = r->recoveredAUs();
+    unsigned lost = r->lostAUs();
+    unsigned bytes = r->bytes();
+    unsigned redundant = r->redundantBytes();
+
+    if (bytes != bytes_prev) {
+        fprintf(stderr, "red stats - frames received: %u - recovered: %u - lost: %u - redundancy: %.1f%% of the payload (total recovered: %u, lost: %u)\n",
+                primary - primary_prev, recovered - recovered_prev, lost - lost_prev,
+                100.0 * (redundant - redundant_prev) / (bytes - bytes_prev), recovered, lost);
+    }
+    primary_prev = primary;
+    recovered_prev = recovered;
+    lost_prev = lost;
+    bytes_prev = bytes;
+    redundant_prev = redundant;
+
+    env->taskScheduler().scheduleDelayedTask(RED_STATS_INTERVAL, redStats, NULL);
+}
+
+// Print how the missing frames were spread: isolated ones are concealed well
+void deinterleaveStats(void* /*clientData*/) {
+    static unsigned aus_prev = 0, concealed_prev = 0, late_prev = 0, single_prev = 0, long_prev = 0;
+    AACDeinterleaver* d = sessionState.deinterleaver;
+    unsigned aus = d->aus();
+    unsigned concealed = d->concealedAUs();
+    unsigned late = d->lateAUs();
+    unsigned single = d->singleGaps();
+    unsigned longer = d->longGaps();
+
+    if ((aus != aus_prev) || (concealed != concealed_prev)) {
+        fprintf(stderr, "deinterleave stats - frames received: %u - concealed: %u - too late: %u - gaps of 1 frame: %u - longer gaps: %u\n",
+                aus - aus_prev, concealed - concealed_prev, late - late_prev, single - single_prev, longer - long_prev);
+    }
+    aus_prev = aus;
+    concealed_prev = concealed;
+    late_prev = late;
+    single_prev = single;
+    long_prev = longer;
+
+    env->taskScheduler().scheduleDelayedTask(DEINTERLEAVE_STATS_INTERVAL, deinterleaveStats, NULL);
+}
+
 void afterPlaying(void* /*clientData*/) {
     fprintf(stderr, "...done receiving\n");
 
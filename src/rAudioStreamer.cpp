@@ -24,8 +24,25 @@
 #include "BasicUsageEnvironment.hh"
 
 #include "AudioFramedMemorySource.hh"
+#include "VideoFramedMemorySource.hh"
+#include "AACAggregator.hh"
+#include "AACRedundancy.hh"
+#include "AACInterleaver.hh"
+#include "AAC2PCMFilter.hh"
+#include "AACTranscoder.hh"
+#include "AACClipSource.hh"
+#include "AudioFramedMemoryServerMediaSubsession.hh"
+#include "BatchGroupsock.hh"
+
+#include "control_socket.h"
 
 #include "rAudioStreamerReceiver.h"
+#include "fshare_parser.h"
+#include "frame_bus.h"
+#include "poll_scheduler.h"
+#include "realtime.h"
+#include "resync.h"
+#include "g711.h"
 
 #include <getopt.h>
 #include <pthread.h>
@@ -35,43 +52,237 @@
 #include <fcntl.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <arpa/inet.h>
 
 // A structure to hold the state of the current session.
 // It is used in the "afterPlaying()" function to clean up the session.
 struct sessionState_t {
     FramedSource* source;
+    AACAggregator* aggregator;              // NULL if each AU is sent in its own packet
+    AACRedundancy* redundancy;              // NULL without RFC 2198 redundancy
+    AACInterleaver* interleaver;            // NULL if the AUs are sent in order
+    AAC2PCMFilter* pcm;                     // NULL if the AUs are sent, not the decoded audio
+    AACTranscoder* transcoder;              // NULL if the AUs of the firmware are sent
     RTPSink* sink;
     RTCPInstance* rtcpInstance;
     Groupsock* rtpGroupsock;
     Groupsock* rtcpGroupsock;
 } sessionState;
 
+// The same for the video sessions
+struct videoSessionState_t {
+    cb_output_buffer *buffer;
+    unsigned short port;                    // RTP port, for the destinations added later
+    FramedSource* memorySource;
+    FramedSource* source;
+    RTPSink* sink;
+    RTCPInstance* rtcpInstance;
+    Groupsock* rtpGroupsock;
+    Groupsock* rtcpGroupsock;
+} videoSessionState[2];
+int videoSessions;
+
+// The decoded audio sent alongside the AAC stream, on its own port
+struct pcmSessionState_t {
+    FramedSource* source;
+    AAC2PCMFilter* filter;
+    RTPSink* sink;
+    RTCPInstance* rtcpInstance;
+    Groupsock* rtpGroupsock;
+    Groupsock* rtcpGroupsock;
+} pcmSessionState;
+
 Boolean isSSM;
 
 int buf_offset;
 int buf_size;
 int frame_header_size;
 
+// Decoder of the frame header, bound to the layout of the model at startup
+typedef void (*frame_header_decoder)(struct frame_header *fh, unsigned char *src);
+#ifdef SINGLE_LAYOUT
+// Build for a single header layout: the decoder is called directly
+#define cb2s_header(fh, src) cb2s_header_decode<frame_header_layout<SINGLE_LAYOUT>::type>(fh, src)
+#else
+frame_header_decoder cb2s_header;
+#endif
+
 int packet_counter;
+int single_copy;
+int threadless;
+int video_high;
+int video_low;
+int video_port;
+int realtime_priority;                      // SCHED_FIFO priority of the capture, 0 if not realtime
+int realtime_cpu;                           // cpu of the capture and of the event loop, -1 if any
+char *bus_name;
+frame_bus_header *frame_bus;
+int overrun_policy;
+int aggregate_latency;                      // max latency added by the AU aggregation (ms), 0 to disable
+int ipv6;
+char *control_path;
+int rtsp_port;                              // RTSP server mode, 0 to push the RTP stream
+int preroll;                                // audio sent at once to a new RTSP client (ms)
+int batch_send;                             // send a packet to all the destinations with one sendmmsg(), opt-in
+int red_depth;                              // previous AUs sent again in each packet (RFC 2198), 0 to disable
+unsigned int interleave_packets;            // packets of an interleaved group, 0 to disable
+unsigned int interleave_frames;             // AUs in each of them
+int pcm_encoding;                           // PCM_ENCODING_* of the decoded audio, -1 to disable
+int pcm_port;                               // RTP port of the decoded audio, 0 to send it instead of the AAC stream
+
+// Adaptive bitrate: the AUs are encoded again at the bitrate that the
+// worst receiver can take, from the loss and the jitter of its RTCP RRs
+int adapt_min;                              // lowest bitrate (kbps), 0 to disable
+int adapt_max;                              // highest bitrate (kbps)
+int adapt_budget;                           // cpu of the re-encoding, % of a core
+static const unsigned adapt_steps[] = { 64000, 48000, 40000, 32000, 24000, 20000, 16000, 12000, 8000 };
+#define ADAPT_STEPS (sizeof(adapt_steps) / sizeof(adapt_steps[0]))
+int adapt_clip_done;                        // the calibration clip went through the transcoder
+struct adaptState_t {
+    unsigned int step;                      // index in adapt_steps of the current bitrate
+    unsigned int first;                     // of adapt_max
+    unsigned int last;                      // of adapt_min
+    unsigned int good;                      // checks in a row with a clean link
+    unsigned int changes;                   // bitrate changes since start
+    unsigned int over;                      // checks in a row over the budget without afterburner
+    long long resume;                       // the AUs are forwarded until then, then encoded again (ms)
+    long long hold;                         // no changes until then (ms)
+    long long checked;                      // last check (ms)
+    struct timeval checked_tv;              // the same, the RRs received after it are new
+    long long cpu;                          // cpu time of the transcoder at the last check (ns)
+    double cost_max;                        // calibration, % of a core: MAX with the afterburner
+    double cost_min;                        // MIN without, the cheapest
+} adaptState;
+
+// Idle mode: without listeners the capture is parked, it only checks
+// that the firmware is alive, and the sinks wait for frames that don't come
+int idle_timeout;                           // park the capture after this many s without listeners, 0 to disable
+int capture_idle;                           // set by the event loop, read by the capture
+int idle_event_fd;                          // wakes up the parked capture thread
+TaskToken capture_task_token;               // next run of the capture in threadless mode
+struct idleState_t {
+    long long last_listener;                // last RTCP RR, new destination or client (ms)
+    long long since;                        // start of the current idle period (ms)
+    long long cpu_since;                    // cpu time of the process at the start of the period (usec)
+    unsigned int polls;                     // liveness polls of the parked capture
+    unsigned int checks;                    // runs of idle_check_task while parked
+    unsigned int periods;                   // idle periods since start
+    long long total;                        // time spent parked (ms)
+    long long alive;                        // last time the firmware was seen writing (ms)
+} idleState;
+
+// Unicast destinations: each sink builds a packet once and its groupsock
+// sends it to all of them, the RTCP groupsock does the same with the SRs
+struct destination_t {
+    unsigned sessionId;                     // id of the destination in the groupsocks, 0 if the entry is free
+    struct sockaddr_storage address;
+    unsigned short port;                    // audio RTP port, RTCP on port + 1
+    char name[80];
+    long long added;
+    long long last_rr;                      // time of the last RTCP RR received from it, 0 if none
+    unsigned rr_count;
+} destinations[DESTINATIONS_MAX];
+char *destination_args[DESTINATIONS_MAX];   // set by -a, added when the sessions are created
+int destination_arg_count;
+
+// Geometry of the output buffers, set by --ring
+#define RING_AUDIO 0
+#define RING_HIGH 1
+#define RING_LOW 2
+struct ringGeometry_t {
+    const char *name;
+    unsigned int size;                      // bytes, not used in single copy mode
+    unsigned int slots;                     // frames
+} ringGeometry[] = {
+    { "audio", OUTPUT_BUFFER_SIZE_AUDIO, OUTPUT_BUFFER_SLOTS_AUDIO },
+    { "high",  OUTPUT_BUFFER_SIZE_HIGH,  OUTPUT_BUFFER_SLOTS_VIDEO },
+    { "low",   OUTPUT_BUFFER_SIZE_LOW,   OUTPUT_BUFFER_SLOTS_VIDEO },
+};
 int debug;                                  /* Set to 1 to debug this .c */
-int model;
+const model_desc *model;
 int freq;
 int chan;
 
 extern unsigned const samplingFrequencyTable[16];
 
+static const model_desc model_table[] = {
+    { "y203c",      Y203C,      PLATFORM_MSTAR,     BUF_OFFSET_MSTAR,       FRAME_HEADER_SIZE_MSTAR },
+    { "y23",        Y23,        PLATFORM_MSTAR,     BUF_OFFSET_MSTAR,       FRAME_HEADER_SIZE_MSTAR },
+    { "y25",        Y25,        PLATFORM_MSTAR,     BUF_OFFSET_MSTAR,       FRAME_HEADER_SIZE_MSTAR },
+    { "y30",        Y30,        PLATFORM_MSTAR,     BUF_OFFSET_MSTAR,       FRAME_HEADER_SIZE_MSTAR },
+    { "h201c",      H201C,      PLATFORM_MSTAR,     BUF_OFFSET_MSTAR,       FRAME_HEADER_SIZE_MSTAR },
+    { "h305r",      H305R,      PLATFORM_MSTAR,     BUF_OFFSET_MSTAR,       FRAME_HEADER_SIZE_MSTAR },
+    { "h307",       H307,       PLATFORM_MSTAR,     BUF_OFFSET_MSTAR,       FRAME_HEADER_SIZE_MSTAR },
+
+    { "y20ga",      Y20GA,      PLATFORM_ALLWINNER, BUF_OFFSET_Y20GA,       FRAME_HEADER_SIZE_Y20GA },
+    { "y25ga",      Y25GA,      PLATFORM_ALLWINNER, BUF_OFFSET_Y25GA,       FRAME_HEADER_SIZE_Y25GA },
+    { "y30qa",      Y30QA,      PLATFORM_ALLWINNER, BUF_OFFSET_Y30QA,       FRAME_HEADER_SIZE_Y30QA },
+    { "y501gc",     Y501GC,     PLATFORM_ALLWINNER, BUF_OFFSET_Y501GC,      FRAME_HEADER_SIZE_Y501GC },
+
+    { "y21ga",      Y21GA,      PLATFORM_ALLWINNER, BUF_OFFSET_Y21GA,       FRAME_HEADER_SIZE_Y21GA },
+    { "y211ga",     Y211GA,     PLATFORM_ALLWINNER, BUF_OFFSET_Y211GA,      FRAME_HEADER_SIZE_Y211GA },
+    { "y213ga",     Y213GA,     PLATFORM_ALLWINNER, BUF_OFFSET_Y213GA,      FRAME_HEADER_SIZE_Y213GA },
+    { "y291ga",     Y291GA,     PLATFORM_ALLWINNER, BUF_OFFSET_Y291GA,      FRAME_HEADER_SIZE_Y291GA },
+    { "h30ga",      H30GA,      PLATFORM_ALLWINNER, BUF_OFFSET_H30GA,       FRAME_HEADER_SIZE_H30GA },
+    { "r30gb",      R30GB,      PLATFORM_ALLWINNER, BUF_OFFSET_R30GB,       FRAME_HEADER_SIZE_R30GB },
+    { "r35gb",      R35GB,      PLATFORM_ALLWINNER, BUF_OFFSET_R35GB,       FRAME_HEADER_SIZE_R35GB },
+    { "r40ga",      R40GA,      PLATFORM_ALLWINNER, BUF_OFFSET_R40GA,       FRAME_HEADER_SIZE_R40GA },
+    { "h51ga",      H51GA,      PLATFORM_ALLWINNER, BUF_OFFSET_H51GA,       FRAME_HEADER_SIZE_H51GA },
+    { "h52ga",      H52GA,      PLATFORM_ALLWINNER, BUF_OFFSET_H52GA,       FRAME_HEADER_SIZE_H52GA },
+    { "h60ga",      H60GA,      PLATFORM_ALLWINNER, BUF_OFFSET_H60GA,       FRAME_HEADER_SIZE_H60GA },
+    { "y28ga",      Y28GA,      PLATFORM_ALLWINNER, BUF_OFFSET_Y28GA,       FRAME_HEADER_SIZE_Y28GA },
+    { "y29ga",      Y29GA,      PLATFORM_ALLWINNER, BUF_OFFSET_Y29GA,       FRAME_HEADER_SIZE_Y29GA },
+    { "y623",       Y623,       PLATFORM_ALLWINNER, BUF_OFFSET_Y623,        FRAME_HEADER_SIZE_Y623 },
+    { "q321br_lsx", Q321BR_LSX, PLATFORM_ALLWINNER, BUF_OFFSET_Q321BR_LSX,  FRAME_HEADER_SIZE_Q321BR_LSX },
+    { "qg311r",     QG311R,     PLATFORM_ALLWINNER, BUF_OFFSET_QG311R,      FRAME_HEADER_SIZE_QG311R },
+    { "b091qp",     B091QP,     PLATFORM_ALLWINNER, BUF_OFFSET_B091QP,      FRAME_HEADER_SIZE_B091QP },
+};
+
+// Offsets used by older firmwares, probed by -m auto
+static const model_desc model_probe_table[] = {
+    { "mstar_old",  MODEL_AUTO, PLATFORM_MSTAR,     BUF_OFFSET_MSTAR_OLD,   FRAME_HEADER_SIZE_MSTAR },
+};
+
+// Filled by the probe
+model_desc model_auto = { "auto", MODEL_AUTO, PLATFORM_ALLWINNER, 0, 0 };
+
+// Return the parameters of the model called name, or NULL
+const model_desc *model_find(const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(model_table) / sizeof(model_table[0]); i++) {
+        if (strcasecmp(model_table[i].name, name) == 0) return &model_table[i];
+    }
+    return NULL;
+}
+
+char volatile capture_ready;                // set when the stream type is detected
+pthread_mutex_t capture_ready_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t capture_ready_cond = PTHREAD_COND_INITIALIZER;
+
+// Startup trace, printed with -d
+static const char *startup_step_name[STARTUP_STEPS] = {
+    "exec", "mmap", "first frame", "stream type detected", "first rtp packet", "adapt calibration"
+};
+long long startup_time[STARTUP_STEPS];
+
 cb_input_buffer input_buffer;
 cb_output_buffer output_buffer_audio;
+cb_output_buffer output_buffer_video_high;
+cb_output_buffer output_buffer_video_low;
 
 UsageEnvironment* env;
 
-// To make the second and subsequent client for each stream reuse the same
-// input stream as the first client (rather than playing the file from the
-// start for each client), change the following "False" to "True":
-Boolean reuseFirstSource = True;
-
 void play(); // forward
 void afterPlaying(void* clientData); // forward
+void afterPlayingVideo(void* clientData); // forward
+void afterPlayingPcm(void* clientData); // forward
+void rtp_stats(long long now); // forward
+void pcm_stats(long long now, AAC2PCMFilter *filter); // forward
+void adapt_stats(long long now); // forward
 
 long long current_timestamp() {
     struct timeval te; 
@@ -81,21 +292,14 @@ long long current_timestamp() {
     return milliseconds;
 }
 
-void s2cb_memcpy(cb_output_buffer *dest, unsigned char *src, size_t n)
+// Save the time of a startup step, only the first time
+void startup_trace(int step)
 {
-    unsigned char *uc_dest = dest->write_index;
+    if (startup_time[step] != 0) return;
 
-    if (uc_dest + n > dest->buffer + dest->size) {
-        memcpy(uc_dest, src, dest->buffer + dest->size - uc_dest);
-        memcpy(dest->buffer, src + (dest->buffer + dest->size - uc_dest), n - (dest->buffer + dest->size - uc_dest));
-        dest->write_index = n + uc_dest - dest->size;
-    } else {
-        memcpy(uc_dest, src, n);
-        dest->write_index += n;
-    }
-    if (dest->write_index == dest->buffer + dest->size) {
-        dest->write_index = dest->buffer;
-    }
+    startup_time[step] = poll_scheduler_now();
+    if (debug) fprintf(stderr, "%lld: startup - %s - +%lld ms\n", current_timestamp(),
+                startup_step_name[step], (startup_time[step] - startup_time[STARTUP_EXEC]) / 1000);
 }
 
 void cb2cb_memcpy(cb_output_buffer *dest, cb_input_buffer *src, size_t n)
@@ -132,13 +336,13 @@ unsigned char *cb_memmem(unsigned char *src, int src_len, unsigned char *what, i
 
 unsigned char *cb_move(unsigned char *buf, int offset)
 {
-    buf += offset;
-    if ((offset > 0) && (buf > input_buffer.buffer + input_buffer.size))
-        buf -= (input_buffer.size - input_buffer.offset);
-    if ((offset < 0) && (buf < input_buffer.buffer + input_buffer.offset))
-        buf += (input_buffer.size - input_buffer.offset);
+    return fshare_move(&input_buffer, buf, offset);
+}
 
-    return buf;
+// Distance from buf to end, moving forward in the circular buffer
+int cb_distance(unsigned char *buf, unsigned char *end)
+{
+    return fshare_distance(&input_buffer, buf, end);
 }
 
 // The second argument is the circular buffer
@@ -160,341 +364,1840 @@ int cb_memcmp(unsigned char *str1, unsigned char *str2, size_t n)
 // The second argument is the circular buffer
 void cb2s_memcpy(unsigned char *dest, unsigned char *src, size_t n)
 {
-    if (src + n > input_buffer.buffer + input_buffer.size) {
-        memcpy(dest, src, input_buffer.buffer + input_buffer.size - src);
-        memcpy(dest + (input_buffer.buffer + input_buffer.size - src), input_buffer.buffer + input_buffer.offset, n - (input_buffer.buffer + input_buffer.size - src));
-    } else {
-        memcpy(dest, src, n);
-    }
+    fshare_memcpy(&input_buffer, dest, src, n);
 }
 
 // The second argument is the circular buffer
-void cb2s_headercpy(unsigned char *dest, unsigned char *src, size_t n)
-{
-    struct frame_header *fh = (struct frame_header *) dest;
-    struct frame_header_19 fh19;
-    struct frame_header_22 fh22;
-    struct frame_header_24 fh24;
-    struct frame_header_26 fh26;
-    struct frame_header_28 fh28;
-    unsigned char *fp = NULL;
-
-    if (n == sizeof(fh19)) {
-        fp = (unsigned char *) &fh19;
-    } else if (n == sizeof(fh22)) {
-        fp = (unsigned char *) &fh22;
-    } else if (n == sizeof(fh24)) {
-        fp = (unsigned char *) &fh24;
-    } else if (n == sizeof(fh26)) {
-        fp = (unsigned char *) &fh26;
-    } else if (n == sizeof(fh28)) {
-        fp = (unsigned char *) &fh28;
-    }
-    if (fp == NULL) return;
-
-    if (src + n > input_buffer.buffer + input_buffer.size) {
-        memcpy(fp, src, input_buffer.buffer + input_buffer.size - src);
-        memcpy(fp + (input_buffer.buffer + input_buffer.size - src), input_buffer.buffer + input_buffer.offset, n - (input_buffer.buffer + input_buffer.size - src));
-    } else {
-        memcpy(fp, src, n);
-    }
-    if (n == sizeof(fh19)) {
-        fh->len = fh19.len;
-        fh->counter = (uint32_t) fh19.counter;
-        fh->time = fh19.time;
-        fh->type = fh19.type;
-        fh->stream_counter = fh19.stream_counter;
-    } else if (n == sizeof(fh22)) {
-        fh->len = fh22.len;
-        fh->counter = fh22.counter;
-        fh->time = fh22.time;
-        fh->type = fh22.type;
-        fh->stream_counter = fh22.stream_counter;
-    } else if (n == sizeof(fh24)) {
-        fh->len = fh24.len;
-        fh->counter = fh24.counter;
-        fh->time = fh24.time;
-        fh->type = fh24.type;
-        fh->stream_counter = fh24.stream_counter;
-    } else if (n == sizeof(fh26)) {
-        fh->len = fh26.len;
-        fh->counter = fh26.counter;
-        fh->time = fh26.time;
-        fh->type = fh26.type;
-        fh->stream_counter = fh26.stream_counter;
-    } else if (n == sizeof(fh28)) {
-        fh->len = fh28.len;
-        fh->counter = fh28.counter;
-        fh->time = fh28.time;
-        fh->type = fh28.type;
-        fh->stream_counter = fh28.stream_counter;
-    }
-}
-
-void getAACConfigStr(char *configStr, unsigned samplingFrequency, unsigned numChannels)
-{
-    unsigned samplingFrequencyTable[16] = {
-        96000, 88200, 64000, 48000,
-        44100, 32000, 24000, 22050,
-        16000, 12000, 11025, 8000,
-        7350, 0, 0, 0
-    };
-
-    u_int8_t samplingFrequencyIndex;
+template <typename T> void cb2s_header_decode(struct frame_header *fh, unsigned char *src)
+{
+    fshare_header_decode<T>(&input_buffer, fh, src);
+}
+
+// Return the decoder of the frame header of size n, or NULL
+frame_header_decoder cb2s_header_decoder(int n)
+{
+#ifdef SINGLE_LAYOUT
+    if (n == SINGLE_LAYOUT) return cb2s_header_decode<frame_header_layout<SINGLE_LAYOUT>::type>;
+#else
+    switch (n) {
+    case 19:
+        return cb2s_header_decode<frame_header_layout<19>::type>;
+    case 22:
+        return cb2s_header_decode<frame_header_layout<22>::type>;
+    case 24:
+        return cb2s_header_decode<frame_header_layout<24>::type>;
+    case 26:
+        return cb2s_header_decode<frame_header_layout<26>::type>;
+    case 28:
+        return cb2s_header_decode<frame_header_layout<28>::type>;
+    }
+#endif
+    return NULL;
+}
+
+// Wake up the readers of the buffer waiting for a frame
+void cb_notify(cb_output_buffer *cb)
+{
+    uint64_t one = 1;
     int i;
 
-    for (i = 0; i < 16; i++) {
-        if (samplingFrequency == samplingFrequencyTable[i]) {
-            samplingFrequencyIndex = i;
-            break;
+    for (i = 0; i < FRAME_RING_READERS; i++) {
+        if (frame_ring_active(&(cb->ring), i) && frame_ring_wake(&(cb->ring), i)) {
+            if (write(cb->event_fd[i], &one, sizeof(one)) != sizeof(one)) {
+                if (debug) fprintf(stderr, "%lld: error - could not signal the reader %d\n", current_timestamp(), i);
+            }
         }
     }
-    if (i == 16) samplingFrequencyIndex = 8;
+}
 
-    u_int8_t channelConfiguration = numChannels;
-    if (channelConfiguration == 8) channelConfiguration--;
+// Single copy mode: check that the firmware didn't overwrite a frame read in place
+int cb_frame_unchanged(cb_output_buffer *cb, cb_output_frame *frame)
+{
+    struct frame_header fh;
 
-    // Construct the 'AudioSpecificConfig', and from it, the corresponding ASCII string:
-    unsigned char audioSpecificConfig[2];
-    u_int8_t const audioObjectType = 2;
-    audioSpecificConfig[0] = (audioObjectType<<3) | (samplingFrequencyIndex>>1);
-    audioSpecificConfig[1] = (samplingFrequencyIndex<<7) | (channelConfiguration<<3);
-    sprintf(configStr, "%02X%02X", audioSpecificConfig[0], audioSpecificConfig[1]);
-    if (debug) fprintf(stderr, "%lld: configStr %s\n", current_timestamp(), configStr);
+    // The firmware writes sequentially, the header is overwritten before the data
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    cb2s_header(&fh, cb_move(cb->buffer + frame->offset, -frame_header_size));
+
+    return ((uint16_t) fh.counter == frame->generation) && (fh.len == frame->size);
 }
 
-void *capture(void *ptr)
+// Alloc the output buffer of size bytes and its frame table of slots frames
+// Single copy mode: the buffer is set by cb_output_buffer_alias() after mapping the input buffer
+void cb_output_buffer_init(cb_output_buffer *cb, int type, unsigned int size, unsigned int slots)
 {
-    unsigned char *buf_idx, *buf_idx_cur, *buf_idx_end, *buf_idx_end_prev;
-    unsigned char *buf_idx_start = NULL;
-    int fshm;
+    unsigned int i;
+    int j;
+
+    cb->type = type;
+    cb->codec = CODEC_NONE;
+    cb->overrun = overrun_policy;
+    cb->retain = 0;
+    cb->dropped_newest = 0;
+    cb->dropped_oldest = 0;
+    cb->resets = 0;
+    for (j = 0; j < FRAME_RING_READERS; j++) {
+        cb->lag_max[j] = 0;
+    }
+    if (single_copy) {
+        cb->size = 0;
+        cb->buffer = NULL;
+        cb->source = &input_buffer;
+    } else {
+        cb->size = size;
+        cb->buffer = (unsigned char *) malloc(size * sizeof(unsigned char));
+        cb->source = NULL;
+        if (cb->buffer == NULL) {
+            fprintf(stderr, "could not alloc memory\n");
+            exit(EXIT_FAILURE);
+        }
+        if (realtime_priority > 0) realtime_prefault_write(cb->buffer, size);
+    }
+    cb->write_index = cb->buffer;
+    cb->output_frame = (cb_output_frame *) malloc(slots * sizeof(cb_output_frame));
+    if (cb->output_frame == NULL) {
+        fprintf(stderr, "could not alloc memory\n");
+        exit(EXIT_FAILURE);
+    }
+    frame_ring_init(&(cb->ring), slots);
+    for (i = 0; i < cb->ring.size; i++) {
+        cb->output_frame[i].offset = 0;
+        cb->output_frame[i].counter = 0;
+        cb->output_frame[i].size = 0;
+        cb->output_frame[i].generation = 0;
+        cb->output_frame[i].time = 0;
+    }
+    // The eventfds live as long as the buffer: the capture could signal a reader while it detaches
+    for (j = 0; j < FRAME_RING_READERS; j++) {
+        cb->event_fd[j] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (cb->event_fd[j] == -1) {
+            fprintf(stderr, "could not create eventfd\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
 
-    int frame_type = TYPE_NONE;
-    int frame_len = 0;
-    int frame_counter = -1;
-    int frame_counter_last_valid_audio = -1;
+// Single copy mode: the output buffer is the stream area of the input buffer
+void cb_output_buffer_alias(cb_output_buffer *cb)
+{
+    cb->buffer = input_buffer.buffer + input_buffer.offset;
+    cb->size = input_buffer.size - input_buffer.offset;
+    cb->write_index = cb->buffer;
+}
 
-    int i, n;
-    cb_output_buffer *cb_current;
-    int write_enable = 0;
-    int frame_sync = 0;
+void cb_output_buffer_free(cb_output_buffer *cb)
+{
+    if ((cb->source == NULL) && (cb->buffer != NULL)) free(cb->buffer);
+    cb->buffer = NULL;
+    if (cb->output_frame != NULL) free(cb->output_frame);
+    cb->output_frame = NULL;
+}
+
+// Pre-roll: move the reader id, that has read everything, back to the frames of the last ms milliseconds
+// Return the number of frames it will read again
+unsigned int cb_output_buffer_rewind(cb_output_buffer *cb, int id, unsigned int ms)
+{
+    frame_ring *r = &(cb->ring);
+    unsigned int head = __atomic_load_n(&(r->head), __ATOMIC_ACQUIRE);
+    unsigned int newest = (frame_ring_slot(r, head) + r->size - 1) % r->size;
+    unsigned int slot, bytes = 0, frames = 0;
+    // The frames can be old if the capture was parked
+    uint32_t age = (uint32_t) current_timestamp() - __atomic_load_n(&(cb->published), __ATOMIC_RELAXED);
+
+    if ((ms == 0) || (frame_ring_tail(r, id) != head) || (cb->output_frame[newest].size == 0)) return 0;
+
+    // Stay far from an overrun: at most half of the slots and, in copy mode, half of the bytes
+    while (frames < r->size / 2) {
+        slot = (newest + r->size - frames) % r->size;
+        if (cb->output_frame[slot].size == 0) break;
+        if (age + cb->output_frame[newest].time - cb->output_frame[slot].time >= ms) break;
+        if ((cb->source == NULL) && (bytes + cb->output_frame[slot].size > cb->size / 2)) break;
+        bytes += cb->output_frame[slot].size;
+        frames++;
+    }
+    if ((frames == 0) || !frame_ring_rewind(r, id, head, frames)) return 0;
+
+    return frames;
+}
+
+// Print the overrun counters and how late each reader is
+void cb_output_buffer_stats(cb_output_buffer *cb, const char *name)
+{
+    frame_ring *r = &(cb->ring);
+    long long now = current_timestamp();
+    unsigned int tail, head, lag;
+    int i;
+
+    if (cb->output_frame == NULL) return;
+
+    fprintf(stderr, "%lld: stats - %s ring - %u bytes - %u slots - dropped newest: %u - dropped oldest: %u - resets: %u\n",
+            now, name, cb->size, r->size, cb->dropped_newest, cb->dropped_oldest, cb->resets);
+    for (i = 0; i < FRAME_RING_READERS; i++) {
+        if (!frame_ring_active(r, i)) continue;
+        head = frame_ring_slot(r, __atomic_load_n(&(r->head), __ATOMIC_ACQUIRE));
+        tail = frame_ring_slot(r, frame_ring_tail(r, i));
+        lag = (head + r->size - tail) % r->size;
+        fprintf(stderr, "%lld: stats - %s ring - reader %d - lag: %u frames, %u bytes, %d ms - max lag: %u frames\n",
+                now, name, i, lag, (cb->source == NULL) ? cb_reader_bytes(cb, i) : 0,
+                (lag > 0) ? (int) (cb->output_frame[(head + r->size - 1) % r->size].time - cb->output_frame[tail].time) : 0,
+                cb->lag_max[i]);
+        cb->lag_max[i] = 0;
+    }
+}
 
-    struct frame_header fhs[10];
-    unsigned char* fhs_addr[10];
+// Map a firmware time (msec) to the wall clock, with the same origin for all the streams
+void frame_presentation_time(uint32_t time, struct timeval *pt)
+{
+    static struct timeval base_pt;
+    static uint32_t base_time;
+    static int base_valid = 0;
+    long long usec;
+
+    if (!base_valid) {
+        gettimeofday(&base_pt, NULL);
+        base_time = time;
+        base_valid = 1;
+    }
+
+    usec = base_pt.tv_usec + (long long) ((int32_t) (time - base_time)) * 1000;
+    pt->tv_sec = base_pt.tv_sec + usec / 1000000;
+    pt->tv_usec = usec % 1000000;
+    if (pt->tv_usec < 0) {
+        pt->tv_sec--;
+        pt->tv_usec += 1000000;
+    }
+}
+
+// State of the capture loop, kept between two polls
+struct captureState_t {
+    unsigned char *buf_idx_end_prev;        // end of the stream at the last poll
+    unsigned char *buf_idx_cur;             // next header to parse
+    struct frame_header pending_fh;         // last parsed frame, sent when the next header is found
+    unsigned char *pending_addr;
+    int pending;
+    int idle;                               // the capture is parked, copy of capture_idle
     uint32_t last_counter;
+    unsigned int frames;                    // frames read
+    unsigned int frames_recovered;          // frames read in polls with 10 or more new frames
+    unsigned int frames_lost;               // gaps in frame_header.counter
+    unsigned int sync_lost;                 // breaks of the header chain
+    unsigned int frames_resynced;           // frames read after a resync
+    unsigned int torn_reads;                // inconsistent reads of the control words
+    poll_scheduler ps;
+} captureState;
+
+// Demux: the output buffer of each type of frame, checked in this order
+// Same type bits as rRTSPServer
+#define CAPTURE_ROUTES 3
+struct captureRoute_t {
+    uint16_t type_mask;
+    int type;
+    const char *name;
+    cb_output_buffer *cb;                   // NULL if the stream is not sent
+    int frame_counter_last_valid;
+} captureRoute[CAPTURE_ROUTES] = {
+    { 0x0800, TYPE_LOW,  "low",  NULL, -1 },
+    { 0x0400, TYPE_HIGH, "high", NULL, -1 },
+    { 0x0100, TYPE_AAC,  "aac",  NULL, -1 },
+};
+
+// Return the time to sleep until the next expected write of the firmware
+int capture_next(int frames)
+{
+    long long now = poll_scheduler_now();
+
+    poll_scheduler_wakeup(&(captureState.ps), frames, now);
+    if (debug) poll_scheduler_stats(&(captureState.ps), now);
+    return poll_scheduler_next(&(captureState.ps), now);
+}
+
+// Read a control word of the input buffer written by the firmware
+static inline int capture_control_word(int offset)
+{
+    return __atomic_load_n((int *) (input_buffer.buffer + offset), __ATOMIC_RELAXED);
+}
+
+// Read a consistent view of the control words (start +16, len +4, end +12)
+// Return 0 and the end of the stream, or -1 if the words keep changing or are invalid
+int capture_snapshot(unsigned char **buf_idx_end)
+{
+    int start, len, end, end_check;
+    int stream_size = input_buffer.size - input_buffer.offset;
+    int retry;
+
+    for (retry = 0; retry < SNAPSHOT_RETRIES; retry++) {
+        // Like a seqlock: end must be the same before and after the other words
+        end = capture_control_word(12);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        start = capture_control_word(16);
+        len = capture_control_word(4);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        end_check = capture_control_word(12);
+
+        if ((end == end_check) && (start >= 0) && (start < stream_size) &&
+                (len >= 0) && (len <= stream_size) && (end >= 0) && (end < stream_size) &&
+                ((start + len) % stream_size == end)) {
+            *buf_idx_end = input_buffer.buffer + input_buffer.offset + end;
+            return 0;
+        }
+        captureState.torn_reads++;
+    }
 
-    // Opening an existing file
-    fshm = shm_open(input_buffer.filename, O_RDWR, 0);
+    return -1;
+}
+
+// Score a model on the frames written between the end positions e0 and e1
+// Return 0 if its chain of headers doesn't go from e0 to e1
+int model_probe_score(const model_desc *m, int e0, int e1)
+{
+    frame_header_decoder decode = cb2s_header_decoder(m->frame_header_size);
+    unsigned char *buf_idx_cur, *buf_idx_end;
+    struct frame_header fh;
+    unsigned char adts[7];
+    uint32_t counter_prev = 0;
+    int stream_size = input_buffer.size - m->buf_offset;
+    int remaining, adts_len;
+    int frames = 0, score = 0;
+
+    if ((decode == NULL) || (e0 >= stream_size) || (e1 >= stream_size)) return 0;
+
+    input_buffer.offset = m->buf_offset;
+    buf_idx_cur = input_buffer.buffer + input_buffer.offset + e0;
+    buf_idx_end = input_buffer.buffer + input_buffer.offset + e1;
+
+    while ((buf_idx_cur != buf_idx_end) && (frames < PROBE_MAX_FRAMES)) {
+        remaining = cb_distance(buf_idx_cur, buf_idx_end) - m->frame_header_size;
+        if (remaining < 0) return 0;
+        decode(&fh, buf_idx_cur);
+        if ((fh.len == 0) || (fh.len > (unsigned int) remaining)) return 0;
+
+        // A point for every header, more for the consecutive counters and the ADTS frames
+        score++;
+        if ((frames > 0) && (fh.counter == counter_prev + 1)) score++;
+        if ((fh.type & 0x0100) && (fh.len >= sizeof(adts))) {
+            cb2s_memcpy(adts, cb_move(buf_idx_cur, m->frame_header_size), sizeof(adts));
+            adts_len = ((adts[3] & 0x03) << 11) | (adts[4] << 3) | ((adts[5] & 0xE0) >> 5);
+            if ((adts[0] == 0xFF) && ((adts[1] & 0xF0) == 0xF0) && (adts_len == (int) fh.len)) score += 2;
+        }
+        counter_prev = fh.counter;
+        frames++;
+        buf_idx_cur = cb_move(buf_idx_cur, fh.len + m->frame_header_size);
+    }
+    if (buf_idx_cur != buf_idx_end) return 0;
+
+    return score;
+}
+
+// Detect offset and frame header layout from the frames written by the firmware
+void model_probe()
+{
+    unsigned int n_table = sizeof(model_table) / sizeof(model_table[0]);
+    unsigned int n_probe = sizeof(model_probe_table) / sizeof(model_probe_table[0]);
+    const model_desc *m, *best = NULL;
+    int e0, e1, e, writes, score, best_score;
+    unsigned int i;
+    long long start;
+
+    e0 = capture_control_word(12);
+    while (best == NULL) {
+        // Wait for a few writes
+        writes = 0;
+        e1 = e0;
+        start = poll_scheduler_now();
+        while ((writes < PROBE_WRITES) && (poll_scheduler_now() - start < PROBE_TIMEOUT)) {
+            usleep(PROBE_POLL);
+            e = capture_control_word(12);
+            if (e != e1) {
+                e1 = e;
+                writes++;
+            }
+        }
+        if (writes == 0) {
+            if (debug) fprintf(stderr, "%lld: probe - no frames written, waiting\n", current_timestamp());
+            continue;
+        }
+
+        best_score = 0;
+        for (i = 0; i < n_table + n_probe; i++) {
+            m = (i < n_table) ? &model_table[i] : &model_probe_table[i - n_table];
+            if (m->platform != model_auto.platform) continue;
+            score = model_probe_score(m, e0, e1);
+            if (debug) fprintf(stderr, "%lld: probe - %s - offset %d - header size %d - score %d\n",
+                        current_timestamp(), m->name, m->buf_offset, m->frame_header_size, score);
+            if (score > best_score) {
+                best = m;
+                best_score = score;
+            }
+        }
+        e0 = e1;
+    }
+
+    model_auto.buf_offset = best->buf_offset;
+    model_auto.frame_header_size = best->frame_header_size;
+    buf_offset = best->buf_offset;
+    frame_header_size = best->frame_header_size;
+    input_buffer.offset = buf_offset;
+#ifndef SINGLE_LAYOUT
+    cb2s_header = cb2s_header_decoder(frame_header_size);
+#endif
+
+    fprintf(stderr, "%lld: probe - detected offset %d and header size %d (as %s)\n",
+                current_timestamp(), buf_offset, frame_header_size, best->name);
+}
+
+void capture_init()
+{
+    unsigned char *buf_idx_end;
+    int i, fshm;
+
+    // Opening an existing file, the capture never writes to it
+    fshm = shm_open(input_buffer.filename, O_RDONLY, 0);
     if (fshm == -1) {
         fprintf(stderr, "error - could not open file %s\n", input_buffer.filename) ;
         exit(EXIT_FAILURE);
     }
 
     // Map file to memory
-    input_buffer.buffer = (unsigned char*) mmap(NULL, input_buffer.size, PROT_READ | PROT_WRITE, MAP_SHARED, fshm, 0);
+    input_buffer.buffer = (unsigned char*) mmap(NULL, input_buffer.size, PROT_READ, MAP_SHARED, fshm, 0);
     if (input_buffer.buffer == MAP_FAILED) {
         fprintf(stderr, "%lld: capture - error - mapping file %s\n", current_timestamp(), input_buffer.filename);
         close(fshm);
         exit(EXIT_FAILURE);
     }
     if (debug) fprintf(stderr, "%lld: capture - mapping file %s, size %d, to %08x\n", current_timestamp(), input_buffer.filename, input_buffer.size, (unsigned int) input_buffer.buffer);
+    if (realtime_priority > 0) realtime_prefault(input_buffer.buffer, input_buffer.size);
+    startup_trace(STARTUP_MMAP);
 
     // Closing the file
     if (debug) fprintf(stderr, "%lld: capture - closing the file %s\n", current_timestamp(), input_buffer.filename);
     close(fshm) ;
 
-    memcpy(&i, input_buffer.buffer + 16, sizeof(i));
-    buf_idx = input_buffer.buffer + input_buffer.offset + i;
-    buf_idx_cur = buf_idx;
-    memcpy(&i, input_buffer.buffer + 4, sizeof(i));
-    buf_idx_end = buf_idx + i;
-    if (buf_idx_end >= input_buffer.buffer + input_buffer.size) buf_idx_end -= (input_buffer.size - input_buffer.offset);
-    buf_idx_end_prev = buf_idx_end;
-    last_counter = 0;
+    if (model == &model_auto) model_probe();
+
+    // Single copy mode: the output buffers are the stream area of the input buffer
+    if (single_copy) {
+        cb_output_buffer_alias(&output_buffer_audio);
+        if (video_high) cb_output_buffer_alias(&output_buffer_video_high);
+        if (video_low) cb_output_buffer_alias(&output_buffer_video_low);
+    }
+
+    captureState.torn_reads = 0;
+    while (capture_snapshot(&buf_idx_end) != 0) {
+        if (debug) fprintf(stderr, "%lld: capture - waiting for a valid header\n", current_timestamp());
+        usleep(POLL_MIN);
+    }
+    captureState.buf_idx_end_prev = buf_idx_end;
+    captureState.buf_idx_cur = buf_idx_end;
+    captureState.pending = 0;
+    captureState.idle = 0;
+    captureRoute[0].cb = video_low ? &output_buffer_video_low : NULL;
+    captureRoute[1].cb = video_high ? &output_buffer_video_high : NULL;
+    captureRoute[2].cb = &output_buffer_audio;
+    for (i = 0; i < CAPTURE_ROUTES; i++) {
+        captureRoute[i].frame_counter_last_valid = -1;
+    }
+    captureState.last_counter = 0;
+    captureState.frames = 0;
+    captureState.frames_recovered = 0;
+    captureState.frames_lost = 0;
+    captureState.sync_lost = 0;
+    captureState.frames_resynced = 0;
+    poll_scheduler_init(&(captureState.ps));
 
     if (debug) fprintf(stderr, "%lld: capture - starting capture main loop\n", current_timestamp());
+}
+
+// Set capture_ready when the type of all the streams is known and wake up main()
+void capture_check_ready()
+{
+    if (capture_ready) return;
+    if ((freq == -1) || (chan == -1)) return;
+    if (video_high && (output_buffer_video_high.codec == CODEC_NONE)) return;
+    if (video_low && (output_buffer_video_low.codec == CODEC_NONE)) return;
+
+    pthread_mutex_lock(&capture_ready_mutex);
+    capture_ready = 1;
+    pthread_cond_signal(&capture_ready_cond);
+    pthread_mutex_unlock(&capture_ready_mutex);
+    startup_trace(STARTUP_READY);
+}
+
+// Detect the codec from the first NAL of a key frame (SPS or VPS)
+int capture_video_codec(unsigned char *buf)
+{
+    unsigned char nal[5];
+
+    cb2s_memcpy(nal, buf, sizeof(nal));
+    if ((nal[0] != 0) || (nal[1] != 0) || (nal[2] != 0) || (nal[3] != 1)) return CODEC_NONE;
+    if ((nal[4] & 0x1F) == 7) return CODEC_H264;
+    if (((nal[4] >> 1) & 0x3F) == 32) return CODEC_H265;
+
+    return CODEC_NONE;
+}
+
+// Frame bus: publish the frame at buf, it can wrap around the end of the input buffer
+void capture_bus_publish(unsigned char *buf, int len, uint32_t time)
+{
+    unsigned char *buf_end = input_buffer.buffer + input_buffer.size;
+
+    if (buf + len > buf_end) {
+        frame_bus_publish(frame_bus, buf, buf_end - buf,
+                input_buffer.buffer + input_buffer.offset, buf + len - buf_end, time);
+    } else {
+        frame_bus_publish(frame_bus, buf, len, NULL, 0, time);
+    }
+}
+
+// Send a frame to its output buffer
+void capture_frame(struct frame_header *fh, unsigned char *addr)
+{
+    unsigned char *buf_idx_cur;
+    unsigned char *buf_idx_start = NULL;
+
+    int frame_type = TYPE_NONE;
+    int frame_len = fh->len;
+    int frame_counter = -1;
+    int *frame_counter_last_valid = NULL;
+    const char *stream_name = "none";
+
+    int i, slot;
+    cb_output_buffer *cb_current;
+    int write_enable = 0;
+
+    if (fh->counter != captureState.last_counter + 1) {
+        fprintf(stderr, "%lld: capture - warning - %d frame(s) lost\n",
+                    current_timestamp(), fh->counter - (captureState.last_counter + 1));
+        if ((captureState.last_counter != 0) && (fh->counter > captureState.last_counter)) {
+            captureState.frames_lost += fh->counter - (captureState.last_counter + 1);
+        }
+    }
+    captureState.last_counter = fh->counter;
+    startup_trace(STARTUP_FIRST_FRAME);
+
+    buf_idx_cur = cb_move(addr, frame_header_size);
+
+    // Autodetect stream type (only the 1st time)
+    if ((freq == -1) && (chan == -1) && ((fh->type & 0x0C00) == 0)) {
+        int n = 0;
+        unsigned char *h = buf_idx_cur;
+
+        n = ((*h & 0xFF) == 0xFF);
+        n += ((*(h + 1) & 0xF0) == 0xF0);
+        if (n == 2) {
+            h += 2;
+            freq = (*h & 0x3c) >> 2;
+            chan = (*h & 0x01) << 2;
+            h++;
+            chan += (*h & 0xc0) >> 6;
+
+            freq = samplingFrequencyTable[freq];
+            if (chan == 8) chan--;
+            if (debug) fprintf(stderr, "%lld: aac detected - frequency: %d - channels: %d\n",
+                        current_timestamp(), freq, chan);
+            if (frame_bus != NULL) frame_bus_format(frame_bus, freq, chan);
+            capture_check_ready();
+        }
+    }
+
+    write_enable = 1;
+    frame_counter = fh->stream_counter;
+    cb_current = NULL;
+    for (i = 0; i < CAPTURE_ROUTES; i++) {
+        if (fh->type & captureRoute[i].type_mask) {
+            frame_type = captureRoute[i].type;
+            cb_current = captureRoute[i].cb;
+            frame_counter_last_valid = &(captureRoute[i].frame_counter_last_valid);
+            stream_name = captureRoute[i].name;
+            break;
+        }
+    }
+
+    // Video: wait for a key frame to detect the codec
+    if ((cb_current != NULL) && (frame_type != TYPE_AAC) && (cb_current->codec == CODEC_NONE)) {
+        cb_current->codec = capture_video_codec(buf_idx_cur);
+        if (cb_current->codec == CODEC_NONE) {
+            cb_current = NULL;
+        } else {
+            if (debug) fprintf(stderr, "%lld: %s detected - codec: h%d\n", current_timestamp(), stream_name, cb_current->codec);
+            capture_check_ready();
+        }
+    }
+
+    // The frame bus doesn't depend on the readers of the rings
+    if ((frame_bus != NULL) && (frame_type == TYPE_AAC)) {
+        capture_bus_publish(buf_idx_cur, frame_len, fh->time);
+    }
+
+    // Don't copy the frames that nobody reads, unless they are kept for the pre-roll
+    if ((cb_current != NULL) && !cb_current->retain && (frame_ring_readers(&(cb_current->ring)) == 0)) {
+        cb_current = NULL;
+    }
+
+    if (cb_current != NULL) {
+        if ((65536 + frame_counter - *frame_counter_last_valid) % 65536 > 1) {
+            if (debug) fprintf(stderr, "%lld: %s in - warning - %d frame(s) lost - frame_counter: %d - frame_counter_last_valid: %d\n",
+                        current_timestamp(), stream_name, (65536 + frame_counter - *frame_counter_last_valid - 1) % 65536, frame_counter, *frame_counter_last_valid);
+            *frame_counter_last_valid = frame_counter;
+        } else {
+            if (debug) fprintf(stderr, "%lld: %s in - frame detected - frame_len: %d - frame_counter: %d\n",
+                        current_timestamp(), stream_name, frame_len, fh->stream_counter);
+
+            *frame_counter_last_valid = frame_counter;
+        }
+        buf_idx_start = buf_idx_cur;
+    } else {
+        write_enable = 0;
+    }
+
+    // Send the frame to the ouput buffer
+    if (write_enable) {
+        if (debug) fprintf(stderr, "%lld: %s in - frame_len: %d - cb_current->size: %d\n", current_timestamp(), stream_name, frame_len, cb_current->size);
+        if (frame_len > (signed) cb_current->size) {
+            fprintf(stderr, "%lld: %s in - error - frame size exceeds buffer size\n", current_timestamp(), stream_name);
+        } else if ((slot = cb_output_buffer_reserve(cb_current, frame_len)) == -1) {
+            if (debug) fprintf(stderr, "%lld: %s in - warning - output buffer full, frame dropped\n", current_timestamp(), stream_name);
+        } else if (cb_current->source != NULL) {
+            // Publish only the position of the frame, it will be copied by the reader
+            cb_current->output_frame[slot].offset = buf_idx_start - cb_current->buffer;
+            cb_current->output_frame[slot].counter = frame_counter;
+            cb_current->output_frame[slot].size = frame_len;
+            cb_current->output_frame[slot].generation = (uint16_t) fh->counter;
+            cb_current->output_frame[slot].time = fh->time;
+            if (debug) fprintf(stderr, "%lld: %s in - frame_len: %d - frame_counter: %d - in place at slot %d/%d\n", current_timestamp(), stream_name, frame_len, frame_counter, slot, cb_current->ring.size);
+            frame_ring_publish(&(cb_current->ring));
+            __atomic_store_n(&(cb_current->published), (uint32_t) current_timestamp(), __ATOMIC_RELAXED);
+            cb_notify(cb_current);
+        } else {
+            input_buffer.read_index = buf_idx_start;
+
+            cb_current->output_frame[slot].offset = cb_current->write_index - cb_current->buffer;
+            cb_current->output_frame[slot].counter = frame_counter;
+            cb_current->output_frame[slot].time = fh->time;
+
+            cb2cb_memcpy(cb_current, &input_buffer, frame_len);
+
+            cb_current->output_frame[slot].size = frame_len;
+            if (debug) {
+                fprintf(stderr, "%lld: %s in - frame_len: %d - frame_counter: %d - resolution: %d\n", current_timestamp(), stream_name, frame_len, frame_counter, frame_type);
+                fprintf(stderr, "%lld: %s in - frame_write_index: %d/%d\n", current_timestamp(), stream_name, slot, cb_current->ring.size);
+            }
+            frame_ring_publish(&(cb_current->ring));
+            __atomic_store_n(&(cb_current->published), (uint32_t) current_timestamp(), __ATOMIC_RELAXED);
+            cb_notify(cb_current);
+        }
+    }
+}
+
+// Check if a valid AAC frame starts at the ADTS header data, before end
+// Return its frame header, or NULL
+unsigned char *capture_resync_check(unsigned char *data, unsigned char *start, unsigned char *end, struct frame_header *fh)
+{
+    unsigned char *h = cb_move(data, -frame_header_size);
+    unsigned char adts[7];
+    int remaining, adts_len;
+
+    // The frame header must be inside the damaged span
+    if (cb_distance(start, data) < frame_header_size) return NULL;
+    remaining = cb_distance(data, end);
+    if (remaining < (int) sizeof(adts)) return NULL;
+
+    cb2s_header(fh, h);
+    if (((fh->type & 0x0100) == 0) || (fh->len < sizeof(adts)) || (fh->len > (unsigned int) remaining)) return NULL;
+
+    // The ADTS frame length must match the len of the frame header
+    cb2s_memcpy(adts, data, sizeof(adts));
+    if ((adts[1] & 0x06) != 0) return NULL;
+    adts_len = ((adts[3] & 0x03) << 11) | (adts[4] << 3) | ((adts[5] & 0xE0) >> 5);
+    if (adts_len != (int) fh->len) return NULL;
+
+    return h;
+}
+
+// Look for the next valid frame between start and end, after a break of the header chain
+// Return its frame header, or NULL
+unsigned char *capture_resync(unsigned char *start, unsigned char *end)
+{
+    unsigned char *buf_end = input_buffer.buffer + input_buffer.size;
+    unsigned char *p = cb_move(start, 1);
+    unsigned char *q, *h;
+    struct frame_header fh;
+
+    while (p != end) {
+        if (p == buf_end) {
+            p = input_buffer.buffer + input_buffer.offset;
+            if (p == end) break;
+        }
+        if (end > p) {
+            // Linear span
+            q = resync_find_sync(p, end);
+            if (q == NULL) return NULL;
+        } else {
+            // From p to the end of the buffer
+            q = resync_find_sync(p, buf_end);
+            if (q == NULL) {
+                // The sync word across the end of the buffer
+                q = buf_end - 1;
+                if ((*q != 0xFF) || ((*(input_buffer.buffer + input_buffer.offset) & 0xF0) != 0xF0)) {
+                    p = input_buffer.buffer + input_buffer.offset;
+                    continue;
+                }
+            }
+        }
+        h = capture_resync_check(q, start, end, &fh);
+        if (h != NULL) return h;
+        p = cb_move(q, 1);
+    }
+
+    return NULL;
+}
+
+// Read the new frames from the input buffer and return the time to sleep (usec)
+int capture_poll()
+{
+    unsigned char *buf_idx_end;
+    struct frame_header fh;
+    unsigned char *buf_idx_resync;
+    int n, walked, remaining, resynced;
+    long long now;
+
+    poll_scheduler_woken(&(captureState.ps), poll_scheduler_now());
+
+    // The firmware is updating the header: retry soon
+    if (capture_snapshot(&buf_idx_end) != 0) {
+        if (debug) fprintf(stderr, "%lld: capture - header not valid after %d reads\n", current_timestamp(), SNAPSHOT_RETRIES);
+        return POLL_MIN;
+    }
+
+    if (buf_idx_end == captureState.buf_idx_end_prev) {
+        if (debug) fprintf(stderr, "%lld: capture - buf_idx_end == buf_idx_end_prev\n", current_timestamp());
+        return capture_next(0);
+    }
+    captureState.buf_idx_end_prev = buf_idx_end;
+
+    // Parse only the headers written since the last poll, whatever their number
+    n = 0;
+    resynced = 0;
+    walked = captureState.pending;
+    now = poll_scheduler_now();
+    while (captureState.buf_idx_cur != buf_idx_end) {
+        remaining = cb_distance(captureState.buf_idx_cur, buf_idx_end) - frame_header_size;
+        if (remaining >= 0) {
+            cb2s_header(&fh, captureState.buf_idx_cur);
+        }
+        // Check the len: the frame can't go beyond the end of the stream
+        if ((remaining < 0) || (fh.len > (unsigned int) remaining)) {
+            // The previous frame pointed to a bad header, don't trust it
+            captureState.pending = 0;
+            captureState.sync_lost++;
+            buf_idx_resync = capture_resync(captureState.buf_idx_cur, buf_idx_end);
+            if (debug) fprintf(stderr, "%lld: capture - sync lost - remaining: %d - resync: %s\n",
+                        current_timestamp(), remaining, (buf_idx_resync != NULL) ? "ok" : "failed");
+            if (buf_idx_resync == NULL) {
+                captureState.buf_idx_cur = buf_idx_end;
+                break;
+            }
+            captureState.buf_idx_cur = buf_idx_resync;
+            resynced = 1;
+            continue;
+        }
+        walked++;
+
+        // Ignore last frame, it could be corrupted: send the previous one
+        if (captureState.pending) {
+            poll_scheduler_frame(&(captureState.ps), captureState.pending_fh.time, now);
+            capture_frame(&(captureState.pending_fh), captureState.pending_addr);
+            n++;
+            if (resynced) captureState.frames_resynced++;
+        }
+        captureState.pending_fh = fh;
+        captureState.pending_addr = captureState.buf_idx_cur;
+        captureState.pending = 1;
+        captureState.buf_idx_cur = cb_move(captureState.buf_idx_cur, fh.len + frame_header_size);
+    }
+
+    // The old walker dropped the whole batch when it found 10 or more headers
+    captureState.frames += n;
+    if (walked >= 10) {
+        captureState.frames_recovered += n;
+        if (debug) fprintf(stderr, "%lld: capture - %d frames in a single poll\n", current_timestamp(), walked);
+    }
+
+    return capture_next(n);
+}
+
+// Parked capture: follow the end of the stream without parsing it, to see that the firmware is alive
+// Return the time to sleep (usec)
+int capture_idle_poll()
+{
+    unsigned char *buf_idx_end;
+
+    __atomic_add_fetch(&idleState.polls, 1, __ATOMIC_RELAXED);
+    if (capture_snapshot(&buf_idx_end) == 0) {
+        if (buf_idx_end != captureState.buf_idx_end_prev) {
+            __atomic_store_n(&idleState.alive, current_timestamp(), __ATOMIC_RELAXED);
+        }
+        captureState.buf_idx_end_prev = buf_idx_end;
+        captureState.buf_idx_cur = buf_idx_end;
+    }
+    captureState.pending = 0;
+
+    return IDLE_CHECK_INTERVAL;
+}
+
+// Poll the input buffer, or only check it if the capture is parked
+// Return the time to sleep (usec)
+int capture_step()
+{
+    int idle = __atomic_load_n(&capture_idle, __ATOMIC_ACQUIRE);
+    int i;
+
+    if (idle != captureState.idle) {
+        captureState.idle = idle;
+        if (!idle) {
+            // The frames written while parked are not lost frames, and the timing learnt before is stale
+            captureState.last_counter = 0;
+            for (i = 0; i < CAPTURE_ROUTES; i++) {
+                captureRoute[i].frame_counter_last_valid = -1;
+            }
+            poll_scheduler_resume(&(captureState.ps));
+        }
+    }
+
+    return idle ? capture_idle_poll() : capture_poll();
+}
+
+// Parked capture thread: sleep until the next liveness poll, or until idle_leave() wakes it up
+void capture_idle_sleep(int usec)
+{
+    struct pollfd pfd;
+    uint64_t count;
+
+    pfd.fd = idle_event_fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, usec / 1000) > 0) {
+        if (read(idle_event_fd, &count, sizeof(count)) != sizeof(count)) {}
+    }
+}
+
+void *capture(void *ptr)
+{
+    int wait;
+
+    if ((realtime_priority > 0) || (realtime_cpu >= 0)) realtime_thread("capture", realtime_priority, realtime_cpu);
+
+    capture_init();
 
     // Infinite loop
     while (1) {
-        memcpy(&i, input_buffer.buffer + 16, sizeof(i));
-        buf_idx = input_buffer.buffer + input_buffer.offset + i;
-        memcpy(&i, input_buffer.buffer + 4, sizeof(i));
-        buf_idx_end = buf_idx + i;
-        if (buf_idx_end >= input_buffer.buffer + input_buffer.size) buf_idx_end -= (input_buffer.size - input_buffer.offset);
-        // Check if the header is ok
-        memcpy(&i, input_buffer.buffer + 12, sizeof(i));
-        if (buf_idx_end != input_buffer.buffer + input_buffer.offset + i) {
-            if (debug) fprintf(stderr, "%lld: capture - buf_idx_end != input_buffer.buffer + input_buffer.offset + i\n", current_timestamp());
-            usleep(1000);
-            continue;
+        wait = capture_step();
+        if (captureState.idle) {
+            capture_idle_sleep(wait);
+        } else {
+            usleep(wait);
+        }
+    }
+
+    // Unreacheable path
+
+    // Unmap file from memory
+    if (munmap(input_buffer.buffer, input_buffer.size) == -1) {
+        fprintf(stderr, "%lld: capture - error - unmapping file\n", current_timestamp());
+    } else {
+        if (debug) fprintf(stderr, "%lld: capture - unmapping file %s, size %d, from %08x\n", current_timestamp(), input_buffer.filename, input_buffer.size, (unsigned int) input_buffer.buffer);
+    }
+
+    return NULL;
+}
+
+// Threadless mode: the capture runs as a task of the live555 event loop
+void capture_task(void *clientData)
+{
+    capture_task_token = env->taskScheduler().scheduleDelayedTask(capture_step(), (TaskFunc*) capture_task, NULL);
+}
+
+// Cpu time used by the process so far (usec)
+long long process_cpu_time()
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+// Park the capture: no frames are read, so no packets are sent
+void idle_enter(long long now)
+{
+    idleState.since = now;
+    idleState.cpu_since = process_cpu_time();
+    idleState.checks = 0;
+    __atomic_store_n(&idleState.polls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&idleState.alive, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&capture_idle, 1, __ATOMIC_RELEASE);
+    idleState.periods++;
+
+    fprintf(stderr, "%lld: idle - no listeners for %d s, capture parked\n", now, idle_timeout);
+}
+
+// Wake up the capture now, it reads the next frame written by the firmware
+void idle_leave(const char *who, long long now)
+{
+    long long elapsed = now - idleState.since;
+    long long cpu = process_cpu_time() - idleState.cpu_since;
+    unsigned int wakeups = __atomic_load_n(&idleState.polls, __ATOMIC_RELAXED) + idleState.checks;
+    uint64_t one = 1;
+
+    __atomic_store_n(&capture_idle, 0, __ATOMIC_RELEASE);
+    if (threadless) {
+        env->taskScheduler().rescheduleDelayedTask(capture_task_token, 0, (TaskFunc*) capture_task, NULL);
+    } else if (write(idle_event_fd, &one, sizeof(one)) != sizeof(one)) {
+        fprintf(stderr, "%lld: idle - error - could not wake up the capture\n", now);
+    }
+    idleState.total += elapsed;
+
+    if (elapsed <= 0) elapsed = 1;
+    fprintf(stderr, "%lld: idle - %s, capture resumed after %lld s - wakeups/s: %.2f - cpu: %.2f%%\n",
+            now, who, elapsed / 1000, wakeups * 1000.0 / elapsed, cpu / (elapsed * 10.0));
+}
+
+// Called when a listener shows up: an RTCP RR, a new destination, a RTSP client
+void idle_listener_seen(const char *who)
+{
+    long long now = current_timestamp();
+
+    idleState.last_listener = now;
+    if ((idle_timeout > 0) && capture_idle) idle_leave(who, now);
+}
+
+void idle_rr_handler(void *clientData)
+{
+    idle_listener_seen("receiver report");
+}
+
+// Check the listeners that don't send anything: RTSP clients and frame bus readers
+void idle_check_task(void *clientData)
+{
+    long long now = current_timestamp();
+    long long alive;
+
+    if (capture_idle) idleState.checks++;
+
+    if ((rtsp_port > 0) && (frame_ring_readers(&(output_buffer_audio.ring)) > 0)) {
+        idleState.last_listener = now;
+    } else if ((frame_bus != NULL) && (frame_bus_readers(frame_bus) > 0)) {
+        idleState.last_listener = now;
+    }
+
+    if (now - idleState.last_listener < idle_timeout * 1000LL) {
+        if (capture_idle) idle_leave((rtsp_port > 0) ? "rtsp client" : "frame bus reader", now);
+    } else if (!capture_idle) {
+        idle_enter(now);
+    } else {
+        alive = __atomic_load_n(&idleState.alive, __ATOMIC_RELAXED);
+        if (now - alive >= idle_timeout * 1000LL) {
+            fprintf(stderr, "%lld: idle - warning - the firmware didn't write for %lld s\n", now, (now - alive) / 1000);
+            __atomic_store_n(&idleState.alive, now, __ATOMIC_RELAXED);
+        }
+    }
+
+    env->taskScheduler().scheduleDelayedTask(IDLE_CHECK_INTERVAL, (TaskFunc*) idle_check_task, NULL);
+}
+
+// Print memory and context switches, to compare threaded and threadless mode
+void process_stats_task(void *clientData)
+{
+    static struct rusage ru_prev;
+    static long long time_prev = 0;
+    struct rusage ru;
+    long long now = current_timestamp();
+    long pages_total, pages_rss = 0;
+    FILE *fStatm;
+
+    getrusage(RUSAGE_SELF, &ru);
+    fStatm = fopen("/proc/self/statm", "r");
+    if (fStatm != NULL) {
+        if (fscanf(fStatm, "%ld %ld", &pages_total, &pages_rss) != 2) pages_rss = 0;
+        fclose(fStatm);
+    }
+
+    if (time_prev != 0) {
+        fprintf(stderr, "%lld: stats - %s - rss: %ld kB - max rss: %ld kB - voluntary cs/s: %.1f - involuntary cs/s: %.1f\n",
+                now, threadless ? "threadless" : "threaded",
+                pages_rss * (sysconf(_SC_PAGESIZE) / 1024), ru.ru_maxrss,
+                (ru.ru_nvcsw - ru_prev.ru_nvcsw) * 1000.0 / (now - time_prev),
+                (ru.ru_nivcsw - ru_prev.ru_nivcsw) * 1000.0 / (now - time_prev));
+        fprintf(stderr, "%lld: stats - cpu: %.2f%% - capture: %s - idle periods: %u - time idle: %lld s\n",
+                now, ((ru.ru_utime.tv_sec - ru_prev.ru_utime.tv_sec + ru.ru_stime.tv_sec - ru_prev.ru_stime.tv_sec) * 1000000LL +
+                    ru.ru_utime.tv_usec - ru_prev.ru_utime.tv_usec + ru.ru_stime.tv_usec - ru_prev.ru_stime.tv_usec) / ((now - time_prev) * 10.0),
+                capture_idle ? "parked" : "running", idleState.periods,
+                (idleState.total + (capture_idle ? now - idleState.since : 0)) / 1000);
+        fprintf(stderr, "%lld: stats - frames read: %u - frames in batches of 10 or more: %u\n",
+                now, captureState.frames, captureState.frames_recovered);
+        fprintf(stderr, "%lld: stats - sync lost: %u - frames recovered by resync: %u - frames lost: %u - torn header reads: %u\n",
+                now, captureState.sync_lost, captureState.frames_resynced, captureState.frames_lost, captureState.torn_reads);
+    }
+    if (frame_bus != NULL) frame_bus_reap(frame_bus);
+    if (sessionState.sink != NULL) rtp_stats(now);
+    if (sessionState.pcm != NULL) pcm_stats(now, sessionState.pcm);
+    if (pcmSessionState.filter != NULL) pcm_stats(now, pcmSessionState.filter);
+    if (sessionState.transcoder != NULL) adapt_stats(now);
+    cb_output_buffer_stats(&output_buffer_audio, "audio");
+    cb_output_buffer_stats(&output_buffer_video_high, "high");
+    cb_output_buffer_stats(&output_buffer_video_low, "low");
+    ru_prev = ru;
+    time_prev = now;
+
+    env->taskScheduler().scheduleDelayedTask(PROCESS_STATS_INTERVAL, (TaskFunc*) process_stats_task, NULL);
+}
+
+// Print the packet rate of the audio RTP stream and the bytes spent in headers
+void rtp_stats(long long now)
+{
+    static unsigned packets_prev = 0, octets_prev = 0, aus_prev = 0, header_prev = 0;
+    static long long time_prev = 0;
+    unsigned packets = sessionState.sink->packetCount();
+    unsigned octets = sessionState.sink->octetCount();
+    unsigned aus, header;
+    // IP + UDP + RTP
+    unsigned packet_overhead = (ipv6 ? 40 : 20) + 8 + 12;
+    double elapsed, overhead;
+    static unsigned datagrams_prev = 0, calls_prev = 0;
+    unsigned datagrams = BatchGroupsock::datagrams();
+    unsigned calls = BatchGroupsock::sendCalls();
+    static unsigned red_bytes_prev = 0, red_blocks_prev = 0;
+    unsigned red_bytes = 0, red_blocks = 0;
+
+    // Without aggregation there is an AU header section of 4 bytes in each packet
+    if (sessionState.pcm != NULL) {
+        // The decoded audio: no header, one payload per packet
+        aus = packets;
+        header = 0;
+    } else if (sessionState.aggregator != NULL) {
+        aus = sessionState.aggregator->aus();
+        header = sessionState.aggregator->headerBytes();
+    } else if (sessionState.interleaver != NULL) {
+        aus = sessionState.interleaver->aus();
+        header = sessionState.interleaver->headerBytes();
+    } else if (sessionState.redundancy != NULL) {
+        // Only the primary blocks are new frames, their header is 1 + 4 bytes
+        aus = sessionState.redundancy->packets();
+        header = aus * 5;
+        red_bytes = sessionState.redundancy->redundantBytes();
+        red_blocks = sessionState.redundancy->redundantBlocks();
+    } else {
+        aus = packets;
+        header = packets * 4;
+    }
+
+    if ((time_prev != 0) && (now > time_prev) && (packets != packets_prev)) {
+        elapsed = (now - time_prev) / 1000.0;
+        overhead = (packets - packets_prev) * packet_overhead + (header - header_prev);
+        fprintf(stderr, "%lld: stats - %s rtp - packets/s: %.1f - frames per packet: %.2f - payload: %.0f B/s - overhead: %.0f B/s (%.1f%% of the bytes sent)\n",
+                now, (sessionState.pcm != NULL) ? "pcm" : "aac", (packets - packets_prev) / elapsed, (double) (aus - aus_prev) / (packets - packets_prev),
+                (octets - octets_prev) / elapsed, overhead / elapsed,
+                100.0 * overhead / (overhead + (octets - octets_prev) - (header - header_prev)));
+        // All the RTP and RTCP datagrams, to compare --batch and the plain sends
+        fprintf(stderr, "%lld: stats - udp - datagrams/s: %.1f - send calls/s: %.1f - datagrams per call: %.2f\n",
+                now, (datagrams - datagrams_prev) / elapsed, (calls - calls_prev) / elapsed,
+                (calls != calls_prev) ? (double) (datagrams - datagrams_prev) / (calls - calls_prev) : 0.0);
+        // The price of the redundancy, to compare with the frames recovered by the receivers
+        if (sessionState.redundancy != NULL) {
+            fprintf(stderr, "%lld: stats - aac red - redundant frames per packet: %.2f - redundancy: %.0f B/s (%.1f%% of the payload)\n",
+                    now, (double) (red_blocks - red_blocks_prev) / (packets - packets_prev), (red_bytes - red_bytes_prev) / elapsed,
+                    (octets != octets_prev) ? 100.0 * (red_bytes - red_bytes_prev) / (octets - octets_prev) : 0.0);
+        }
+        // Packets sent short because the frames stopped coming
+        if (sessionState.aggregator != NULL) {
+            fprintf(stderr, "%lld: stats - aac aggregate - packets sent on timeout: %u since start\n",
+                    now, sessionState.aggregator->flushes());
+        }
+    }
+    red_bytes_prev = red_bytes;
+    red_blocks_prev = red_blocks;
+    datagrams_prev = datagrams;
+    calls_prev = calls;
+    packets_prev = packets;
+    octets_prev = octets;
+    aus_prev = aus;
+    header_prev = header;
+    time_prev = now;
+}
+
+// Cpu time spent on the decoded audio, for each AAC frame, and its share of a core
+void pcm_stats(long long now, AAC2PCMFilter *filter)
+{
+    static unsigned frames_prev = 0, errors_prev = 0;
+    static long long decode_prev = 0, resample_prev = 0, compand_prev = 0;
+    static long long time_prev = 0;
+    unsigned frames = filter->frames();
+    unsigned errors = filter->decodeErrors();
+    long long decode = filter->decodeTime();
+    long long resample = filter->resampleTime();
+    long long compand = filter->compandTime();
+    unsigned n = frames - frames_prev;
+
+    if ((time_prev != 0) && (now > time_prev) && (n > 0)) {
+        fprintf(stderr, "%lld: stats - pcm - frames decoded/s: %.1f - decode errors: %u - per frame: decode %.1f us, resample %.1f us, compand %.1f us - cpu: %.2f%%\n",
+                now, n * 1000.0 / (now - time_prev), errors - errors_prev,
+                (decode - decode_prev) / (n * 1000.0), (resample - resample_prev) / (n * 1000.0),
+                (compand - compand_prev) / (n * 1000.0),
+                (decode - decode_prev + resample - resample_prev + compand - compand_prev) / ((now - time_prev) * 10000.0));
+    }
+    frames_prev = frames;
+    errors_prev = errors;
+    decode_prev = decode;
+    resample_prev = resample;
+    compand_prev = compand;
+    time_prev = now;
+}
+
+// Bitrate in and out of the re-encoding, and what it costs
+void adapt_stats(long long now)
+{
+    static unsigned frames_prev = 0, errors_prev = 0, in_prev = 0, out_prev = 0;
+    static long long decode_prev = 0, encode_prev = 0;
+    static long long time_prev = 0;
+    AACTranscoder *t = sessionState.transcoder;
+    unsigned frames = t->frames();
+    unsigned errors = t->decodeErrors();
+    unsigned in = t->inBytes();
+    unsigned out = t->outBytes();
+    long long decode = t->decodeTime();
+    long long encode = t->encodeTime();
+    unsigned n = frames - frames_prev;
+
+    if ((time_prev != 0) && (now > time_prev)) {
+        fprintf(stderr, "%lld: stats - adapt - bitrate: %u kbps%s - in: %.1f kbps - out: %.1f kbps - changes: %u - decode errors: %u - skipped: %u\n",
+                now, t->bitrate() / 1000, t->passthrough() ? " (passthrough)" : (t->afterburner() ? "" : " (afterburner off)"),
+                (in - in_prev) * 8.0 / (now - time_prev), (out - out_prev) * 8.0 / (now - time_prev),
+                adaptState.changes, errors - errors_prev, t->skipped());
+        if (n > 0) {
+            fprintf(stderr, "%lld: stats - adapt - per frame: decode %.1f us, encode %.1f us - cpu: %.2f%% (budget %d%%)\n",
+                    now, (decode - decode_prev) / (n * 1000.0), (encode - encode_prev) / (n * 1000.0),
+                    (decode - decode_prev + encode - encode_prev) / ((now - time_prev) * 10000.0), adapt_budget);
         }
+    }
+    frames_prev = frames;
+    errors_prev = errors;
+    in_prev = in;
+    out_prev = out;
+    decode_prev = decode;
+    encode_prev = encode;
+    time_prev = now;
+}
+
+// The steps between --adapt MIN and MAX, start from the highest
+// Return -1 if no step of the ladder is within MIN and MAX
+int adapt_init()
+{
+    unsigned i;
+
+    // The ladder is descending: first is the highest step <= MAX, last the lowest >= MIN
+    adaptState.first = ADAPT_STEPS;
+    adaptState.last = 0;
+    for (i = 0; i < ADAPT_STEPS; i++) {
+        if (adapt_steps[i] > (unsigned) adapt_max * 1000) continue;
+        if (adapt_steps[i] < (unsigned) adapt_min * 1000) break;
+        if (adaptState.first == ADAPT_STEPS) adaptState.first = i;
+        adaptState.last = i;
+    }
+    if (adaptState.first == ADAPT_STEPS) {
+        fprintf(stderr, "%lld: adapt - error - no bitrate of the ladder between %d and %d kbps\n",
+                current_timestamp(), adapt_min, adapt_max);
+        return -1;
+    }
+    // adapt_task() only moves between first and last: all of them must be in MIN..MAX
+    for (i = adaptState.first; i <= adaptState.last; i++) {
+        if ((adapt_steps[i] > (unsigned) adapt_max * 1000) || (adapt_steps[i] < (unsigned) adapt_min * 1000)) {
+            fprintf(stderr, "%lld: adapt - error - step %u at %u kbps out of %d to %d kbps\n",
+                    current_timestamp(), i, adapt_steps[i] / 1000, adapt_min, adapt_max);
+            return -1;
+        }
+    }
+    adaptState.step = adaptState.first;
+    adaptState.good = 0;
+    adaptState.changes = 0;
+    adaptState.over = 0;
+    adaptState.resume = 0;
+    adaptState.checked = current_timestamp();
+    adaptState.hold = adaptState.checked;
+    gettimeofday(&adaptState.checked_tv, NULL);
+    adaptState.cpu = 0;
+
+    return 0;
+}
+
+void adapt_calibrate_frame(void* /*clientData*/, unsigned /*frameSize*/, unsigned /*numTruncatedBytes*/,
+                           struct timeval /*presentationTime*/, unsigned /*durationInMicroseconds*/)
+{
+}
+
+void adapt_calibrate_end(void* /*clientData*/)
+{
+    adapt_clip_done = 1;
+}
+
+// The cpu time per frame of a transcoder at bitrate, % of a core, pulling
+// the clip without the event loop: each AU is delivered before
+// getNextFrame() returns
+// Return -1 if the transcoder can't be created
+int adapt_measure(AACClipSource *clip, unsigned int freq, unsigned int chan,
+                  unsigned bitrate, Boolean afterburner, double *cost)
+{
+    unsigned char au[TRANSCODE_AU_SIZE_MAX];
+    AACTranscoder *t;
+    double decodeUs, encodeUs;
+
+    t = AACTranscoder::createNew(*env, clip, freq, chan, bitrate);
+    if (t == NULL) return -1;
+    t->setAfterburner(afterburner);
+    clip->rewind();
+    adapt_clip_done = 0;
+    while (!adapt_clip_done) {
+        t->getNextFrame(au, sizeof(au), adapt_calibrate_frame, NULL, adapt_calibrate_end, NULL);
+    }
+    decodeUs = (t->frames() > 0) ? t->decodeTime() / 1000.0 / t->frames() : 0;
+    encodeUs = (t->frames() > 0) ? t->encodeTime() / 1000.0 / t->frames() : 0;
+    *cost = 100.0 * (decodeUs + encodeUs) / (1024 * 1000000.0 / freq);
+    fprintf(stderr, "%lld: adapt - %2u kbps%s - per frame: decode %.1f us, encode %.1f us - cpu: %.2f%%\n",
+            current_timestamp(), bitrate / 1000, afterburner ? " with afterburner" : "", decodeUs, encodeUs, *cost);
+    // The clip is closed by the caller
+    t->detachInputSource();
+    Medium::close(t);
+
+    return 0;
+}
+
+// The cost of the re-encoding on this cpu, against --adapt_budget: the
+// most expensive setting, MAX with the afterburner, and the cheapest, MIN
+// without. It blocks the event loop, and with --threadless the capture:
+// a short clip, a synthetic voice encoded at MAX, is measured only at the
+// first start and the costs are kept in ADAPT_CALIBRATION_FILE for the
+// restarts with the same stream and range
+// Return -1 if the calibration fails or if MIN doesn't fit in the budget
+int adapt_calibrate(unsigned int freq, unsigned int chan)
+{
+    AACClipSource *clip;
+    FILE *f;
+    unsigned cachedFreq, cachedChan, cachedMax, cachedMin;
+    long long start = current_timestamp();
+    int cached = 0;
+
+    f = fopen(ADAPT_CALIBRATION_FILE, "r");
+    if (f != NULL) {
+        if ((fscanf(f, "%u %u %u %u %lf %lf", &cachedFreq, &cachedChan, &cachedMax, &cachedMin,
+                    &adaptState.cost_max, &adaptState.cost_min) == 6) &&
+                (cachedFreq == freq) && (cachedChan == chan) &&
+                (cachedMax == adapt_steps[adaptState.first]) && (cachedMin == adapt_steps[adaptState.last])) {
+            cached = 1;
+        }
+        fclose(f);
+    }
+
+    if (!cached) {
+        clip = AACClipSource::createNew(*env, freq, chan, adapt_steps[adaptState.first], ADAPT_CALIBRATE_SECONDS);
+        if (clip == NULL) {
+            fprintf(stderr, "%lld: adapt - error - couldn't create the calibration clip\n", current_timestamp());
+            return -1;
+        }
+        if ((adapt_measure(clip, freq, chan, adapt_steps[adaptState.first], True, &adaptState.cost_max) < 0) ||
+                (adapt_measure(clip, freq, chan, adapt_steps[adaptState.last], False, &adaptState.cost_min) < 0)) {
+            Medium::close(clip);
+            return -1;
+        }
+        Medium::close(clip);
+        f = fopen(ADAPT_CALIBRATION_FILE, "w");
+        if (f != NULL) {
+            fprintf(f, "%u %u %u %u %.2f %.2f\n", freq, chan, adapt_steps[adaptState.first], adapt_steps[adaptState.last],
+                    adaptState.cost_max, adaptState.cost_min);
+            fclose(f);
+        } else {
+            fprintf(stderr, "%lld: adapt - warning - couldn't save the calibration to %s\n", current_timestamp(), ADAPT_CALIBRATION_FILE);
+        }
+    }
+    startup_trace(STARTUP_ADAPT);
+    fprintf(stderr, "%lld: adapt - calibration %s in %lld ms - %u kbps with afterburner: %.2f%% - %u kbps: %.2f%% - budget %d%%\n",
+            current_timestamp(), cached ? "cached" : "measured", current_timestamp() - start,
+            adapt_steps[adaptState.first] / 1000, adaptState.cost_max,
+            adapt_steps[adaptState.last] / 1000, adaptState.cost_min, adapt_budget);
+
+    if (adaptState.cost_min > adapt_budget) {
+        fprintf(stderr, "%lld: adapt - error - %u kbps without afterburner costs %.2f%% of a core, over the budget of %d%%\n",
+                current_timestamp(), adapt_steps[adaptState.last] / 1000, adaptState.cost_min, adapt_budget);
+        return -1;
+    }
+    if (adaptState.cost_max > adapt_budget) {
+        fprintf(stderr, "%lld: adapt - warning - %u kbps with the afterburner costs %.2f%% of a core, over the budget of %d%%, the afterburner will likely be turned off\n",
+                current_timestamp(), adapt_steps[adaptState.first] / 1000, adaptState.cost_max, adapt_budget);
+    }
+
+    return 0;
+}
+
+// Keep the re-encoding within its cpu budget: without the afterburner
+// first, then forwarding the AUs of the firmware after ADAPT_OVER_CHECKS
+// checks in a row over it, a spike doesn't stop the re-encoding. After
+// ADAPT_PASSTHROUGH_HOLD ms they are encoded again at MIN, the cheapest step
+// Return 0 if the AUs are still encoded again
+int adapt_budget_check(long long now)
+{
+    AACTranscoder *t = sessionState.transcoder;
+    long long cpu = t->decodeTime() + t->encodeTime();
+    double share = (cpu - adaptState.cpu) / ((now - adaptState.checked) * 10000.0);
+
+    adaptState.cpu = cpu;
+    if (t->passthrough()) {
+        if (now < adaptState.resume) return -1;
+        if (!t->resume(adapt_steps[adaptState.last])) {
+            fprintf(stderr, "%lld: adapt - error - couldn't encode again, the AAC frames are still sent as they are\n", now);
+            adaptState.resume = now + ADAPT_PASSTHROUGH_HOLD;
+            return -1;
+        }
+        fprintf(stderr, "%lld: adapt - AAC frames encoded again at %u kbps after %d s sent as they are\n",
+                now, adapt_steps[adaptState.last] / 1000, ADAPT_PASSTHROUGH_HOLD / 1000);
+        adaptState.step = adaptState.last;
+        adaptState.good = 0;
+        adaptState.changes++;
+        adaptState.hold = now + ADAPT_HOLD;
+        return 0;
+    }
+    if (share <= adapt_budget) {
+        adaptState.over = 0;
+        return 0;
+    }
+
+    if (t->afterburner()) {
+        t->setAfterburner(False);
+        fprintf(stderr, "%lld: adapt - cpu %.1f%% over the budget of %d%%, afterburner off\n", now, share, adapt_budget);
+        return 0;
+    }
+    adaptState.over++;
+    if (adaptState.over < ADAPT_OVER_CHECKS) {
+        fprintf(stderr, "%lld: adapt - cpu %.1f%% over the budget of %d%% also without afterburner (%u/%d)\n",
+                now, share, adapt_budget, adaptState.over, ADAPT_OVER_CHECKS);
+        return 0;
+    }
+    t->setPassthrough();
+    adaptState.over = 0;
+    adaptState.resume = now + ADAPT_PASSTHROUGH_HOLD;
+    fprintf(stderr, "%lld: adapt - error - cpu %.1f%% over the budget of %d%% also without afterburner, the AAC frames are sent as they are after the ones held by the encoder for %d s\n",
+            now, share, adapt_budget, ADAPT_PASSTHROUGH_HOLD / 1000);
+    return -1;
+}
+
+// Move the bitrate a step down when the worst receiver reports losses or
+// jitter, a step up after ADAPT_UP_CHECKS clean checks: the thresholds of
+// the two directions are apart, and the reports that may still describe
+// the old bitrate are ignored for ADAPT_HOLD ms after a change
+void adapt_task(void *clientData)
+{
+    AACTranscoder *t = sessionState.transcoder;
+    RTPTransmissionStats *stats;
+    long long now = current_timestamp();
+    unsigned loss = 0, jitter = 0, reports = 0, j;
+    unsigned step = adaptState.step;
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    // The reports received while the AUs are forwarded describe their bitrate
+    if (adapt_budget_check(now) != 0) {
+        adaptState.checked = now;
+        adaptState.checked_tv = tv;
+        env->taskScheduler().scheduleDelayedTask(ADAPT_INTERVAL, (TaskFunc*) adapt_task, NULL);
+        return;
+    }
+    adaptState.checked = now;
+
+    RTPTransmissionStatsDB::Iterator it(sessionState.sink->transmissionStatsDB());
+    while ((stats = it.next()) != NULL) {
+        if (!timercmp(&stats->lastTimeReceived(), &adaptState.checked_tv, >)) continue;
+        reports++;
+        if (stats->packetLossRatio() > loss) loss = stats->packetLossRatio();
+        j = stats->jitter() * 1000 / freq;
+        if (j > jitter) jitter = j;
+    }
+    adaptState.checked_tv = tv;
+
+    if ((reports > 0) && (now >= adaptState.hold)) {
+        if ((loss >= ADAPT_LOSS_DOWN) || (jitter >= ADAPT_JITTER_DOWN)) {
+            step += (loss >= ADAPT_LOSS_DOWN_FAST) ? 2 : 1;
+            if (step > adaptState.last) step = adaptState.last;
+            adaptState.good = 0;
+        } else if ((loss <= ADAPT_LOSS_UP) && (jitter <= ADAPT_JITTER_UP)) {
+            adaptState.good++;
+            if ((adaptState.good >= ADAPT_UP_CHECKS) && (step > adaptState.first)) step--;
+        } else {
+            adaptState.good = 0;
+        }
+    }
+    if (debug && (reports > 0)) fprintf(stderr, "%lld: adapt - %u reports - loss: %.1f%% - jitter: %u ms\n", now, reports, loss * 100.0 / 256, jitter);
+
+    if (step != adaptState.step) {
+        fprintf(stderr, "%lld: adapt - loss: %.1f%% - jitter: %u ms - bitrate %u -> %u kbps\n",
+                now, loss * 100.0 / 256, jitter, adapt_steps[adaptState.step] / 1000, adapt_steps[step] / 1000);
+        t->setBitrate(adapt_steps[step]);
+        adaptState.step = step;
+        adaptState.good = 0;
+        adaptState.changes++;
+        adaptState.hold = now + ADAPT_HOLD;
+    }
+
+    env->taskScheduler().scheduleDelayedTask(ADAPT_INTERVAL, (TaskFunc*) adapt_task, NULL);
+}
+
+// Create groupsocks, RTP sink and RTCP instance of a video stream
+void video_session_init(struct videoSessionState_t *vs, cb_output_buffer *cb, FramedSource *memorySource,
+        struct sockaddr_storage const& destinationAddress, unsigned short rtpPortNum,
+        unsigned char ttl, unsigned char const* CNAME)
+{
+    const Port rtpPort(rtpPortNum);
+    const Port rtcpPort(rtpPortNum + 1);
+    unsigned char rtpPayloadFormat = 96; // a dynamic payload type
+    const unsigned estimatedSessionBandwidth = (cb->type == TYPE_HIGH) ? 2000 : 500; // in kbps; for RTCP b/w share
+
+    vs->buffer = cb;
+    vs->port = rtpPortNum;
+    vs->memorySource = memorySource;
+    vs->source = NULL;
+    vs->rtpGroupsock = new BatchGroupsock(*env, destinationAddress, rtpPort, ttl);
+    vs->rtcpGroupsock = new BatchGroupsock(*env, destinationAddress, rtcpPort, ttl);
+    if (isSSM) {
+        vs->rtpGroupsock->multicastSendOnly();
+        vs->rtcpGroupsock->multicastSendOnly();
+    }
+
+    if (cb->codec == CODEC_H264) {
+        vs->sink = H264VideoRTPSink::createNew(*env, vs->rtpGroupsock, rtpPayloadFormat);
+    } else {
+        vs->sink = H265VideoRTPSink::createNew(*env, vs->rtpGroupsock, rtpPayloadFormat);
+    }
+    vs->rtcpInstance = RTCPInstance::createNew(*env, vs->rtcpGroupsock,
+                                  estimatedSessionBandwidth, CNAME,
+                                  vs->sink, NULL /* we're a server */,
+                                  isSSM);
+    if (idle_timeout > 0) vs->rtcpInstance->setRRHandler(idle_rr_handler, NULL);
+
+    fprintf(stderr, "Video %s: h%d on port %d\n", (cb->type == TYPE_HIGH) ? "high" : "low", cb->codec, rtpPortNum);
+}
+
+// RTP sink of the decoded audio: G.711 has static payload types, L16 a dynamic one
+RTPSink *pcm_sink_create(Groupsock *gs)
+{
+    if (pcm_encoding == PCM_ENCODING_PCMU) {
+        return SimpleRTPSink::createNew(*env, gs, 0, 8000, "audio", "PCMU", 1, False);
+    } else if (pcm_encoding == PCM_ENCODING_PCMA) {
+        return SimpleRTPSink::createNew(*env, gs, 8, 8000, "audio", "PCMA", 1, False);
+    }
+    return SimpleRTPSink::createNew(*env, gs, 96, freq, "audio", "L16", 1, False);
+}
+
+const char *pcm_encoding_name()
+{
+    if (pcm_encoding == PCM_ENCODING_PCMU) return "PCMU";
+    if (pcm_encoding == PCM_ENCODING_PCMA) return "PCMA";
+    return "L16";
+}
+
+// Create groupsocks, RTP sink and RTCP instance of the decoded audio sent alongside the AAC stream
+void pcm_session_init(struct sockaddr_storage const& destinationAddress, unsigned char ttl, unsigned char const* CNAME)
+{
+    const Port rtpPort(pcm_port);
+    const Port rtcpPort(pcm_port + 1);
+    // in kbps; for RTCP b/w share
+    const unsigned estimatedSessionBandwidth = (pcm_encoding == PCM_ENCODING_L16) ? freq * 16 / 1000 : 64;
+
+    pcmSessionState.source = NULL;
+    pcmSessionState.filter = NULL;
+    pcmSessionState.rtpGroupsock = new BatchGroupsock(*env, destinationAddress, rtpPort, ttl);
+    pcmSessionState.rtcpGroupsock = new BatchGroupsock(*env, destinationAddress, rtcpPort, ttl);
+    if (isSSM) {
+        pcmSessionState.rtpGroupsock->multicastSendOnly();
+        pcmSessionState.rtcpGroupsock->multicastSendOnly();
+    }
+
+    pcmSessionState.sink = pcm_sink_create(pcmSessionState.rtpGroupsock);
+    pcmSessionState.rtcpInstance = RTCPInstance::createNew(*env, pcmSessionState.rtcpGroupsock,
+                                  estimatedSessionBandwidth, CNAME,
+                                  pcmSessionState.sink, NULL /* we're a server */,
+                                  isSSM);
+    if (idle_timeout > 0) pcmSessionState.rtcpInstance->setRRHandler(idle_rr_handler, NULL);
+
+    fprintf(stderr, "Decoded audio: %s on port %d\n", pcm_encoding_name(), pcm_port);
+}
+
+// Cost of the G.711 tables on this cpu, compared with the reference encoder
+void pcm_benchmark()
+{
+    long long table_ns, reference_ns;
+    int alaw = (pcm_encoding == PCM_ENCODING_PCMA);
+
+    g711_benchmark(alaw, 8000, &table_ns, &reference_ns);
+    fprintf(stderr, "%lld: g711 - %s of 1 s of audio: %lld us with the tables, %lld us with the reference encoder\n",
+            current_timestamp(), alaw ? "A-law" : "mu-law", table_ns / 1000, reference_ns / 1000);
+}
+
+// Parse ADDRESS, ADDRESS:PORT or [ADDRESS]:PORT (ipv6), PORT is the audio RTP port
+// Return 0 on success
+int destination_parse(const char *spec, struct sockaddr_storage *address, unsigned short *port)
+{
+    char host[64];
+    const char *end, *port_str = NULL;
+    char *port_end;
+    long p;
+
+    if (spec[0] == '[') {
+        end = strchr(spec, ']');
+        if (end == NULL) return -1;
+        if (end[1] == ':') {
+            port_str = end + 2;
+        } else if (end[1] != '\0') {
+            return -1;
+        }
+        spec++;
+    } else {
+        end = strchr(spec, ':');
+        // More than one ':' is an ipv6 address without port
+        if ((end != NULL) && (strchr(end + 1, ':') == NULL)) {
+            port_str = end + 1;
+        } else {
+            end = spec + strlen(spec);
+        }
+    }
+    if ((end == spec) || (end - spec >= (int) sizeof(host))) return -1;
+    memcpy(host, spec, end - spec);
+    host[end - spec] = '\0';
+
+    *port = AUDIO_PORT_DEFAULT;
+    if (port_str != NULL) {
+        errno = 0;
+        p = strtol(port_str, &port_end, 10);
+        if ((errno != 0) || (port_end == port_str) || (*port_end != '\0') || (p < 1024) || (p > 65534)) return -1;
+        *port = p;
+    }
+
+    NetAddressList addresses(host, ipv6 ? AF_INET6 : AF_INET);
+    if (addresses.numAddresses() == 0) return -1;
+    copyAddress(*address, addresses.firstAddress());
+
+    return 0;
+}
+
+// Compare the ip addresses only
+int destination_same_address(struct sockaddr_storage const& a, struct sockaddr_storage const& b)
+{
+    if (a.ss_family != b.ss_family) return 0;
+    if (a.ss_family == AF_INET) {
+        return ((struct sockaddr_in const&) a).sin_addr.s_addr == ((struct sockaddr_in const&) b).sin_addr.s_addr;
+    }
+    return memcmp(&((struct sockaddr_in6 const&) a).sin6_addr, &((struct sockaddr_in6 const&) b).sin6_addr,
+            sizeof(struct in6_addr)) == 0;
+}
+
+unsigned short destination_address_port(struct sockaddr_storage const& a)
+{
+    if (a.ss_family == AF_INET) return ntohs(((struct sockaddr_in const&) a).sin_port);
+    return ntohs(((struct sockaddr_in6 const&) a).sin6_port);
+}
+
+struct destination_t *destination_find(struct sockaddr_storage const& address, unsigned short port)
+{
+    int i;
 
-        if (buf_idx_end == buf_idx_end_prev) {
-            if (debug) fprintf(stderr, "%lld: capture - buf_idx_end == buf_idx_end_prev\n", current_timestamp());
-            usleep(10000);
-            continue;
+    for (i = 0; i < DESTINATIONS_MAX; i++) {
+        if ((destinations[i].sessionId != 0) && (destinations[i].port == port) &&
+                destination_same_address(destinations[i].address, address)) {
+            return &destinations[i];
         }
+    }
+    return NULL;
+}
 
-        buf_idx_cur = buf_idx_end_prev;
-        frame_sync = 1;
-        i = 0;
+// Called by the audio RTCP instance when the destination sends a RR
+void destination_rr_handler(void *clientData)
+{
+    struct destination_t *d = (struct destination_t *) clientData;
 
-        while (buf_idx_cur != buf_idx_end) {
-            cb2s_headercpy((unsigned char *) &fhs[i], buf_idx_cur, frame_header_size);
-            // Check the len
-            if (fhs[i].len > input_buffer.size - input_buffer.offset) {
-                frame_sync = 0;
-                if (debug) fprintf(stderr, "%lld: capture - fhs[i].len > input_buffer.size - input_buffer.offset\n", current_timestamp());
-                break;
-            }
-            fhs_addr[i] = buf_idx_cur;
-            buf_idx_cur = cb_move(buf_idx_cur, fhs[i].len + frame_header_size);
-            i++;
-            // Check if the sync is lost
-            if (i == 10) {
-                frame_sync = 0;
-                if (debug) fprintf(stderr, "%lld: capture - i=10\n", current_timestamp());
-                break;
-            }
-        }
+    d->last_rr = current_timestamp();
+    d->rr_count++;
+}
 
-        if (frame_sync == 0) {
-            buf_idx_end_prev = buf_idx_end;
-            if (debug) fprintf(stderr, "%lld: capture - frame_sync == 0\n", current_timestamp());
-            usleep(10000);
-            continue;
+// Add a unicast destination to the audio and video sessions
+// The packets already queued are not affected: the other destinations don't notice it
+// Return 0 on success, msg is the answer for the control socket
+int destination_add(const char *spec, char *msg, int msg_size)
+{
+    struct sockaddr_storage address;
+    unsigned short port;
+    struct destination_t *d = NULL;
+    struct videoSessionState_t *vs;
+    char host[INET6_ADDRSTRLEN];
+    int i, video_rtp, pcm_rtp = 0;
+
+    if (destination_parse(spec, &address, &port) != 0) {
+        snprintf(msg, msg_size, "error - invalid destination %s\n", spec);
+        return -1;
+    }
+    // The video ports keep the same distance from the audio port as the defaults
+    for (i = 0; i < videoSessions; i++) {
+        video_rtp = port + videoSessionState[i].port - AUDIO_PORT_DEFAULT;
+        if ((video_rtp < 1024) || (video_rtp > 65534)) {
+            snprintf(msg, msg_size, "error - the video port of %s would be %d\n", spec, video_rtp);
+            return -1;
         }
-
-        n = i;
-        // Ignore last frame, it could be corrupted
-        if (n > 1) {
-            buf_idx_end_prev = fhs_addr[n - 1];
-            n--;
-        } else {
-            if (debug) fprintf(stderr, "%lld: capture - ! n > 1\n", current_timestamp());
-            usleep(10000);
-            continue;
+    }
+    // And the port of the decoded audio
+    if (pcmSessionState.sink != NULL) {
+        pcm_rtp = port + pcm_port - AUDIO_PORT_DEFAULT;
+        if ((pcm_rtp < 1024) || (pcm_rtp > 65534)) {
+            snprintf(msg, msg_size, "error - the pcm port of %s would be %d\n", spec, pcm_rtp);
+            return -1;
+        }
+    }
+    if (destination_find(address, port) != NULL) {
+        snprintf(msg, msg_size, "error - %s is already a destination\n", spec);
+        return -1;
+    }
+    for (i = 0; i < DESTINATIONS_MAX; i++) {
+        if (destinations[i].sessionId == 0) {
+            d = &destinations[i];
+            break;
         }
+    }
+    if (d == NULL) {
+        snprintf(msg, msg_size, "error - too many destinations, max %d\n", DESTINATIONS_MAX);
+        return -1;
+    }
 
-        if (n > 0) {
-            if (fhs[0].counter != last_counter + 1) {
-                fprintf(stderr, "%lld: capture - warning - %d frame(s) lost\n",
-                            current_timestamp(), fhs[0].counter - (last_counter + 1));
-            }
-            last_counter = fhs[n - 1].counter;
-        }
-
-        for (i = 0; i < n; i++) {
-            buf_idx_cur = fhs_addr[i];
-            frame_len = fhs[i].len;
-            buf_idx_cur = cb_move(buf_idx_cur, frame_header_size);
-
-            // Autodetect stream type (only the 1st time)
-            if ((freq == -1) && (chan == -1)) {
-                int n = 0;
-                unsigned char *h = buf_idx_cur;
-
-                n = ((*h & 0xFF) == 0xFF);
-                n += ((*(h + 1) & 0xF0) == 0xF0);
-                if (n == 2) {
-                    h += 2;
-                    freq = (*h & 0x3c) >> 2;
-                    chan = (*h & 0x01) << 2;
-                    h++;
-                    chan += (*h & 0xc0) >> 6;
-
-                    freq = samplingFrequencyTable[freq];
-                    if (chan == 8) chan--;
-                    if (debug) fprintf(stderr, "%lld: aac detected - frequency: %d - channels: %d\n",
-                                current_timestamp(), freq, chan);
-                }
-            }
+    d->sessionId = d - destinations + 1;
+    d->address = address;
+    d->port = port;
+    if (address.ss_family == AF_INET) {
+        inet_ntop(AF_INET, &((struct sockaddr_in *) &address)->sin_addr, host, sizeof(host));
+        snprintf(d->name, sizeof(d->name), "%s:%u", host, port);
+    } else {
+        inet_ntop(AF_INET6, &((struct sockaddr_in6 *) &address)->sin6_addr, host, sizeof(host));
+        snprintf(d->name, sizeof(d->name), "[%s]:%u", host, port);
+    }
+    d->added = current_timestamp();
+    d->last_rr = 0;
+    d->rr_count = 0;
+
+    sessionState.rtpGroupsock->addDestination(address, Port(port), d->sessionId);
+    sessionState.rtcpGroupsock->addDestination(address, Port(port + 1), d->sessionId);
+    sessionState.rtcpInstance->setSpecificRRHandler(address, Port(port + 1), destination_rr_handler, d);
+    for (i = 0; i < videoSessions; i++) {
+        vs = &videoSessionState[i];
+        video_rtp = port + vs->port - AUDIO_PORT_DEFAULT;
+        vs->rtpGroupsock->addDestination(address, Port(video_rtp), d->sessionId);
+        vs->rtcpGroupsock->addDestination(address, Port(video_rtp + 1), d->sessionId);
+    }
+    if (pcmSessionState.sink != NULL) {
+        pcmSessionState.rtpGroupsock->addDestination(address, Port(pcm_rtp), d->sessionId);
+        pcmSessionState.rtcpGroupsock->addDestination(address, Port(pcm_rtp + 1), d->sessionId);
+    }
 
-            write_enable = 1;
-            frame_counter = fhs[i].stream_counter;
-            if (fhs[i].type & 0x0100) {
-                frame_type = TYPE_AAC;
-            } else {
-                frame_type = TYPE_NONE;
-            }
+    fprintf(stderr, "%lld: destination %s added\n", d->added, d->name);
+    idle_listener_seen("new destination");
+    snprintf(msg, msg_size, "ok - %s added\n", d->name);
+    return 0;
+}
 
-            if (frame_type == TYPE_AAC) {
-                if ((65536 + frame_counter - frame_counter_last_valid_audio) % 65536 > 1) {
-                    if (debug) fprintf(stderr, "%lld: aac in - warning - %d AAC frame(s) lost - frame_counter: %d - frame_counter_last_valid: %d\n",
-                                current_timestamp(), (65536 + frame_counter - frame_counter_last_valid_audio - 1) % 65536, frame_counter, frame_counter_last_valid_audio);
-                    frame_counter_last_valid_audio = frame_counter;
-                } else {
-                    if (debug) fprintf(stderr, "%lld: aac in - frame detected - frame_len: %d - frame_counter: %d - audio AAC\n",
-                                current_timestamp(), frame_len, fhs[i].stream_counter);
+// Remove a unicast destination, the others keep receiving without interruption
+// Return 0 on success, msg is the answer for the control socket
+int destination_remove(const char *spec, char *msg, int msg_size)
+{
+    struct sockaddr_storage address;
+    unsigned short port;
+    struct destination_t *d;
+    int i;
 
-                    frame_counter_last_valid_audio = frame_counter;
-                }
-                buf_idx_start = buf_idx_cur;
-            } else {
-                write_enable = 0;
-            }
+    if (destination_parse(spec, &address, &port) != 0) {
+        snprintf(msg, msg_size, "error - invalid destination %s\n", spec);
+        return -1;
+    }
+    d = destination_find(address, port);
+    if (d == NULL) {
+        snprintf(msg, msg_size, "error - %s is not a destination\n", spec);
+        return -1;
+    }
 
-            // Send the frame to the ouput buffer
-            if (write_enable) {
-                if (frame_type == TYPE_AAC) {
-                    cb_current = &output_buffer_audio;
-                } else {
-                    cb_current = NULL;
-                }
+    sessionState.rtcpInstance->unsetSpecificRRHandler(d->address, Port(d->port + 1));
+    sessionState.rtpGroupsock->removeDestination(d->sessionId);
+    sessionState.rtcpGroupsock->removeDestination(d->sessionId);
+    for (i = 0; i < videoSessions; i++) {
+        videoSessionState[i].rtpGroupsock->removeDestination(d->sessionId);
+        videoSessionState[i].rtcpGroupsock->removeDestination(d->sessionId);
+    }
+    if (pcmSessionState.sink != NULL) {
+        pcmSessionState.rtpGroupsock->removeDestination(d->sessionId);
+        pcmSessionState.rtcpGroupsock->removeDestination(d->sessionId);
+    }
+    d->sessionId = 0;
 
-                if (cb_current != NULL) {
-                    if (debug) fprintf(stderr, "%lld: aac in - frame_len: %d - cb_current->size: %d\n", current_timestamp(), frame_len, cb_current->size);
-                    if (frame_len > (signed) cb_current->size) {
-                        fprintf(stderr, "%lld: aac in - error - frame size exceeds buffer size\n", current_timestamp());
-                    } else {
-                        pthread_mutex_lock(&(cb_current->mutex));
-                        input_buffer.read_index = buf_idx_start;
-
-                        cb_current->output_frame[cb_current->frame_write_index].ptr = cb_current->write_index;
-                        cb_current->output_frame[cb_current->frame_write_index].counter = frame_counter;
-
-                        cb2cb_memcpy(cb_current, &input_buffer, frame_len);
-
-                        cb_current->output_frame[cb_current->frame_write_index].size = frame_len;
-                        if (debug) {
-                            fprintf(stderr, "%lld: aac in - frame_len: %d - frame_counter: %d - resolution: %d\n", current_timestamp(), frame_len, frame_counter, frame_type);
-                            fprintf(stderr, "%lld: aac in - frame_write_index: %d/%d\n", current_timestamp(), cb_current->frame_write_index, cb_current->output_frame_size);
-                        }
-                        cb_current->frame_write_index = (cb_current->frame_write_index + 1) % cb_current->output_frame_size;
-                        pthread_mutex_unlock(&(cb_current->mutex));
-                    }
-                }
-            }
+    fprintf(stderr, "%lld: destination %s removed\n", current_timestamp(), d->name);
+    snprintf(msg, msg_size, "ok - %s removed\n", d->name);
+    return 0;
+}
+
+// One line for each destination, with what its last RTCP RR says
+void destination_list(char *msg, int msg_size)
+{
+    RTPTransmissionStats *stats;
+    struct destination_t *d;
+    long long now = current_timestamp();
+    int i, len = 0;
+
+    msg[0] = '\0';
+    for (i = 0; i < DESTINATIONS_MAX; i++) {
+        d = &destinations[i];
+        if (d->sessionId == 0) continue;
+
+        RTPTransmissionStatsDB::Iterator it(sessionState.sink->transmissionStatsDB());
+        while ((stats = it.next()) != NULL) {
+            if ((destination_address_port(stats->lastFromAddress()) == d->port + 1) &&
+                    destination_same_address(stats->lastFromAddress(), d->address)) break;
         }
 
-        usleep(25000);
+        if ((d->last_rr == 0) || (stats == NULL)) {
+            len += snprintf(msg + len, msg_size - len, "%s - up %lld s - no rtcp rr\n",
+                    d->name, (now - d->added) / 1000);
+        } else {
+            len += snprintf(msg + len, msg_size - len,
+                    "%s - up %lld s - rtcp rr: %u, last %lld s ago - loss: %.1f%% - jitter: %u ms - rtt: %u ms\n",
+                    d->name, (now - d->added) / 1000, d->rr_count, (now - d->last_rr) / 1000,
+                    stats->packetLossRatio() * 100.0 / 256, stats->jitter() * 1000 / freq,
+                    stats->roundTripDelay() * 1000 / 65536);
+        }
+        if (len >= msg_size) return;
     }
+    if (len == 0) snprintf(msg, msg_size, "no destinations\n");
+}
 
-    // Unreacheable path
-
-    // Unmap file from memory
-    if (munmap(input_buffer.buffer, input_buffer.size) == -1) {
-        fprintf(stderr, "%lld: capture - error - unmapping file\n", current_timestamp());
+// Commands of the control socket
+void destination_command(char *line, char *reply, int reply_size)
+{
+    char *cmd = strtok(line, " \t");
+    char *arg = strtok(NULL, " \t");
+
+    if ((cmd != NULL) && (strcasecmp("add", cmd) == 0) && (arg != NULL)) {
+        destination_add(arg, reply, reply_size);
+    } else if ((cmd != NULL) && (strcasecmp("remove", cmd) == 0) && (arg != NULL)) {
+        destination_remove(arg, reply, reply_size);
+    } else if ((cmd != NULL) && (strcasecmp("list", cmd) == 0)) {
+        destination_list(reply, reply_size);
     } else {
-        if (debug) fprintf(stderr, "%lld: capture - unmapping file %s, size %d, from %08x\n", current_timestamp(), input_buffer.filename, input_buffer.size, (unsigned int) input_buffer.buffer);
+        snprintf(reply, reply_size, "error - commands: add ADDRESS[:PORT], remove ADDRESS[:PORT], list\n");
+    }
+}
+
+// RTSP server with the audio stream, a source for each client
+void rtsp_server_init()
+{
+    RTSPServer* rtspServer = RTSPServer::createNew(*env, rtsp_port, NULL);
+    if (rtspServer == NULL) {
+        fprintf(stderr, "Failed to create RTSP server: %s\n", env->getResultMsg());
+        exit(EXIT_FAILURE);
     }
 
-    return NULL;
+    ServerMediaSession* sms = ServerMediaSession::createNew(*env, RTSP_STREAM_NAME, RTSP_STREAM_NAME,
+            "Audio of the cam, from rAudioStreamer");
+    // A shared source would give the pre-roll only to the first client
+    sms->addSubsession(AudioFramedMemoryServerMediaSubsession::createNew(*env, &output_buffer_audio,
+            freq, chan, preroll, aggregate_latency, False));
+    rtspServer->addServerMediaSession(sms);
+
+    char* url = rtspServer->rtspURL(sms);
+    fprintf(stderr, "Play this stream using the URL \"%s\"\n", url);
+    delete[] url;
+}
+
+// Parse STREAM:BYTES:SLOTS and set the geometry of the output buffer of STREAM
+// Return 0 on success
+int ring_geometry_parse(const char *spec)
+{
+    char name[16];
+    unsigned int size, slots;
+    unsigned int i;
+
+    if (sscanf(spec, "%15[^:]:%u:%u", name, &size, &slots) != 3) return -1;
+    if ((slots < OUTPUT_BUFFER_SLOTS_MIN) || (slots > OUTPUT_BUFFER_SLOTS_MAX)) return -1;
+
+    for (i = 0; i < sizeof(ringGeometry) / sizeof(ringGeometry[0]); i++) {
+        if (strcasecmp(ringGeometry[i].name, name) != 0) continue;
+        // A frame must always fit: audio frames are small, video ones up to VIDEO_FRAME_SIZE_MAX
+        if ((size < ((i == RING_AUDIO) ? 4096 : VIDEO_FRAME_SIZE_MAX)) || (size > 64 * 1024 * 1024)) return -1;
+        ringGeometry[i].size = size;
+        ringGeometry[i].slots = slots;
+        return 0;
+    }
+    return -1;
 }
 
 void print_usage(char *progname)
 {
     fprintf(stderr, "\nUsage: %s [options]\n\n", progname);
     fprintf(stderr, "\t-m MODEL, --model MODEL\n");
-    fprintf(stderr, "\t\tset model: y203c, y23, y25, y30, h201c, h305r, h307\n");
+    fprintf(stderr, "\t\tset model: auto (detect offset and header from the buffer)\n");
+    fprintf(stderr, "\t\t           y203c, y23, y25, y30, h201c, h305r, h307\n");
     fprintf(stderr, "\t\t           y20ga, y25ga, y30qa, y501gc\n");
     fprintf(stderr, "\t\t           y21ga, y211ga, y213ga, y291ga, h30ga, r30gb, r35gb, r40ga, h51ga, h52ga, h60ga, y28ga, y29ga, y623, q321br_lsx, qg311r or b091qp (default y21ga)\n");
     fprintf(stderr, "\t-x TYPE, --xcast TYPE\n");
     fprintf(stderr, "\t\tset unicast, multicast or ssm (source-specific multicast)\n");
-    fprintf(stderr, "\t-a ADDRESS,  --address ADDRESS\n");
-    fprintf(stderr, "\t\tset unicast destination address\n");
+    fprintf(stderr, "\t-a ADDRESS[:PORT],  --address ADDRESS[:PORT]\n");
+    fprintf(stderr, "\t\tadd a unicast destination, ipv6 as [ADDRESS]:PORT (default port %d), repeat it for up to %d destinations\n",
+            AUDIO_PORT_DEFAULT, DESTINATIONS_MAX);
     fprintf(stderr, "\t-i,   --ipv6\n");
     fprintf(stderr, "\t\tuse ipv6 instead of ipv4\n");
+    fprintf(stderr, "\t-s,   --single_copy\n");
+    fprintf(stderr, "\t\tcopy the frames from the shared memory straight to the RTP packets\n");
+    fprintf(stderr, "\t-t,   --threadless\n");
+    fprintf(stderr, "\t\tread the shared memory from the RTP event loop, without a capture thread\n");
+    fprintf(stderr, "\t-v STREAM, --video STREAM\n");
+    fprintf(stderr, "\t\tstream also the video: none, high, low or both (default none)\n");
+    fprintf(stderr, "\t-o PORT, --video_port PORT\n");
+    fprintf(stderr, "\t\tset the RTP port of the high video, the low one uses PORT + 2 (default %d)\n", VIDEO_PORT_DEFAULT);
+    fprintf(stderr, "\t-b NAME, --bus NAME\n");
+    fprintf(stderr, "\t\tpublish also the audio frames to /dev/shm/NAME for other local processes\n");
+    fprintf(stderr, "\t\twithout --address and --control: publish only, no RTP\n");
+    fprintf(stderr, "\t-r PRIO, --realtime PRIO\n");
+    fprintf(stderr, "\t\trun the capture with SCHED_FIFO priority PRIO (1-99), lock and prefault the memory\n");
+    fprintf(stderr, "\t-c CPU, --cpu CPU\n");
+    fprintf(stderr, "\t\tbind the capture and the RTP event loop to CPU\n");
+    fprintf(stderr, "\t-g STREAM:BYTES:SLOTS, --ring STREAM:BYTES:SLOTS\n");
+    fprintf(stderr, "\t\tset the size of the output buffer of STREAM (audio, high or low) and the max number of frames in it\n");
+    fprintf(stderr, "\t\t(default audio:%d:%d, high:%d:%d, low:%d:%d, BYTES is not used with --single_copy)\n",
+            OUTPUT_BUFFER_SIZE_AUDIO, OUTPUT_BUFFER_SLOTS_AUDIO, OUTPUT_BUFFER_SIZE_HIGH, OUTPUT_BUFFER_SLOTS_VIDEO,
+            OUTPUT_BUFFER_SIZE_LOW, OUTPUT_BUFFER_SLOTS_VIDEO);
+    fprintf(stderr, "\t-O POLICY, --overrun POLICY\n");
+    fprintf(stderr, "\t\twhen a reader is too late for a new frame: drop-newest, drop-oldest or reset-to-live (default drop-newest)\n");
+    fprintf(stderr, "\t-A MS, --aggregate MS\n");
+    fprintf(stderr, "\t\tpack several AAC frames in each RTP packet, adding at most MS ms of latency (default 0, one frame per packet)\n");
+    fprintf(stderr, "\t-e N, --red N\n");
+    fprintf(stderr, "\t\tsend again the previous N AAC frames (max %d) in each RTP packet (RFC 2198, receiver --red), default 0\n", RED_DEPTH_MAX);
+    fprintf(stderr, "\t-L PACKETS:FRAMES, --interleave PACKETS:FRAMES\n");
+    fprintf(stderr, "\t\tspread groups of PACKETS x FRAMES AAC frames over PACKETS packets (max %d:%d), a burst of lost packets\n",
+            INTERLEAVE_PACKETS_MAX, INTERLEAVE_FRAMES_MAX);
+    fprintf(stderr, "\t\tloses isolated frames (RFC 3640 interleaving, receiver --deinterleave), adds PACKETS x FRAMES frames of latency\n");
+    fprintf(stderr, "\t-E CODEC[:PORT], --pcm CODEC[:PORT]\n");
+    fprintf(stderr, "\t\tdecode the AAC frames and send them as CODEC: l16, pcmu or pcma (G.711, 8 or 16 kHz audio only), mono\n");
+    fprintf(stderr, "\t\tinstead of the AAC stream, or alongside it on PORT (with --debug the cpu time is in the stats)\n");
+    fprintf(stderr, "\t-T MIN:MAX, --adapt MIN:MAX\n");
+    fprintf(stderr, "\t\tencode the AAC frames again at a bitrate between MIN and MAX kbps (%u-%u), lowered when the RTCP\n",
+            adapt_steps[ADAPT_STEPS - 1] / 1000, adapt_steps[0] / 1000);
+    fprintf(stderr, "\t\treports of the receivers show losses or jitter, raised again when the link is clean\n");
+    fprintf(stderr, "\t-B PCT, --adapt_budget PCT\n");
+    fprintf(stderr, "\t\tmax cpu of --adapt, %% of a core: over it the afterburner is turned off, then the frames are sent as they are\n");
+    fprintf(stderr, "\t\t(default %d), the streamer exits if MIN without the afterburner costs more\n", ADAPT_BUDGET_DEFAULT);
+    fprintf(stderr, "\t-C PATH, --control PATH\n");
+    fprintf(stderr, "\t\tadd and remove unicast destinations at runtime with commands sent to the Unix socket PATH\n");
+    fprintf(stderr, "\t-R PORT, --rtsp PORT\n");
+    fprintf(stderr, "\t\tdon't push the stream, run a RTSP server on PORT: rtsp://CAM:PORT/%s (audio only), %d clients at most\n",
+            RTSP_STREAM_NAME, FRAME_RING_READERS);
+    fprintf(stderr, "\t-P MS, --preroll MS\n");
+    fprintf(stderr, "\t\tRTSP server: start a new stream with the last MS ms of audio, sent at once (default %d)\n", PREROLL_DEFAULT);
+    fprintf(stderr, "\t-M,   --batch\n");
+    fprintf(stderr, "\t\tsend each packet to all the destinations with one sendmmsg() instead of one sendto() for each of them\n");
+    fprintf(stderr, "\t-I SEC, --idle SEC\n");
+    fprintf(stderr, "\t\tpark the capture and stop sending when there are no listeners for SEC s (min %d, default 0, never)\n", IDLE_TIMEOUT_MIN);
     fprintf(stderr, "\t-d,   --debug\n");
     fprintf(stderr, "\t\tenable debug\n");
     fprintf(stderr, "\t-h,   --help\n");
@@ -504,24 +2207,55 @@ void print_usage(char *progname)
 int main(int argc, char** argv)
 {
     char cast[16];
-    char address[16];
-    int ipv6;
     char configStr[5];
+    char msg[128];
+    char *pcm_port_str;
     int pth_ret;
-    int c, i;
+    unsigned savedMaxSize;
+    int c;
 
     pthread_t capture_thread;
+    pthread_attr_t capture_thread_attr;
+    FramedSource *videoSourceHigh, *videoSourceLow;
 
     FILE *fFS;
 
+    startup_trace(STARTUP_EXEC);
+
     // Setting default
-    model = Y21GA;
+    model = model_find("y21ga");
     debug = 0;
     packet_counter = 0;
+    single_copy = 0;
+    threadless = 0;
+    video_high = 0;
+    video_low = 0;
+    video_port = VIDEO_PORT_DEFAULT;
+    realtime_priority = 0;
+    realtime_cpu = -1;
+    bus_name = NULL;
+    frame_bus = NULL;
+    overrun_policy = OVERRUN_DROP_NEWEST;
+    aggregate_latency = 0;
+    control_path = NULL;
+    destination_arg_count = 0;
+    rtsp_port = 0;
+    preroll = PREROLL_DEFAULT;
+    idle_timeout = 0;
+    batch_send = 0;
+    red_depth = 0;
+    interleave_packets = 0;
+    interleave_frames = 0;
+    pcm_encoding = -1;
+    pcm_port = 0;
+    adapt_min = 0;
+    adapt_max = 0;
+    adapt_budget = ADAPT_BUDGET_DEFAULT;
+    capture_idle = 0;
+    capture_ready = 0;
     isSSM = False;
 
     strcpy(cast, "unicast");
-    memset(address, 0, sizeof(address));
     ipv6 = 0;
     freq = -1;
     chan = -1;
@@ -534,6 +2268,26 @@ int main(int argc, char** argv)
             {"address",  required_argument, 0, 'a'},
             {"ipv6",  no_argument, 0, 'i'},
             {"pc",  no_argument, 0, 'p'},
+            {"single_copy",  no_argument, 0, 's'},
+            {"threadless",  no_argument, 0, 't'},
+            {"video",  required_argument, 0, 'v'},
+            {"video_port",  required_argument, 0, 'o'},
+            {"bus",  required_argument, 0, 'b'},
+            {"realtime",  required_argument, 0, 'r'},
+            {"cpu",  required_argument, 0, 'c'},
+            {"ring",  required_argument, 0, 'g'},
+            {"overrun",  required_argument, 0, 'O'},
+            {"aggregate",  required_argument, 0, 'A'},
+            {"control",  required_argument, 0, 'C'},
+            {"rtsp",  required_argument, 0, 'R'},
+            {"preroll",  required_argument, 0, 'P'},
+            {"idle",  required_argument, 0, 'I'},
+            {"batch",  no_argument, 0, 'M'},
+            {"red",  required_argument, 0, 'e'},
+            {"interleave",  required_argument, 0, 'L'},
+            {"pcm",  required_argument, 0, 'E'},
+            {"adapt",  required_argument, 0, 'T'},
+            {"adapt_budget",  required_argument, 0, 'B'},
             {"debug",  no_argument, 0, 'd'},
             {"help",  no_argument, 0, 'h'},
             {0, 0, 0, 0}
@@ -541,7 +2295,7 @@ int main(int argc, char** argv)
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long (argc, argv, "m:a:x:ipdh",
+        c = getopt_long (argc, argv, "m:a:x:ipstv:o:b:r:c:g:O:A:C:R:P:I:Me:L:E:T:B:dh",
                          long_options, &option_index);
 
         /* Detect the end of the options. */
@@ -550,64 +2304,14 @@ int main(int argc, char** argv)
 
         switch (c) {
         case 'm':
-            if (strcasecmp("y203c", optarg) == 0) {
-                model = Y203C;
-            } else if (strcasecmp("y23", optarg) == 0) {
-                model = Y23;
-            } else if (strcasecmp("y25", optarg) == 0) {
-                model = Y25;
-            } else if (strcasecmp("y30", optarg) == 0) {
-                model = Y30;
-            } else if (strcasecmp("h201c", optarg) == 0) {
-                model = H201C;
-            } else if (strcasecmp("h305r", optarg) == 0) {
-                model = H305R;
-            } else if (strcasecmp("h307", optarg) == 0) {
-                model = H307;
-
-            } else if (strcasecmp("y20ga", optarg) == 0) {
-                model = Y20GA;
-            } else if (strcasecmp("y25ga", optarg) == 0) {
-                model = Y25GA;
-            } else if (strcasecmp("y30qa", optarg) == 0) {
-                model = Y30QA;
-            } else if (strcasecmp("y501gc", optarg) == 0) {
-                model = Y501GC;
-
-            } else if (strcasecmp("y21ga", optarg) == 0) {
-                model = Y21GA;
-            } else if (strcasecmp("y211ga", optarg) == 0) {
-                model = Y211GA;
-            } else if (strcasecmp("y213ga", optarg) == 0) {
-                model = Y213GA;
-            } else if (strcasecmp("y291ga", optarg) == 0) {
-                model = Y291GA;
-            } else if (strcasecmp("h30ga", optarg) == 0) {
-                model = H30GA;
-            } else if (strcasecmp("r30gb", optarg) == 0) {
-                model = R30GB;
-            } else if (strcasecmp("r35gb", optarg) == 0) {
-                model = R35GB;
-            } else if (strcasecmp("r40ga", optarg) == 0) {
-                model = R40GA;
-            } else if (strcasecmp("h51ga", optarg) == 0) {
-                model = H51GA;
-            } else if (strcasecmp("h52ga", optarg) == 0) {
-                model = H52GA;
-            } else if (strcasecmp("h60ga", optarg) == 0) {
-                model = H60GA;
-            } else if (strcasecmp("y28ga", optarg) == 0) {
-                model = Y28GA;
-            } else if (strcasecmp("y29ga", optarg) == 0) {
-                model = Y29GA;
-            } else if (strcasecmp("y623", optarg) == 0) {
-                model = Y623;
-            } else if (strcasecmp("q321br_lsx", optarg) == 0) {
-                model = Q321BR_LSX;
-            } else if (strcasecmp("qg311r", optarg) == 0) {
-                model = QG311R;
-            } else if (strcasecmp("b091qp", optarg) == 0) {
-                model = B091QP;
+            if (strcasecmp("auto", optarg) == 0) {
+                model = &model_auto;
+            } else {
+                model = model_find(optarg);
+            }
+            if (model == NULL) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
             }
             break;
 
@@ -627,9 +2331,11 @@ int main(int argc, char** argv)
             break;
 
         case 'a':
-            if (strlen(optarg) < sizeof(address)) {
-                strcpy(address, optarg);
+            if (destination_arg_count == DESTINATIONS_MAX) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
             }
+            destination_args[destination_arg_count++] = optarg;
             break;
 
         case 'i':
@@ -640,6 +2346,187 @@ int main(int argc, char** argv)
             packet_counter = 1;
             break;
 
+        case 's':
+            single_copy = 1;
+            break;
+
+        case 't':
+            threadless = 1;
+            break;
+
+        case 'v':
+            if (strcasecmp("high", optarg) == 0) {
+                video_high = 1;
+            } else if (strcasecmp("low", optarg) == 0) {
+                video_low = 1;
+            } else if (strcasecmp("both", optarg) == 0) {
+                video_high = 1;
+                video_low = 1;
+            } else if (strcasecmp("none", optarg) != 0) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'o':
+            errno = 0;
+            video_port = strtol(optarg, NULL, 10);
+            if ((errno != 0) || (video_port < 1024) || (video_port > 65533)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'b':
+            // A POSIX shm name: one component, no slashes
+            if ((strlen(optarg) == 0) || (strlen(optarg) >= NAME_MAX) || (strchr(optarg, '/') != NULL)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            bus_name = optarg;
+            break;
+
+        case 'r':
+            errno = 0;
+            realtime_priority = strtol(optarg, NULL, 10);
+            if ((errno != 0) || (realtime_priority < 1) || (realtime_priority > 99)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'c':
+            errno = 0;
+            realtime_cpu = strtol(optarg, NULL, 10);
+            if ((errno != 0) || (realtime_cpu < 0) || (realtime_cpu >= sysconf(_SC_NPROCESSORS_CONF))) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'g':
+            if (ring_geometry_parse(optarg) != 0) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'O':
+            if (strcasecmp("drop-newest", optarg) == 0) {
+                overrun_policy = OVERRUN_DROP_NEWEST;
+            } else if (strcasecmp("drop-oldest", optarg) == 0) {
+                overrun_policy = OVERRUN_DROP_OLDEST;
+            } else if (strcasecmp("reset-to-live", optarg) == 0) {
+                overrun_policy = OVERRUN_RESET;
+            } else {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'A':
+            errno = 0;
+            aggregate_latency = strtol(optarg, NULL, 10);
+            if ((errno != 0) || (aggregate_latency < 0) || (aggregate_latency > 2000)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'C':
+            control_path = optarg;
+            break;
+
+        case 'R':
+            errno = 0;
+            rtsp_port = strtol(optarg, NULL, 10);
+            if ((errno != 0) || (rtsp_port < 1) || (rtsp_port > 65535)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'P':
+            errno = 0;
+            preroll = strtol(optarg, NULL, 10);
+            if ((errno != 0) || (preroll < 0) || (preroll > 2000)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'I':
+            errno = 0;
+            idle_timeout = strtol(optarg, NULL, 10);
+            if ((errno != 0) || ((idle_timeout != 0) && (idle_timeout < IDLE_TIMEOUT_MIN)) || (idle_timeout > 86400)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'M':
+            batch_send = 1;
+            break;
+
+        case 'L':
+            if ((sscanf(optarg, "%u:%u", &interleave_packets, &interleave_frames) != 2) ||
+                    (interleave_packets < 2) || (interleave_packets > INTERLEAVE_PACKETS_MAX) ||
+                    (interleave_frames < 1) || (interleave_frames > INTERLEAVE_FRAMES_MAX)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'E':
+            pcm_port_str = strchr(optarg, ':');
+            if (pcm_port_str != NULL) {
+                *pcm_port_str++ = '\0';
+                errno = 0;
+                pcm_port = strtol(pcm_port_str, NULL, 10);
+                if ((errno != 0) || (pcm_port < 1024) || (pcm_port > 65534)) {
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            if (strcasecmp("l16", optarg) == 0) {
+                pcm_encoding = PCM_ENCODING_L16;
+            } else if (strcasecmp("pcmu", optarg) == 0) {
+                pcm_encoding = PCM_ENCODING_PCMU;
+            } else if (strcasecmp("pcma", optarg) == 0) {
+                pcm_encoding = PCM_ENCODING_PCMA;
+            } else {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'T':
+            if ((sscanf(optarg, "%d:%d", &adapt_min, &adapt_max) != 2) ||
+                    (adapt_min < (int) adapt_steps[ADAPT_STEPS - 1] / 1000) || (adapt_max > (int) adapt_steps[0] / 1000) ||
+                    (adapt_min > adapt_max)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'B':
+            errno = 0;
+            adapt_budget = strtol(optarg, NULL, 10);
+            if ((errno != 0) || (adapt_budget < 1) || (adapt_budget > 100)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'e':
+            errno = 0;
+            red_depth = strtol(optarg, NULL, 10);
+            if ((errno != 0) || (red_depth < 0) || (red_depth > RED_DEPTH_MAX)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
         case 'd':
             debug = 1;
             break;
@@ -659,7 +2546,12 @@ int main(int argc, char** argv)
         }
     }
 
-    if ((model / 100) == 2) {
+    // Auto: the buffer file tells the platform
+    if (model == &model_auto) {
+        model_auto.platform = (access(BUFFER_FILE_MSTAR, F_OK) == 0) ? PLATFORM_MSTAR : PLATFORM_ALLWINNER;
+    }
+
+    if (model->platform == PLATFORM_MSTAR) {
         fFS = fopen(BUFFER_FILE_MSTAR, "r");
         if (fFS == NULL) {
             fprintf(stderr, "could not get size of %s\n", BUFFER_FILE_MSTAR);
@@ -675,158 +2567,178 @@ int main(int argc, char** argv)
     fseek(fFS, 0, SEEK_END);
     buf_size = ftell(fFS);
     // MStar
-    if ((model / 100) == 2) {
+    if (model->platform == PLATFORM_MSTAR) {
         buf_size -= 2;
     }
     fclose(fFS);
     if (debug) fprintf(stderr, "%lld: the size of the buffer is %d\n",
             current_timestamp(), buf_size);
 
-    if (model == Y203C) {
-        buf_offset = BUF_OFFSET_MSTAR;
-        frame_header_size = FRAME_HEADER_SIZE_MSTAR;
-    } else if (model == Y23) {
-        buf_offset = BUF_OFFSET_MSTAR;
-        frame_header_size = FRAME_HEADER_SIZE_MSTAR;
-    } else if (model == Y25) {
-        buf_offset = BUF_OFFSET_MSTAR;
-        frame_header_size = FRAME_HEADER_SIZE_MSTAR;
-    } else if (model == Y30) {
-        buf_offset = BUF_OFFSET_MSTAR;
-        frame_header_size = FRAME_HEADER_SIZE_MSTAR;
-    } else if (model == H201C) {
-        buf_offset = BUF_OFFSET_MSTAR;
-        frame_header_size = FRAME_HEADER_SIZE_MSTAR;
-    } else if (model == H305R) {
-        buf_offset = BUF_OFFSET_MSTAR;
-        frame_header_size = FRAME_HEADER_SIZE_MSTAR;
-    } else if (model == H307) {
-        buf_offset = BUF_OFFSET_MSTAR;
-        frame_header_size = FRAME_HEADER_SIZE_MSTAR;
-
-    } else if (model == Y20GA) {
-        buf_offset = BUF_OFFSET_Y20GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y20GA;
-    } else if (model == Y25GA) {
-        buf_offset = BUF_OFFSET_Y25GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y25GA;
-    } else if (model == Y30QA) {
-        buf_offset = BUF_OFFSET_Y30QA;
-        frame_header_size = FRAME_HEADER_SIZE_Y30QA;
-    } else if (model == Y501GC) {
-        buf_offset = BUF_OFFSET_Y501GC;
-        frame_header_size = FRAME_HEADER_SIZE_Y501GC;
-
-    } else if (model == Y21GA) {
-        buf_offset = BUF_OFFSET_Y21GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y21GA;
-    } else if (model == Y211GA) {
-        buf_offset = BUF_OFFSET_Y211GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y211GA;
-    } else if (model == Y213GA) {
-        buf_offset = BUF_OFFSET_Y213GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y213GA;
-    } else if (model == Y291GA) {
-        buf_offset = BUF_OFFSET_Y291GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y291GA;
-    } else if (model == H30GA) {
-        buf_offset = BUF_OFFSET_H30GA;
-        frame_header_size = FRAME_HEADER_SIZE_H30GA;
-    } else if (model == R30GB) {
-        buf_offset = BUF_OFFSET_R30GB;
-        frame_header_size = FRAME_HEADER_SIZE_R30GB;
-    } else if (model == R35GB) {
-        buf_offset = BUF_OFFSET_R35GB;
-        frame_header_size = FRAME_HEADER_SIZE_R35GB;
-    } else if (model == R40GA) {
-        buf_offset = BUF_OFFSET_R40GA;
-        frame_header_size = FRAME_HEADER_SIZE_R40GA;
-    } else if (model == H51GA) {
-        buf_offset = BUF_OFFSET_H51GA;
-        frame_header_size = FRAME_HEADER_SIZE_H51GA;
-    } else if (model == H52GA) {
-        buf_offset = BUF_OFFSET_H52GA;
-        frame_header_size = FRAME_HEADER_SIZE_H52GA;
-    } else if (model == H60GA) {
-        buf_offset = BUF_OFFSET_H60GA;
-        frame_header_size = FRAME_HEADER_SIZE_H60GA;
-    } else if (model == Y28GA) {
-        buf_offset = BUF_OFFSET_Y28GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y28GA;
-    } else if (model == Y29GA) {
-        buf_offset = BUF_OFFSET_Y29GA;
-        frame_header_size = FRAME_HEADER_SIZE_Y29GA;
-    } else if (model == Y623) {
-        buf_offset = BUF_OFFSET_Y623;
-        frame_header_size = FRAME_HEADER_SIZE_Y623;
-    } else if (model == Q321BR_LSX) {
-        buf_offset = BUF_OFFSET_Q321BR_LSX;
-        frame_header_size = FRAME_HEADER_SIZE_Q321BR_LSX;
-    } else if (model == QG311R) {
-        buf_offset = BUF_OFFSET_QG311R;
-        frame_header_size = FRAME_HEADER_SIZE_QG311R;
-    } else if (model == B091QP) {
-        buf_offset = BUF_OFFSET_B091QP;
-        frame_header_size = FRAME_HEADER_SIZE_B091QP;
-    }
-
-    if ((strcasecmp("unicast", cast) == 0) && (address[0] == '\0')) {
-        print_usage(argv[0]);
+    // Auto: both are set by the probe, when the buffer is mapped
+    buf_offset = model->buf_offset;
+    frame_header_size = model->frame_header_size;
+#ifdef SINGLE_LAYOUT
+    if ((model != &model_auto) && (frame_header_size != SINGLE_LAYOUT)) {
+        fprintf(stderr, "error - this build supports only %d bytes frame headers, model %s uses %d\n",
+                SINGLE_LAYOUT, model->name, frame_header_size);
+        exit(EXIT_FAILURE);
+    }
+#else
+    cb2s_header = cb2s_header_decoder(frame_header_size);
+#endif
+
+    if (rtsp_port > 0) {
+        // RTSP server: only the audio
+        video_high = 0;
+        video_low = 0;
+    } else if ((strcasecmp("unicast", cast) == 0) && (destination_arg_count == 0) && (control_path == NULL)) {
+        if (bus_name == NULL) {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        // Publisher only: no RTP, the video is not read
+        video_high = 0;
+        video_low = 0;
+    }
+    // Redundancy: the receivers must know the RFC 2198 payload type, the RTSP SDP doesn't
+    // describe it, and the blocks carry one AU each
+    if ((red_depth > 0) && ((rtsp_port > 0) || (aggregate_latency > 0))) {
+        fprintf(stderr, "error - --red can't be used with --rtsp or --aggregate\n");
+        exit(EXIT_FAILURE);
+    }
+    // Interleaving: the RTSP players don't de-interleave, and it packs the AUs itself
+    if ((interleave_packets > 0) && ((rtsp_port > 0) || (aggregate_latency > 0) || (red_depth > 0))) {
+        fprintf(stderr, "error - --interleave can't be used with --rtsp, --aggregate or --red\n");
+        exit(EXIT_FAILURE);
+    }
+    // Decoded audio: the RTSP SDP describes only the AAC stream
+    if ((pcm_encoding >= 0) && (rtsp_port > 0)) {
+        fprintf(stderr, "error - --pcm can't be used with --rtsp\n");
+        exit(EXIT_FAILURE);
+    }
+    // Instead of the AAC stream there are no AUs to pack, to send again or to interleave
+    if ((pcm_encoding >= 0) && (pcm_port == 0) && ((aggregate_latency > 0) || (red_depth > 0) || (interleave_packets > 0))) {
+        fprintf(stderr, "error - --pcm without PORT can't be used with --aggregate, --red or --interleave\n");
+        exit(EXIT_FAILURE);
+    }
+    // Alongside it: RTP and RTCP ports of its own
+    if ((pcm_port > 0) && ((abs(pcm_port - AUDIO_PORT_DEFAULT) < 2) ||
+            (video_high && (abs(pcm_port - video_port) < 2)) || (video_low && (abs(pcm_port - video_port - 2) < 2)))) {
+        fprintf(stderr, "error - the --pcm port %d is used by another stream\n", pcm_port);
+        exit(EXIT_FAILURE);
+    }
+    // Adaptive bitrate: it needs the RTCP RRs of the receivers, and the AUs
+    if ((adapt_min > 0) && ((rtsp_port > 0) || isSSM || ((pcm_encoding >= 0) && (pcm_port == 0)))) {
+        fprintf(stderr, "error - --adapt can't be used with --rtsp, ssm or --pcm without PORT\n");
+        exit(EXIT_FAILURE);
+    }
+    // Idle mode: the listeners are seen by their RTCP RRs, the ssm receivers send them only to the source
+    if ((idle_timeout > 0) && isSSM && (rtsp_port == 0)) {
+        fprintf(stderr, "error - --idle doesn't work with ssm, the receivers can't send RTCP reports to the cam\n");
         exit(EXIT_FAILURE);
     }
 
     setpriority(PRIO_PROCESS, 0, -10);
 
+    // Realtime: lock the memory before allocating the buffers, the event
+    // loop runs just below the capture (the capture thread inherits it)
+    if (realtime_priority > 0) realtime_lock();
+    if ((realtime_priority > 0) || (realtime_cpu >= 0)) {
+        realtime_thread("event loop", threadless ? realtime_priority :
+                ((realtime_priority > 1) ? realtime_priority - 1 : 1), realtime_cpu);
+    }
+
     // Fill input and output buffer struct
     strcpy(input_buffer.filename, BUFFER_SHM);
     input_buffer.size = buf_size;
     input_buffer.offset = buf_offset;
 
     // Audio
-    output_buffer_audio.type = TYPE_AAC;
-    output_buffer_audio.size = OUTPUT_BUFFER_SIZE_AUDIO;
-    output_buffer_audio.buffer = (unsigned char *) malloc(OUTPUT_BUFFER_SIZE_AUDIO * sizeof(unsigned char));
-    output_buffer_audio.write_index = output_buffer_audio.buffer;
-    output_buffer_audio.frame_read_index = 0;
-    output_buffer_audio.frame_write_index = 0;
-    output_buffer_audio.output_frame_size = sizeof(output_buffer_audio.output_frame) / sizeof(output_buffer_audio.output_frame[0]);
-    if (output_buffer_audio.buffer == NULL) {
-        fprintf(stderr, "could not alloc memory\n");
-        exit(EXIT_FAILURE);
+    cb_output_buffer_init(&output_buffer_audio, TYPE_AAC, ringGeometry[RING_AUDIO].size, ringGeometry[RING_AUDIO].slots);
+    // RTSP server: the ring is filled also when there are no clients, for the pre-roll of the next one
+    if ((rtsp_port > 0) && (preroll > 0)) output_buffer_audio.retain = 1;
+
+    // Video
+    if (video_high) cb_output_buffer_init(&output_buffer_video_high, TYPE_HIGH, ringGeometry[RING_HIGH].size, ringGeometry[RING_HIGH].slots);
+    if (video_low) cb_output_buffer_init(&output_buffer_video_low, TYPE_LOW, ringGeometry[RING_LOW].size, ringGeometry[RING_LOW].slots);
+
+    // Frame bus, before the capture starts
+    if (bus_name != NULL) {
+        frame_bus = frame_bus_create(bus_name, TYPE_AAC);
+        if (frame_bus == NULL) exit(EXIT_FAILURE);
+        fprintf(stderr, "Publishing the audio frames to /dev/shm/%s\n", bus_name);
     }
-    for (i = 0; i < output_buffer_audio.output_frame_size; i++) {
-        output_buffer_audio.output_frame[i].ptr = NULL;
-        output_buffer_audio.output_frame[i].counter = 0;
-        output_buffer_audio.output_frame[i].size = 0;
+
+    // Idle mode: wakes up the parked capture thread
+    if (idle_timeout > 0) {
+        idle_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (idle_event_fd == -1) {
+            fprintf(stderr, "error - could not create the eventfd of the idle mode\n");
+            exit(EXIT_FAILURE);
+        }
     }
 
     // Begin by setting up our usage environment:
     TaskScheduler* scheduler = BasicTaskScheduler::createNew();
     env = BasicUsageEnvironment::createNew(*scheduler);
 
-    // Start capture thread
-    if (pthread_mutex_init(&(output_buffer_audio.mutex), NULL) != 0) {
-        fprintf(stderr, "Failed to create mutex\n");
-        if(output_buffer_audio.buffer != NULL) free(output_buffer_audio.buffer);
-        exit(EXIT_FAILURE);
+    // Attach the video readers before starting the capture, so that the
+    // first key frame is kept: the frames of a ring without readers are skipped
+    videoSourceHigh = VideoFramedMemorySource::createNew(*env, video_high ? &output_buffer_video_high : NULL);
+    videoSourceLow = VideoFramedMemorySource::createNew(*env, video_low ? &output_buffer_video_low : NULL);
+
+    if (threadless) {
+        // Run the capture in the event loop until the stream type is detected
+        capture_init();
+        capture_task_token = env->taskScheduler().scheduleDelayedTask(0, (TaskFunc*) capture_task, NULL);
+        env->taskScheduler().doEventLoop(&capture_ready);
+    } else {
+        // Start capture thread
+        // Realtime: the whole stack is locked, keep it small
+        pthread_attr_init(&capture_thread_attr);
+        if (realtime_priority > 0) pthread_attr_setstacksize(&capture_thread_attr, REALTIME_STACK_SIZE);
+        pth_ret = pthread_create(&capture_thread, &capture_thread_attr, capture, (void*) NULL);
+        pthread_attr_destroy(&capture_thread_attr);
+        if (pth_ret != 0) {
+            fprintf(stderr, "Failed to create capture thread\n");
+            cb_output_buffer_free(&output_buffer_audio);
+            cb_output_buffer_free(&output_buffer_video_high);
+            cb_output_buffer_free(&output_buffer_video_low);
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(capture_thread);
+
+        // Wait for stream type autodetect
+        pthread_mutex_lock(&capture_ready_mutex);
+        while (!capture_ready) {
+            pthread_cond_wait(&capture_ready_cond, &capture_ready_mutex);
+        }
+        pthread_mutex_unlock(&capture_ready_mutex);
     }
-    pth_ret = pthread_create(&capture_thread, NULL, capture, (void*) NULL);
-    if (pth_ret != 0) {
-        fprintf(stderr, "Failed to create capture thread\n");
-        if(output_buffer_audio.buffer != NULL) free(output_buffer_audio.buffer);
-        exit(EXIT_FAILURE);
+
+    if (debug) process_stats_task(NULL);
+
+    // Idle mode: the listeners have idle_timeout s to show up
+    if (idle_timeout > 0) {
+        idleState.last_listener = current_timestamp();
+        env->taskScheduler().scheduleDelayedTask(IDLE_CHECK_INTERVAL, (TaskFunc*) idle_check_task, NULL);
     }
-    pthread_detach(capture_thread);
 
-    sleep(2);
+    // RTSP server: nothing is sent until a client asks for the stream
+    if (rtsp_port > 0) {
+        rtsp_server_init();
+        env->taskScheduler().doEventLoop(); // does not return
+    }
 
-    // Wait for stream type autodetect
-    while (1) {
-        if ((freq != -1) && (chan != -1)) {
-            usleep(10000);
-            break;
-        }
-        usleep(10000);
+    // Publisher only: keep the capture running in the event loop
+    if ((strcasecmp("unicast", cast) == 0) && (destination_arg_count == 0) && (control_path == NULL)) {
+        env->taskScheduler().doEventLoop(); // does not return
+    }
+
+    // G.711 is 8 kHz, AAC2PCMFilter can only halve the sampling frequency
+    if ((pcm_encoding >= 0) && (pcm_encoding != PCM_ENCODING_L16) && (freq != 8000) && (freq != 16000)) {
+        fprintf(stderr, "error - --pcm %s needs 8 or 16 kHz audio, the stream is %d Hz\n", pcm_encoding_name(), freq);
+        exit(EXIT_FAILURE);
     }
 
   // Create 'groupsocks' for RTP and RTCP:
@@ -837,7 +2749,7 @@ int main(int argc, char** argv)
         } else if (strcasecmp("multicast", cast) == 0) {
             strcpy(destinationAddressStr, "FF1E::FFFF:2A2A");
         } else if (strcasecmp("unicast", cast) == 0) {
-            strcpy(destinationAddressStr, address);
+            strcpy(destinationAddressStr, "::");
         }
     } else {
         if (strcasecmp("ssm", cast) == 0) {
@@ -845,15 +2757,19 @@ int main(int argc, char** argv)
         } else if (strcasecmp("multicast", cast) == 0) {
             strcpy(destinationAddressStr, "239.255.42.42");
         } else if (strcasecmp("unicast", cast) == 0) {
-            strcpy(destinationAddressStr, address);
+            strcpy(destinationAddressStr, "0.0.0.0");
         }
     }
 
-    const unsigned short rtpPortNum = 6666;
+    BatchGroupsock::setBatching(batch_send ? True : False);
+
+    const unsigned short rtpPortNum = AUDIO_PORT_DEFAULT;
     const unsigned short rtcpPortNum = rtpPortNum+1;
     const unsigned char ttl = 1; // low, in case routers don't admin scope
 
-    NetAddressList destinationAddresses(destinationAddressStr);
+    // Unicast: the groupsocks are created without destinations, the
+    // destinations of -a and of the control socket are added later
+    NetAddressList destinationAddresses(destinationAddressStr, ipv6 ? AF_INET6 : AF_INET);
     struct sockaddr_storage destinationAddress;
     copyAddress(destinationAddress, destinationAddresses.firstAddress());
 
@@ -861,9 +2777,9 @@ int main(int argc, char** argv)
     const Port rtcpPort(rtcpPortNum);
 
     sessionState.rtpGroupsock
-        = new Groupsock(*env, destinationAddress, rtpPort, ttl);
+        = new BatchGroupsock(*env, destinationAddress, rtpPort, ttl);
     sessionState.rtcpGroupsock
-        = new Groupsock(*env, destinationAddress, rtcpPort, ttl);
+        = new BatchGroupsock(*env, destinationAddress, rtcpPort, ttl);
 
     if (strcasecmp("ssm", cast) == 0) {
         sessionState.rtpGroupsock->multicastSendOnly();
@@ -872,12 +2788,33 @@ int main(int argc, char** argv)
 
     getAACConfigStr(configStr, freq, chan);
     unsigned char rtpPayloadFormat = 97; // a dynamic payload type
-    sessionState.sink
-        = MPEG4GenericRTPSink::createNew(*env, sessionState.rtpGroupsock,
-                                        rtpPayloadFormat,
-                                        freq,
-                                        "audio", "aac-hbr", configStr,
-                                        chan);
+    if ((pcm_encoding >= 0) && (pcm_port == 0)) {
+        // The decoded audio instead of the AUs
+        sessionState.sink = pcm_sink_create(sessionState.rtpGroupsock);
+    } else if ((aggregate_latency > 0) || (interleave_packets > 0)) {
+        // Same SDP, the AU header section is built by AACAggregator or AACInterleaver
+        sessionState.sink
+            = AACAggregateRTPSink::createNew(*env, sessionState.rtpGroupsock,
+                                            rtpPayloadFormat,
+                                            freq,
+                                            "audio", "aac-hbr", configStr,
+                                            chan);
+    } else if (red_depth > 0) {
+        // The RFC 2198 payload, with its blocks and their AU header sections, is built by AACRedundancy
+        sessionState.sink
+            = AACAggregateRTPSink::createNew(*env, sessionState.rtpGroupsock,
+                                            RED_PAYLOAD_FORMAT,
+                                            freq,
+                                            "audio", "aac-hbr", configStr,
+                                            chan);
+    } else {
+        sessionState.sink
+            = MPEG4GenericRTPSink::createNew(*env, sessionState.rtpGroupsock,
+                                            rtpPayloadFormat,
+                                            freq,
+                                            "audio", "aac-hbr", configStr,
+                                            chan);
+    }
 
     // Create (and start) a 'RTCP instance' for this RTP sink:
     const unsigned estimatedSessionBandwidth = 50; // in kbps; for RTCP b/w share
@@ -891,34 +2828,155 @@ int main(int argc, char** argv)
 				  sessionState.sink, NULL /* we're a server */,
 				  isSSM);
     // Note: This starts RTCP running automatically
+    if (idle_timeout > 0) sessionState.rtcpInstance->setRRHandler(idle_rr_handler, NULL);
+
+    // Video: high on video_port, low on video_port + 2
+    // Key frames don't fit in the default buffer of the sinks: only the video sinks get the big one
+    videoSessions = 0;
+    savedMaxSize = OutPacketBuffer::maxSize;
+    OutPacketBuffer::maxSize = VIDEO_FRAME_SIZE_MAX;
+    if (video_high) {
+        video_session_init(&videoSessionState[videoSessions++], &output_buffer_video_high, videoSourceHigh,
+                destinationAddress, video_port, ttl, CNAME);
+    }
+    if (video_low) {
+        video_session_init(&videoSessionState[videoSessions++], &output_buffer_video_low, videoSourceLow,
+                destinationAddress, video_port + 2, ttl, CNAME);
+    }
+    OutPacketBuffer::maxSize = savedMaxSize;
+    if (pcm_port > 0) pcm_session_init(destinationAddress, ttl, CNAME);
+
+    if (strcasecmp("unicast", cast) == 0) {
+        sessionState.rtpGroupsock->removeAllDestinations();
+        sessionState.rtcpGroupsock->removeAllDestinations();
+        for (c = 0; c < videoSessions; c++) {
+            videoSessionState[c].rtpGroupsock->removeAllDestinations();
+            videoSessionState[c].rtcpGroupsock->removeAllDestinations();
+        }
+        if (pcm_port > 0) {
+            pcmSessionState.rtpGroupsock->removeAllDestinations();
+            pcmSessionState.rtcpGroupsock->removeAllDestinations();
+        }
+        for (c = 0; c < destination_arg_count; c++) {
+            if (destination_add(destination_args[c], msg, sizeof(msg)) != 0) {
+                fprintf(stderr, "%s", msg);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (control_path != NULL) {
+            if (control_socket_open(env, control_path, destination_command) != 0) exit(EXIT_FAILURE);
+            fprintf(stderr, "Destinations can be changed with %s\n", control_path);
+        }
+    }
 
     play();
 
     env->taskScheduler().doEventLoop(); // does not return
 
-    pthread_mutex_destroy(&(output_buffer_audio.mutex));
-
     // Free buffers
-    if(output_buffer_audio.buffer != NULL) free(output_buffer_audio.buffer);
+    cb_output_buffer_free(&output_buffer_audio);
+    cb_output_buffer_free(&output_buffer_video_high);
+    cb_output_buffer_free(&output_buffer_video_low);
+    if (frame_bus != NULL) frame_bus_destroy(frame_bus, bus_name);
+    control_socket_close();
 
     delete sessionState.rtcpGroupsock;
     delete sessionState.rtpGroupsock;
+    for (c = 0; c < videoSessions; c++) {
+        delete videoSessionState[c].rtcpGroupsock;
+        delete videoSessionState[c].rtpGroupsock;
+    }
+    if (pcm_port > 0) {
+        delete pcmSessionState.rtcpGroupsock;
+        delete pcmSessionState.rtpGroupsock;
+    }
 
     return 0; // only to prevent compiler warning
 }
 
 void play()
 {
+    struct videoSessionState_t *vs;
+    int i;
+
     // Open the source:
     sessionState.source = AudioFramedMemorySource::createNew(*env, &output_buffer_audio, freq, chan);
     if (sessionState.source == NULL) {
         fprintf(stderr, "Unable to open source\n");
         exit(1);
     }
+    // First: the other filters pack, send again and interleave the new AUs
+    sessionState.transcoder = NULL;
+    if (adapt_min > 0) {
+        if (adapt_init() < 0) exit(EXIT_FAILURE);
+        if (adapt_calibrate(freq, chan) < 0) exit(EXIT_FAILURE);
+        sessionState.transcoder = AACTranscoder::createNew(*env, sessionState.source, freq, chan, adapt_steps[adaptState.step]);
+        if (sessionState.transcoder == NULL) exit(1);
+        sessionState.source = sessionState.transcoder;
+        fprintf(stderr, "AAC frames encoded again at %d to %d kbps, starting at %u kbps, %u ms of delay, cpu budget %d%% of a core\n",
+                adapt_min, adapt_max, adapt_steps[adaptState.step] / 1000, sessionState.transcoder->delayMs(), adapt_budget);
+        env->taskScheduler().scheduleDelayedTask(ADAPT_INTERVAL, (TaskFunc*) adapt_task, NULL);
+    }
+    sessionState.pcm = NULL;
+    if ((pcm_encoding >= 0) && (pcm_port == 0)) {
+        sessionState.pcm = AAC2PCMFilter::createNew(*env, sessionState.source, freq, chan, pcm_encoding);
+        if (sessionState.pcm == NULL) exit(1);
+        sessionState.source = sessionState.pcm;
+        fprintf(stderr, "AAC frames decoded and sent as %s at %u Hz, %u ms per RTP packet\n", pcm_encoding_name(),
+                sessionState.pcm->outputFrequency(), sessionState.pcm->payloadMs());
+    }
+    sessionState.aggregator = NULL;
+    if (aggregate_latency > 0) {
+        sessionState.aggregator = AACAggregator::createNew(*env, sessionState.source, freq, aggregate_latency);
+        sessionState.source = sessionState.aggregator;
+        fprintf(stderr, "Up to %u AAC frames per RTP packet\n", sessionState.aggregator->maxAUs());
+    }
+    sessionState.interleaver = NULL;
+    if (interleave_packets > 0) {
+        sessionState.interleaver = AACInterleaver::createNew(*env, sessionState.source, freq, interleave_packets, interleave_frames);
+        sessionState.source = sessionState.interleaver;
+        fprintf(stderr, "AAC frames interleaved in groups of %u packets x %u frames, %u ms of latency, bursts of up to %u lost packets lose isolated frames\n",
+                interleave_packets, interleave_frames, sessionState.interleaver->latencyMs(),
+                sessionState.interleaver->burstPackets());
+    }
+    sessionState.redundancy = NULL;
+    if (red_depth > 0) {
+        sessionState.redundancy = AACRedundancy::createNew(*env, sessionState.source, freq, red_depth, 97 /* the blocks are MPEG4-GENERIC */);
+        sessionState.source = sessionState.redundancy;
+        fprintf(stderr, "The previous %d AAC frames sent again in each RTP packet\n", red_depth);
+    }
 
     // Finally, start the streaming:
     fprintf(stderr, "Beginning streaming...\n");
     sessionState.sink->startPlaying(*sessionState.source, afterPlaying, NULL);
+
+    // Decoded audio alongside the AAC stream, from its own reader of the ring
+    if (pcm_port > 0) {
+        pcmSessionState.source = AudioFramedMemorySource::createNew(*env, &output_buffer_audio, freq, chan);
+        if (pcmSessionState.source == NULL) {
+            fprintf(stderr, "Unable to open source\n");
+            exit(1);
+        }
+        pcmSessionState.filter = AAC2PCMFilter::createNew(*env, pcmSessionState.source, freq, chan, pcm_encoding);
+        if (pcmSessionState.filter == NULL) exit(1);
+        pcmSessionState.source = pcmSessionState.filter;
+        fprintf(stderr, "AAC frames decoded and sent also as %s at %u Hz, %u ms per RTP packet\n", pcm_encoding_name(),
+                pcmSessionState.filter->outputFrequency(), pcmSessionState.filter->payloadMs());
+        pcmSessionState.sink->startPlaying(*pcmSessionState.source, afterPlayingPcm, NULL);
+    }
+    if ((pcm_encoding >= 0) && (pcm_encoding != PCM_ENCODING_L16) && debug) pcm_benchmark();
+
+    // Video: the framer splits the frames of the firmware in NAL units
+    for (i = 0; i < videoSessions; i++) {
+        vs = &videoSessionState[i];
+
+        if (vs->buffer->codec == CODEC_H264) {
+            vs->source = H264VideoStreamDiscreteFramer::createNew(*env, vs->memorySource);
+        } else {
+            vs->source = H265VideoStreamDiscreteFramer::createNew(*env, vs->memorySource);
+        }
+        vs->sink->startPlaying(*vs->source, afterPlayingVideo, vs);
+    }
 }
 
 
@@ -934,3 +2992,22 @@ void afterPlaying(void* /*clientData*/)
     // And start another loop:
 //    play();
 }
+
+void afterPlayingPcm(void* /*clientData*/)
+{
+    pcmSessionState.sink->stopPlaying();
+
+    // Closing the decoder closes the source too
+    Medium::close(pcmSessionState.source);
+    pcmSessionState.filter = NULL;
+}
+
+void afterPlayingVideo(void* clientData)
+{
+    struct videoSessionState_t *vs = (struct videoSessionState_t *) clientData;
+
+    vs->sink->stopPlaying();
+
+    // Closing the framer closes the source too
+    Medium::close(vs->source);
+}
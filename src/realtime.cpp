@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Realtime mode.
+ *
+ * mlockall(MCL_FUTURE) locks also the memory mapped later (output
+ * buffers, shm, thread stacks), so it's called before any of them is
+ * allocated. The prefault functions touch every page anyway, so that
+ * the first walk of the buffers doesn't fault even if mlockall failed.
+ */
+
+#include "realtime.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+extern int debug;
+
+long long current_timestamp();
+
+// Run the calling thread with SCHED_FIFO at priority if priority > 0, on cpu if cpu >= 0
+// Return 0 on success
+int realtime_thread(const char *name, int priority, int cpu)
+{
+    struct sched_param sp;
+    cpu_set_t set;
+    int ret = 0;
+
+    memset(&sp, 0, sizeof(sp));
+    sp.sched_priority = priority;
+    // pid 0 is the calling thread
+    if ((priority > 0) && (sched_setscheduler(0, SCHED_FIFO, &sp) == -1)) {
+        fprintf(stderr, "%lld: realtime - warning - could not set SCHED_FIFO %d for %s: %s\n",
+                current_timestamp(), priority, name, strerror(errno));
+        ret = -1;
+    }
+
+    if (cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+            fprintf(stderr, "%lld: realtime - warning - could not bind %s to cpu %d: %s\n",
+                    current_timestamp(), name, cpu, strerror(errno));
+            ret = -1;
+        }
+    }
+
+    if ((ret == 0) && debug) fprintf(stderr, "%lld: realtime - %s - SCHED_FIFO %d - cpu %d\n",
+                current_timestamp(), name, priority, cpu);
+    return ret;
+}
+
+// Lock the current and future memory of the process
+// Return 0 on success
+int realtime_lock()
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+        fprintf(stderr, "%lld: realtime - warning - mlockall failed: %s\n", current_timestamp(), strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Fault in the pages of a read-only mapping
+void realtime_prefault(const unsigned char *buf, size_t size)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    volatile unsigned char sink;
+    size_t i;
+
+    for (i = 0; i < size; i += page) {
+        sink = buf[i];
+    }
+    if (size > 0) sink = buf[size - 1];
+    (void) sink;
+}
+
+// Fault in the pages of a writable buffer, its content is lost
+void realtime_prefault_write(unsigned char *buf, size_t size)
+{
+    memset(buf, 0, size);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Scanner for the ADTS sync word.
+ * 16 bytes are compared at once with the bytes that follow them, the
+ * position is then found with a scalar loop only in the blocks that
+ * contain a match.
+ */
+
+#include "resync.h"
+
+#include <stddef.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RESYNC_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RESYNC_SSE2
+#endif
+
+static inline int resync_is_sync(unsigned char *p)
+{
+    return (p[0] == 0xFF) && ((p[1] & 0xF0) == 0xF0);
+}
+
+unsigned char *resync_find_sync(unsigned char *buf, unsigned char *end)
+{
+    unsigned char *p = buf;
+
+#if defined(RESYNC_NEON)
+    uint8x16_t ff = vdupq_n_u8(0xFF);
+    uint8x16_t f0 = vdupq_n_u8(0xF0);
+    uint8x16_t a, b, m;
+    uint64x2_t m64;
+    int i;
+
+    for (; p + 17 <= end; p += 16) {
+        a = vld1q_u8(p);
+        b = vld1q_u8(p + 1);
+        m = vandq_u8(vceqq_u8(a, ff), vceqq_u8(vandq_u8(b, f0), f0));
+        m64 = vreinterpretq_u64_u8(m);
+        if ((vgetq_lane_u64(m64, 0) | vgetq_lane_u64(m64, 1)) != 0) {
+            for (i = 0; i < 16; i++) {
+                if (resync_is_sync(p + i)) return p + i;
+            }
+        }
+    }
+#elif defined(RESYNC_SSE2)
+    __m128i ff = _mm_set1_epi8((char) 0xFF);
+    __m128i f0 = _mm_set1_epi8((char) 0xF0);
+    __m128i a, b, m;
+    int mask;
+
+    for (; p + 17 <= end; p += 16) {
+        a = _mm_loadu_si128((const __m128i *) p);
+        b = _mm_loadu_si128((const __m128i *) (p + 1));
+        m = _mm_and_si128(_mm_cmpeq_epi8(a, ff), _mm_cmpeq_epi8(_mm_and_si128(b, f0), f0));
+        mask = _mm_movemask_epi8(m);
+        if (mask != 0) return p + __builtin_ctz(mask);
+    }
+#endif
+
+    for (; p + 1 < end; p++) {
+        if (resync_is_sync(p)) return p;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,81 @@
+#!/bin/sh
+
+# Compare the batched sends of rAudioStreamer (--batch) with the plain
+# ones: the streamer streams to 1, 8 and 32 destinations on loopback
+# (nothing needs to listen on the ports), with and without --batch, and
+# after a warm up prints the datagrams and send calls per second from its
+# debug stats and the cpu time it used in SECONDS seconds, read from /proc.
+#
+# Usage: batch_bench.sh SECONDS STREAMER [OPTIONS]
+# e.g.   ./batch_bench.sh 60 ./rAudioStreamer -m y21ga
+#
+# Run it on the cam, with the firmware writing the audio. SECONDS should be
+# at least 20, the stats are printed every 10 seconds.
+
+WARMUP=5
+HZ=100                                      # USER_HZ, the unit of utime and stime
+PORT=10000
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 SECONDS STREAMER [OPTIONS]"
+    exit 1
+fi
+SECONDS_RUN=$1
+shift
+
+LOG=$(mktemp /tmp/batch_bench.XXXXXX)
+
+# utime + stime of the process (ticks)
+cpu_ticks()
+{
+    # The name in field 2 can't contain spaces here
+    awk '{ print $14 + $15 }' /proc/$1/stat
+}
+
+destinations()
+{
+    i=0
+    while [ $i -lt $1 ]; do
+        printf "%s " "-a 127.0.0.1:$((PORT + 2 * i))"
+        i=$((i + 1))
+    done
+}
+
+run()
+{
+    LABEL=$1
+    DESTS=$2
+    shift 2
+
+    "$@" -d $(destinations $DESTS) > /dev/null 2> $LOG &
+    PID=$!
+    sleep $WARMUP
+    if ! kill -0 $PID 2>/dev/null; then
+        echo "$LABEL: the streamer exited, check the options"
+        return 1
+    fi
+
+    T0=$(cpu_ticks $PID)
+    sleep $SECONDS_RUN
+    T1=$(cpu_ticks $PID)
+
+    kill $PID
+    wait $PID 2>/dev/null
+
+    # The last stats line: "... udp - datagrams/s: D - send calls/s: C - datagrams per call: P"
+    grep "stats - udp" $LOG | tail -n 1 | awk -v l="$LABEL" -v d=$DESTS -v s=$SECONDS_RUN -v hz=$HZ -v c=$((T1 - T0)) '{
+        for (i = 1; i < NF; i++) {
+            if ($i == "datagrams/s:") dg = $(i + 1)
+            if ($i == "calls/s:") calls = $(i + 1)
+        }
+        printf "%-10s %5d %12.1f %12.1f %7.2f\n", l, d, dg, calls, c * 100.0 / hz / s
+    }'
+}
+
+printf "%-10s %5s %12s %12s %7s\n" "mode" "dests" "datagrams/s" "calls/s" "cpu %"
+for DESTS in 1 8 32; do
+    run sendmmsg $DESTS "$@" -M
+    run sendto $DESTS "$@"
+done
+
+rm -f $LOG
@@ -0,0 +1,419 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Stress test of the output buffers: one producer thread, as the capture,
+ * and up to FRAME_RING_READERS reader threads, as AudioFramedMemorySource,
+ * each one on its own core when there are enough of them.
+ * The producer writes frames of random size with cb_output_buffer_reserve()
+ * and s2cb_memcpy(), so both the slots and the bytes wrap around, and the
+ * readers copy them out and release them as the RTP sources do. The readers
+ * are slowed down at random, also between the copy and the release, to hit
+ * the overrun policy while a frame is being read.
+ * Each frame starts with its sequence number and size and is filled with a
+ * pattern of both: a reader checks that the frames it gets are in order and
+ * not corrupted, without gaps with drop-newest, and at the end the frames
+ * missed by all the readers must be the ones dropped by the producer.
+ * A reader that waits more than a second for a frame already published
+ * counts a lost wakeup.
+ */
+
+#include "rAudioStreamerReceiver.h"
+
+#include <strings.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#define STRESS_FRAMES_DEFAULT 200000
+#define STRESS_SLOTS_DEFAULT 8
+#define STRESS_BYTES_DEFAULT 4096
+#define STRESS_BYTES_MAX 1048576
+#define STRESS_FRAME_HEADER 8               // sequence number and size
+#define STRESS_WAKEUP_TIMEOUT 1000          // a wakeup later than this is lost (msec)
+#define STRESS_EXIT_SINGLE_CPU 77            // passed, but without a second core: skipped as a cross-core test
+
+typedef struct
+{
+    int id;                                 // reader id in the ring
+    int cpu;                                // -1 if not bound
+    unsigned int seed;
+    unsigned int frames;                    // frames received
+    unsigned int taken_back;                // frames taken back by the producer during the copy
+    unsigned int corrupted;
+    unsigned int out_of_order;
+    unsigned int lost_wakeups;
+    pthread_t thread;
+} stress_reader;
+
+cb_output_buffer cb;
+int producer_done;
+unsigned int frames_total;
+unsigned int frame_size_max;
+int policy;
+
+const char *policy_name[] = { "drop-newest", "drop-oldest", "reset-to-live" };
+
+void print_usage(char *progname)
+{
+    fprintf(stderr, "\nUsage: %s [options]\n\n", progname);
+    fprintf(stderr, "\t-n FRAMES, --frames FRAMES\n");
+    fprintf(stderr, "\t\tframes written for each overrun policy (default %d)\n", STRESS_FRAMES_DEFAULT);
+    fprintf(stderr, "\t-s SLOTS, --slots SLOTS\n");
+    fprintf(stderr, "\t\tslots of the ring (default %d)\n", STRESS_SLOTS_DEFAULT);
+    fprintf(stderr, "\t-b BYTES, --bytes BYTES\n");
+    fprintf(stderr, "\t\tbytes of the buffer, the frames are up to a quarter of it (default %d)\n", STRESS_BYTES_DEFAULT);
+    fprintf(stderr, "\t-r READERS, --readers READERS\n");
+    fprintf(stderr, "\t\treader threads, 1 - %d (default 2)\n", FRAME_RING_READERS);
+    fprintf(stderr, "\t-p POLICY, --policy POLICY\n");
+    fprintf(stderr, "\t\tdrop-newest, drop-oldest or reset-to-live (default all of them, one after the other)\n");
+    fprintf(stderr, "\t-h, --help\n");
+    fprintf(stderr, "\t\tprint this help\n");
+}
+
+long long current_timestamp()
+{
+    struct timeval te;
+
+    gettimeofday(&te, NULL);
+    return te.tv_sec * 1000LL + te.tv_usec / 1000;
+}
+
+static unsigned char stress_pattern(uint32_t seq, uint32_t size, unsigned int i)
+{
+    return (unsigned char) (seq * 31 + size * 7 + i);
+}
+
+static void stress_bind(const char *who, int cpu)
+{
+    cpu_set_t set;
+
+    if (cpu < 0) return;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        fprintf(stderr, "warning - could not bind the %s to cpu %d\n", who, cpu);
+    }
+}
+
+// Now and then spin or sleep, so that the ring fills up
+static void stress_delay(unsigned int *seed)
+{
+    unsigned int r = rand_r(seed) % 1024;
+    volatile unsigned int spin;
+
+    if (r < 8) {
+        usleep(r * 100);
+    } else if (r < 64) {
+        for (spin = 0; spin < r * 50; spin++);
+    }
+}
+
+void *stress_producer(void *arg)
+{
+    unsigned char *frame = (unsigned char *) malloc(frame_size_max);
+    unsigned int seed = 1, seq = 0, size, i;
+    uint64_t one = 1;
+    int slot, j;
+
+    if (frame == NULL) {
+        fprintf(stderr, "could not alloc memory\n");
+        exit(EXIT_FAILURE);
+    }
+    stress_bind("producer", *((int *) arg));
+
+    while (seq < frames_total) {
+        size = STRESS_FRAME_HEADER + rand_r(&seed) % (frame_size_max - STRESS_FRAME_HEADER + 1);
+        slot = cb_output_buffer_reserve(&cb, size);
+        if (slot == -1) {
+            sched_yield();
+            continue;
+        }
+
+        memcpy(frame, &seq, 4);
+        memcpy(frame + 4, &size, 4);
+        for (i = STRESS_FRAME_HEADER; i < size; i++) frame[i] = stress_pattern(seq, size, i);
+
+        // As the capture: position and counter, the bytes, then the size
+        cb.output_frame[slot].offset = cb.write_index - cb.buffer;
+        cb.output_frame[slot].counter = seq;
+        cb.output_frame[slot].time = seq;
+        s2cb_memcpy(&cb, frame, size);
+        cb.output_frame[slot].size = size;
+        frame_ring_publish(&(cb.ring));
+        for (j = 0; j < FRAME_RING_READERS; j++) {
+            if (frame_ring_active(&(cb.ring), j) && frame_ring_wake(&(cb.ring), j)) {
+                if (write(cb.event_fd[j], &one, sizeof(one)) != sizeof(one)) {
+                    fprintf(stderr, "error - could not signal the reader %d\n", j);
+                }
+            }
+        }
+        seq++;
+        if ((seq & 0x3FF) == 0) stress_delay(&seed);
+    }
+    __atomic_store_n(&producer_done, 1, __ATOMIC_RELEASE);
+    for (j = 0; j < FRAME_RING_READERS; j++) {
+        if (write(cb.event_fd[j], &one, sizeof(one)) != sizeof(one)) {
+            fprintf(stderr, "error - could not signal the reader %d\n", j);
+        }
+    }
+    free(frame);
+
+    return NULL;
+}
+
+void *stress_consumer(void *arg)
+{
+    stress_reader *reader = (stress_reader *) arg;
+    unsigned char *frame = (unsigned char *) malloc(frame_size_max);
+    cb_output_frame desc;
+    struct pollfd pfd;
+    uint64_t value;
+    uint32_t seq, size;
+    long long seq_prev = -1;
+    unsigned char *ptr;
+    unsigned int i;
+    int slot, done;
+
+    if (frame == NULL) {
+        fprintf(stderr, "could not alloc memory\n");
+        exit(EXIT_FAILURE);
+    }
+    stress_bind("reader", reader->cpu);
+    pfd.fd = cb.event_fd[reader->id];
+    pfd.events = POLLIN;
+
+    for (;;) {
+        done = __atomic_load_n(&producer_done, __ATOMIC_ACQUIRE);
+        slot = frame_ring_read_slot(&(cb.ring), reader->id);
+        if (slot == -1) {
+            if (done) break;
+            if (frame_ring_wait(&(cb.ring), reader->id)) continue;
+            if ((poll(&pfd, 1, STRESS_WAKEUP_TIMEOUT) == 0) && !__atomic_load_n(&producer_done, __ATOMIC_ACQUIRE) &&
+                    (frame_ring_read_slot(&(cb.ring), reader->id) != -1)) {
+                reader->lost_wakeups++;
+            }
+            if (read(pfd.fd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+                fprintf(stderr, "error - could not read the eventfd of the reader %d\n", reader->id);
+            }
+            continue;
+        }
+
+        // As AudioFramedMemorySource: the descriptor, the bytes, then the release
+        desc = cb.output_frame[slot];
+        ptr = cb.buffer + desc.offset;
+        if ((desc.offset >= cb.size) || (desc.size > frame_size_max)) {
+            if (frame_ring_release(&(cb.ring), reader->id)) {
+                reader->corrupted++;
+            } else {
+                reader->taken_back++;
+            }
+            continue;
+        }
+        if (ptr + desc.size > cb.buffer + cb.size) {
+            memcpy(frame, ptr, cb.buffer + cb.size - ptr);
+            memcpy(frame + (cb.buffer + cb.size - ptr), cb.buffer, desc.size - (cb.buffer + cb.size - ptr));
+        } else {
+            memcpy(frame, ptr, desc.size);
+        }
+        // A copy that takes long, the producer can go round the ring meanwhile
+        stress_delay(&(reader->seed));
+        if (!frame_ring_release(&(cb.ring), reader->id)) {
+            reader->taken_back++;
+            continue;
+        }
+
+        memcpy(&seq, frame, 4);
+        memcpy(&size, frame + 4, 4);
+        if ((size != desc.size) || (seq != desc.time) || ((uint16_t) seq != desc.counter)) {
+            reader->corrupted++;
+            continue;
+        }
+        for (i = STRESS_FRAME_HEADER; i < size; i++) {
+            if (frame[i] != stress_pattern(seq, size, i)) break;
+        }
+        if (i < size) {
+            reader->corrupted++;
+            continue;
+        }
+        if (((long long) seq <= seq_prev) || ((policy == OVERRUN_DROP_NEWEST) && ((long long) seq != seq_prev + 1))) {
+            if (reader->out_of_order++ < 10) fprintf(stderr, "reader %d - frame %u after %lld\n", reader->id, seq, seq_prev);
+        }
+        seq_prev = seq;
+        reader->frames++;
+        stress_delay(&(reader->seed));
+    }
+    free(frame);
+
+    return NULL;
+}
+
+// Return the number of errors
+int stress_run(int readers, unsigned int slots, unsigned int bytes, int ncpu)
+{
+    stress_reader reader[FRAME_RING_READERS];
+    pthread_t producer;
+    int producer_cpu = (ncpu > 1) ? 0 : -1;
+    unsigned int missed = 0;
+    long long start, elapsed;
+    int i, errors = 0;
+
+    memset(&cb, 0, sizeof(cb));
+    cb.size = bytes;
+    cb.buffer = (unsigned char *) malloc(bytes);
+    cb.write_index = cb.buffer;
+    cb.output_frame = (cb_output_frame *) calloc(slots, sizeof(cb_output_frame));
+    cb.overrun = policy;
+    if ((cb.buffer == NULL) || (cb.output_frame == NULL)) {
+        fprintf(stderr, "could not alloc memory\n");
+        exit(EXIT_FAILURE);
+    }
+    frame_ring_init(&(cb.ring), slots);
+    // The positions go round too
+    cb.ring.head = cb.ring.wrap - 16 * slots;
+    for (i = 0; i < FRAME_RING_READERS; i++) {
+        cb.event_fd[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (cb.event_fd[i] == -1) {
+            fprintf(stderr, "could not create eventfd\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    producer_done = 0;
+
+    start = current_timestamp();
+    for (i = 0; i < readers; i++) {
+        memset(&reader[i], 0, sizeof(reader[i]));
+        reader[i].id = frame_ring_attach(&(cb.ring));
+        reader[i].cpu = (ncpu > 1) ? (i + 1) % ncpu : -1;
+        reader[i].seed = 1000 + i;
+        pthread_create(&(reader[i].thread), NULL, stress_consumer, &reader[i]);
+    }
+    pthread_create(&producer, NULL, stress_producer, &producer_cpu);
+    pthread_join(producer, NULL);
+    for (i = 0; i < readers; i++) {
+        pthread_join(reader[i].thread, NULL);
+    }
+    elapsed = current_timestamp() - start;
+
+    fprintf(stderr, "%s - %u frames - %u slots - %u bytes - %lld ms - dropped newest: %u - dropped oldest: %u - resets: %u\n",
+            policy_name[policy], frames_total, slots, bytes, elapsed, cb.dropped_newest, cb.dropped_oldest, cb.resets);
+    for (i = 0; i < readers; i++) {
+        fprintf(stderr, "    reader %d - cpu %d - received: %u - taken back during the copy: %u - corrupted: %u - out of order: %u - lost wakeups: %u\n",
+                reader[i].id, reader[i].cpu, reader[i].frames, reader[i].taken_back, reader[i].corrupted,
+                reader[i].out_of_order, reader[i].lost_wakeups);
+        errors += reader[i].corrupted + reader[i].out_of_order + reader[i].lost_wakeups;
+        missed += frames_total - reader[i].frames;
+        frame_ring_detach(&(cb.ring), reader[i].id);
+    }
+    // Each frame taken back from a reader was counted once by the producer
+    if (missed != cb.dropped_oldest) {
+        fprintf(stderr, "    error - the readers missed %u frames, the producer took back %u\n", missed, cb.dropped_oldest);
+        errors++;
+    }
+
+    for (i = 0; i < FRAME_RING_READERS; i++) {
+        close(cb.event_fd[i]);
+    }
+    free(cb.buffer);
+    free(cb.output_frame);
+
+    return errors;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int slots = STRESS_SLOTS_DEFAULT;
+    unsigned int bytes = STRESS_BYTES_DEFAULT;
+    int readers = 2;
+    int policy_arg = -1;
+    int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int c, errors = 0;
+
+    frames_total = STRESS_FRAMES_DEFAULT;
+
+    while (1) {
+        static struct option long_options[] =
+        {
+            {"frames",  required_argument, 0, 'n'},
+            {"slots",  required_argument, 0, 's'},
+            {"bytes",  required_argument, 0, 'b'},
+            {"readers",  required_argument, 0, 'r'},
+            {"policy",  required_argument, 0, 'p'},
+            {"help",  no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        c = getopt_long(argc, argv, "n:s:b:r:p:h", long_options, &option_index);
+        if (c == -1) break;
+
+        switch (c) {
+        case 'n':
+            frames_total = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            slots = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            bytes = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            readers = atoi(optarg);
+            break;
+        case 'p':
+            for (policy_arg = 2; policy_arg >= 0; policy_arg--) {
+                if (strcasecmp(policy_name[policy_arg], optarg) == 0) break;
+            }
+            if (policy_arg == -1) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'h':
+        default:
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((frames_total == 0) || (slots < 2) || (bytes < 64) || (bytes > STRESS_BYTES_MAX) ||
+            (readers < 1) || (readers > FRAME_RING_READERS)) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    frame_size_max = bytes / 4;
+    if (frame_size_max < STRESS_FRAME_HEADER) frame_size_max = STRESS_FRAME_HEADER;
+
+    fprintf(stderr, "%d cpu(s)%s\n", ncpu, (ncpu > 1) ? "" : " - warning - the threads share the only cpu, the test is not cross-core");
+    for (policy = 0; policy <= 2; policy++) {
+        if ((policy_arg != -1) && (policy != policy_arg)) continue;
+        errors += stress_run(readers, slots, bytes, ncpu);
+    }
+
+    // On a single cpu the readers never run while the producer writes: the
+    // barriers between cores are not exercised, the result proves less
+    if (errors > 0) {
+        fprintf(stderr, "FAILED\n");
+        return EXIT_FAILURE;
+    }
+    if (ncpu < 2) {
+        fprintf(stderr, "OK on a single cpu - not verified across cores\n");
+        return STRESS_EXIT_SINGLE_CPU;
+    }
+    fprintf(stderr, "OK\n");
+    return EXIT_SUCCESS;
+}
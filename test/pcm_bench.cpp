@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Cost of AAC2PCMFilter: a fixed AAC clip (AACClipSource) is pulled through
+ * the filter as fast as it goes, once for L16, PCMU and PCMA, and the cpu
+ * time measured by the filter for each step is printed per AAC frame,
+ * with the share of a core it takes in real time. The clip is encoded at
+ * startup from a synthetic voice, always the same, or read from an ADTS
+ * file. Run it on the cam: the numbers of a PC say little about an ARM
+ * core without NEON in fdk-aac.
+ */
+
+#include "liveMedia.hh"
+#include "BasicUsageEnvironment.hh"
+
+#include "AAC2PCMFilter.hh"
+#include "AACClipSource.hh"
+
+#define BENCH_SECONDS_DEFAULT 20
+#define BENCH_BITRATE_DEFAULT 32000
+#define BENCH_REPEAT_DEFAULT 5
+
+int debug = 0;
+
+UsageEnvironment* env;
+Boolean clipDone;
+unsigned payloads;
+
+const char *encoding_name[] = { "L16", "PCMU", "PCMA" };
+
+void print_usage(char *progname)
+{
+    fprintf(stderr, "\nUsage: %s [options]\n\n", progname);
+    fprintf(stderr, "\t-f FILE, --file FILE\n");
+    fprintf(stderr, "\t\tADTS file to decode, instead of the synthetic clip\n");
+    fprintf(stderr, "\t-r RATE, --rate RATE\n");
+    fprintf(stderr, "\t\tsampling frequency of the synthetic clip (default 16000)\n");
+    fprintf(stderr, "\t-c CHANNELS, --channels CHANNELS\n");
+    fprintf(stderr, "\t\tchannels of the synthetic clip, 1 or 2 (default 1)\n");
+    fprintf(stderr, "\t-b BITRATE, --bitrate BITRATE\n");
+    fprintf(stderr, "\t\tbitrate of the synthetic clip (default %d)\n", BENCH_BITRATE_DEFAULT);
+    fprintf(stderr, "\t-s SECONDS, --seconds SECONDS\n");
+    fprintf(stderr, "\t\tlength of the synthetic clip (default %d)\n", BENCH_SECONDS_DEFAULT);
+    fprintf(stderr, "\t-n TIMES, --repeat TIMES\n");
+    fprintf(stderr, "\t\tdecode the clip TIMES times for each encoding (default %d)\n", BENCH_REPEAT_DEFAULT);
+    fprintf(stderr, "\t-h, --help\n");
+    fprintf(stderr, "\t\tprint this help\n");
+}
+
+long long current_timestamp()
+{
+    struct timeval te;
+
+    gettimeofday(&te, NULL);
+    return te.tv_sec * 1000LL + te.tv_usec / 1000;
+}
+
+void afterGettingPayload(void* /*clientData*/, unsigned /*frameSize*/, unsigned /*numTruncatedBytes*/,
+                         struct timeval /*presentationTime*/, unsigned /*durationInMicroseconds*/)
+{
+    payloads++;
+}
+
+void afterClip(void* /*clientData*/)
+{
+    clipDone = True;
+}
+
+// The clip goes through the filter without the event loop: each payload is
+// delivered before getNextFrame() returns
+// Return 0 on success
+int bench_encoding(AACClipSource* clip, int encoding, unsigned repeat)
+{
+    unsigned char payload[RTP_PAYLOAD_MAX_SIZE];
+    AAC2PCMFilter* filter;
+    double frames, frameUs, decodeUs, resampleUs, compandUs;
+    unsigned i;
+
+    clip->rewind();
+    filter = AAC2PCMFilter::createNew(*env, clip, clip->samplingFrequency(), clip->numChannels(), encoding);
+    if (filter == NULL) return -1;
+
+    payloads = 0;
+    for (i = 0; i < repeat; i++) {
+        clip->rewind();
+        clipDone = False;
+        while (!clipDone) {
+            filter->getNextFrame(payload, sizeof(payload), afterGettingPayload, NULL, afterClip, NULL);
+        }
+    }
+
+    frames = filter->frames();
+    frameUs = 1024 * 1000000.0 / clip->samplingFrequency();
+    decodeUs = filter->decodeTime() / 1000.0 / frames;
+    resampleUs = filter->resampleTime() / 1000.0 / frames;
+    compandUs = filter->compandTime() / 1000.0 / frames;
+    fprintf(stdout, "%-5s %7u %7u %6u %10.1f %10.1f %10.1f %10.1f %7.2f\n",
+            encoding_name[encoding], filter->frames(), payloads, filter->decodeErrors(),
+            decodeUs, resampleUs, compandUs, decodeUs + resampleUs + compandUs,
+            100.0 * (decodeUs + resampleUs + compandUs) / frameUs);
+
+    // The clip is closed by the filter
+    filter->detachInputSource();
+    Medium::close(filter);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    char *fileName = NULL;
+    unsigned rate = 16000, channels = 1, bitrate = BENCH_BITRATE_DEFAULT;
+    unsigned seconds = BENCH_SECONDS_DEFAULT, repeat = BENCH_REPEAT_DEFAULT;
+    AACClipSource* clip;
+    int c, encoding, errors = 0;
+
+    while (1) {
+        static struct option long_options[] =
+        {
+            {"file",  required_argument, 0, 'f'},
+            {"rate",  required_argument, 0, 'r'},
+            {"channels",  required_argument, 0, 'c'},
+            {"bitrate",  required_argument, 0, 'b'},
+            {"seconds",  required_argument, 0, 's'},
+            {"repeat",  required_argument, 0, 'n'},
+            {"help",  no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        c = getopt_long(argc, argv, "f:r:c:b:s:n:h", long_options, &option_index);
+        if (c == -1) break;
+
+        switch (c) {
+        case 'f':
+            fileName = optarg;
+            break;
+        case 'r':
+            rate = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            channels = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            bitrate = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            seconds = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            repeat = strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+        default:
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((rate == 0) || (channels < 1) || (channels > 2) || (seconds == 0) || (repeat == 0)) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    TaskScheduler* scheduler = BasicTaskScheduler::createNew();
+    env = BasicUsageEnvironment::createNew(*scheduler);
+
+    if (fileName != NULL) {
+        clip = AACClipSource::createNew(*env, fileName);
+    } else {
+        clip = AACClipSource::createNew(*env, rate, channels, bitrate, seconds);
+    }
+    if (clip == NULL) {
+        fprintf(stderr, "could not create the clip\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "clip - %u frames - %u Hz - %u channel(s) - %.1f kbps - decoded %u times\n",
+            clip->numFrames(), clip->samplingFrequency(), clip->numChannels(),
+            clip->bytes() * 8.0 * clip->samplingFrequency() / 1024 / clip->numFrames() / 1000, repeat);
+
+    fprintf(stdout, "%-5s %7s %7s %6s %10s %10s %10s %10s %7s\n", "codec", "frames", "packets", "errors",
+            "decode us", "resamp us", "compand us", "total us", "core %");
+    for (encoding = PCM_ENCODING_L16; encoding <= PCM_ENCODING_PCMA; encoding++) {
+        // G.711 needs 8 or 16 kHz, createNew() says why
+        if (bench_encoding(clip, encoding, repeat) != 0) errors++;
+    }
+    Medium::close(clip);
+
+    return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,86 @@
+#!/bin/sh
+
+# Compare the threaded and the threadless (-t) capture of rAudioStreamer:
+# the streamer is started twice with the same options and, after a warm
+# up, /proc gives the RSS, the context switches of all its threads and
+# the cpu time used in SECONDS seconds.
+#
+# Usage: threadless_bench.sh SECONDS STREAMER [OPTIONS]
+# e.g.   ./threadless_bench.sh 60 ./rAudioStreamer -m y21ga -a 192.168.1.10
+#
+# Run it on the cam, with the firmware writing the audio.
+
+WARMUP=5
+HZ=100                                      # USER_HZ, the unit of utime and stime
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 SECONDS STREAMER [OPTIONS]"
+    exit 1
+fi
+SECONDS_RUN=$1
+shift
+
+# Context switches of all the threads: voluntary nonvoluntary
+ctxt_switches()
+{
+    cat /proc/$1/task/*/status 2>/dev/null | awk '
+        /^voluntary_ctxt_switches/ { v += $2 }
+        /^nonvoluntary_ctxt_switches/ { n += $2 }
+        END { print v + 0, n + 0 }'
+}
+
+# utime + stime of the process, all the threads (ticks)
+cpu_ticks()
+{
+    # The name in field 2 can't contain spaces here
+    awk '{ print $14 + $15 }' /proc/$1/stat
+}
+
+rss_kb()
+{
+    awk '/^VmRSS/ { print $2 }' /proc/$1/status
+}
+
+hwm_kb()
+{
+    awk '/^VmHWM/ { print $2 }' /proc/$1/status
+}
+
+run()
+{
+    LABEL=$1
+    shift
+
+    "$@" > /dev/null 2>&1 &
+    PID=$!
+    sleep $WARMUP
+    if ! kill -0 $PID 2>/dev/null; then
+        echo "$LABEL: the streamer exited, check the options"
+        return 1
+    fi
+
+    set -- $(ctxt_switches $PID)
+    V0=$1
+    N0=$2
+    T0=$(cpu_ticks $PID)
+    sleep $SECONDS_RUN
+    set -- $(ctxt_switches $PID)
+    V1=$1
+    N1=$2
+    T1=$(cpu_ticks $PID)
+    RSS=$(rss_kb $PID)
+    HWM=$(hwm_kb $PID)
+    THREADS=$(ls /proc/$PID/task | wc -l)
+
+    kill $PID
+    wait $PID 2>/dev/null
+
+    awk -v l="$LABEL" -v s=$SECONDS_RUN -v hz=$HZ -v t=$THREADS -v rss=$RSS -v hwm=$HWM \
+        -v v=$((V1 - V0)) -v n=$((N1 - N0)) -v c=$((T1 - T0)) 'BEGIN {
+        printf "%-10s %7d %8d %8d %10.1f %10.1f %7.2f\n", l, t, rss, hwm, v / s, n / s, c * 100.0 / hz / s
+    }'
+}
+
+printf "%-10s %7s %8s %8s %10s %10s %7s\n" "mode" "threads" "rss kB" "hwm kB" "vol cs/s" "invol cs/s" "cpu %"
+run threaded "$@"
+run threadless "$@" -t
@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2024 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host model of the threaded and of the threadless (-t) capture, to compare
+ * them where there is no cam. A child process plays the firmware and writes
+ * a frame to shared memory every PERIOD usec. The model reads the frames
+ * with the poll scheduler, the output buffers and the eventfd of the
+ * streamer, and a select() loop plays the live555 event loop: the reader
+ * copies each frame out and sends it to a loopback UDP port, as the RTP
+ * sink does.
+ * Threaded: a capture thread sleeps between the polls and signals the loop.
+ * Threadless: the loop itself polls, when its select() times out.
+ * Each mode runs in a process of its own, the RSS, the context switches and
+ * the cpu time are those of the model only, the firmware is not counted.
+ * The numbers show the cost of the two loops, not the cost of live555 and
+ * of the RTP stack: measure the streamer on the cam with threadless_bench.sh.
+ */
+
+#include "rAudioStreamerReceiver.h"
+#include "poll_scheduler.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sys/select.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MODEL_SECONDS_DEFAULT 30
+#define MODEL_PERIOD_DEFAULT 64000          // 1024 AAC samples at 16 kHz (usec)
+#define MODEL_FRAME_SIZE_DEFAULT 256
+#define MODEL_FRAME_SIZE_MAX 4096
+#define MODEL_WARMUP 3                      // seconds, the scheduler learns the cadence meanwhile
+#define MODEL_SLOTS 16
+#define MODEL_BYTES 65536
+#define MODEL_PORT 9                        // discard
+
+// Written by the firmware process
+typedef struct
+{
+    volatile uint32_t frames;               // frames written so far
+    volatile uint32_t time[MODEL_SLOTS];    // frame_header.time of each frame (msec)
+    unsigned char data[MODEL_SLOTS][MODEL_FRAME_SIZE_MAX];
+} model_firmware;
+
+int debug = 0;
+
+model_firmware *fw;
+unsigned int frame_size;
+int period;
+
+cb_output_buffer cb;
+int reader_id;
+poll_scheduler ps;
+uint32_t frames_read;
+int udp_socket;
+struct sockaddr_in udp_dest;
+unsigned int frames_sent;
+volatile int model_stop;
+
+void print_usage(char *progname)
+{
+    fprintf(stderr, "\nUsage: %s [options]\n\n", progname);
+    fprintf(stderr, "\t-d SECONDS, --duration SECONDS\n");
+    fprintf(stderr, "\t\tmeasure each mode for SECONDS seconds (default %d)\n", MODEL_SECONDS_DEFAULT);
+    fprintf(stderr, "\t-p PERIOD, --period PERIOD\n");
+    fprintf(stderr, "\t\tinterval between two frames of the firmware, usec (default %d)\n", MODEL_PERIOD_DEFAULT);
+    fprintf(stderr, "\t-s SIZE, --size SIZE\n");
+    fprintf(stderr, "\t\tframe size, 1 - %d (default %d)\n", MODEL_FRAME_SIZE_MAX, MODEL_FRAME_SIZE_DEFAULT);
+    fprintf(stderr, "\t-h, --help\n");
+    fprintf(stderr, "\t\tprint this help\n");
+}
+
+long long current_timestamp()
+{
+    struct timeval te;
+
+    gettimeofday(&te, NULL);
+    return te.tv_sec * 1000LL + te.tv_usec / 1000;
+}
+
+// The firmware: a frame every period, on an absolute clock as the audio codec
+void model_firmware_run()
+{
+    struct timespec next;
+    uint32_t n = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (;;) {
+        next.tv_nsec += period * 1000L;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        memset(fw->data[n % MODEL_SLOTS], n, frame_size);
+        fw->time[n % MODEL_SLOTS] = (uint32_t) (next.tv_sec * 1000LL + next.tv_nsec / 1000000);
+        n++;
+        __atomic_store_n(&(fw->frames), n, __ATOMIC_RELEASE);
+    }
+}
+
+// As capture_poll(): read the new frames, publish them and return the time to sleep (usec)
+int model_capture_step()
+{
+    uint32_t frames = __atomic_load_n(&(fw->frames), __ATOMIC_ACQUIRE);
+    long long now;
+    int slot, n = 0;
+
+    poll_scheduler_woken(&ps, poll_scheduler_now());
+    now = poll_scheduler_now();
+    // Behind by more than the firmware keeps: skip the lost ones
+    if (frames - frames_read > MODEL_SLOTS) frames_read = frames - MODEL_SLOTS;
+    while (frames_read != frames) {
+        poll_scheduler_frame(&ps, fw->time[frames_read % MODEL_SLOTS], now);
+        slot = cb_output_buffer_reserve(&cb, frame_size);
+        if (slot != -1) {
+            cb.output_frame[slot].offset = cb.write_index - cb.buffer;
+            cb.output_frame[slot].counter = frames_read;
+            cb.output_frame[slot].time = fw->time[frames_read % MODEL_SLOTS];
+            s2cb_memcpy(&cb, fw->data[frames_read % MODEL_SLOTS], frame_size);
+            cb.output_frame[slot].size = frame_size;
+            frame_ring_publish(&(cb.ring));
+        }
+        frames_read++;
+        n++;
+    }
+    if (n > 0) {
+        uint64_t one = 1;
+
+        if (frame_ring_wake(&(cb.ring), reader_id)) {
+            if (write(cb.event_fd[reader_id], &one, sizeof(one)) != sizeof(one)) {
+                fprintf(stderr, "error - could not signal the reader\n");
+            }
+        }
+    }
+
+    now = poll_scheduler_now();
+    poll_scheduler_wakeup(&ps, n, now);
+    return poll_scheduler_next(&ps, now);
+}
+
+void *model_capture(void * /*arg*/)
+{
+    while (!model_stop) {
+        usleep(model_capture_step());
+    }
+
+    return NULL;
+}
+
+// As AudioFramedMemorySource and the RTP sink: copy out the frames and send them
+void model_reader()
+{
+    unsigned char frame[MODEL_FRAME_SIZE_MAX];
+    cb_output_frame desc;
+    unsigned char *ptr;
+    uint64_t value;
+    int slot;
+
+    if (read(cb.event_fd[reader_id], &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        fprintf(stderr, "error - could not read the eventfd\n");
+    }
+    for (;;) {
+        slot = frame_ring_read_slot(&(cb.ring), reader_id);
+        if (slot == -1) {
+            if (frame_ring_wait(&(cb.ring), reader_id)) continue;
+            break;
+        }
+        desc = cb.output_frame[slot];
+        ptr = cb.buffer + desc.offset;
+        if (ptr + desc.size > cb.buffer + cb.size) {
+            memcpy(frame, ptr, cb.buffer + cb.size - ptr);
+            memcpy(frame + (cb.buffer + cb.size - ptr), cb.buffer, desc.size - (cb.buffer + cb.size - ptr));
+        } else {
+            memcpy(frame, ptr, desc.size);
+        }
+        if (!frame_ring_release(&(cb.ring), reader_id)) continue;
+        if (sendto(udp_socket, frame, desc.size, 0, (struct sockaddr *) &udp_dest, sizeof(udp_dest)) > 0) {
+            frames_sent++;
+        }
+    }
+}
+
+long long model_cpu_time(struct rusage *ru)
+{
+    return (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000000LL + ru->ru_utime.tv_usec + ru->ru_stime.tv_usec;
+}
+
+int model_status(const char *key)
+{
+    char line[256];
+    int value = -1;
+    size_t len = strlen(key);
+    FILE *f = fopen("/proc/self/status", "r");
+
+    if (f == NULL) return -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, key, len) == 0) {
+            value = atoi(line + len + 1);
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+// The event loop, with or without the capture thread
+void model_run(int threadless, int seconds)
+{
+    pthread_t capture_thread;
+    struct rusage ru_start, ru_end;
+    struct timeval tv;
+    fd_set read_set;
+    long long now, start = 0, end, next_capture, wait;
+    int fd, threads = 1;
+
+    memset(&cb, 0, sizeof(cb));
+    cb.size = MODEL_BYTES;
+    cb.buffer = (unsigned char *) malloc(MODEL_BYTES);
+    cb.write_index = cb.buffer;
+    cb.output_frame = (cb_output_frame *) calloc(MODEL_SLOTS, sizeof(cb_output_frame));
+    cb.overrun = OVERRUN_DROP_OLDEST;
+    if ((cb.buffer == NULL) || (cb.output_frame == NULL)) {
+        fprintf(stderr, "could not alloc memory\n");
+        exit(EXIT_FAILURE);
+    }
+    frame_ring_init(&(cb.ring), MODEL_SLOTS);
+    reader_id = frame_ring_attach(&(cb.ring));
+    cb.event_fd[reader_id] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fd = cb.event_fd[reader_id];
+    udp_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if ((fd == -1) || (udp_socket == -1)) {
+        fprintf(stderr, "could not create the descriptors\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(&udp_dest, 0, sizeof(udp_dest));
+    udp_dest.sin_family = AF_INET;
+    udp_dest.sin_port = htons(MODEL_PORT);
+    udp_dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    poll_scheduler_init(&ps);
+    frames_read = __atomic_load_n(&(fw->frames), __ATOMIC_ACQUIRE);
+    model_stop = 0;
+    if (!threadless) {
+        pthread_create(&capture_thread, NULL, model_capture, NULL);
+        threads++;
+    }
+
+    // As doGetNextFrame(): the reader asks for the first frame
+    model_reader();
+    now = poll_scheduler_now();
+    end = now + (MODEL_WARMUP + seconds) * 1000000LL;
+    next_capture = now;
+    while (now < end) {
+        // After the warm up
+        if ((start == 0) && (now >= end - seconds * 1000000LL)) {
+            getrusage(RUSAGE_SELF, &ru_start);
+            start = now;
+        }
+
+        // As the live555 scheduler: select() until the next delayed task
+        wait = end - now;
+        if (threadless && (next_capture - now < wait)) wait = next_capture - now;
+        if (start == 0) wait = ((end - seconds * 1000000LL) - now < wait) ? (end - seconds * 1000000LL) - now : wait;
+        if (wait < 0) wait = 0;
+        tv.tv_sec = wait / 1000000;
+        tv.tv_usec = wait % 1000000;
+        FD_ZERO(&read_set);
+        FD_SET(fd, &read_set);
+        if (select(fd + 1, &read_set, NULL, NULL, &tv) > 0) {
+            model_reader();
+        }
+
+        now = poll_scheduler_now();
+        if (threadless && (now >= next_capture)) {
+            next_capture = now + model_capture_step();
+            now = poll_scheduler_now();
+        }
+    }
+
+    getrusage(RUSAGE_SELF, &ru_end);
+    model_stop = 1;
+    if (!threadless) pthread_join(capture_thread, NULL);
+
+    fprintf(stdout, "%-10s %7d %8d %10.1f %10.1f %7.2f %9.1f %8.1f\n",
+            threadless ? "threadless" : "threaded", threads, model_status("VmRSS:"),
+            (ru_end.ru_nvcsw - ru_start.ru_nvcsw) * 1000000.0 / (now - start),
+            (ru_end.ru_nivcsw - ru_start.ru_nivcsw) * 1000000.0 / (now - start),
+            (model_cpu_time(&ru_end) - model_cpu_time(&ru_start)) * 100.0 / (now - start),
+            ps.wakeups * 1000000.0 / (now - start + MODEL_WARMUP * 1000000LL),
+            frames_sent * 1000000.0 / (now - start + MODEL_WARMUP * 1000000LL));
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = MODEL_SECONDS_DEFAULT;
+    pid_t firmware, model;
+    int c, mode, status, errors = 0;
+
+    period = MODEL_PERIOD_DEFAULT;
+    frame_size = MODEL_FRAME_SIZE_DEFAULT;
+
+    while (1) {
+        static struct option long_options[] =
+        {
+            {"duration",  required_argument, 0, 'd'},
+            {"period",  required_argument, 0, 'p'},
+            {"size",  required_argument, 0, 's'},
+            {"help",  no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        c = getopt_long(argc, argv, "d:p:s:h", long_options, &option_index);
+        if (c == -1) break;
+
+        switch (c) {
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        case 'p':
+            period = atoi(optarg);
+            break;
+        case 's':
+            frame_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+        default:
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((seconds <= 0) || (period < POLL_MIN) || (frame_size == 0) || (frame_size > MODEL_FRAME_SIZE_MAX)) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    fw = (model_firmware *) mmap(NULL, sizeof(model_firmware), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (fw == MAP_FAILED) {
+        fprintf(stderr, "could not map the firmware buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(fw, 0, sizeof(model_firmware));
+
+    firmware = fork();
+    if (firmware == 0) {
+        model_firmware_run();
+        exit(EXIT_SUCCESS);
+    }
+
+    fprintf(stderr, "%d sec - a frame of %u bytes every %d usec\n", seconds, frame_size, period);
+    fprintf(stdout, "%-10s %7s %8s %10s %10s %7s %9s %8s\n",
+            "mode", "threads", "rss kB", "vol cs/s", "invol cs/s", "cpu %", "polls/s", "sent/s");
+    fflush(stdout);
+    for (mode = 0; mode <= 1; mode++) {
+        model = fork();
+        if (model == 0) {
+            model_run(mode, seconds);
+            exit(EXIT_SUCCESS);
+        }
+        if ((waitpid(model, &status, 0) == -1) || !WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS)) {
+            errors++;
+        }
+    }
+
+    kill(firmware, SIGTERM);
+    waitpid(firmware, NULL, 0);
+
+    return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}